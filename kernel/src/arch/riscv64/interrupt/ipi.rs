@@ -1,21 +1,65 @@
-use sbi_rt::HartMask;
+use alloc::sync::Arc;
+use core::sync::atomic::{fence, Ordering};
+use sbi_rt::{HartMask, SbiRet};
 
 use crate::{
-    arch::mm::RiscV64MMArch,
-    exception::ipi::{IpiKind, IpiTarget},
+    arch::{interrupt::TrapFrame, mm::RiscV64MMArch},
+    driver::irqchip::riscv_intc::riscv_intc_assicate_irq,
+    exception::{
+        ipi::{IpiKind, IpiTarget, RaiseSoftirqIpiHandler},
+        irqdesc::{irq_desc_manager, IrqDesc, IrqFlowHandler, IrqHandler},
+        HardwareIrqNumber,
+    },
     smp::core::smp_get_processor_id,
 };
 
+/// S态软件中断的硬件中断号，用于接收核间中断
+pub const RISCV_IPI_IRQ: HardwareIrqNumber = HardwareIrqNumber::new(1);
+
 #[inline(always)]
 pub fn send_ipi(kind: IpiKind, target: IpiTarget) {
     let mask = Into::into(target);
     match kind {
         IpiKind::KickCpu => todo!(),
         IpiKind::FlushTLB => RiscV64MMArch::remote_invalidate_all_with_mask(mask).ok(),
+        IpiKind::RaiseSoftirq => riscv_send_ipi(mask).ok(),
         IpiKind::SpecVector(_) => todo!(),
     };
 }
 
+/// 通过SBI向`mask`中的hart发送S态软件中断
+fn riscv_send_ipi(mask: HartMask) -> Result<(), SbiRet> {
+    let r = sbi_rt::send_ipi(mask);
+    if r.is_ok() {
+        return Ok(());
+    } else {
+        return Err(r);
+    }
+}
+
+/// 初始化接收核间中断的S态软件中断
+pub fn riscv_ipi_irq_desc_init() {
+    let virq = riscv_intc_assicate_irq(RISCV_IPI_IRQ).unwrap();
+    let desc = irq_desc_manager().lookup(virq).unwrap();
+    desc.set_handler(&RiscvIpiIrqFlowHandler);
+    unsafe { riscv::register::sie::set_ssoft() };
+}
+
+#[derive(Debug)]
+struct RiscvIpiIrqFlowHandler;
+
+impl IrqFlowHandler for RiscvIpiIrqFlowHandler {
+    fn handle(&self, irq_desc: &Arc<IrqDesc>, _trap_frame: &mut TrapFrame) {
+        // 先清除sip.SSIP再处理，处理期间到达的核间中断会再次触发
+        unsafe { riscv::register::sip::clear_ssoft() };
+        fence(Ordering::SeqCst);
+        // 目前只有RaiseSoftirq通过软件中断发送，KickCpu和SpecVector还没有实现
+        RaiseSoftirqIpiHandler
+            .handle(irq_desc.irq_data().irq(), None, None)
+            .ok();
+    }
+}
+
 impl Into<HartMask> for IpiTarget {
     fn into(self) -> HartMask {
         match self {
@@ -10,6 +10,8 @@ use crate::{
         allocator::{
             buddy::BuddyAllocator,
             page_frame::{FrameAllocator, PageFrameCount, PageFrameUsage, PhysPageFrame},
+            pcp::{pcp_allocate, pcp_free, pcp_usage},
+            zeroed_pages::zeroed_page_allocate,
         },
         kernel_mapper::KernelMapper,
         page::{EntryFlags, PageEntry, PAGE_1G_SHIFT},
@@ -348,25 +350,19 @@ pub struct LockedFrameAllocator;
 
 impl FrameAllocator for LockedFrameAllocator {
     unsafe fn allocate(&mut self, count: PageFrameCount) -> Option<(PhysAddr, PageFrameCount)> {
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.allocate(count);
-        } else {
-            return None;
-        }
+        return pcp_allocate(&INNER_ALLOCATOR, count);
+    }
+
+    unsafe fn allocate_one_zeroed(&mut self) -> Option<PhysAddr> {
+        return zeroed_page_allocate();
     }
 
     unsafe fn free(&mut self, address: crate::mm::PhysAddr, count: PageFrameCount) {
         assert!(count.data().is_power_of_two());
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.free(address, count);
-        }
+        pcp_free(&INNER_ALLOCATOR, address, count);
     }
 
     unsafe fn usage(&self) -> PageFrameUsage {
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.usage();
-        } else {
-            panic!("usage error");
-        }
+        return pcp_usage(&INNER_ALLOCATOR).expect("usage error");
     }
 }
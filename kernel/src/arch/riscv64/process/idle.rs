@@ -2,12 +2,19 @@ use core::hint::spin_loop;
 
 use log::error;
 
-use crate::{arch::CurrentIrqArch, exception::InterruptArch, process::ProcessManager};
+use crate::{
+    arch::CurrentIrqArch, exception::InterruptArch,
+    mm::allocator::zeroed_pages::zeroed_pages_idle_refill, process::ProcessManager,
+};
 
 impl ProcessManager {
     /// 每个核的idle进程
     pub fn arch_idle_func() -> ! {
         loop {
+            // 空闲时预先清零一批页帧
+            if zeroed_pages_idle_refill() {
+                continue;
+            }
             if CurrentIrqArch::is_irq_enabled() {
                 riscv::asm::wfi();
             } else {
@@ -64,6 +64,7 @@ pub const SYS_FSTATFS: usize = 44;
 pub const SYS_FSYNC: usize = 82;
 pub const SYS_FTRUNCATE: usize = 46;
 pub const SYS_FUTEX: usize = 98;
+pub const SYS_FUTEX_WAITV: usize = 449;
 pub const SYS_GET_MEMPOLICY: usize = 236;
 pub const SYS_GET_ROBUST_LIST: usize = 100;
 pub const SYS_GETCPU: usize = 168;
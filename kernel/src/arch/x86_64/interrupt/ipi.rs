@@ -9,7 +9,7 @@ use crate::{
         smp::SMP_BOOT_DATA,
     },
     exception::{
-        ipi::{FlushTLBIpiHandler, IpiKind, IpiTarget, KickCpuIpiHandler},
+        ipi::{FlushTLBIpiHandler, IpiKind, IpiTarget, KickCpuIpiHandler, RaiseSoftirqIpiHandler},
         irqdata::{IrqData, IrqLineStatus},
         irqdesc::{irq_desc_manager, IrqDesc, IrqFlowHandler, IrqHandler},
         HardwareIrqNumber, IrqNumber,
@@ -21,12 +21,14 @@ use super::TrapFrame;
 
 pub const IPI_NUM_KICK_CPU: IrqNumber = IrqNumber::new(200);
 pub const IPI_NUM_FLUSH_TLB: IrqNumber = IrqNumber::new(201);
+pub const IPI_NUM_RAISE_SOFTIRQ: IrqNumber = IrqNumber::new(202);
 /// IPI的种类(架构相关，指定了向量号)
 #[derive(Debug, Copy, Clone, Eq, PartialEq)]
 #[repr(u32)]
 pub enum ArchIpiKind {
     KickCpu = IPI_NUM_KICK_CPU.data(),
     FlushTLB = IPI_NUM_FLUSH_TLB.data(),
+    RaiseSoftirq = IPI_NUM_RAISE_SOFTIRQ.data(),
     SpecVector(HardwareIrqNumber),
 }
 
@@ -35,6 +37,7 @@ impl From<IpiKind> for ArchIpiKind {
         match kind {
             IpiKind::KickCpu => ArchIpiKind::KickCpu,
             IpiKind::FlushTLB => ArchIpiKind::FlushTLB,
+            IpiKind::RaiseSoftirq => ArchIpiKind::RaiseSoftirq,
             IpiKind::SpecVector(vec) => ArchIpiKind::SpecVector(vec),
         }
     }
@@ -45,6 +48,7 @@ impl From<ArchIpiKind> for u8 {
         match value {
             ArchIpiKind::KickCpu => IPI_NUM_KICK_CPU.data() as u8,
             ArchIpiKind::FlushTLB => IPI_NUM_FLUSH_TLB.data() as u8,
+            ArchIpiKind::RaiseSoftirq => IPI_NUM_RAISE_SOFTIRQ.data() as u8,
             ArchIpiKind::SpecVector(vec) => (vec.data() & 0xFF) as u8,
         }
     }
@@ -229,6 +233,7 @@ pub fn ipi_send_smp_startup(target_cpu: ProcessorId) -> Result<(), SystemError>
 pub fn arch_ipi_handler_init() {
     do_init_irq_handler(IPI_NUM_KICK_CPU);
     do_init_irq_handler(IPI_NUM_FLUSH_TLB);
+    do_init_irq_handler(IPI_NUM_RAISE_SOFTIRQ);
 }
 
 fn do_init_irq_handler(irq: IrqNumber) {
@@ -256,6 +261,10 @@ impl IrqFlowHandler for X86_64IpiIrqFlowHandler {
                 FlushTLBIpiHandler.handle(irq, None, None).ok();
                 CurrentApic.send_eoi();
             }
+            IPI_NUM_RAISE_SOFTIRQ => {
+                RaiseSoftirqIpiHandler.handle(irq, None, None).ok();
+                CurrentApic.send_eoi();
+            }
             _ => {
                 error!("Unknown IPI: {}", irq.data());
                 CurrentApic.send_eoi();
@@ -18,6 +18,8 @@ use crate::libs::lib_ui::screen_manager::scm_disable_put_to_window;
 use crate::libs::spinlock::SpinLock;
 
 use crate::mm::allocator::page_frame::{FrameAllocator, PageFrameCount, PageFrameUsage};
+use crate::mm::allocator::pcp::{pcp_allocate, pcp_free, pcp_usage};
+use crate::mm::allocator::zeroed_pages::zeroed_page_allocate;
 use crate::mm::memblock::mem_block_manager;
 use crate::mm::ucontext::LockedVMA;
 use crate::{
@@ -650,26 +652,20 @@ pub struct LockedFrameAllocator;
 impl FrameAllocator for LockedFrameAllocator {
     unsafe fn allocate(&mut self, mut count: PageFrameCount) -> Option<(PhysAddr, PageFrameCount)> {
         count = count.next_power_of_two();
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.allocate(count);
-        } else {
-            return None;
-        }
+        return pcp_allocate(&INNER_ALLOCATOR, count);
+    }
+
+    unsafe fn allocate_one_zeroed(&mut self) -> Option<PhysAddr> {
+        return zeroed_page_allocate();
     }
 
     unsafe fn free(&mut self, address: crate::mm::PhysAddr, count: PageFrameCount) {
         assert!(count.data().is_power_of_two());
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.free(address, count);
-        }
+        pcp_free(&INNER_ALLOCATOR, address, count);
     }
 
     unsafe fn usage(&self) -> PageFrameUsage {
-        if let Some(ref mut allocator) = *INNER_ALLOCATOR.lock_irqsave() {
-            return allocator.usage();
-        } else {
-            panic!("usage error");
-        }
+        return pcp_usage(&INNER_ALLOCATOR).expect("usage error");
     }
 }
 
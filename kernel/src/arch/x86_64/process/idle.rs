@@ -5,6 +5,7 @@ use log::error;
 use crate::{
     arch::CurrentIrqArch,
     exception::InterruptArch,
+    mm::allocator::zeroed_pages::zeroed_pages_idle_refill,
     process::{ProcessFlags, ProcessManager},
     sched::{SchedMode, __schedule},
 };
@@ -17,6 +18,10 @@ impl ProcessManager {
             if pcb.flags().contains(ProcessFlags::NEED_SCHEDULE) {
                 __schedule(SchedMode::SM_NONE);
             }
+            // 空闲时预先清零一批页帧，之后重新检查是否需要调度
+            if zeroed_pages_idle_refill() {
+                continue;
+            }
             if CurrentIrqArch::is_irq_enabled() {
                 unsafe {
                     x86::halt();
@@ -16,7 +16,7 @@ use crate::{
     arch::process::table::TSSManager,
     exception::InterruptArch,
     libs::spinlock::SpinLockGuard,
-    mm::VirtAddr,
+    mm::{tlb::switch_mm, VirtAddr},
     process::{
         fork::{CloneFlags, KernelCloneArgs},
         KernelStack, ProcessControlBlock, ProcessFlags, ProcessManager, PROCESS_SWITCH_RESULT,
@@ -381,10 +381,12 @@ impl ProcessManager {
         Self::switch_gsbase(&prev, &next);
 
         // 切换地址空间
+        let prev_addr_space = prev.basic().user_vm();
         let next_addr_space = next.basic().user_vm().as_ref().unwrap().clone();
         compiler_fence(Ordering::SeqCst);
 
-        next_addr_space.read().user_mapper.utable.make_current();
+        switch_mm(prev_addr_space.as_ref(), &next_addr_space);
+        drop(prev_addr_space);
         drop(next_addr_space);
         compiler_fence(Ordering::SeqCst);
         // 切换内核栈
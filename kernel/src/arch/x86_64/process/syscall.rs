@@ -8,7 +8,7 @@ use crate::{
         CurrentIrqArch,
     },
     exception::InterruptArch,
-    mm::ucontext::AddressSpace,
+    mm::{tlb::switch_mm, ucontext::AddressSpace},
     process::{
         exec::{load_binary_file, ExecParam, ExecParamFlags},
         ProcessControlBlock, ProcessManager,
@@ -58,7 +58,7 @@ impl Syscall {
         // debug!("Switch to new address space");
 
         // 切换到新的用户地址空间
-        unsafe { address_space.read().user_mapper.utable.make_current() };
+        unsafe { switch_mm(old_address_space.as_ref(), &address_space) };
 
         drop(old_address_space);
         drop(irq_guard);
@@ -80,6 +80,7 @@ pub const SYS_FSTATFS: usize = 138;
 pub const SYS_FSYNC: usize = 74;
 pub const SYS_FTRUNCATE: usize = 77;
 pub const SYS_FUTEX: usize = 202;
+pub const SYS_FUTEX_WAITV: usize = 449;
 pub const SYS_FUTIMESAT: usize = 261;
 pub const SYS_GET_KERNEL_SYMS: usize = 177;
 pub const SYS_GET_MEMPOLICY: usize = 239;
@@ -0,0 +1,533 @@
+//! 多队列异步块I/O请求层（blk-mq）
+//!
+//! 提交路径：
+//! - 上层构造`BlkRequest`，通过`BlkMqQueue::submit`提交到当前CPU的软件提交队列；
+//! - 或者先放入`BlkPlug`中攒批，在unplug时一次性提交；
+//! - `run_queue`只收集提交者所在CPU的软件队列，按(操作,LBA)排序后合并相邻请求放入派发队列，
+//!   然后调用驱动的`queue_rq`下发给硬件，硬件队列满时剩余请求留在派发队列中；
+//! - 派发队列已经清空（硬件空闲）而其他CPU的软件队列中还有请求时，`run_hw_queue`才会去收集它们，
+//!   因此普通的提交路径不需要访问其他CPU的软件队列。
+//!
+//! 完成路径：
+//! - 驱动在中断处理函数中回收已完成的硬件请求，调用`BlkMqHwRequest::end`拆分结果
+//!   并唤醒等待者，然后调用`run_hw_queue`继续派发积压的请求；
+//! - 在中断关闭或者设备没有中断的情况下，等待者通过驱动的`poll`轮询完成。
+
+use core::{
+    fmt::Debug,
+    hint::spin_loop,
+    ops::{Deref, DerefMut},
+    ptr::NonNull,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{
+    collections::VecDeque,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use system_error::SystemError;
+
+use crate::{
+    arch::CurrentIrqArch,
+    exception::InterruptArch,
+    libs::spinlock::SpinLock,
+    mm::percpu::{PerCpu, PerCpuVar},
+    sched::completion::Completion,
+    smp::cpu::ProcessorId,
+};
+
+use super::block_device::{BlockId, LBA_SIZE};
+
+/// 合并后单个硬件请求的默认最大扇区数
+pub const BLK_MQ_DEFAULT_MAX_SECTORS: usize = 256;
+
+/// 中断模式下单次睡眠的超时时间（jiffies），超时后会主动轮询一次，防止丢失中断导致永久睡眠
+const BLK_MQ_WAIT_TIMEOUT: i64 = 100;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum BlkReqOp {
+    Read,
+    Write,
+}
+
+/// 请求的数据缓冲区
+pub enum BlkMqBuf {
+    /// 请求自己分配的缓冲区
+    Owned(Vec<u8>),
+    /// 调用者提供的缓冲区。调用者保证在请求完成之前它一直有效，并且不会访问它
+    Borrowed { ptr: NonNull<u8>, len: usize },
+}
+
+// 借用的缓冲区在请求完成之前只会被请求层和驱动访问
+unsafe impl Send for BlkMqBuf {}
+unsafe impl Sync for BlkMqBuf {}
+
+impl Default for BlkMqBuf {
+    fn default() -> Self {
+        Self::Owned(Vec::new())
+    }
+}
+
+impl Debug for BlkMqBuf {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        match self {
+            Self::Owned(buf) => write!(f, "Owned({})", buf.len()),
+            Self::Borrowed { len, .. } => write!(f, "Borrowed({})", len),
+        }
+    }
+}
+
+impl Deref for BlkMqBuf {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            Self::Owned(buf) => buf,
+            Self::Borrowed { ptr, len } => unsafe {
+                core::slice::from_raw_parts(ptr.as_ptr(), *len)
+            },
+        }
+    }
+}
+
+impl DerefMut for BlkMqBuf {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        match self {
+            Self::Owned(buf) => buf,
+            Self::Borrowed { ptr, len } => unsafe {
+                core::slice::from_raw_parts_mut(ptr.as_ptr(), *len)
+            },
+        }
+    }
+}
+
+/// 块设备请求
+///
+/// 直到完成之前，请求的数据缓冲区都不会被上层访问，因此驱动可以把它直接交给硬件做DMA。
+/// 缓冲区可以由请求自己分配，也可以直接使用调用者的缓冲区（见`new_read_into`/`new_write_from`）。
+pub struct BlkRequest {
+    op: BlkReqOp,
+    lba_start: BlockId,
+    count: usize,
+    inner: SpinLock<InnerBlkRequest>,
+    done: Completion,
+}
+
+struct InnerBlkRequest {
+    buf: BlkMqBuf,
+    result: Option<Result<usize, SystemError>>,
+}
+
+impl Debug for BlkRequest {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("BlkRequest")
+            .field("op", &self.op)
+            .field("lba_start", &self.lba_start)
+            .field("count", &self.count)
+            .finish()
+    }
+}
+
+impl BlkRequest {
+    /// 创建一个读请求，读取`count`个LBA
+    pub fn new_read(lba_start: BlockId, count: usize) -> Arc<Self> {
+        Self::new(
+            BlkReqOp::Read,
+            lba_start,
+            count,
+            BlkMqBuf::Owned(vec![0; count * LBA_SIZE]),
+        )
+    }
+
+    /// 创建一个写请求，`buf`的长度必须等于`count * LBA_SIZE`
+    pub fn new_write(lba_start: BlockId, count: usize, buf: Vec<u8>) -> Arc<Self> {
+        assert_eq!(buf.len(), count * LBA_SIZE);
+        Self::new(BlkReqOp::Write, lba_start, count, BlkMqBuf::Owned(buf))
+    }
+
+    /// 创建一个直接读入调用者缓冲区的读请求，省去中间缓冲区的分配和拷贝
+    ///
+    /// ## Safety
+    ///
+    /// 调用者必须保证在请求完成（`wait`返回）之前，`buf`一直有效并且不会被访问
+    pub unsafe fn new_read_into(lba_start: BlockId, count: usize, buf: &mut [u8]) -> Arc<Self> {
+        assert_eq!(buf.len(), count * LBA_SIZE);
+        let buf = BlkMqBuf::Borrowed {
+            ptr: NonNull::new(buf.as_mut_ptr()).unwrap(),
+            len: buf.len(),
+        };
+        Self::new(BlkReqOp::Read, lba_start, count, buf)
+    }
+
+    /// 创建一个直接从调用者缓冲区写出的写请求，省去中间缓冲区的分配和拷贝
+    ///
+    /// ## Safety
+    ///
+    /// 调用者必须保证在请求完成（`wait`返回）之前，`buf`一直有效并且不会被修改
+    pub unsafe fn new_write_from(lba_start: BlockId, count: usize, buf: &[u8]) -> Arc<Self> {
+        assert_eq!(buf.len(), count * LBA_SIZE);
+        // 写请求只会读取缓冲区
+        let buf = BlkMqBuf::Borrowed {
+            ptr: NonNull::new(buf.as_ptr() as *mut u8).unwrap(),
+            len: buf.len(),
+        };
+        Self::new(BlkReqOp::Write, lba_start, count, buf)
+    }
+
+    fn new(op: BlkReqOp, lba_start: BlockId, count: usize, buf: BlkMqBuf) -> Arc<Self> {
+        Arc::new(Self {
+            op,
+            lba_start,
+            count,
+            inner: SpinLock::new(InnerBlkRequest { buf, result: None }),
+            done: Completion::new(),
+        })
+    }
+
+    pub fn op(&self) -> BlkReqOp {
+        self.op
+    }
+
+    pub fn lba_start(&self) -> BlockId {
+        self.lba_start
+    }
+
+    pub fn count(&self) -> usize {
+        self.count
+    }
+
+    fn lba_end(&self) -> BlockId {
+        self.lba_start + self.count
+    }
+
+    pub fn is_done(&self) -> bool {
+        self.inner.lock_irqsave().result.is_some()
+    }
+
+    /// 请求完成后取出数据缓冲区
+    ///
+    /// 使用调用者缓冲区的请求，数据已经在调用者的缓冲区中，返回空的`Vec`
+    pub fn take_buf(&self) -> Vec<u8> {
+        match self.take_data() {
+            BlkMqBuf::Owned(buf) => buf,
+            BlkMqBuf::Borrowed { .. } => Vec::new(),
+        }
+    }
+
+    fn take_data(&self) -> BlkMqBuf {
+        core::mem::take(&mut self.inner.lock_irqsave().buf)
+    }
+
+    fn complete(&self, result: Result<usize, SystemError>) {
+        self.inner.lock_irqsave().result = Some(result);
+        self.done.complete_all();
+    }
+
+    /// 等待请求完成
+    ///
+    /// 如果中断已关闭，或者队列工作在轮询模式，则通过`queue`的驱动轮询完成，否则睡眠等待中断唤醒。
+    /// 请求可能正在使用调用者的缓冲区，因此无论如何都要等到请求完成才返回。
+    pub fn wait(&self, queue: &BlkMqQueue) -> Result<usize, SystemError> {
+        if queue.irq_driven() && CurrentIrqArch::is_irq_enabled() {
+            while !self.is_done() {
+                // 睡眠失败时退化为轮询
+                let _ = self.done.wait_for_completion_timeout(BLK_MQ_WAIT_TIMEOUT);
+                queue.poll();
+            }
+        } else {
+            while !self.is_done() {
+                queue.poll();
+                spin_loop();
+            }
+        }
+        return self.inner.lock_irqsave().result.clone().unwrap();
+    }
+}
+
+/// 下发给驱动的硬件请求，由一个或多个相邻的`BlkRequest`合并而成
+#[derive(Debug)]
+pub struct BlkMqHwRequest {
+    pub op: BlkReqOp,
+    pub lba_start: BlockId,
+    pub count: usize,
+    /// 硬件请求的数据缓冲区，长度为`count * LBA_SIZE`
+    pub buf: BlkMqBuf,
+    rqs: Vec<Arc<BlkRequest>>,
+}
+
+impl BlkMqHwRequest {
+    fn from_requests(rqs: Vec<Arc<BlkRequest>>) -> Self {
+        let first = &rqs[0];
+        let op = first.op;
+        let lba_start = first.lba_start;
+        let count = rqs.iter().map(|rq| rq.count).sum::<usize>();
+
+        // 单个请求直接复用它的缓冲区（可能是调用者的缓冲区），避免拷贝
+        let buf = if rqs.len() == 1 {
+            first.take_data()
+        } else {
+            BlkMqBuf::Owned(match op {
+                BlkReqOp::Read => vec![0; count * LBA_SIZE],
+                BlkReqOp::Write => {
+                    let mut buf = Vec::with_capacity(count * LBA_SIZE);
+                    for rq in rqs.iter() {
+                        buf.extend_from_slice(&rq.inner.lock_irqsave().buf);
+                    }
+                    buf
+                }
+            })
+        };
+
+        Self {
+            op,
+            lba_start,
+            count,
+            buf,
+            rqs,
+        }
+    }
+
+    /// 结束硬件请求：把数据拆分回各个原始请求，并唤醒等待者
+    pub fn end(self, result: Result<(), SystemError>) {
+        let buf = self.buf;
+        if self.rqs.len() == 1 {
+            let rq = &self.rqs[0];
+            rq.inner.lock_irqsave().buf = buf;
+            rq.complete(result.map(|_| rq.count * LBA_SIZE));
+            return;
+        }
+
+        let mut offset = 0;
+        for rq in self.rqs.iter() {
+            let len = rq.count * LBA_SIZE;
+            if self.op == BlkReqOp::Read && result.is_ok() {
+                rq.inner.lock_irqsave().buf[..len].copy_from_slice(&buf[offset..offset + len]);
+            }
+            offset += len;
+            rq.complete(result.clone().map(|_| len));
+        }
+    }
+}
+
+/// 块设备驱动需要实现的多队列操作
+pub trait BlkMqOps: Send + Sync + Debug {
+    /// 把硬件请求下发到设备。
+    ///
+    /// 设备队列已满时，应当原样返回`Err(rq)`，请求层会在下一次`run_hw_queue`时重试。
+    /// 下发失败（非队列满）时，驱动应当自行调用`rq.end(Err(..))`并返回`Ok(())`。
+    fn queue_rq(&self, rq: BlkMqHwRequest) -> Result<(), BlkMqHwRequest>;
+
+    /// 轮询设备并完成已结束的请求（用于中断不可用的场景）
+    fn poll(&self);
+}
+
+/// 块设备的多队列请求队列
+#[derive(Debug)]
+pub struct BlkMqQueue {
+    ops: Weak<dyn BlkMqOps>,
+    /// 每个CPU的软件提交队列
+    sw_queues: PerCpuVar<SpinLock<Vec<Arc<BlkRequest>>>>,
+    /// 所有软件队列中还没有被收集到派发队列的请求数
+    sw_pending: AtomicUsize,
+    /// 已经排序合并、等待下发到硬件的请求
+    dispatch: SpinLock<VecDeque<BlkMqHwRequest>>,
+    max_sectors: usize,
+    irq_driven: AtomicBool,
+}
+
+impl BlkMqQueue {
+    /// 创建一个请求队列
+    ///
+    /// ## 参数
+    ///
+    /// - `ops` - 驱动的多队列操作
+    /// - `max_sectors` - 合并后单个硬件请求的最大LBA数
+    ///
+    /// 队列初始工作在轮询模式，驱动确认中断可用后调用`set_irq_driven`切换到中断模式。
+    pub fn new(ops: Weak<dyn BlkMqOps>, max_sectors: usize) -> Arc<Self> {
+        let mut sw_queues = Vec::with_capacity(PerCpu::MAX_CPU_NUM as usize);
+        for _ in 0..PerCpu::MAX_CPU_NUM {
+            sw_queues.push(SpinLock::new(Vec::new()));
+        }
+
+        Arc::new(Self {
+            ops,
+            sw_queues: PerCpuVar::new(sw_queues).unwrap(),
+            sw_pending: AtomicUsize::new(0),
+            dispatch: SpinLock::new(VecDeque::new()),
+            max_sectors: max_sectors.max(1),
+            irq_driven: AtomicBool::new(false),
+        })
+    }
+
+    pub fn irq_driven(&self) -> bool {
+        self.irq_driven.load(Ordering::Acquire)
+    }
+
+    pub fn set_irq_driven(&self, irq_driven: bool) {
+        self.irq_driven.store(irq_driven, Ordering::Release);
+    }
+
+    /// 提交一个请求，并立即派发
+    pub fn submit(&self, rq: Arc<BlkRequest>) {
+        // 先计数再入队，保证收集者减去的请求都已经被计入
+        self.sw_pending.fetch_add(1, Ordering::AcqRel);
+        self.sw_queues.get().lock_irqsave().push(rq);
+        self.run_queue();
+    }
+
+    /// 提交一个请求并等待其完成
+    pub fn submit_and_wait(&self, rq: &Arc<BlkRequest>) -> Result<usize, SystemError> {
+        self.submit(rq.clone());
+        rq.wait(self)
+    }
+
+    /// 收集当前CPU的软件队列，排序合并后派发
+    pub fn run_queue(&self) {
+        let rqs = core::mem::take(&mut *self.sw_queues.get().lock_irqsave());
+        self.dispatch_requests(rqs);
+        self.run_hw_queue();
+    }
+
+    /// 把从软件队列中取出的请求排序合并后放入派发队列
+    fn dispatch_requests(&self, rqs: Vec<Arc<BlkRequest>>) {
+        if rqs.is_empty() {
+            return;
+        }
+        self.sw_pending.fetch_sub(rqs.len(), Ordering::AcqRel);
+        let merged = self.merge_requests(rqs);
+        self.dispatch.lock_irqsave().extend(merged);
+    }
+
+    /// 收集其他CPU的软件队列中积压的请求
+    ///
+    /// 只使用`try_lock`，正在被其所属CPU操作的队列会被跳过（那个CPU随后会自己派发它们）
+    ///
+    /// ## 返回值
+    ///
+    /// 是否收集到了请求
+    fn steal_sw_queues(&self) -> bool {
+        if self.sw_pending.load(Ordering::Acquire) == 0 {
+            return false;
+        }
+
+        let mut rqs = Vec::new();
+        for cpu in 0..PerCpu::MAX_CPU_NUM {
+            let sw = unsafe { self.sw_queues.force_get(ProcessorId::new(cpu)) };
+            if let Ok(mut guard) = sw.try_lock_irqsave() {
+                rqs.append(&mut guard);
+            }
+        }
+        let stolen = !rqs.is_empty();
+        self.dispatch_requests(rqs);
+        return stolen;
+    }
+
+    /// 把派发队列中的请求下发到硬件，直到硬件队列满
+    ///
+    /// 派发队列清空之后，如果其他CPU的软件队列中还有请求，则把它们也收集过来下发
+    pub fn run_hw_queue(&self) {
+        let ops = match self.ops.upgrade() {
+            Some(ops) => ops,
+            None => return,
+        };
+
+        loop {
+            let mut dispatch = self.dispatch.lock_irqsave();
+            while let Some(hw_rq) = dispatch.pop_front() {
+                if let Err(hw_rq) = ops.queue_rq(hw_rq) {
+                    dispatch.push_front(hw_rq);
+                    return;
+                }
+            }
+            drop(dispatch);
+
+            if !self.steal_sw_queues() {
+                return;
+            }
+        }
+    }
+
+    /// 轮询驱动以完成请求，并继续派发积压的请求
+    pub fn poll(&self) {
+        if let Some(ops) = self.ops.upgrade() {
+            ops.poll();
+        }
+        self.run_hw_queue();
+    }
+
+    /// 按(操作, 起始LBA)排序，并把操作相同、LBA相邻的请求合并成一个硬件请求
+    fn merge_requests(&self, mut rqs: Vec<Arc<BlkRequest>>) -> Vec<BlkMqHwRequest> {
+        rqs.sort_by_key(|rq| (rq.op, rq.lba_start));
+
+        let mut result = Vec::new();
+        let mut batch: Vec<Arc<BlkRequest>> = Vec::new();
+        let mut batch_sectors = 0;
+        for rq in rqs {
+            let mergeable = batch.last().is_some_and(|last| {
+                last.op == rq.op
+                    && last.lba_end() == rq.lba_start
+                    && batch_sectors + rq.count <= self.max_sectors
+            });
+
+            if !mergeable && !batch.is_empty() {
+                result.push(BlkMqHwRequest::from_requests(core::mem::take(&mut batch)));
+                batch_sectors = 0;
+            }
+            batch_sectors += rq.count;
+            batch.push(rq);
+        }
+
+        if !batch.is_empty() {
+            result.push(BlkMqHwRequest::from_requests(batch));
+        }
+        return result;
+    }
+}
+
+/// 请求批量提交
+///
+/// 在plug期间加入的请求只会暂存在本地，`unplug`或者drop时才一次性交给请求队列，
+/// 这样相邻的请求有机会被合并，并且只需要触发一次派发。
+#[derive(Debug)]
+pub struct BlkPlug {
+    queue: Arc<BlkMqQueue>,
+    rqs: Vec<Arc<BlkRequest>>,
+}
+
+impl BlkPlug {
+    pub fn new(queue: Arc<BlkMqQueue>) -> Self {
+        Self {
+            queue,
+            rqs: Vec::new(),
+        }
+    }
+
+    /// 把请求加入plug列表
+    pub fn add(&mut self, rq: Arc<BlkRequest>) {
+        self.rqs.push(rq);
+    }
+
+    /// 提交plug列表中的所有请求
+    pub fn unplug(&mut self) {
+        if self.rqs.is_empty() {
+            return;
+        }
+        self.queue
+            .sw_pending
+            .fetch_add(self.rqs.len(), Ordering::AcqRel);
+        self.queue
+            .sw_queues
+            .get()
+            .lock_irqsave()
+            .append(&mut self.rqs);
+        self.queue.run_queue();
+    }
+}
+
+impl Drop for BlkPlug {
+    fn drop(&mut self) {
+        self.unplug();
+    }
+}
@@ -10,7 +10,7 @@ use crate::driver::{
             DEV_MAJOR_HASH_SIZE, DEV_MAJOR_MAX,
         },
     },
-    block::cache::{cached_block_device::BlockCache, BlockCacheError, BLOCK_SIZE},
+    block::cache::cached_block_device::BlockCache,
 };
 
 use alloc::{string::String, sync::Arc, vec::Vec};
@@ -18,7 +18,7 @@ use core::{any::Any, fmt::Display, ops::Deref};
 use log::error;
 use system_error::SystemError;
 
-use super::{disk_info::Partition, gendisk::GenDisk, manager::BlockDevMeta};
+use super::{blk_mq::BlkMqQueue, disk_info::Partition, gendisk::GenDisk, manager::BlockDevMeta};
 
 /// 该文件定义了 Device 和 BlockDevice 的接口
 /// Notice 设备错误码使用 Posix 规定的 int32_t 的错误码表示，而不是自己定义错误enum
@@ -324,7 +324,8 @@ pub trait BlockDevice: Device {
         buf: &[u8],
     ) -> Result<usize, SystemError>;
 
-    /// @brief: 同步磁盘信息，把所有的dirty数据写回硬盘 - 待实现
+    /// @brief: 同步磁盘信息，把所有的dirty数据写回硬盘。
+    /// 实现时应当先调用`BlockCache::sync`写回cache中的脏块
     fn sync(&self) -> Result<(), SystemError>;
 
     /// @brief: 每个块设备都必须固定自己块大小，而且该块大小必须是2的幂次
@@ -348,6 +349,12 @@ pub trait BlockDevice: Device {
     /// @brief 返回当前磁盘上的所有分区的Arc指针数组
     fn partitions(&self) -> Vec<Arc<Partition>>;
 
+    /// @brief 返回块设备的多队列请求队列。
+    /// 支持异步I/O的设备可以返回Some，上层可借此批量提交请求(参见`BlkPlug`)；默认不支持。
+    fn request_queue(&self) -> Option<Arc<BlkMqQueue>> {
+        None
+    }
+
     /// # 函数的功能
     /// 经由Cache对块设备的读操作
     fn read_at(
@@ -378,39 +385,19 @@ pub trait BlockDevice: Device {
         count: usize,
         buf: &mut [u8],
     ) -> Result<usize, SystemError> {
-        let cache_response = BlockCache::read(lba_id_start, count, buf);
-        if let Err(e) = cache_response {
-            match e {
-                BlockCacheError::StaticParameterError => {
-                    BlockCache::init();
-                    let ans = self.read_at_sync(lba_id_start, count, buf)?;
-                    return Ok(ans);
-                }
-                BlockCacheError::BlockFaultError(fail_vec) => {
-                    let ans = self.read_at_sync(lba_id_start, count, buf)?;
-                    let _ = BlockCache::insert(fail_vec, buf);
-                    return Ok(ans);
-                }
-                _ => {
-                    let ans = self.read_at_sync(lba_id_start, count, buf)?;
-                    return Ok(ans);
-                }
-            }
-        } else {
-            return Ok(count * BLOCK_SIZE);
-        }
+        BlockCache::read(self, lba_id_start, count, buf)
     }
 
     /// # 函数功能
-    /// 其功能对外而言和write_at函数完全一致，但是加入blockcache的功能
+    /// 其功能对外而言和write_at函数完全一致，但是加入blockcache的功能。
+    /// 数据先写入cache，由回写线程或者sync写回磁盘
     fn cache_write(
         &self,
         lba_id_start: BlockId,
         count: usize,
         buf: &[u8],
     ) -> Result<usize, SystemError> {
-        let _cache_response = BlockCache::immediate_write(lba_id_start, count, buf);
-        self.write_at_sync(lba_id_start, count, buf)
+        BlockCache::write(self, lba_id_start, count, buf)
     }
 
     fn write_at_bytes(&self, offset: usize, len: usize, buf: &[u8]) -> Result<usize, SystemError> {
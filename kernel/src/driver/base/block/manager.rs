@@ -1,4 +1,7 @@
-use core::fmt::Formatter;
+use core::{
+    fmt::Formatter,
+    sync::atomic::{AtomicUsize, Ordering},
+};
 
 use alloc::sync::Arc;
 use hashbrown::HashMap;
@@ -6,7 +9,7 @@ use system_error::SystemError;
 use unified_init::macros::unified_init;
 
 use crate::{
-    driver::base::block::gendisk::GenDisk,
+    driver::{base::block::gendisk::GenDisk, block::cache::cached_block_device::BlockCache},
     filesystem::mbr::MbrDiskPartionTable,
     init::initcall::INITCALL_POSTCORE,
     libs::spinlock::{SpinLock, SpinLockGuard},
@@ -61,6 +64,7 @@ impl BlockDevManager {
             return Err(SystemError::EEXIST);
         }
         inner.disks.insert(dev_name.clone(), dev.clone());
+        BlockCache::register_device(&dev);
 
         let mut out_remove = || {
             inner.disks.remove(dev_name);
@@ -207,6 +211,8 @@ impl BlockDevManager {
 
 pub struct BlockDevMeta {
     pub devname: BlockDevName,
+    /// 设备在BlockCache中的编号，全局唯一
+    cache_id: usize,
     inner: SpinLock<InnerBlockDevMeta>,
 }
 
@@ -216,8 +222,10 @@ pub struct InnerBlockDevMeta {
 
 impl BlockDevMeta {
     pub fn new(devname: BlockDevName) -> Self {
+        static NEXT_CACHE_ID: AtomicUsize = AtomicUsize::new(0);
         BlockDevMeta {
             devname,
+            cache_id: NEXT_CACHE_ID.fetch_add(1, Ordering::Relaxed),
             inner: SpinLock::new(InnerBlockDevMeta {
                 gendisks: GenDiskMap::new(),
             }),
@@ -227,6 +235,11 @@ impl BlockDevMeta {
     fn inner(&self) -> SpinLockGuard<InnerBlockDevMeta> {
         self.inner.lock()
     }
+
+    #[inline]
+    pub fn cache_id(&self) -> usize {
+        self.cache_id
+    }
 }
 
 impl core::fmt::Debug for BlockDevMeta {
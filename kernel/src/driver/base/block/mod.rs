@@ -1,3 +1,4 @@
+pub mod blk_mq;
 pub mod block_device;
 pub mod disk_info;
 pub mod gendisk;
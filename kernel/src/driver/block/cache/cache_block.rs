@@ -2,53 +2,89 @@ use alloc::{boxed::Box, vec::Vec};
 
 use crate::driver::base::block::block_device::BlockId;
 
-use super::{BlockCacheError, BLOCK_SIZE};
-
-/// # 枚举功能
-/// 该枚举设计来是用于实现回写法的，但是目前并未使用
-#[allow(dead_code)]
-pub enum CacheBlockFlag {
-    Unused,
-    Unwrited,
-    Writed,
+bitflags! {
+    /// # 结构功能
+    /// 缓存块的状态标志
+    pub struct CacheBlockFlags: u8 {
+        /// 数据比磁盘上的新，需要回写
+        const DIRTY = 1 << 0;
+        /// 最近被访问过（CLOCK算法的引用位）
+        const REFERENCED = 1 << 1;
+        /// 正在回写，回写完成之前不能被换出，也不能被再次选中回写
+        const WRITEBACK = 1 << 2;
+    }
 }
 
-pub type CacheBlockAddr = usize;
-
 /// # 结构功能
-/// 存储数据的最小单位
+/// 存储数据的最小单位，大小为所属设备的块大小
 pub struct CacheBlock {
-    data: Box<[u8]>,
-    _flag: CacheBlockFlag,
+    /// 所属设备在BlockCache中的编号
+    dev: usize,
     lba_id: BlockId,
+    data: Box<[u8]>,
+    flags: CacheBlockFlags,
 }
 
 impl CacheBlock {
-    pub fn new(data: Box<[u8]>, flag: CacheBlockFlag, lba_id: BlockId) -> Self {
+    pub fn new(dev: usize, lba_id: BlockId, data: Vec<u8>, flags: CacheBlockFlags) -> Self {
         CacheBlock {
-            data,
-            _flag: flag,
+            dev,
             lba_id,
+            data: data.into_boxed_slice(),
+            flags,
         }
     }
 
-    pub fn from_data(lba_id: BlockId, data: Vec<u8>) -> Self {
-        let space_box = data.into_boxed_slice();
-        CacheBlock::new(space_box, CacheBlockFlag::Unwrited, lba_id)
+    #[inline]
+    pub fn matches(&self, dev: usize, lba_id: BlockId) -> bool {
+        self.dev == dev && self.lba_id == lba_id
     }
 
-    pub fn _set_flag(&mut self, _flag: CacheBlockFlag) -> Option<()> {
-        todo!()
-    }
-    pub fn data(&self, buf: &mut [u8]) -> Result<usize, BlockCacheError> {
-        if buf.len() != BLOCK_SIZE {
-            return Err(BlockCacheError::BlockSizeError);
-        }
-        buf.copy_from_slice(&self.data);
-        return Ok(BLOCK_SIZE);
+    #[inline]
+    pub fn dev(&self) -> usize {
+        self.dev
     }
 
+    #[inline]
     pub fn lba_id(&self) -> BlockId {
         self.lba_id
     }
+
+    #[inline]
+    pub fn data(&self) -> &[u8] {
+        &self.data
+    }
+
+    #[inline]
+    pub fn data_mut(&mut self) -> &mut [u8] {
+        &mut self.data
+    }
+
+    #[inline]
+    pub fn size(&self) -> usize {
+        self.data.len()
+    }
+
+    #[inline]
+    pub fn flags(&self) -> CacheBlockFlags {
+        self.flags
+    }
+
+    #[inline]
+    pub fn set_flags(&mut self, flags: CacheBlockFlags) {
+        self.flags.insert(flags);
+    }
+
+    #[inline]
+    pub fn clear_flags(&mut self, flags: CacheBlockFlags) {
+        self.flags.remove(flags);
+    }
+
+    /// 块是否可以被换出：干净且不在回写中
+    #[inline]
+    pub fn evictable(&self) -> bool {
+        !self
+            .flags
+            .intersects(CacheBlockFlags::DIRTY | CacheBlockFlags::WRITEBACK)
+    }
 }
@@ -1,425 +1,577 @@
-use alloc::{boxed::Box, vec::Vec};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use alloc::{
+    string::ToString,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
 use hashbrown::HashMap;
-use log::debug;
+use log::{error, info};
+use system_error::SystemError;
+use unified_init::macros::unified_init;
 
-use crate::{driver::base::block::block_device::BlockId, libs::rwlock::RwLock};
+use crate::{
+    arch::mm::LockedFrameAllocator,
+    driver::base::block::block_device::{BlockDevice, BlockId, LBA_SIZE},
+    init::initcall::INITCALL_CORE,
+    libs::{lazy_init::Lazy, spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::allocator::page_frame::FrameAllocator,
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessControlBlock, ProcessManager,
+    },
+    time::{sleep::nanosleep, PosixTimeSpec},
+};
 
 use super::{
-    cache_block::{CacheBlock, CacheBlockAddr},
-    cache_iter::{BlockIter, FailData},
-    BlockCacheError, BLOCK_SIZE, BLOCK_SIZE_LOG, CACHE_THRESHOLD,
+    cache_block::{CacheBlock, CacheBlockFlags},
+    CACHE_DIRTY_RATIO, CACHE_FLUSH_INTERVAL, CACHE_MAX_BYTES, CACHE_MEMORY_RATIO, CACHE_MIN_BYTES,
+    CACHE_WAYS,
 };
 
-static mut CSPACE: Option<LockedCacheSpace> = None;
-static mut CMAPPER: Option<LockedCacheMapper> = None;
+static BLOCK_CACHE: Lazy<CacheSpace> = Lazy::new();
+
+/// 回写线程
+static mut BLOCK_CACHE_FLUSH_THREAD: Option<Arc<ProcessControlBlock>> = None;
+
+/// 单次回写最多收集的块数，避免一次性复制过多的数据
+const WRITEBACK_BATCH: usize = 256;
+
 /// # 结构功能
 /// 该结构体向外提供BlockCache服务
+///
+/// Cache以(设备, 块号)为键，块大小为设备自身的块大小。
+/// 写操作只写入Cache并标记为脏，由回写线程（或者sync）批量写回磁盘。
 pub struct BlockCache;
 
-#[allow(static_mut_refs)]
-unsafe fn mapper() -> Result<&'static mut LockedCacheMapper, BlockCacheError> {
+#[unified_init(INITCALL_CORE)]
+fn block_cache_init() -> Result<(), SystemError> {
+    BLOCK_CACHE.init(CacheSpace::new());
+
+    let closure =
+        KernelThreadClosure::StaticEmptyClosure((&(block_cache_flush_thread as fn() -> i32), ()));
+    let pcb = KernelThreadMechanism::create_and_run(closure, "blk_flush".to_string())
+        .ok_or("")
+        .expect("create blk_flush thread failed");
     unsafe {
-        match &mut CMAPPER {
-            Some(x) => return Ok(x),
-            None => return Err(BlockCacheError::StaticParameterError),
-        }
-    };
+        BLOCK_CACHE_FLUSH_THREAD = Some(pcb);
+    }
+    Ok(())
+}
+
+/// 回写线程执行的函数
+fn block_cache_flush_thread() -> i32 {
+    loop {
+        let _ = nanosleep(PosixTimeSpec::new(CACHE_FLUSH_INTERVAL, 0));
+        let cache = BLOCK_CACHE.get();
+        cache.resize_by_policy();
+        let _ = cache.flush(None);
+        cache.trim();
+    }
 }
 
 #[allow(static_mut_refs)]
-unsafe fn space() -> Result<&'static mut LockedCacheSpace, BlockCacheError> {
-    unsafe {
-        match &mut CSPACE {
-            Some(x) => return Ok(x),
-            None => return Err(BlockCacheError::StaticParameterError),
-        }
-    };
+fn wakeup_flush_thread() {
+    if let Some(pcb) = unsafe { BLOCK_CACHE_FLUSH_THREAD.as_ref() } {
+        let _ = ProcessManager::wakeup(pcb);
+    }
 }
 
 impl BlockCache {
     /// # 函数的功能
-    /// 初始化BlockCache需要的结构体
-    pub fn init() {
-        unsafe {
-            CSPACE = Some(LockedCacheSpace::new(CacheSpace::new()));
-            CMAPPER = Some(LockedCacheMapper::new(CacheMapper::new()));
+    /// 登记块设备，只有登记过的设备才能进行回写，未登记设备的写操作会直写到磁盘
+    pub fn register_device(dev: &Arc<dyn BlockDevice>) {
+        if let Some(cache) = BLOCK_CACHE.try_get() {
+            cache
+                .devices
+                .lock()
+                .insert(dev.blkdev_meta().cache_id(), Arc::downgrade(dev));
         }
-        debug!("BlockCache Initialized!");
     }
+
     /// # 函数的功能
-    /// 使用blockcache进行对块设备进行连续块的读操作
+    /// 使用blockcache对块设备进行连续块的读操作
+    ///
+    /// 命中的块直接从Cache复制到buf中，缺失的连续块合并成一次I/O读取后插入Cache。
     ///
     /// ## 参数：
+    /// - 'dev' :块设备
     /// - 'lba_id_start' :连续块的起始块的lba_id
     /// - 'count' :从连续块算起需要读多少块
     /// - 'buf' :读取出来的数据存放在buf中
     ///
     /// ## 返回值：
     /// - Ok(usize) :表示读取块的个数
-    /// - Err(BlockCacheError::BlockFaultError) :缺块的情况下，返回读取失败的块的数据，利用该返回值可以帮助blockcache插入读取失败的块值（见insert函数）
-    /// - Err(BlockCacheError::____) :不缺块的情况往往是初始化或者其他问题，这种异常会在block_device中得到处理
-    pub fn read(
+    pub fn read<D: BlockDevice + ?Sized>(
+        dev: &D,
         lba_id_start: BlockId,
         count: usize,
         buf: &mut [u8],
-    ) -> Result<usize, BlockCacheError> {
-        // 生成一个块迭代器（BlockIter），它可以迭代地给出所有需要块的数据，其中就包括lba_id
-        let block_iter = BlockIter::new(lba_id_start, count, BLOCK_SIZE);
-        // 调用检查函数，检查有无缺块，如果没有就可以获得所有块的Cache地址。如果失败了就直接返回FailData向量
-        let cache_block_addr = Self::check_able_to_read(block_iter)?;
-        // 块地址vec的长度应当等于块迭代器的大小
-        assert!(cache_block_addr.len() == block_iter.count());
-        // 迭代地读取cache并写入到buf中
-        for (index, _) in block_iter.enumerate() {
-            Self::read_one_block(cache_block_addr[index], index, buf)?;
-        }
-        return Ok(count);
-    }
+    ) -> Result<usize, SystemError> {
+        let cache = match BLOCK_CACHE.try_get() {
+            Some(cache) => cache,
+            None => return dev.read_at_sync(lba_id_start, count, buf),
+        };
+        let bsize = 1usize << dev.blk_size_log2();
+        let id = dev.blkdev_meta().cache_id();
+        let buf = &mut buf[..count * bsize];
 
-    /// # 函数的功能
-    /// 检查cache中是否有缺块的函数
-    ///
-    /// ## 参数：
-    /// - 'block_iter' :需要检查的块迭代器（因为块迭代器包含了需要读块的信息，所以传入块迭代器）
-    ///
-    /// ## 返回值：
-    /// - Ok(Vec<CacheBlockAddr>) :如果成功了，那么函数会返回每个块的Cache地址，利用Cache地址就可以访问Cache了
-    /// - Err(BlockCacheError::BlockFaultError) :如果发现了缺块，那么我们会返回所有缺块的信息（即FailData）
-    /// - Err(BlockCacheError::____) :不缺块的情况往往是初始化或者其他问题                  
-    fn check_able_to_read(block_iter: BlockIter) -> Result<Vec<CacheBlockAddr>, BlockCacheError> {
-        // 存放缺块信息的向量
-        let mut fail_ans = vec![];
-        // 存放命中块地址的向量
-        let mut success_ans = vec![];
-        // 获取mapper
-        let mapper = unsafe { mapper()? };
-        for (index, i) in block_iter.enumerate() {
-            // 在mapper中寻找块的lba_id，判断是否命中
-            match mapper.find(i.lba_id()) {
-                Some(x) => {
-                    success_ans.push(x);
-                    continue;
+        // 当前这一段连续缺块的起始下标
+        let mut miss_start: Option<usize> = None;
+        for i in 0..count {
+            let hit = cache.lookup(id, lba_id_start + i, &mut buf[i * bsize..(i + 1) * bsize]);
+            match (hit, miss_start) {
+                (true, Some(s)) => {
+                    cache.fill(dev, id, lba_id_start + s, &mut buf[s * bsize..i * bsize])?;
+                    miss_start = None;
                 }
-                // 缺块就放入fail_ans
-                None => fail_ans.push(FailData::new(i.lba_id(), index)),
-                // 缺块不break的原因是，我们需要把所有缺块都找出来，这样才能补上缺块
+                (false, None) => miss_start = Some(i),
+                _ => {}
             }
         }
-        // 只要有缺块就认为cache失败，因为需要补块就需要进行io操作
-        if !fail_ans.is_empty() {
-            return Err(BlockCacheError::BlockFaultError(fail_ans));
-        } else {
-            return Ok(success_ans);
+        if let Some(s) = miss_start {
+            cache.fill(dev, id, lba_id_start + s, &mut buf[s * bsize..])?;
         }
+        return Ok(count);
     }
+
     /// # 函数的功能
-    /// 在cache中读取一个块的数据并放置于缓存的指定位置
-    ///
-    /// ## 参数：
-    /// - 'cache_block_addr' :表示需要读取的cache块的地址
-    /// - 'position' :表示该块的数据需要放置在buf的哪个位置，比如position为2，那么读出的数据将放置在buf\[1024..1536\](这里假设块大小是512)
-    /// - 'buf' :块数据的缓存
-    ///
-    /// ## 返回值：
-    /// - Ok(usize) :表示读取了多少个字节
-    /// - Err(BlockCacheError) :如果输入的cache_block_addr超过了cache的容量，那么将返回Err（由于目前的cache不支持动态变化上限，所以可能出现这种错误;而实际上，由于Cache的地址是由frame_selector给出的,所以正确实现的frame_selector理论上不会出现这种错误）
-    fn read_one_block(
-        cache_block_addr: CacheBlockAddr,
-        position: usize,
-        buf: &mut [u8],
-    ) -> Result<usize, BlockCacheError> {
-        let space = unsafe { space()? };
-        space.read(cache_block_addr, position, buf)
-    }
-    /// # 函数的功能
-    /// 根据缺块的数据和io获得的数据，向cache中补充块数据
+    /// 使用blockcache对块设备进行连续块的写操作
     ///
-    /// ## 参数：
-    /// - 'f_data_vec' :这里输入的一般是从read函数中返回的缺块数据
-    /// - 'data' :经过一次io后获得的数据
+    /// 已登记的设备采用回写法：数据写入Cache并标记为脏；未登记的设备直写到磁盘并更新Cache。
     ///
     /// ## 返回值：
-    /// Ok(usize) :表示补上缺页的个数
-    /// Err(BlockCacheError) :一般来说不会产生错误，这里产生错误的原因只有插入时还没有初始化（一般也很难发生）
-    pub fn insert(f_data_vec: Vec<FailData>, data: &[u8]) -> Result<usize, BlockCacheError> {
-        let count = f_data_vec.len();
-        for i in f_data_vec {
-            let index = i.index();
-            Self::insert_one_block(
-                i.lba_id(),
-                data[index * BLOCK_SIZE..(index + 1) * BLOCK_SIZE].to_vec(),
+    /// - Ok(usize) :表示写入块的个数
+    pub fn write<D: BlockDevice + ?Sized>(
+        dev: &D,
+        lba_id_start: BlockId,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<usize, SystemError> {
+        let cache = match BLOCK_CACHE.try_get() {
+            Some(cache) => cache,
+            None => return dev.write_at_sync(lba_id_start, count, buf),
+        };
+        let bsize = 1usize << dev.blk_size_log2();
+        let id = dev.blkdev_meta().cache_id();
+        let write_back = cache.devices.lock().contains_key(&id);
+
+        if !write_back {
+            dev.write_at_sync(lba_id_start, count, buf)?;
+        }
+        for i in 0..count {
+            cache.insert(
+                id,
+                lba_id_start + i,
+                InsertData::Store(&buf[i * bsize..(i + 1) * bsize], write_back),
             )?;
         }
-        Ok(count)
+
+        if cache.dirty_bytes.load(Ordering::Relaxed)
+            > cache.max_bytes.load(Ordering::Relaxed) / CACHE_DIRTY_RATIO
+        {
+            wakeup_flush_thread();
+        }
+        return Ok(count);
     }
 
     /// # 函数的功能
-    /// 将一个块数据插入到cache中
-    ///
-    /// ## 参数：
-    /// - 'lba_id' :表明该块对应的lba_id，用于建立映射
-    /// - 'data' :传入的数据
-    ///
-    /// ## 返回值：
-    /// Ok(()):表示插入成功
-    /// Err(BlockCacheError) :一般来说不会产生错误，这里产生错误的原因只有插入时还没有初始化（一般也很难发生）
-    fn insert_one_block(lba_id: BlockId, data: Vec<u8>) -> Result<(), BlockCacheError> {
-        let space = unsafe { space()? };
-        space.insert(lba_id, data)
+    /// 把指定设备的所有脏块写回磁盘
+    pub fn sync<D: BlockDevice + ?Sized>(dev: &D) -> Result<(), SystemError> {
+        match BLOCK_CACHE.try_get() {
+            Some(cache) => cache.flush(Some(dev.blkdev_meta().cache_id())),
+            None => Ok(()),
+        }
     }
+
     /// # 函数的功能
-    /// 立即回写，这里仅仅作为取消映射的方法，并没有真正写入到cache的功能
-    ///
-    /// ## 参数：
-    /// - 'lba_id_start' :需要读取的连续块的起始块
-    /// - 'count' :需要读取块的个数
-    /// - '_data' :目前没有写入功能，该参数暂时无用
-    ///
-    /// ## 返回值：
-    /// Ok(usize) :表示写入了多少个块
-    /// Err(BlockCacheError) :这里产生错误的原因只有插入时还没有初始化
-    pub fn immediate_write(
-        lba_id_start: BlockId,
-        count: usize,
-        _data: &[u8],
-    ) -> Result<usize, BlockCacheError> {
-        let mapper = unsafe { mapper()? };
-        let block_iter = BlockIter::new(lba_id_start, count, BLOCK_SIZE);
-        for i in block_iter {
-            mapper.remove(i.lba_id());
+    /// 设置Cache的容量（单位：字节），超出部分的干净块会被回写线程逐步换出
+    pub fn set_capacity(bytes: usize) {
+        if let Some(cache) = BLOCK_CACHE.try_get() {
+            let bytes = bytes.clamp(CACHE_MIN_BYTES, cache.capacity_limit());
+            cache.target_bytes.store(bytes, Ordering::Relaxed);
+            cache.max_bytes.store(bytes, Ordering::Relaxed);
+            wakeup_flush_thread();
         }
-        Ok(count)
     }
 }
 
-struct LockedCacheSpace(RwLock<CacheSpace>);
+/// 插入Cache的数据来源
+enum InsertData<'a> {
+    /// 刚从磁盘读出的数据。如果Cache中已有该块，则以Cache为准，并把Cache中的数据复制回buf
+    Fill(&'a mut [u8]),
+    /// 上层写入的数据，覆盖Cache中的旧数据。第二个参数表示是否标记为脏
+    Store(&'a [u8], bool),
+}
 
-impl LockedCacheSpace {
-    pub fn new(space: CacheSpace) -> Self {
-        LockedCacheSpace(RwLock::new(space))
-    }
+/// # 结构功能
+/// Cache中的一个组，组内使用CLOCK算法选择被换出的块
+struct CacheSet {
+    blocks: Vec<CacheBlock>,
+    hand: usize,
+}
 
-    pub fn read(
-        &self,
-        addr: CacheBlockAddr,
-        position: usize,
-        buf: &mut [u8],
-    ) -> Result<usize, BlockCacheError> {
-        self.0.read().read(addr, position, buf)
+impl CacheSet {
+    const fn new() -> Self {
+        Self {
+            blocks: Vec::new(),
+            hand: 0,
+        }
     }
 
-    pub fn _write(&mut self, _addr: CacheBlockAddr, _data: CacheBlock) -> Option<()> {
-        todo!()
+    fn find(&mut self, dev: usize, lba_id: BlockId) -> Option<&mut CacheBlock> {
+        self.blocks.iter_mut().find(|b| b.matches(dev, lba_id))
     }
 
-    pub fn insert(&mut self, lba_id: BlockId, data: Vec<u8>) -> Result<(), BlockCacheError> {
-        unsafe { self.0.get_mut().insert(lba_id, data) }
+    /// # 函数的功能
+    /// CLOCK算法：跳过脏块和回写中的块，被访问过的块获得第二次机会
+    fn clock_victim(&mut self) -> Option<usize> {
+        let len = self.blocks.len();
+        for _ in 0..2 * len {
+            let idx = self.hand % len;
+            self.hand = (idx + 1) % len;
+            let block = &mut self.blocks[idx];
+            if !block.evictable() {
+                continue;
+            }
+            if block.flags().contains(CacheBlockFlags::REFERENCED) {
+                block.clear_flags(CacheBlockFlags::REFERENCED);
+                continue;
+            }
+            return Some(idx);
+        }
+        return None;
     }
 }
 
+/// 等待回写的块的拷贝
+struct WritebackBlock {
+    dev: usize,
+    lba_id: BlockId,
+    data: Vec<u8>,
+}
+
 /// # 结构功能
-/// 管理Cache空间的结构体
+/// 管理Cache空间的结构体，组相联：(设备, 块号)先散列到组，再在组内查找
 struct CacheSpace {
-    /// 用于存放CacheBlock，是Cache数据的实际存储空间的向量
-    root: Vec<CacheBlock>,
-    /// 在块换出换入时，用于选择替换块的结构体
-    frame_selector: Box<dyn FrameSelector>,
+    sets: Vec<SpinLock<CacheSet>>,
+    set_mask: usize,
+    /// 已登记的设备，用于回写
+    devices: SpinLock<HashMap<usize, Weak<dyn BlockDevice>>>,
+    used_bytes: AtomicUsize,
+    dirty_bytes: AtomicUsize,
+    /// 当前允许使用的容量，会随内存压力在[CACHE_MIN_BYTES, target_bytes]之间调整
+    max_bytes: AtomicUsize,
+    /// 内存充足时的目标容量
+    target_bytes: AtomicUsize,
+    /// trim时下一个要扫描的组
+    trim_cursor: AtomicUsize,
+    /// 等待回写结束的线程，见`insert`
+    writeback_wait: WaitQueue,
 }
 
 impl CacheSpace {
-    pub fn new() -> Self {
+    fn new() -> Self {
+        let total = unsafe { LockedFrameAllocator.usage() }.total().bytes();
+        let target = (total / CACHE_MEMORY_RATIO).clamp(CACHE_MIN_BYTES, CACHE_MAX_BYTES);
+        // 组的数量按照最小的块大小计算，保证容量用满时每组不超过CACHE_WAYS路
+        let nsets = (target / LBA_SIZE / CACHE_WAYS).next_power_of_two();
+        let mut sets = Vec::with_capacity(nsets);
+        for _ in 0..nsets {
+            sets.push(SpinLock::new(CacheSet::new()));
+        }
+
+        info!(
+            "BlockCache initialized: capacity {} KB, {} sets x {} ways",
+            target >> 10,
+            nsets,
+            CACHE_WAYS
+        );
         Self {
-            root: Vec::new(),
-            // 如果要修改替换算法，可以设计一个结构体实现FrameSelector trait，再在这里替换掉SimpleFrameSelector
-            frame_selector: Box::new(SimpleFrameSelector::new()),
+            sets,
+            set_mask: nsets - 1,
+            devices: SpinLock::new(HashMap::new()),
+            used_bytes: AtomicUsize::new(0),
+            dirty_bytes: AtomicUsize::new(0),
+            max_bytes: AtomicUsize::new(target),
+            target_bytes: AtomicUsize::new(target),
+            trim_cursor: AtomicUsize::new(0),
+            writeback_wait: WaitQueue::default(),
         }
     }
-    /// # 函数的功能
-    /// 将一个块的数据写入到buf的指定位置
-    ///
-    /// ## 参数：
-    /// - 'addr' :请求块在Cache中的地址
-    /// - 'position' :表示需要将Cache放入buf中的位置，例如:若position为1，则块的数据放入buf\[512..1024\]
-    /// - 'buf' :存放数据的buf
-    ///
-    /// ## 返回值：
-    /// Some(usize):表示读取的字节数（这里默认固定为BLOCK_SIZE）
-    /// Err(BlockCacheError):如果你输入地址大于cache的最大上限，那么就返回InsufficientCacheSpace
-    pub fn read(
-        &self,
-        addr: CacheBlockAddr,
-        position: usize,
-        buf: &mut [u8],
-    ) -> Result<usize, BlockCacheError> {
-        if addr > self.frame_selector.size() {
-            return Err(BlockCacheError::InsufficientCacheSpace);
-        } else {
-            // CacheBlockAddr就是用于给root寻址的
-            return self.root[addr]
-                .data(&mut buf[position * BLOCK_SIZE..(position + 1) * BLOCK_SIZE]);
-        }
+
+    /// 组的数量决定的容量上限
+    fn capacity_limit(&self) -> usize {
+        self.sets.len() * CACHE_WAYS * LBA_SIZE
     }
-    /// # 函数的功能
-    /// 向cache空间中写入的函数，目前尚未实现
-    pub fn _write(&mut self, _addr: CacheBlockAddr, _data: CacheBlock) -> Option<()> {
-        todo!()
+
+    #[inline]
+    fn set_index(&self, dev: usize, lba_id: BlockId) -> usize {
+        // 相邻的块落在相邻的组里，不同设备之间错开
+        (lba_id ^ dev.wrapping_mul(0x9e37_79b9)) & self.set_mask
     }
+
     /// # 函数的功能
-    /// 向cache中插入一个块并建立lba_id到块之间的映射
-    ///
-    /// ## 参数：
-    /// - 'lba_id' :表明你插入的块的lba_id，用于建立映射
-    /// - 'data' :要插入块的数据
-    ///
-    /// ## 返回值：
-    /// Ok(())
-    pub fn insert(&mut self, lba_id: BlockId, data: Vec<u8>) -> Result<(), BlockCacheError> {
-        // CacheBlock是cached block的基本单位，这里使用data生成一个CacheBlock用于向Cache空间中插入块
-        let data_block = CacheBlock::from_data(lba_id, data);
-        let mapper = unsafe { mapper()? };
-        // 这里我设计了cache的一个threshold，如果不超过阈值就可以append，否则只能替换
-        if self.frame_selector.can_append() {
-            // 这是append的操作逻辑：
-            // 从frame_selector获得一个CacheBlockAddr
-            let index = self.frame_selector.index_append();
-            // 直接将块push进去就可以，因为现在是append操作
-            self.root.push(data_block);
-            assert!(index == self.root.len() - 1);
-            // 建立mapper的映射
-            mapper.insert(lba_id, index);
-            Ok(())
-        } else {
-            // 这是replace的操作逻辑
-            // 从frame_selector获得一个CacheBlockAddr，这次是它替换出来的
-            let index = self.frame_selector.index_replace();
-            // 获取被替换的块的lba_id，待会用于取消映射
-            let removed_id = self.root[index].lba_id();
-            // 直接替换原本的块，由于被替换的块没有引用了，所以会被drop
-            self.root[index] = data_block;
-            // 建立映射插入块的映射
-            mapper.insert(lba_id, index);
-            // 取消被替换块的映射
-            mapper.remove(removed_id);
-            Ok(())
+    /// 查找一个块，命中则直接复制到buf中
+    fn lookup(&self, dev: usize, lba_id: BlockId, buf: &mut [u8]) -> bool {
+        let mut set = self.sets[self.set_index(dev, lba_id)].lock();
+        match set.find(dev, lba_id) {
+            Some(block) => {
+                buf.copy_from_slice(block.data());
+                block.set_flags(CacheBlockFlags::REFERENCED);
+                true
+            }
+            None => false,
         }
     }
-}
-
-struct LockedCacheMapper {
-    lock: RwLock<CacheMapper>,
-}
 
-impl LockedCacheMapper {
-    pub fn new(inner: CacheMapper) -> Self {
-        Self {
-            lock: RwLock::new(inner),
+    /// # 函数的功能
+    /// 从磁盘读取一段连续的缺块，并插入Cache
+    fn fill<D: BlockDevice + ?Sized>(
+        &self,
+        dev: &D,
+        id: usize,
+        lba_id_start: BlockId,
+        buf: &mut [u8],
+    ) -> Result<(), SystemError> {
+        let bsize = 1usize << dev.blk_size_log2();
+        let count = buf.len() / bsize;
+        dev.read_at_sync(lba_id_start, count, buf)?;
+        for (i, data) in buf.chunks_exact_mut(bsize).enumerate() {
+            self.insert(id, lba_id_start + i, InsertData::Fill(data))?;
         }
+        Ok(())
     }
 
-    pub fn insert(&mut self, lba_id: BlockId, caddr: CacheBlockAddr) -> Option<()> {
-        unsafe { self.lock.get_mut().insert(lba_id, caddr) }
-    }
+    /// # 函数的功能
+    /// 向cache中插入一个块。组满且没有可换出的块时，先同步回写该组的脏块再重试；
+    /// 组内的块都在被其他线程回写时，睡眠等待回写结束
+    fn insert(&self, dev: usize, lba_id: BlockId, mut data: InsertData) -> Result<(), SystemError> {
+        let idx = self.set_index(dev, lba_id);
+        loop {
+            let mut set = self.sets[idx].lock();
+            if let Some(block) = set.find(dev, lba_id) {
+                match &mut data {
+                    InsertData::Fill(buf) => buf.copy_from_slice(block.data()),
+                    InsertData::Store(buf, dirty) => {
+                        block.data_mut().copy_from_slice(buf);
+                        if *dirty && !block.flags().contains(CacheBlockFlags::DIRTY) {
+                            block.set_flags(CacheBlockFlags::DIRTY);
+                            self.dirty_bytes.fetch_add(block.size(), Ordering::Relaxed);
+                        }
+                    }
+                }
+                block.set_flags(CacheBlockFlags::REFERENCED);
+                return Ok(());
+            }
 
-    pub fn find(&self, lba_id: BlockId) -> Option<CacheBlockAddr> {
-        self.lock.read().find(lba_id)
-    }
+            let (buf, flags) = match &data {
+                InsertData::Fill(buf) => (&buf[..], CacheBlockFlags::empty()),
+                InsertData::Store(buf, true) => (*buf, CacheBlockFlags::DIRTY),
+                InsertData::Store(buf, false) => (*buf, CacheBlockFlags::empty()),
+            };
+            let size = buf.len();
+            let over_budget = self.used_bytes.load(Ordering::Relaxed) + size
+                > self.max_bytes.load(Ordering::Relaxed);
 
-    pub fn remove(&mut self, lba_id: BlockId) {
-        unsafe { self.lock.get_mut().remove(lba_id) }
-    }
-}
-
-/// # 结构功能
-/// 该结构体用于建立lba_id到cached块的映射
-struct CacheMapper {
-    // 执行键值对操作的map
-    map: HashMap<BlockId, CacheBlockAddr>,
-}
+            let slot = if set.blocks.len() < CACHE_WAYS && !over_budget {
+                None
+            } else {
+                match set.clock_victim() {
+                    Some(victim) => Some(victim),
+                    // 超出容量但组内没有可换出的块，暂时超额使用，由回写线程负责收缩
+                    None if set.blocks.len() < CACHE_WAYS => None,
+                    None if set
+                        .blocks
+                        .iter()
+                        .all(|b| b.flags().contains(CacheBlockFlags::WRITEBACK)) =>
+                    {
+                        // 没有可以由自己回写的脏块，不能忙等回写线程的磁盘I/O
+                        self.writeback_wait
+                            .sleep_uninterruptible_unlock_spinlock(set);
+                        continue;
+                    }
+                    None => {
+                        drop(set);
+                        self.writeback_set(idx)?;
+                        continue;
+                    }
+                }
+            };
 
-impl CacheMapper {
-    pub fn new() -> Self {
-        Self {
-            map: HashMap::new(),
+            let block = CacheBlock::new(dev, lba_id, buf.to_vec(), flags);
+            match slot {
+                Some(victim) => {
+                    let old = core::mem::replace(&mut set.blocks[victim], block);
+                    self.used_bytes.fetch_sub(old.size(), Ordering::Relaxed);
+                }
+                None => set.blocks.push(block),
+            }
+            self.used_bytes.fetch_add(size, Ordering::Relaxed);
+            if flags.contains(CacheBlockFlags::DIRTY) {
+                self.dirty_bytes.fetch_add(size, Ordering::Relaxed);
+            }
+            return Ok(());
         }
     }
+
     /// # 函数的功能
-    /// 插入操作
-    pub fn insert(&mut self, lba_id: BlockId, caddr: CacheBlockAddr) -> Option<()> {
-        self.map.insert(lba_id, caddr)?;
-        Some(())
+    /// 从一个组中收集脏块的拷贝，并把它们标记为回写中
+    fn collect_dirty(&self, idx: usize, dev: Option<usize>, out: &mut Vec<WritebackBlock>) {
+        let mut set = self.sets[idx].lock();
+        for block in set.blocks.iter_mut() {
+            let flags = block.flags();
+            if !flags.contains(CacheBlockFlags::DIRTY)
+                || flags.contains(CacheBlockFlags::WRITEBACK)
+                || dev.is_some_and(|dev| dev != block.dev())
+            {
+                continue;
+            }
+            block.clear_flags(CacheBlockFlags::DIRTY);
+            block.set_flags(CacheBlockFlags::WRITEBACK);
+            self.dirty_bytes.fetch_sub(block.size(), Ordering::Relaxed);
+            out.push(WritebackBlock {
+                dev: block.dev(),
+                lba_id: block.lba_id(),
+                data: block.data().to_vec(),
+            });
+        }
     }
-    /// # 函数的功能
-    /// 查找操作
-    #[inline]
-    pub fn find(&self, lba_id: BlockId) -> Option<CacheBlockAddr> {
-        Some(*self.map.get(&lba_id)?)
+
+    fn writeback_set(&self, idx: usize) -> Result<(), SystemError> {
+        let mut blocks = Vec::new();
+        self.collect_dirty(idx, None, &mut blocks);
+        self.writeback(blocks)
     }
+
     /// # 函数的功能
-    /// 去除操作
-    pub fn remove(&mut self, lba_id: BlockId) {
-        self.map.remove(&lba_id);
+    /// 回写脏块。dev为None时回写所有设备
+    fn flush(&self, dev: Option<usize>) -> Result<(), SystemError> {
+        let mut result = Ok(());
+        let mut blocks = Vec::new();
+        for idx in 0..self.sets.len() {
+            self.collect_dirty(idx, dev, &mut blocks);
+            if blocks.len() >= WRITEBACK_BATCH {
+                if let Err(e) = self.writeback(core::mem::take(&mut blocks)) {
+                    result = Err(e);
+                }
+            }
+        }
+        if let Err(e) = self.writeback(blocks) {
+            result = Err(e);
+        }
+        return result;
     }
-}
 
-/// # 结构功能
-/// 该trait用于实现块的换入换出算法，需要设计替换算法只需要实现该trait即可
-trait FrameSelector {
-    /// # 函数的功能
-    /// 给出append操作的index（理论上，如果cache没满，就不需要换出块，就可以使用append操作）
-    fn index_append(&mut self) -> CacheBlockAddr;
-    /// # 函数的功能
-    /// 给出replace操作后的index
-    fn index_replace(&mut self) -> CacheBlockAddr;
     /// # 函数的功能
-    /// 判断是否可以append
-    fn can_append(&self) -> bool;
-    /// # 函数的功能
-    /// 获取size
-    fn size(&self) -> usize;
-}
+    /// 把收集到的脏块按(设备, 块号)排序，连续的块合并成一次写操作
+    fn writeback(&self, mut blocks: Vec<WritebackBlock>) -> Result<(), SystemError> {
+        if blocks.is_empty() {
+            return Ok(());
+        }
+        blocks.sort_unstable_by_key(|b| (b.dev, b.lba_id));
 
-/// # 结构功能
-/// 该结构体用于管理块的换入换出过程中，CacheBlockAddr的选择，替换算法在这里实现
-struct SimpleFrameSelector {
-    // 表示BlockCache的阈值，即最大可以存放多少块，这里目前还不支持动态变化
-    threshold: usize,
-    // 表示使用过的块帧的数量
-    size: usize,
-    // 这里使用从头至尾的替换算法，其替换策略为0，1，2，...，threshold，0，1...以此类推（该算法比FIFO还要简陋，后面可以再实现别的：）
-    current: usize,
-}
+        let mut result = Ok(());
+        let mut start = 0;
+        while start < blocks.len() {
+            let mut end = start + 1;
+            while end < blocks.len()
+                && blocks[end].dev == blocks[start].dev
+                && blocks[end].lba_id == blocks[end - 1].lba_id + 1
+            {
+                end += 1;
+            }
 
-impl SimpleFrameSelector {
-    pub fn new() -> Self {
-        Self {
-            threshold: CACHE_THRESHOLD * (1 << (20 - BLOCK_SIZE_LOG)),
-            size: 0,
-            current: 0,
+            let run = &blocks[start..end];
+            let r = self.write_run(run);
+            if let Err(e) = &r {
+                error!(
+                    "BlockCache: writeback dev {} lba {}..{} failed: {:?}",
+                    run[0].dev,
+                    run[0].lba_id,
+                    run[0].lba_id + run.len(),
+                    e
+                );
+                result = r.clone();
+            }
+            self.end_writeback(run, r.is_ok());
+            start = end;
         }
+        return result;
     }
-}
 
-impl FrameSelector for SimpleFrameSelector {
-    fn index_append(&mut self) -> CacheBlockAddr {
-        let ans = self.current;
-        self.size += 1;
-        self.current += 1;
-        self.current %= self.threshold;
-        return ans;
+    fn write_run(&self, run: &[WritebackBlock]) -> Result<(), SystemError> {
+        let dev = self
+            .devices
+            .lock()
+            .get(&run[0].dev)
+            .and_then(|dev| dev.upgrade())
+            .ok_or(SystemError::ENODEV)?;
+
+        if run.len() == 1 {
+            dev.write_at_sync(run[0].lba_id, 1, &run[0].data)?;
+        } else {
+            let mut buf = Vec::with_capacity(run.len() * run[0].data.len());
+            for block in run {
+                buf.extend_from_slice(&block.data);
+            }
+            dev.write_at_sync(run[0].lba_id, run.len(), &buf)?;
+        }
+        Ok(())
     }
 
-    fn index_replace(&mut self) -> CacheBlockAddr {
-        let ans = self.current;
-        self.current += 1;
-        self.current %= self.threshold;
-        return ans;
+    /// 回写结束，清除回写标志；回写失败的块重新标记为脏
+    fn end_writeback(&self, run: &[WritebackBlock], success: bool) {
+        for wb in run {
+            let mut set = self.sets[self.set_index(wb.dev, wb.lba_id)].lock();
+            if let Some(block) = set.find(wb.dev, wb.lba_id) {
+                block.clear_flags(CacheBlockFlags::WRITEBACK);
+                if !success && !block.flags().contains(CacheBlockFlags::DIRTY) {
+                    block.set_flags(CacheBlockFlags::DIRTY);
+                    self.dirty_bytes.fetch_add(block.size(), Ordering::Relaxed);
+                }
+            }
+        }
+        self.writeback_wait.wakeup_all(None);
     }
 
-    fn can_append(&self) -> bool {
-        self.size < self.threshold
+    /// # 函数的功能
+    /// 容量策略：空闲内存不足1/8时容量减半，空闲内存超过1/4时逐步恢复到目标容量
+    fn resize_by_policy(&self) {
+        let usage = unsafe { LockedFrameAllocator.usage() };
+        let free = usage.free().bytes();
+        let total = usage.total().bytes();
+        let cur = self.max_bytes.load(Ordering::Relaxed);
+        let target = self.target_bytes.load(Ordering::Relaxed);
+
+        let new = if free < total / 8 {
+            (cur / 2).max(CACHE_MIN_BYTES)
+        } else if free > total / 4 {
+            cur.saturating_mul(2).min(target)
+        } else {
+            cur
+        };
+        self.max_bytes.store(new, Ordering::Relaxed);
     }
 
-    fn size(&self) -> usize {
-        self.size
+    /// # 函数的功能
+    /// 换出干净块，直到使用量不超过当前容量
+    fn trim(&self) {
+        let nsets = self.sets.len();
+        let mut scanned = 0;
+        while scanned < nsets
+            && self.used_bytes.load(Ordering::Relaxed) > self.max_bytes.load(Ordering::Relaxed)
+        {
+            let idx = self.trim_cursor.fetch_add(1, Ordering::Relaxed) & self.set_mask;
+            let mut set = self.sets[idx].lock();
+            if !set.blocks.is_empty() {
+                if let Some(victim) = set.clock_victim() {
+                    let old = set.blocks.swap_remove(victim);
+                    set.hand = 0;
+                    self.used_bytes.fetch_sub(old.size(), Ordering::Relaxed);
+                }
+            }
+            scanned += 1;
+        }
     }
 }
@@ -1,19 +1,15 @@
-use alloc::vec::Vec;
-
-use self::cache_iter::FailData;
-
 mod cache_block;
-mod cache_iter;
 pub mod cached_block_device;
-pub const BLOCK_SIZE_LOG: usize = 9;
-///块大小这里固定为512
-pub const BLOCK_SIZE: usize = 1 << BLOCK_SIZE_LOG;
-///这里规定Cache的threshold大小，单位为：MB
-pub const CACHE_THRESHOLD: usize = 64;
 
-pub enum BlockCacheError {
-    BlockSizeError,
-    InsufficientCacheSpace,
-    StaticParameterError,
-    BlockFaultError(Vec<FailData>),
-}
+/// 每个组的路数（组相联度）
+pub const CACHE_WAYS: usize = 8;
+/// Cache容量下限，单位为：字节
+pub const CACHE_MIN_BYTES: usize = 1 << 20;
+/// Cache容量上限，单位为：字节
+pub const CACHE_MAX_BYTES: usize = 256 << 20;
+/// 默认使用物理内存的1/CACHE_MEMORY_RATIO作为Cache容量
+pub const CACHE_MEMORY_RATIO: usize = 16;
+/// 脏块超过Cache容量的1/CACHE_DIRTY_RATIO时，唤醒回写线程
+pub const CACHE_DIRTY_RATIO: usize = 4;
+/// 回写线程的周期，单位为：秒
+pub const CACHE_FLUSH_INTERVAL: i64 = 5;
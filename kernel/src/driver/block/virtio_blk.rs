@@ -1,7 +1,8 @@
 use core::{any::Any, fmt::Debug};
 
 use alloc::{
-    collections::LinkedList,
+    boxed::Box,
+    collections::{BTreeMap, LinkedList},
     string::{String, ToString},
     sync::{Arc, Weak},
     vec::Vec,
@@ -10,12 +11,16 @@ use bitmap::traits::BitMapOps;
 use log::error;
 use system_error::SystemError;
 use unified_init::macros::unified_init;
-use virtio_drivers::device::blk::{VirtIOBlk, SECTOR_SIZE};
+use virtio_drivers::device::blk::{BlkReq, BlkResp, VirtIOBlk, SECTOR_SIZE};
 
 use crate::{
     driver::{
         base::{
             block::{
+                blk_mq::{
+                    BlkMqHwRequest, BlkMqOps, BlkMqQueue, BlkReqOp, BlkRequest,
+                    BLK_MQ_DEFAULT_MAX_SECTORS,
+                },
                 block_device::{BlockDevName, BlockDevice, BlockId, GeneralBlockRange, LBA_SIZE},
                 disk_info::Partition,
                 manager::{block_dev_manager, BlockDevMeta},
@@ -29,6 +34,7 @@ use crate::{
             kobject::{KObjType, KObject, KObjectCommonData, KObjectState, LockedKObjectState},
             kset::KSet,
         },
+        block::cache::cached_block_device::BlockCache,
         virtio::{
             sysfs::{virtio_bus, virtio_device_manager, virtio_driver_manager},
             transport::VirtIOTransport,
@@ -154,6 +160,9 @@ pub struct VirtIOBlkDevice {
     blkdev_meta: BlockDevMeta,
     dev_id: Arc<DeviceId>,
     inner: SpinLock<InnerVirtIOBlkDevice>,
+    /// virtqueue及在途请求，会在中断上下文中访问，必须使用lock_irqsave
+    queue: SpinLock<VirtIOBlkQueue>,
+    blk_mq: Arc<BlkMqQueue>,
     locked_kobj_state: LockedKObjectState,
     self_ref: Weak<Self>,
 }
@@ -178,8 +187,15 @@ impl VirtIOBlkDevice {
             self_ref: self_ref.clone(),
             dev_id,
             locked_kobj_state: LockedKObjectState::default(),
-            inner: SpinLock::new(InnerVirtIOBlkDevice {
+            queue: SpinLock::new(VirtIOBlkQueue {
                 device_inner,
+                inflight: BTreeMap::new(),
+            }),
+            blk_mq: BlkMqQueue::new(
+                self_ref.clone() as Weak<dyn BlkMqOps>,
+                BLK_MQ_DEFAULT_MAX_SECTORS,
+            ),
+            inner: SpinLock::new(InnerVirtIOBlkDevice {
                 name: None,
                 virtio_index: None,
                 device_common: DeviceCommonData::default(),
@@ -194,6 +210,96 @@ impl VirtIOBlkDevice {
     fn inner(&self) -> SpinLockGuard<InnerVirtIOBlkDevice> {
         self.inner.lock()
     }
+
+    /// 回收virtqueue中已经完成的请求，并唤醒等待者
+    fn complete_inflight(&self) {
+        let mut finished = Vec::new();
+        let mut queue = self.queue.lock_irqsave();
+        while let Some(token) = queue.device_inner.peek_used() {
+            let Some(mut inflight) = queue.inflight.remove(&token) else {
+                error!(
+                    "VirtIOBlkDevice '{:?}': unknown used token {}",
+                    self.dev_id, token
+                );
+                break;
+            };
+
+            let r = unsafe {
+                match inflight.hw_rq.op {
+                    BlkReqOp::Read => queue.device_inner.complete_read_blocks(
+                        token,
+                        &inflight.req,
+                        &mut inflight.hw_rq.buf,
+                        &mut inflight.resp,
+                    ),
+                    BlkReqOp::Write => queue.device_inner.complete_write_blocks(
+                        token,
+                        &inflight.req,
+                        &inflight.hw_rq.buf,
+                        &mut inflight.resp,
+                    ),
+                }
+            };
+            finished.push((inflight.hw_rq, r.map_err(|_| SystemError::EIO)));
+        }
+        drop(queue);
+
+        for (hw_rq, r) in finished {
+            hw_rq.end(r);
+        }
+    }
+}
+
+impl BlkMqOps for VirtIOBlkDevice {
+    fn queue_rq(&self, mut rq: BlkMqHwRequest) -> Result<(), BlkMqHwRequest> {
+        let mut req = Box::<BlkReq>::default();
+        let mut resp = Box::<BlkResp>::default();
+        let mut queue = self.queue.lock_irqsave();
+        // 缓冲区、req和resp都在堆上，在请求完成之前不会移动或释放
+        let r = unsafe {
+            match rq.op {
+                BlkReqOp::Read => queue.device_inner.read_blocks_nb(
+                    rq.lba_start,
+                    &mut req,
+                    &mut rq.buf,
+                    &mut resp,
+                ),
+                BlkReqOp::Write => {
+                    queue
+                        .device_inner
+                        .write_blocks_nb(rq.lba_start, &mut req, &rq.buf, &mut resp)
+                }
+            }
+        };
+
+        match r {
+            Ok(token) => {
+                queue.inflight.insert(
+                    token,
+                    VirtIOBlkInflight {
+                        req,
+                        resp,
+                        hw_rq: rq,
+                    },
+                );
+                Ok(())
+            }
+            Err(virtio_drivers::Error::QueueFull) => Err(rq),
+            Err(e) => {
+                drop(queue);
+                error!(
+                    "VirtIOBlkDevice '{:?}' queue_rq failed: {:?}",
+                    self.dev_id, e
+                );
+                rq.end(Err(SystemError::EIO));
+                Ok(())
+            }
+        }
+    }
+
+    fn poll(&self) {
+        self.complete_inflight();
+    }
 }
 
 impl BlockDevice for VirtIOBlkDevice {
@@ -206,9 +312,9 @@ impl BlockDevice for VirtIOBlkDevice {
     }
 
     fn disk_range(&self) -> GeneralBlockRange {
-        let inner = self.inner();
-        let blocks = inner.device_inner.capacity() as usize * SECTOR_SIZE / LBA_SIZE;
-        drop(inner);
+        let queue = self.queue.lock_irqsave();
+        let blocks = queue.device_inner.capacity() as usize * SECTOR_SIZE / LBA_SIZE;
+        drop(queue);
         log::debug!(
             "VirtIOBlkDevice '{:?}' disk_range: 0..{}",
             self.dev_name(),
@@ -223,18 +329,15 @@ impl BlockDevice for VirtIOBlkDevice {
         count: usize,
         buf: &mut [u8],
     ) -> Result<usize, SystemError> {
-        let mut inner = self.inner();
-
-        inner
-            .device_inner
-            .read_blocks(lba_id_start, &mut buf[..count * LBA_SIZE])
-            .map_err(|e| {
-                error!(
-                    "VirtIOBlkDevice '{:?}' read_at_sync failed: {:?}",
-                    self.dev_id, e
-                );
-                SystemError::EIO
-            })?;
+        // 直接读入调用者的缓冲区。submit_and_wait在请求完成之前不会返回
+        let rq =
+            unsafe { BlkRequest::new_read_into(lba_id_start, count, &mut buf[..count * LBA_SIZE]) };
+        self.blk_mq.submit_and_wait(&rq).inspect_err(|e| {
+            error!(
+                "VirtIOBlkDevice '{:?}' read_at_sync failed: {:?}",
+                self.dev_id, e
+            );
+        })?;
 
         Ok(count)
     }
@@ -245,15 +348,14 @@ impl BlockDevice for VirtIOBlkDevice {
         count: usize,
         buf: &[u8],
     ) -> Result<usize, SystemError> {
-        self.inner()
-            .device_inner
-            .write_blocks(lba_id_start, &buf[..count * LBA_SIZE])
-            .map_err(|_| SystemError::EIO)?;
+        let rq =
+            unsafe { BlkRequest::new_write_from(lba_id_start, count, &buf[..count * LBA_SIZE]) };
+        self.blk_mq.submit_and_wait(&rq)?;
         Ok(count)
     }
 
     fn sync(&self) -> Result<(), SystemError> {
-        Ok(())
+        BlockCache::sync(self)
     }
 
     fn blk_size_log2(&self) -> u8 {
@@ -272,6 +374,10 @@ impl BlockDevice for VirtIOBlkDevice {
         todo!()
     }
 
+    fn request_queue(&self) -> Option<Arc<BlkMqQueue>> {
+        Some(self.blk_mq.clone())
+    }
+
     fn partitions(&self) -> Vec<Arc<Partition>> {
         let device = self.self_ref.upgrade().unwrap() as Arc<dyn BlockDevice>;
         let mbr_table = MbrDiskPartionTable::from_disk(device.clone())
@@ -280,8 +386,28 @@ impl BlockDevice for VirtIOBlkDevice {
     }
 }
 
-struct InnerVirtIOBlkDevice {
+struct VirtIOBlkQueue {
     device_inner: VirtIOBlk<HalImpl, VirtIOTransport>,
+    /// 以virtqueue token为索引的在途请求
+    inflight: BTreeMap<u16, VirtIOBlkInflight>,
+}
+
+impl Debug for VirtIOBlkQueue {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("VirtIOBlkQueue")
+            .field("inflight", &self.inflight.len())
+            .finish()
+    }
+}
+
+/// 已经提交到virtqueue、尚未完成的请求
+struct VirtIOBlkInflight {
+    req: Box<BlkReq>,
+    resp: Box<BlkResp>,
+    hw_rq: BlkMqHwRequest,
+}
+
+struct InnerVirtIOBlkDevice {
     name: Option<String>,
     virtio_index: Option<VirtIODeviceIndex>,
     device_common: DeviceCommonData,
@@ -304,8 +430,14 @@ impl VirtIODevice for VirtIOBlkDevice {
         &self,
         _irq: crate::exception::IrqNumber,
     ) -> Result<IrqReturn, system_error::SystemError> {
-        // todo: handle virtio blk irq
-        Ok(crate::exception::irqdesc::IrqReturn::Handled)
+        if !self.queue.lock_irqsave().device_inner.ack_interrupt() {
+            return Ok(IrqReturn::NotHandled);
+        }
+        // 收到过中断，说明中断通路可用，之后的等待者可以睡眠等待
+        self.blk_mq.set_irq_driven(true);
+        self.complete_inflight();
+        self.blk_mq.run_hw_queue();
+        Ok(IrqReturn::Handled)
     }
 
     fn dev_id(&self) -> &Arc<DeviceId> {
@@ -7,6 +7,7 @@ use crate::driver::base::block::disk_info::Partition;
 use crate::driver::base::block::manager::BlockDevMeta;
 use crate::driver::base::class::Class;
 use crate::driver::base::device::bus::Bus;
+use crate::driver::block::cache::cached_block_device::BlockCache;
 
 use crate::driver::base::device::driver::Driver;
 use crate::driver::base::device::{Device, DeviceType, IdTable};
@@ -543,6 +544,7 @@ impl BlockDevice for LockedAhciDisk {
     }
 
     fn sync(&self) -> Result<(), SystemError> {
+        BlockCache::sync(self)?;
         return self.inner().sync();
     }
 
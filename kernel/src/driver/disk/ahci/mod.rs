@@ -5,7 +5,6 @@ pub mod hba;
 
 use crate::arch::MMArch;
 use crate::driver::base::block::manager::block_dev_manager;
-use crate::driver::block::cache::cached_block_device::BlockCache;
 use crate::driver::disk::ahci::ahcidisk::LockedAhciDisk;
 use crate::driver::pci::pci::{
     get_pci_device_structure_mut, PciDeviceStructure, PCI_DEVICE_LINKEDLIST,
@@ -127,7 +126,6 @@ pub fn ahci_init() -> Result<(), SystemError> {
                 }
             }
         }
-        BlockCache::init();
     }
 
     compiler_fence(core::sync::atomic::Ordering::SeqCst);
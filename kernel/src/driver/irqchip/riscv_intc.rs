@@ -3,7 +3,7 @@ use log::error;
 use system_error::SystemError;
 
 use crate::{
-    arch::interrupt::TrapFrame,
+    arch::interrupt::{ipi::riscv_ipi_irq_desc_init, TrapFrame},
     driver::clocksource::timer_riscv::{riscv_sbi_timer_irq_desc_init, RiscVSbiTimer},
     exception::{
         handle::PerCpuDevIdIrqHandler,
@@ -167,6 +167,7 @@ pub unsafe fn riscv_intc_init() -> Result<(), SystemError> {
     }
 
     riscv_sbi_timer_irq_desc_init();
+    riscv_ipi_irq_desc_init();
 
     return Ok(());
 }
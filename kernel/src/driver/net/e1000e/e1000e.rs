@@ -15,6 +15,7 @@ use super::e1000e_driver::e1000e_driver_init;
 use crate::driver::base::device::DeviceId;
 use crate::driver::net::dma::{dma_alloc, dma_dealloc};
 use crate::driver::net::irq_handle::DefaultNetIrqHandler;
+use crate::driver::net::napi::{napi_register, NapiIrq, NapiStruct, NAPI_POLL_WEIGHT};
 use crate::driver::pci::pci::{
     get_pci_device_structure_mut, PciDeviceStructure, PciDeviceStructureGeneralDevice, PciError,
     PCI_DEVICE_LINKEDLIST,
@@ -61,9 +62,6 @@ const E1000E_DMA_PAGES: usize = 1;
 // 中断相关
 const E1000E_RECV_VECTOR: IrqNumber = IrqNumber::new(57);
 
-// napi队列中暂时存储的buffer个数
-const E1000E_RECV_NAPI: usize = 1024;
-
 // 收/发包的描述符结构 pp.24 Table 3-1
 #[repr(C)]
 #[derive(Copy, Clone, Debug)]
@@ -186,13 +184,38 @@ pub struct E1000EDevice {
     trans_buffers: Vec<E1000EBuffer>,
     mac: [u8; 6],
     first_trans: bool,
-    // napi队列，用于存放在中断关闭期间通过轮询收取的buffer
-    // the napi queue is designed to save buffer/packet when the interrupt is close
-    // NOTE: this feature is not completely implemented and not used in the current version
-    napi_buffers: Vec<E1000EBuffer>,
-    napi_buffer_head: usize,
-    napi_buffer_tail: usize,
-    napi_buffer_empty: bool,
+    // 收/发包队列的软件尾指针，以及上一次写入RDT/TDT寄存器的值
+    // 轮询期间只移动软件尾指针，由e1000e_flush一次性写入寄存器
+    // software tail of the rings, written to RDT/TDT in batches by e1000e_flush
+    recv_tail: usize,
+    recv_doorbell: usize,
+    trans_tail: usize,
+    trans_doorbell: usize,
+    napi: Arc<NapiStruct>,
+}
+
+/// e1000e收包中断的开关，只访问中断控制寄存器，不需要获取设备的锁
+struct E1000EIrq {
+    interrupt_regs: NonNull<InterruptRegs>,
+}
+
+unsafe impl Send for E1000EIrq {}
+unsafe impl Sync for E1000EIrq {}
+
+impl NapiIrq for E1000EIrq {
+    fn napi_irq_disable(&self) {
+        unsafe {
+            volwrite!(self.interrupt_regs, imc, E1000E_NAPI_IRQ_MASK);
+            // 向ICR寄存器中的某一bit写入1b表示该中断已经被接收，同时会清空该位
+            // write 1b to any bit in ICR will clear the bit
+            let icr = volread!(self.interrupt_regs, icr);
+            volwrite!(self.interrupt_regs, icr, icr);
+        }
+    }
+
+    fn napi_irq_enable(&self) {
+        unsafe { volwrite!(self.interrupt_regs, ims, E1000E_NAPI_IRQ_MASK) };
+    }
 }
 
 impl E1000EDevice {
@@ -233,7 +256,7 @@ impl E1000EDevice {
                 0,
                 "E1000E_RECV_IRQ".to_string(),
                 &DefaultNetIrqHandler,
-                device_id,
+                device_id.clone(),
             ),
             irq_specific_message: IrqSpecificMsg::msi_default(),
         };
@@ -404,6 +427,8 @@ impl E1000EDevice {
             ims = E1000E_IMS_LSC | E1000E_IMS_RXT0 | E1000E_IMS_RXDMT0 | E1000E_IMS_OTHER;
             volwrite!(interrupt_regs, ims, ims);
         }
+        let napi = NapiStruct::new(Arc::new(E1000EIrq { interrupt_regs }), NAPI_POLL_WEIGHT);
+        napi_register(device_id, napi.clone());
         return Ok(E1000EDevice {
             general_regs,
             interrupt_regs,
@@ -420,137 +445,102 @@ impl E1000EDevice {
             trans_buffers,
             mac,
             first_trans: true,
-            napi_buffers: vec![E1000EBuffer::new(0); E1000E_RECV_NAPI],
-            napi_buffer_head: 0,
-            napi_buffer_tail: 0,
-            napi_buffer_empty: true,
+            recv_tail: recv_ring_length - 1,
+            recv_doorbell: recv_ring_length - 1,
+            trans_tail: 0,
+            trans_doorbell: 0,
+            napi,
         });
     }
+
+    pub fn napi(&self) -> Arc<NapiStruct> {
+        return self.napi.clone();
+    }
+
+    // 取出一个收到的分组。只移动软件尾指针，在下一次e1000e_flush之前网卡不会覆盖返回的buffer
+    // Take a received packet. The buffer is not handed back to the device until the next e1000e_flush
     pub fn e1000e_receive(&mut self) -> Option<E1000EBuffer> {
-        self.e1000e_intr();
-        let mut rdt = unsafe { volread!(self.receive_regs, rdt0) } as usize;
-        let index = (rdt + 1) % self.recv_desc_ring.len();
+        let index = (self.recv_tail + 1) % self.recv_desc_ring.len();
         let desc = &mut self.recv_desc_ring[index];
         if (desc.status & E1000E_RXD_STATUS_DD) == 0 {
             return None;
         }
         let mut buffer = self.recv_buffers[index];
-        let new_buffer = E1000EBuffer::new(PAGE_SIZE);
-        self.recv_buffers[index] = new_buffer;
-        desc.addr = new_buffer.as_paddr() as u64;
         buffer.set_length(desc.len as usize);
-        rdt = index;
-        unsafe { volwrite!(self.receive_regs, rdt0, rdt as u32) };
-        // debug!("e1000e: receive packet");
+        desc.status = 0;
+        self.recv_tail = index;
         return Some(buffer);
     }
 
-    pub fn e1000e_can_transmit(&self) -> bool {
-        let tdt = unsafe { volread!(self.transimit_regs, tdt0) } as usize;
-        let index = tdt % self.trans_desc_ring.len();
-        let desc = &self.trans_desc_ring[index];
-        if (desc.status & E1000E_TXD_STATUS_DD) == 0 {
-            return false;
+    // 网卡的接收队列中是否还有没有取出的分组
+    // whether there is packet remains in the device buffer
+    pub fn e1000e_rx_pending(&self) -> bool {
+        let index = (self.recv_tail + 1) % self.recv_desc_ring.len();
+        return (self.recv_desc_ring[index].status & E1000E_RXD_STATUS_DD) != 0;
+    }
+
+    // 发送队列尾部是否有空闲的descriptor。队列中始终保留一个空闲的descriptor，
+    // 否则TDT追上TDH之后，网卡会把整个队列当作空队列，已经填写的分组永远不会被发送。
+    // 队列因为还没有写入TDT的descriptor而满时，立即写入TDT，让网卡开始发送
+    // Whether a descriptor is free at the tail of the transmit ring. One descriptor is always kept free,
+    // otherwise TDT would catch up with TDH and the device would see the full ring as empty.
+    // If the ring is full of descriptors not yet handed to the device, write TDT right away
+    pub fn e1000e_can_transmit(&mut self) -> bool {
+        let len = self.trans_desc_ring.len();
+        let next = (self.trans_tail + 1) % len;
+        if (self.trans_desc_ring[self.trans_tail].status & E1000E_TXD_STATUS_DD) != 0
+            && (self.trans_desc_ring[next].status & E1000E_TXD_STATUS_DD) != 0
+        {
+            return true;
         }
-        true
+        if self.trans_tail != self.trans_doorbell {
+            compiler_fence(Ordering::Release);
+            unsafe { volwrite!(self.transimit_regs, tdt0, self.trans_tail as u32) };
+            self.trans_doorbell = self.trans_tail;
+        }
+        return false;
     }
 
-    pub fn e1000e_transmit(&mut self, packet: E1000EBuffer) {
-        let mut tdt = unsafe { volread!(self.transimit_regs, tdt0) } as usize;
-        let index = tdt % self.trans_desc_ring.len();
-        let desc = &mut self.trans_desc_ring[index];
-        let buffer = self.trans_buffers[index];
-        self.trans_buffers[index] = packet;
-        // recycle unused transmit buffer
-        buffer.free_buffer();
+    // 在发送队列尾部的buffer中构造分组并填写descriptor，TDT寄存器由e1000e_flush统一写入。
+    // 调用之前必须检查e1000e_can_transmit
+    // Build the packet in the buffer at the tail of the transmit ring. TDT is written by e1000e_flush.
+    // The caller must check e1000e_can_transmit first
+    pub fn e1000e_transmit<R, F>(&mut self, len: usize, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        assert!(len <= PAGE_SIZE);
+        let index = self.trans_tail;
+        let mut buffer = self.trans_buffers[index];
+        buffer.set_length(len);
+        let result = f(buffer.as_mut_slice());
         // Set the transmit descriptor
-        desc.addr = packet.as_paddr() as u64;
-        desc.len = packet.len() as u16;
+        let desc = &mut self.trans_desc_ring[index];
+        desc.addr = buffer.as_paddr() as u64;
+        desc.len = len as u16;
         desc.status = 0;
         desc.cmd = E1000E_TXD_CMD_EOP | E1000E_TXD_CMD_RS | E1000E_TXD_CMD_IFCS;
-        tdt = (tdt + 1) % self.trans_desc_ring.len();
-        unsafe { volwrite!(self.transimit_regs, tdt0, tdt as u32) };
+        self.trans_tail = (index + 1) % self.trans_desc_ring.len();
         self.first_trans = false;
-    }
-    pub fn mac_address(&self) -> [u8; 6] {
-        return self.mac;
-    }
-    // 向ICR寄存器中的某一bit写入1b表示该中断已经被接收，同时会清空该位
-    // we need to clear ICR to tell e1000e we have read the interrupt
-    pub fn e1000e_intr(&mut self) {
-        let icr = unsafe { volread!(self.interrupt_regs, icr) };
-        // write 1b to any bit in ICR will clear the bit
-        unsafe { volwrite!(self.interrupt_regs, icr, icr) };
+        return result;
     }
 
-    // 切换是否接受分组到达的中断
-    // change whether the receive timer interrupt is enabled
-    // Note: this method is not completely implemented and not used in the current version
-    #[allow(dead_code)]
-    pub fn e1000e_intr_set(&mut self, state: bool) {
-        let mut ims = unsafe { volread!(self.interrupt_regs, ims) };
-        match state {
-            true => ims |= E1000E_IMS_RXT0,
-            false => ims &= !E1000E_IMS_RXT0,
+    // 把轮询期间回收的接收descriptor和新填写的发送descriptor一次性交给网卡
+    // Hand the recycled receive descriptors and the queued transmit descriptors to the device at once
+    pub fn e1000e_flush(&mut self) {
+        compiler_fence(Ordering::Release);
+        if self.recv_tail != self.recv_doorbell {
+            unsafe { volwrite!(self.receive_regs, rdt0, self.recv_tail as u32) };
+            self.recv_doorbell = self.recv_tail;
         }
-        unsafe { volwrite!(self.interrupt_regs, ims, ims) };
-    }
-
-    // 实现了一部分napi机制的收包函数, 现在还没有投入使用
-    // This method is a partial implementation of napi (New API) techniques
-    // Note: this method is not completely implemented and not used in the current version
-    #[allow(dead_code)]
-    pub fn e1000e_receive2(&mut self) -> Option<E1000EBuffer> {
-        // 向设备表明我们已经接受到了之前的中断
-        // Tell e1000e we have received the interrupt
-        self.e1000e_intr();
-        // 如果napi队列不存在已经收到的分组...
-        // if napi queue is empty...
-        if self.napi_buffer_empty {
-            // 暂时关闭设备中断
-            // close interrupt
-            self.e1000e_intr_set(false);
-            loop {
-                if self.napi_buffer_tail == self.napi_buffer_head && !self.napi_buffer_empty {
-                    // napi缓冲队列已满，停止收包
-                    // napi queue is full, stop
-                    break;
-                }
-                match self.e1000e_receive() {
-                    Some(buffer) => {
-                        self.napi_buffers[self.napi_buffer_tail] = buffer;
-                        self.napi_buffer_tail = (self.napi_buffer_tail + 1) % E1000E_RECV_NAPI;
-                        self.napi_buffer_empty = false;
-                    }
-                    None => {
-                        // 设备队列中没有剩余的已到达的数据包
-                        // no packet remains in the device buffer
-                        break;
-                    }
-                };
-            }
-            // 重新打开设备中断
-            // open the interrupt
-            self.e1000e_intr_set(true);
+        if self.trans_tail != self.trans_doorbell {
+            unsafe { volwrite!(self.transimit_regs, tdt0, self.trans_tail as u32) };
+            self.trans_doorbell = self.trans_tail;
         }
+    }
 
-        let result = self.napi_buffers[self.napi_buffer_head];
-        match result.len() {
-            0 => {
-                // napi队列和网卡队列中都不存在数据包
-                // both napi queue and device buffer is empty, no packet will receive
-                return None;
-            }
-            _ => {
-                // 有剩余的已到达的数据包
-                // there is packet in napi queue
-                self.napi_buffer_head = (self.napi_buffer_head + 1) % E1000E_RECV_NAPI;
-                if self.napi_buffer_head == self.napi_buffer_tail {
-                    self.napi_buffer_empty = true;
-                }
-                return Some(result);
-            }
-        }
+    pub fn mac_address(&self) -> [u8; 6] {
+        return self.mac;
     }
 }
 
@@ -750,6 +740,8 @@ const E1000E_IMS_OTHER: u32 = 1 << 24; // qemu use this bit to set msi-x interru
 
 // IMC
 const E1000E_IMC_CLEAR: u32 = 0xffffffff;
+// NAPI轮询期间屏蔽的收包中断
+const E1000E_NAPI_IRQ_MASK: u32 = E1000E_IMS_RXT0 | E1000E_IMS_RXDMT0;
 
 // RCTL
 const E1000E_RCTL_EN: u32 = 1 << 1;
@@ -8,13 +8,20 @@ use crate::{
             device::{bus::Bus, driver::Driver, Device, DeviceCommonData, DeviceType, IdTable},
             kobject::{KObjType, KObject, KObjectCommonData, KObjectState, LockedKObjectState},
         },
-        net::{register_netdevice, NetDeivceState, NetDevice, NetDeviceCommonData, Operstate},
+        net::{
+            napi::{NapiDevice, NapiStruct, NAPI_POLL_WEIGHT},
+            register_netdevice, NetDeivceState, NetDevice, NetDeviceCommonData, Operstate,
+        },
     },
     libs::{
         rwlock::{RwLockReadGuard, RwLockWriteGuard},
         spinlock::{SpinLock, SpinLockGuard},
     },
-    net::{generate_iface_id, NET_DEVICES},
+    net::{
+        generate_iface_id,
+        socket::shard::{PollScope, ShardedDevice},
+        NET_DEVICES,
+    },
     time::Instant,
 };
 use alloc::{
@@ -37,9 +44,10 @@ use super::e1000e::{E1000EBuffer, E1000EDevice};
 
 const DEVICE_NAME: &str = "e1000e";
 
+/// 收到的数据帧直接引用接收队列中的buffer，在下一次`e1000e_flush`之前不会被网卡覆盖
 pub struct E1000ERxToken(E1000EBuffer);
-pub struct E1000ETxToken {
-    driver: E1000EDriver,
+pub struct E1000ETxToken<'a> {
+    device: &'a SpinLock<E1000EDevice>,
 }
 pub struct E1000EDriver {
     pub inner: Arc<SpinLock<E1000EDevice>>,
@@ -84,6 +92,7 @@ pub struct E1000EInterface {
     driver: E1000EDriverWrapper,
     iface_id: usize,
     iface: SpinLock<smoltcp::iface::Interface>,
+    napi: Arc<NapiStruct>,
     name: String,
     inner: SpinLock<InnerE1000EInterface>,
     locked_kobj_state: LockedKObjectState,
@@ -101,23 +110,21 @@ impl phy::RxToken for E1000ERxToken {
     where
         F: FnOnce(&mut [u8]) -> R,
     {
-        let result = f(self.0.as_mut_slice());
-        self.0.free_buffer();
-        return result;
+        return f(self.0.as_mut_slice());
     }
 }
 
-impl phy::TxToken for E1000ETxToken {
-    fn consume<R, F>(self, _len: usize, f: F) -> R
+impl<'a> phy::TxToken for E1000ETxToken<'a> {
+    fn consume<R, F>(self, len: usize, f: F) -> R
     where
         F: FnOnce(&mut [u8]) -> R,
     {
-        let mut buffer = E1000EBuffer::new(4096);
-        let result = f(buffer.as_mut_slice());
-        let mut device = self.driver.inner.lock();
-        device.e1000e_transmit(buffer);
-        buffer.free_buffer();
-        return result;
+        let mut device = self.device.lock();
+        // 收包时得到的发送令牌没有检查发送队列，队列已满时丢弃回复的分组，由对端重传
+        if !device.e1000e_can_transmit() {
+            return f(vec![0; len].as_mut_slice());
+        }
+        return device.e1000e_transmit(len, f);
     }
 }
 
@@ -146,29 +153,25 @@ impl Clone for E1000EDriver {
 
 impl phy::Device for E1000EDriver {
     type RxToken<'a> = E1000ERxToken;
-    type TxToken<'a> = E1000ETxToken;
+    type TxToken<'a> = E1000ETxToken<'a>;
 
     fn receive(
         &mut self,
         _timestamp: smoltcp::time::Instant,
     ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
-        match self.inner.lock().e1000e_receive() {
-            Some(buffer) => Some((
-                E1000ERxToken(buffer),
-                E1000ETxToken {
-                    driver: self.clone(),
-                },
-            )),
-            None => {
-                return None;
-            }
-        }
+        let buffer = self.inner.lock().e1000e_receive()?;
+        return Some((
+            E1000ERxToken(buffer),
+            E1000ETxToken {
+                device: &self.inner,
+            },
+        ));
     }
 
     fn transmit(&mut self, _timestamp: smoltcp::time::Instant) -> Option<Self::TxToken<'_>> {
         match self.inner.lock().e1000e_can_transmit() {
             true => Some(E1000ETxToken {
-                driver: self.clone(),
+                device: &self.inner,
             }),
             false => None,
         }
@@ -185,11 +188,24 @@ impl phy::Device for E1000EDriver {
            The network device is unable to send or receive bursts large than the value returned by this function.
            If None, there is no fixed limit on burst size, e.g. if network buffers are dynamically allocated.
         */
-        caps.max_burst_size = Some(1);
+        caps.max_burst_size = Some(NAPI_POLL_WEIGHT);
         return caps;
     }
 }
 
+// 接收缓冲区属于接收环，取出数据帧之后要立即归还，使用默认的实现
+impl ShardedDevice for E1000EDriver {}
+
+impl NapiDevice for E1000EDriver {
+    fn napi_rx_pending(&mut self) -> bool {
+        return self.inner.lock().e1000e_rx_pending();
+    }
+
+    fn napi_flush(&mut self) {
+        self.inner.lock().e1000e_flush();
+    }
+}
+
 impl E1000EInterface {
     pub fn new(mut driver: E1000EDriver) -> Arc<Self> {
         let iface_id = generate_iface_id();
@@ -200,12 +216,14 @@ impl E1000EInterface {
 
         let iface =
             smoltcp::iface::Interface::new(iface_config, &mut driver, Instant::now().into());
+        let napi = driver.inner.lock().napi();
 
         let driver: E1000EDriverWrapper = E1000EDriverWrapper(UnsafeCell::new(driver));
         let result = Arc::new(E1000EInterface {
             driver,
             iface_id,
             iface: SpinLock::new(iface),
+            napi,
             name: format!("eth{}", iface_id),
             inner: SpinLock::new(InnerE1000EInterface {
                 netdevice_common: NetDeviceCommonData::default(),
@@ -335,14 +353,13 @@ impl NetDevice for E1000EInterface {
         return Ok(());
     }
 
-    fn poll(&self, sockets: &mut smoltcp::iface::SocketSet) -> Result<(), SystemError> {
-        let timestamp: smoltcp::time::Instant = Instant::now().into();
-        let mut guard = self.iface.lock();
-        let poll_res = guard.poll(timestamp, self.driver.force_get_mut(), sockets);
-        if poll_res {
-            return Ok(());
-        }
-        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    fn poll(&self, scope: PollScope) -> Result<(), SystemError> {
+        return self.napi.poll(
+            self.iface_id,
+            &self.iface,
+            self.driver.force_get_mut(),
+            scope,
+        );
     }
 
     #[inline(always)]
@@ -2,15 +2,20 @@ use alloc::sync::Arc;
 use system_error::SystemError;
 
 use crate::{
+    driver::base::device::DeviceId,
     exception::{
         irqdata::IrqHandlerData,
         irqdesc::{IrqHandler, IrqReturn},
         IrqNumber,
     },
-    net::net_core::poll_ifaces_try_lock_onetime,
+    net::net_core::net_raise_rx,
 };
 
+use super::napi::napi_lookup;
+
 /// 默认的网卡中断处理函数
+///
+/// 网卡登记了NAPI状态时，屏蔽网卡的收包中断并调度轮询，否则直接调度NET_RX软中断
 #[derive(Debug)]
 pub struct DefaultNetIrqHandler;
 
@@ -19,9 +24,15 @@ impl IrqHandler for DefaultNetIrqHandler {
         &self,
         _irq: IrqNumber,
         _static_data: Option<&dyn IrqHandlerData>,
-        _dynamic_data: Option<Arc<dyn IrqHandlerData>>,
+        dev_id: Option<Arc<dyn IrqHandlerData>>,
     ) -> Result<IrqReturn, SystemError> {
-        poll_ifaces_try_lock_onetime().ok();
+        let napi = dev_id
+            .and_then(|dev_id| dev_id.arc_any().downcast::<DeviceId>().ok())
+            .and_then(|dev_id| napi_lookup(&dev_id));
+        match napi {
+            Some(napi) => napi.schedule(),
+            None => net_raise_rx(),
+        }
         Ok(IrqReturn::Handled)
     }
 }
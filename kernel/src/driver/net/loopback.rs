@@ -11,7 +11,11 @@ use crate::filesystem::kernfs::KernFSInode;
 use crate::init::initcall::INITCALL_DEVICE;
 use crate::libs::rwlock::{RwLockReadGuard, RwLockWriteGuard};
 use crate::libs::spinlock::{SpinLock, SpinLockGuard};
-use crate::net::{generate_iface_id, NET_DEVICES};
+use crate::net::{
+    generate_iface_id,
+    socket::shard::{poll_iface, PollScope, RxFrame, ShardedDevice},
+    NET_DEVICES,
+};
 use crate::time::Instant;
 use alloc::collections::VecDeque;
 use alloc::fmt::Debug;
@@ -185,6 +189,21 @@ impl Clone for LoopbackDriver {
     }
 }
 
+impl ShardedDevice for LoopbackDriver {
+    /// 环回的数据帧本来就存放在单独分配的缓冲区中，直接交出缓冲区
+    fn receive_frame<F>(&mut self, _timestamp: smoltcp::time::Instant, f: F) -> bool
+    where
+        F: FnOnce(RxFrame),
+    {
+        let buffer = self.inner.lock().loopback_receive();
+        if buffer.is_empty() {
+            return false;
+        }
+        f(RxFrame::Owned(buffer));
+        return true;
+    }
+}
+
 impl phy::Device for LoopbackDriver {
     type RxToken<'a> = LoopbackRxToken where Self: 'a;
     type TxToken<'a> = LoopbackTxToken where Self: 'a;
@@ -489,16 +508,18 @@ impl NetDevice for LoopbackInterface {
     ///
     /// ## 参数
     /// - `&self` ：自身引用
-    /// - `sockets` ：一个可变引用到 `smoltcp::iface::SocketSet`，表示要轮询的套接字集
+    /// - `scope` ：要处理的socket分片
     ///
     /// ## 返回值
     /// - 如果轮询成功，返回 `Ok(())`
     /// - 如果轮询失败，返回 `Err(SystemError::EAGAIN_OR_EWOULDBLOCK)`，表示需要再次尝试或者操作会阻塞
-    fn poll(&self, sockets: &mut smoltcp::iface::SocketSet) -> Result<(), SystemError> {
-        let timestamp: smoltcp::time::Instant = Instant::now().into();
-        let mut guard = self.iface.lock();
-        let poll_res = guard.poll(timestamp, self.driver.force_get_mut(), sockets);
-        if poll_res {
+    fn poll(&self, scope: PollScope) -> Result<(), SystemError> {
+        if poll_iface(
+            self.iface_id,
+            &self.iface,
+            self.driver.force_get_mut(),
+            scope,
+        ) {
             return Ok(());
         }
         return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
@@ -1,12 +1,9 @@
 use alloc::{string::String, sync::Arc};
-use smoltcp::{
-    iface,
-    wire::{self, EthernetAddress},
-};
+use smoltcp::wire::{self, EthernetAddress};
 use sysfs::netdev_register_kobject;
 
 use super::base::device::Device;
-use crate::libs::spinlock::SpinLock;
+use crate::{libs::spinlock::SpinLock, net::socket::shard::PollScope};
 use system_error::SystemError;
 
 pub mod class;
@@ -14,6 +11,7 @@ mod dma;
 pub mod e1000e;
 pub mod irq_handle;
 pub mod loopback;
+pub mod napi;
 pub mod sysfs;
 pub mod virtio_net;
 
@@ -61,7 +59,13 @@ pub trait NetDevice: Device {
     /// @brief 获取网卡的id
     fn nic_id(&self) -> usize;
 
-    fn poll(&self, sockets: &mut iface::SocketSet) -> Result<(), SystemError>;
+    /// @brief 轮询网卡，处理收到的数据帧和socket上待发送的数据
+    ///
+    /// 收到的数据帧按照四元组分发到各个socket分片处理，见`net::socket::shard::poll_iface`
+    ///
+    /// ## 参数
+    /// - `scope`：要处理的socket分片
+    fn poll(&self, scope: PollScope) -> Result<(), SystemError>;
 
     fn update_ip_addrs(&self, ip_addrs: &[wire::IpCidr]) -> Result<(), SystemError>;
 
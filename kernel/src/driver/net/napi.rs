@@ -0,0 +1,146 @@
+//! # NAPI
+//!
+//! 网卡中断到来时只屏蔽网卡的收包中断并调度NET_RX软中断，收发包全部在软中断中按照预算批量完成：
+//! - 一次轮询最多从网卡取出`weight`个数据帧，还有剩余时保持中断屏蔽，再次调度软中断
+//! - 轮询期间驱动只把发送描述符和回收的接收缓冲区放进队列，轮询结束时由`NapiDevice::napi_flush`一次性通知网卡
+//! - 网卡上的数据帧收完之后才重新打开中断
+
+use core::sync::atomic::{AtomicBool, Ordering};
+
+use alloc::sync::Arc;
+use hashbrown::HashMap;
+use smoltcp::iface::Interface;
+use system_error::SystemError;
+
+use crate::{
+    driver::base::device::DeviceId,
+    libs::{rwlock::RwLock, spinlock::SpinLock},
+    net::{
+        net_core::net_raise_rx,
+        socket::shard::{poll_iface_budget, PollScope, ShardedDevice, NET_RX_BUDGET},
+    },
+};
+
+/// 一次NAPI轮询默认最多从网卡取出的数据帧数
+pub const NAPI_POLL_WEIGHT: usize = NET_RX_BUDGET;
+
+lazy_static! {
+    /// 使用`DefaultNetIrqHandler`的网卡的NAPI状态，按照中断的设备id索引
+    static ref NAPI_TABLE: RwLock<HashMap<Arc<DeviceId>, Arc<NapiStruct>>> =
+        RwLock::new(HashMap::new());
+}
+
+/// 网卡收包中断的开关，会在中断上下文中被调用，不能等待驱动自己的锁
+pub trait NapiIrq: Send + Sync {
+    /// 屏蔽网卡的收包中断
+    fn napi_irq_disable(&self);
+
+    /// 重新打开网卡的收包中断
+    fn napi_irq_enable(&self);
+}
+
+/// 支持NAPI的网卡的smoltcp设备需要实现的操作，只会在持有网卡接口的锁时被调用
+pub trait NapiDevice: ShardedDevice {
+    /// 网卡上是否还有没有取出的数据帧
+    fn napi_rx_pending(&mut self) -> bool;
+
+    /// 把轮询期间攒下的发送描述符和回收的接收缓冲区一次性交给网卡
+    fn napi_flush(&mut self);
+}
+
+/// 一个网卡的NAPI状态
+pub struct NapiStruct {
+    /// 网卡的中断已经被屏蔽，正在等待软中断轮询
+    scheduled: AtomicBool,
+    /// 一次轮询最多取出的数据帧数
+    weight: usize,
+    irq: Arc<dyn NapiIrq>,
+}
+
+impl core::fmt::Debug for NapiStruct {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("NapiStruct")
+            .field("scheduled", &self.scheduled)
+            .field("weight", &self.weight)
+            .finish()
+    }
+}
+
+impl NapiStruct {
+    pub fn new(irq: Arc<dyn NapiIrq>, weight: usize) -> Arc<Self> {
+        return Arc::new(Self {
+            scheduled: AtomicBool::new(false),
+            weight,
+            irq,
+        });
+    }
+
+    /// ## 在网卡的中断处理函数中调用：屏蔽网卡的收包中断，并调度NET_RX软中断
+    pub fn schedule(&self) {
+        if self.scheduled.swap(true, Ordering::AcqRel) {
+            return;
+        }
+        self.irq.napi_irq_disable();
+        net_raise_rx();
+    }
+
+    /// ## 在NET_RX软中断中轮询网卡
+    ///
+    /// ## 参数
+    /// - `nic_id`：网卡的id
+    /// - `iface`：网卡的smoltcp接口
+    /// - `device`：网卡的smoltcp设备，只能在持有`iface`的锁时访问
+    /// - `scope`：要处理的socket分片
+    ///
+    /// ## 返回值
+    /// - `Ok(())`：有socket的状态可能发生了变化
+    /// - `Err(SystemError::EAGAIN_OR_EWOULDBLOCK)`：没有任何变化
+    pub fn poll<D: NapiDevice + ?Sized>(
+        &self,
+        nic_id: usize,
+        iface: &SpinLock<Interface>,
+        device: &mut D,
+        scope: PollScope,
+    ) -> Result<(), SystemError> {
+        let changed = poll_iface_budget(nic_id, iface, device, self.weight, scope);
+
+        let guard = iface.lock_irqsave();
+        device.napi_flush();
+        if self.scheduled.load(Ordering::Acquire) {
+            if device.napi_rx_pending() {
+                // 预算用完了，保持中断屏蔽，让出CPU后继续轮询
+                net_raise_rx();
+            } else {
+                self.complete(device);
+            }
+        }
+        drop(guard);
+
+        if changed {
+            return Ok(());
+        }
+        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    }
+
+    /// 轮询结束，重新打开网卡的中断
+    fn complete<D: NapiDevice + ?Sized>(&self, device: &mut D) {
+        if !self.scheduled.swap(false, Ordering::AcqRel) {
+            return;
+        }
+        self.irq.napi_irq_enable();
+        // 在屏蔽中断期间到达、还没有被取出的数据帧不会再触发中断
+        if device.napi_rx_pending() {
+            self.schedule();
+        }
+    }
+}
+
+/// 登记使用`DefaultNetIrqHandler`的网卡的NAPI状态
+pub fn napi_register(dev_id: Arc<DeviceId>, napi: Arc<NapiStruct>) {
+    NAPI_TABLE.write_irqsave().insert(dev_id, napi);
+}
+
+/// 根据中断的设备id查找网卡的NAPI状态
+pub fn napi_lookup(dev_id: &Arc<DeviceId>) -> Option<Arc<NapiStruct>> {
+    NAPI_TABLE.read_irqsave().get(dev_id).cloned()
+}
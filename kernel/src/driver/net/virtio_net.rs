@@ -14,9 +14,12 @@ use alloc::{
 use log::{debug, error};
 use smoltcp::{iface, phy, wire};
 use unified_init::macros::unified_init;
-use virtio_drivers::device::net::VirtIONet;
+use virtio_drivers::device::net::{RxBuffer, VirtIONet};
 
-use super::{NetDeivceState, NetDevice, NetDeviceCommonData, Operstate};
+use super::{
+    napi::{NapiDevice, NapiIrq, NapiStruct, NAPI_POLL_WEIGHT},
+    NetDeivceState, NetDevice, NetDeviceCommonData, Operstate,
+};
 use crate::{
     arch::rand::rand,
     driver::{
@@ -47,7 +50,11 @@ use crate::{
         rwlock::{RwLockReadGuard, RwLockWriteGuard},
         spinlock::{SpinLock, SpinLockGuard},
     },
-    net::{generate_iface_id, net_core::poll_ifaces_try_lock_onetime, NET_DEVICES},
+    net::{
+        generate_iface_id,
+        socket::shard::{PollScope, ShardedDevice},
+        NET_DEVICES,
+    },
     time::Instant,
 };
 use system_error::SystemError;
@@ -55,6 +62,12 @@ use system_error::SystemError;
 static mut VIRTIO_NET_DRIVER: Option<Arc<VirtIONetDriver>> = None;
 
 const VIRTIO_NET_BASENAME: &str = "virtio_net";
+/// 收发队列的长度
+const VIRTIO_NET_QUEUE_SIZE: usize = 64;
+/// 攒够这么多个已经处理完的接收缓冲区后，在一次加锁中把它们还给设备
+const VIRTIO_NET_RECYCLE_BATCH: usize = 16;
+
+type VirtIONetDev = VirtIONet<HalImpl, VirtIOTransport, VIRTIO_NET_QUEUE_SIZE>;
 
 #[inline(always)]
 #[allow(dead_code)]
@@ -68,6 +81,7 @@ fn virtio_net_driver() -> Arc<VirtIONetDriver> {
 #[cast_to([sync] Device)]
 pub struct VirtIONetDevice {
     dev_id: Arc<DeviceId>,
+    napi: Arc<NapiStruct>,
     inner: SpinLock<InnerVirtIONetDevice>,
     locked_kobj_state: LockedKObjectState,
 }
@@ -91,20 +105,26 @@ impl Debug for InnerVirtIONetDevice {
 
 impl VirtIONetDevice {
     pub fn new(transport: VirtIOTransport, dev_id: Arc<DeviceId>) -> Option<Arc<Self>> {
-        let driver_net: VirtIONet<HalImpl, VirtIOTransport, 2> =
-            match VirtIONet::<HalImpl, VirtIOTransport, 2>::new(transport, 4096) {
-                Ok(net) => net,
-                Err(_) => {
-                    error!("VirtIONet init failed");
-                    return None;
-                }
-            };
+        let driver_net = match VirtIONetDev::new(transport, 4096) {
+            Ok(net) => net,
+            Err(_) => {
+                error!("VirtIONet init failed");
+                return None;
+            }
+        };
         let mac = wire::EthernetAddress::from_bytes(&driver_net.mac_address());
         debug!("VirtIONetDevice mac: {:?}", mac);
         let device_inner = VirtIONicDeviceInner::new(driver_net);
+        let napi = NapiStruct::new(
+            Arc::new(VirtIONetIrq {
+                inner: device_inner.inner.clone(),
+            }),
+            NAPI_POLL_WEIGHT,
+        );
 
         let dev = Arc::new(Self {
             dev_id,
+            napi,
             inner: SpinLock::new(InnerVirtIONetDevice {
                 device_inner,
                 name: None,
@@ -253,7 +273,7 @@ impl Device for VirtIONetDevice {
 
 impl VirtIODevice for VirtIONetDevice {
     fn handle_irq(&self, _irq: IrqNumber) -> Result<IrqReturn, SystemError> {
-        poll_ifaces_try_lock_onetime().ok();
+        self.napi.schedule();
         return Ok(IrqReturn::Handled);
     }
 
@@ -294,17 +314,17 @@ impl VirtIODevice for VirtIONetDevice {
 }
 
 pub struct VirtIoNetImpl {
-    inner: VirtIONet<HalImpl, VirtIOTransport, 2>,
+    inner: VirtIONetDev,
 }
 
 impl VirtIoNetImpl {
-    const fn new(inner: VirtIONet<HalImpl, VirtIOTransport, 2>) -> Self {
+    const fn new(inner: VirtIONetDev) -> Self {
         Self { inner }
     }
 }
 
 impl Deref for VirtIoNetImpl {
-    type Target = VirtIONet<HalImpl, VirtIOTransport, 2>;
+    type Target = VirtIONetDev;
     fn deref(&self) -> &Self::Target {
         &self.inner
     }
@@ -319,6 +339,25 @@ impl DerefMut for VirtIoNetImpl {
 unsafe impl Send for VirtIoNetImpl {}
 unsafe impl Sync for VirtIoNetImpl {}
 
+/// virtio-net收包中断的开关
+///
+/// 中断上下文中拿不到设备的锁时不屏蔽中断：此时有其他CPU正在访问设备，只是多收到几次中断
+struct VirtIONetIrq {
+    inner: Arc<SpinLock<VirtIoNetImpl>>,
+}
+
+impl NapiIrq for VirtIONetIrq {
+    fn napi_irq_disable(&self) {
+        if let Ok(mut driver_net) = self.inner.try_lock_irqsave() {
+            driver_net.disable_interrupts();
+        }
+    }
+
+    fn napi_irq_enable(&self) {
+        self.inner.lock_irqsave().enable_interrupts();
+    }
+}
+
 #[derive(Debug)]
 struct VirtIONicDeviceInnerWrapper(UnsafeCell<VirtIONicDeviceInner>);
 unsafe impl Send for VirtIONicDeviceInnerWrapper {}
@@ -346,12 +385,16 @@ impl VirtIONicDeviceInnerWrapper {
 /// Virtio网络设备驱动(加锁)
 pub struct VirtIONicDeviceInner {
     pub inner: Arc<SpinLock<VirtIoNetImpl>>,
+    /// 已经处理完、等待批量还给设备的接收缓冲区
+    rx_recycle: Vec<RxBuffer>,
 }
 
 impl Clone for VirtIONicDeviceInner {
     fn clone(&self) -> Self {
+        // 待回收的接收缓冲区属于轮询网卡的那一个实例，不跟着复制
         return VirtIONicDeviceInner {
             inner: self.inner.clone(),
+            rx_recycle: Vec::new(),
         };
     }
 }
@@ -366,6 +409,7 @@ impl Debug for VirtIONicDeviceInner {
 #[cast_to([sync] Device)]
 pub struct VirtioInterface {
     device_inner: VirtIONicDeviceInnerWrapper,
+    napi: Arc<NapiStruct>,
     iface_id: usize,
     iface_name: String,
     iface: SpinLock<iface::Interface>,
@@ -392,7 +436,7 @@ impl core::fmt::Debug for VirtioInterface {
 }
 
 impl VirtioInterface {
-    pub fn new(mut device_inner: VirtIONicDeviceInner) -> Arc<Self> {
+    pub fn new(mut device_inner: VirtIONicDeviceInner, napi: Arc<NapiStruct>) -> Arc<Self> {
         let iface_id = generate_iface_id();
         let mut iface_config = iface::Config::new(wire::HardwareAddress::Ethernet(
             wire::EthernetAddress(device_inner.inner.lock().mac_address()),
@@ -403,6 +447,7 @@ impl VirtioInterface {
 
         let result = Arc::new(VirtioInterface {
             device_inner: VirtIONicDeviceInnerWrapper(UnsafeCell::new(device_inner)),
+            napi,
             iface_id,
             locked_kobj_state: LockedKObjectState::default(),
             iface: SpinLock::new(iface),
@@ -505,7 +550,7 @@ impl Device for VirtioInterface {
 }
 
 impl VirtIONicDeviceInner {
-    pub fn new(driver_net: VirtIONet<HalImpl, VirtIOTransport, 2>) -> Self {
+    pub fn new(driver_net: VirtIONetDev) -> Self {
         let mut iface_config = iface::Config::new(wire::HardwareAddress::Ethernet(
             wire::EthernetAddress(driver_net.mac_address()),
         ));
@@ -513,48 +558,77 @@ impl VirtIONicDeviceInner {
         iface_config.random_seed = rand() as u64;
 
         let inner = Arc::new(SpinLock::new(VirtIoNetImpl::new(driver_net)));
-        let result = VirtIONicDeviceInner { inner };
+        let result = VirtIONicDeviceInner {
+            inner,
+            rx_recycle: Vec::with_capacity(VIRTIO_NET_QUEUE_SIZE),
+        };
         return result;
     }
 }
 
-pub struct VirtioNetToken {
-    driver: VirtIONicDeviceInner,
-    rx_buffer: Option<virtio_drivers::device::net::RxBuffer>,
+/// 发送数据帧时使用的token
+pub struct VirtioNetToken<'a> {
+    driver: &'a SpinLock<VirtIoNetImpl>,
 }
 
-impl VirtioNetToken {
-    pub fn new(
-        driver: VirtIONicDeviceInner,
-        rx_buffer: Option<virtio_drivers::device::net::RxBuffer>,
-    ) -> Self {
-        return Self { driver, rx_buffer };
+/// 收到的数据帧。处理完后缓冲区先放进`rx_recycle`，攒够一批再还给设备
+pub struct VirtioRxToken<'a> {
+    rx_buffer: RxBuffer,
+    rx_recycle: &'a mut Vec<RxBuffer>,
+}
+
+/// 在一次加锁中把攒下的接收缓冲区全部还给设备
+fn recycle_rx_buffers(driver_net: &mut VirtIoNetImpl, rx_recycle: &mut Vec<RxBuffer>) {
+    for rx_buf in rx_recycle.drain(..) {
+        driver_net
+            .recycle_rx_buffer(rx_buf)
+            .expect("virtio_net recv failed");
     }
 }
 
 impl phy::Device for VirtIONicDeviceInner {
-    type RxToken<'a> = VirtioNetToken where Self: 'a;
-    type TxToken<'a> = VirtioNetToken where Self: 'a;
+    type RxToken<'a>
+        = VirtioRxToken<'a>
+    where
+        Self: 'a;
+    type TxToken<'a>
+        = VirtioNetToken<'a>
+    where
+        Self: 'a;
 
     fn receive(
         &mut self,
         _timestamp: smoltcp::time::Instant,
     ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
-        match self.inner.lock().receive() {
-            Ok(buf) => Some((
-                VirtioNetToken::new(self.clone(), Some(buf)),
-                VirtioNetToken::new(self.clone(), None),
-            )),
-            Err(virtio_drivers::Error::NotReady) => None,
-            Err(err) => panic!("VirtIO receive failed: {}", err),
+        let mut driver_net = self.inner.lock_irqsave();
+        if self.rx_recycle.len() >= VIRTIO_NET_RECYCLE_BATCH {
+            recycle_rx_buffers(&mut driver_net, &mut self.rx_recycle);
         }
+        let rx_buffer = match driver_net.receive() {
+            Ok(buf) => buf,
+            Err(virtio_drivers::Error::NotReady) => return None,
+            Err(err) => panic!("VirtIO receive failed: {}", err),
+        };
+        drop(driver_net);
+
+        return Some((
+            VirtioRxToken {
+                rx_buffer,
+                rx_recycle: &mut self.rx_recycle,
+            },
+            VirtioNetToken {
+                driver: &self.inner,
+            },
+        ));
     }
 
     fn transmit(&mut self, _timestamp: smoltcp::time::Instant) -> Option<Self::TxToken<'_>> {
         // debug!("VirtioNet: transmit");
         if self.inner.lock_irqsave().can_send() {
             // debug!("VirtioNet: can send");
-            return Some(VirtioNetToken::new(self.clone(), None));
+            return Some(VirtioNetToken {
+                driver: &self.inner,
+            });
         } else {
             // debug!("VirtioNet: can not send");
             return None;
@@ -570,18 +644,37 @@ impl phy::Device for VirtIONicDeviceInner {
            The network device is unable to send or receive bursts large than the value returned by this function.
            If None, there is no fixed limit on burst size, e.g. if network buffers are dynamically allocated.
         */
-        caps.max_burst_size = Some(1);
+        caps.max_burst_size = Some(NAPI_POLL_WEIGHT);
+        // 没有协商VIRTIO_NET_F_GUEST_CSUM，宿主机不会在virtio_net_hdr中设置DATA_VALID，
+        // 转发自物理链路的数据帧可能带有错误的校验和，收包时仍然由smoltcp校验（默认的Checksum::Both）。
+        // 因此这个网卡不使用GRO，见`gro_supported`
         return caps;
     }
 }
 
-impl phy::TxToken for VirtioNetToken {
+// 接收缓冲区需要回收给virtqueue，使用默认的实现
+impl ShardedDevice for VirtIONicDeviceInner {}
+
+impl NapiDevice for VirtIONicDeviceInner {
+    fn napi_rx_pending(&mut self) -> bool {
+        return self.inner.lock_irqsave().can_recv();
+    }
+
+    fn napi_flush(&mut self) {
+        if self.rx_recycle.is_empty() {
+            return;
+        }
+        recycle_rx_buffers(&mut self.inner.lock_irqsave(), &mut self.rx_recycle);
+    }
+}
+
+impl<'a> phy::TxToken for VirtioNetToken<'a> {
     fn consume<R, F>(self, len: usize, f: F) -> R
     where
         F: FnOnce(&mut [u8]) -> R,
     {
         // // 为了线程安全，这里需要对VirtioNet进行加【写锁】，以保证对设备的互斥访问。
-        let mut driver_net = self.driver.inner.lock();
+        let mut driver_net = self.driver.lock_irqsave();
         let mut tx_buf = driver_net.new_tx_buffer(len);
         let result = f(tx_buf.packet_mut());
         driver_net.send(tx_buf).expect("virtio_net send failed");
@@ -589,19 +682,13 @@ impl phy::TxToken for VirtioNetToken {
     }
 }
 
-impl phy::RxToken for VirtioNetToken {
-    fn consume<R, F>(self, f: F) -> R
+impl<'a> phy::RxToken for VirtioRxToken<'a> {
+    fn consume<R, F>(mut self, f: F) -> R
     where
         F: FnOnce(&mut [u8]) -> R,
     {
-        // 为了线程安全，这里需要对VirtioNet进行加【写锁】，以保证对设备的互斥访问。
-        let mut rx_buf = self.rx_buffer.unwrap();
-        let result = f(rx_buf.packet_mut());
-        self.driver
-            .inner
-            .lock()
-            .recycle_rx_buffer(rx_buf)
-            .expect("virtio_net recv failed");
+        let result = f(self.rx_buffer.packet_mut());
+        self.rx_recycle.push(self.rx_buffer);
         result
     }
 }
@@ -659,16 +746,13 @@ impl NetDevice for VirtioInterface {
         return Ok(());
     }
 
-    fn poll(&self, sockets: &mut iface::SocketSet) -> Result<(), SystemError> {
-        let timestamp: smoltcp::time::Instant = Instant::now().into();
-        let mut guard = self.iface.lock();
-        let poll_res = guard.poll(timestamp, self.device_inner.force_get_mut(), sockets);
-        // todo: notify!!!
-        // debug!("Virtio Interface poll:{poll_res}");
-        if poll_res {
-            return Ok(());
-        }
-        return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    fn poll(&self, scope: PollScope) -> Result<(), SystemError> {
+        return self.napi.poll(
+            self.iface_id,
+            &self.iface,
+            self.device_inner.force_get_mut(),
+            scope,
+        );
     }
 
     #[inline(always)]
@@ -832,8 +916,10 @@ impl VirtIODriver for VirtIONetDriver {
                 SystemError::EINVAL
             })?;
 
-        let iface: Arc<VirtioInterface> =
-            VirtioInterface::new(virtio_net_device.inner().device_inner.clone());
+        let iface: Arc<VirtioInterface> = VirtioInterface::new(
+            virtio_net_device.inner().device_inner.clone(),
+            virtio_net_device.napi.clone(),
+        );
         // 标识网络设备已经启动
         iface.set_net_state(NetDeivceState::__LINK_STATE_START);
         // 设置iface的父设备为virtio_net_device
@@ -487,7 +487,7 @@ impl TtyCoreData {
 
     #[inline]
     pub fn add_epitem(&self, epitem: Arc<EPollItem>) {
-        self.epitems.lock().push_back(epitem)
+        self.epitems.lock_irqsave().push_back(epitem)
     }
 
     pub fn eptiems(&self) -> &SpinLock<LinkedList<Arc<EPollItem>>> {
@@ -279,6 +279,10 @@ impl IndexNode for TtyDevice {
         todo!()
     }
 
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
     fn as_any_ref(&self) -> &dyn core::any::Any {
         self
     }
@@ -5,8 +5,8 @@ use system_error::SystemError;
 use crate::arch::driver::apic::{CurrentApic, LocalAPIC};
 
 use crate::{
-    arch::MMArch,
-    mm::MemoryManagementArch,
+    exception::softirq::softirq_vectors,
+    mm::tlb::handle_flush_tlb_ipi,
     sched::{SchedMode, __schedule},
     smp::cpu::ProcessorId,
 };
@@ -22,6 +22,8 @@ use super::{
 pub enum IpiKind {
     KickCpu,
     FlushTLB,
+    /// 通知目标CPU执行其他CPU为它标记的软中断
+    RaiseSoftirq,
     /// 指定中断向量号
     SpecVector(HardwareIrqNumber),
 }
@@ -71,7 +73,25 @@ impl IrqHandler for FlushTLBIpiHandler {
         _static_data: Option<&dyn IrqHandlerData>,
         _dynamic_data: Option<Arc<dyn IrqHandlerData>>,
     ) -> Result<IrqReturn, SystemError> {
-        unsafe { MMArch::invalidate_all() };
+        handle_flush_tlb_ipi();
+
+        Ok(IrqReturn::Handled)
+    }
+}
+
+/// 处理其他CPU标记软中断的IPI
+#[derive(Debug)]
+pub struct RaiseSoftirqIpiHandler;
+
+impl IrqHandler for RaiseSoftirqIpiHandler {
+    fn handle(
+        &self,
+        _irq: IrqNumber,
+        _static_data: Option<&dyn IrqHandlerData>,
+        _dynamic_data: Option<Arc<dyn IrqHandlerData>>,
+    ) -> Result<IrqReturn, SystemError> {
+        // 软中断在退出中断时执行
+        softirq_vectors().take_remote_pending();
 
         Ok(IrqReturn::Handled)
     }
@@ -3,7 +3,7 @@ use core::{
     intrinsics::unlikely,
     mem::{self, MaybeUninit},
     ptr::null_mut,
-    sync::atomic::{compiler_fence, fence, AtomicI16, Ordering},
+    sync::atomic::{compiler_fence, fence, AtomicI16, AtomicU64, Ordering},
 };
 
 use alloc::{boxed::Box, sync::Arc, vec::Vec};
@@ -12,8 +12,11 @@ use num_traits::FromPrimitive;
 use system_error::SystemError;
 
 use crate::{
-    arch::CurrentIrqArch,
-    exception::InterruptArch,
+    arch::{interrupt::ipi::send_ipi, CurrentIrqArch},
+    exception::{
+        ipi::{IpiKind, IpiTarget},
+        InterruptArch,
+    },
     libs::rwlock::RwLock,
     mm::percpu::{PerCpu, PerCpuVar},
     process::ProcessManager,
@@ -72,6 +75,8 @@ pub enum SoftirqNumber {
     /// 时钟软中断信号
     TIMER = 0,
     VideoRefresh = 1, //帧缓冲区刷新软中断
+    /// 网络收包软中断
+    NetRx = 2,
 }
 
 impl From<u64> for SoftirqNumber {
@@ -85,6 +90,7 @@ bitflags! {
     pub struct VecStatus: u64 {
         const TIMER = 1 << 0;
         const VIDEO_REFRESH = 1 << 1;
+        const NET_RX = 1 << 2;
     }
 }
 
@@ -103,6 +109,8 @@ pub struct Softirq {
     table: RwLock<[Option<Arc<dyn SoftirqVec>>; MAX_SOFTIRQ_NUM as usize]>,
     /// 软中断嵌套层数（per cpu）
     cpu_running_count: PerCpuVar<AtomicI16>,
+    /// 其他CPU为这个CPU标记的软中断（per cpu），在执行软中断之前并入`cpu_pending`
+    remote_pending: PerCpuVar<AtomicU64>,
 }
 impl Softirq {
     /// 每个CPU最大嵌套的软中断数量
@@ -123,9 +131,14 @@ impl Softirq {
         percpu_count.resize_with(PerCpu::MAX_CPU_NUM as usize, || AtomicI16::new(0));
         let cpu_running_count = PerCpuVar::new(percpu_count).unwrap();
 
+        let mut remote_pending = Vec::with_capacity(PerCpu::MAX_CPU_NUM as usize);
+        remote_pending.resize_with(PerCpu::MAX_CPU_NUM as usize, || AtomicU64::new(0));
+        let remote_pending = PerCpuVar::new(remote_pending).unwrap();
+
         return Softirq {
             table: RwLock::new(data),
             cpu_running_count,
+            remote_pending,
         };
     }
 
@@ -196,6 +209,8 @@ impl Softirq {
         let cpu_id = smp_get_processor_id();
         let mut max_restart = MAX_SOFTIRQ_RESTART;
         loop {
+            // CPU还没有开始处理IPI时发来的请求，在之后的任意一次中断返回时处理
+            self.take_remote_pending();
             compiler_fence(Ordering::SeqCst);
             let pending = cpu_pending(cpu_id).bits;
             cpu_pending(cpu_id).bits = 0;
@@ -258,6 +273,35 @@ impl Softirq {
         // debug!("raise_softirq exited");
     }
 
+    /// ## 在指定的CPU上标记软中断
+    ///
+    /// 目标CPU是其他CPU时，通过`IpiKind::RaiseSoftirq`通知它，软中断在它退出中断时执行。
+    /// 目标CPU上已经有还没处理的同一个软中断时不会重复发送IPI
+    pub fn raise_softirq_on(&self, cpu: ProcessorId, softirq_num: SoftirqNumber) {
+        if cpu == smp_get_processor_id() {
+            self.raise_softirq(softirq_num);
+            return;
+        }
+
+        let bits = VecStatus::from(softirq_num).bits();
+        let prev = unsafe { self.remote_pending.force_get(cpu) }.fetch_or(bits, Ordering::AcqRel);
+        if prev & bits == 0 {
+            send_ipi(IpiKind::RaiseSoftirq, IpiTarget::Specified(cpu));
+        }
+    }
+
+    /// 把其他CPU为当前CPU标记的软中断并入当前CPU的pending，在关中断时调用
+    pub fn take_remote_pending(&self) {
+        let remote = self.remote_pending.get();
+        if remote.load(Ordering::Acquire) == 0 {
+            return;
+        }
+        let bits = remote.swap(0, Ordering::AcqRel);
+        compiler_fence(Ordering::SeqCst);
+        cpu_pending(smp_get_processor_id()).insert(VecStatus::from_bits_truncate(bits));
+        compiler_fence(Ordering::SeqCst);
+    }
+
     #[allow(dead_code)]
     pub unsafe fn clear_softirq_pending(&self, softirq_num: SoftirqNumber) {
         compiler_fence(Ordering::SeqCst);
@@ -224,12 +224,15 @@ impl IndexNode for EventFdInode {
             .arc_any()
             .downcast::<EPollItem>()
             .map_err(|_| SystemError::EFAULT)?;
-        self.epitems.lock().push_back(epitem);
+        self.epitems.lock_irqsave().push_back(epitem);
         Ok(0)
     }
     fn fs(&self) -> Arc<dyn FileSystem> {
         panic!("EventFd does not have a filesystem")
     }
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
     fn as_any_ref(&self) -> &dyn Any {
         self
     }
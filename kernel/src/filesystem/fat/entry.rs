@@ -14,6 +14,7 @@ use alloc::{
 };
 
 use super::{
+    extent::FATExtentCache,
     fs::{Cluster, FATFileSystem, MAX_FILE_SIZE},
     utils::decode_u8_ascii,
 };
@@ -56,6 +57,8 @@ pub struct FATFile {
     pub short_dir_entry: ShortDirEntry,
     /// 文件目录项的起始、终止簇。格式：(簇，簇内偏移量)
     pub loc: ((Cluster, u64), (Cluster, u64)),
+    /// 文件簇链的区段缓存
+    pub extent_cache: FATExtentCache,
 }
 
 impl FATFile {
@@ -88,59 +91,37 @@ impl FATFile {
             return Ok(0);
         }
 
-        // 文件内的簇偏移量
-        let start_cluster_number: u64 = offset / fs.bytes_per_cluster();
-        // 计算对应在分区内的簇号
-        let mut current_cluster = if let Some(c) =
-            fs.get_cluster_by_relative(self.first_cluster, start_cluster_number as usize)
-        {
-            c
-        } else {
-            return Ok(0);
-        };
-
+        let bytes_per_cluster = fs.bytes_per_cluster();
         let bytes_remain: u64 = self.size() - offset;
-
-        // 计算簇内偏移量
-        let mut in_cluster_offset: u64 = offset % fs.bytes_per_cluster();
         let to_read_size: usize = min(buf.len(), bytes_remain as usize);
 
-        let mut start = 0;
         let mut read_ok = 0;
+        while read_ok < to_read_size {
+            let pos = offset + read_ok as u64;
+            let in_cluster_offset = pos % bytes_per_cluster;
+            // 当前位置所在的簇，以及从这个簇开始连续的簇数
+            let want =
+                (in_cluster_offset + (to_read_size - read_ok) as u64).div_ceil(bytes_per_cluster);
+            let (cluster, run) = match self.cluster_run(fs, pos / bytes_per_cluster, want) {
+                Some(r) => r,
+                None => break,
+            };
 
-        loop {
-            // 当前簇已经读取完，尝试读取下一个簇
-            if in_cluster_offset >= fs.bytes_per_cluster() {
-                if let Ok(FATEntry::Next(c)) = fs.get_fat_entry(current_cluster) {
-                    current_cluster = c;
-                    in_cluster_offset %= fs.bytes_per_cluster();
-                } else {
-                    break;
-                }
-            }
-
-            // 计算下一次读取，能够读多少字节
+            // 连续的簇合并成一次读操作
             let end_len: usize = min(
+                (run * bytes_per_cluster - in_cluster_offset) as usize,
                 to_read_size - read_ok,
-                min(
-                    (fs.bytes_per_cluster() - in_cluster_offset) as usize,
-                    buf.len() - read_ok,
-                ),
             );
 
             //  从磁盘上读取数据
-            let offset = fs.cluster_bytes_offset(current_cluster) + in_cluster_offset;
+            let disk_offset = fs.cluster_bytes_offset(cluster) + in_cluster_offset;
             let r = fs
                 .gendisk
-                .read_at_bytes(&mut buf[start..start + end_len], offset as usize)?;
-
-            // 更新偏移量计数信息
-            read_ok += r;
-            start += r;
-            in_cluster_offset += r as u64;
-            if read_ok == to_read_size {
+                .read_at_bytes(&mut buf[read_ok..read_ok + end_len], disk_offset as usize)?;
+            if r == 0 {
                 break;
             }
+            read_ok += r;
         }
         // todo: 更新时间信息
         return Ok(read_ok);
@@ -161,58 +142,58 @@ impl FATFile {
     ) -> Result<usize, SystemError> {
         self.ensure_len(fs, offset, buf.len() as u64)?;
 
-        // 要写入的第一个簇的簇号
-        let start_cluster_num = offset / fs.bytes_per_cluster();
-        // 获取要写入的第一个簇
-        let mut current_cluster: Cluster = if let Some(c) =
-            fs.get_cluster_by_relative(self.first_cluster, start_cluster_num as usize)
-        {
-            c
-        } else {
-            return Ok(0);
-        };
-
-        let mut in_cluster_bytes_offset: u64 = offset % fs.bytes_per_cluster();
-
-        let mut start: usize = 0;
+        let bytes_per_cluster = fs.bytes_per_cluster();
         let mut write_ok: usize = 0;
 
         // 循环写入数据
-        loop {
-            if in_cluster_bytes_offset >= fs.bytes_per_cluster() {
-                if let Ok(FATEntry::Next(c)) = fs.get_fat_entry(current_cluster) {
-                    current_cluster = c;
-                    in_cluster_bytes_offset %= fs.bytes_per_cluster();
-                } else {
-                    break;
-                }
-            }
+        while write_ok < buf.len() {
+            let pos = offset + write_ok as u64;
+            let in_cluster_offset = pos % bytes_per_cluster;
+            let want =
+                (in_cluster_offset + (buf.len() - write_ok) as u64).div_ceil(bytes_per_cluster);
+            let (cluster, run) = match self.cluster_run(fs, pos / bytes_per_cluster, want) {
+                Some(r) => r,
+                None => break,
+            };
 
+            // 连续的簇合并成一次写操作
             let end_len = min(
-                (fs.bytes_per_cluster() - in_cluster_bytes_offset) as usize,
+                (run * bytes_per_cluster - in_cluster_offset) as usize,
                 buf.len() - write_ok,
             );
 
             // 计算本次写入位置在分区上的偏移量
-            let offset = fs.cluster_bytes_offset(current_cluster) + in_cluster_bytes_offset;
+            let disk_offset = fs.cluster_bytes_offset(cluster) + in_cluster_offset;
             // 写入磁盘
             let w = fs
                 .gendisk
-                .write_at_bytes(&buf[start..start + end_len], offset as usize)?;
-
-            // 更新偏移量数据
-            write_ok += w;
-            start += w;
-            in_cluster_bytes_offset += w as u64;
-
-            if write_ok == buf.len() {
+                .write_at_bytes(&buf[write_ok..write_ok + end_len], disk_offset as usize)?;
+            if w == 0 {
                 break;
             }
+            write_ok += w;
         }
         // todo: 更新时间信息
         return Ok(write_ok);
     }
 
+    /// @brief 获取文件内第n个簇开始的连续簇
+    ///
+    /// @param count 调用者需要的簇数
+    ///
+    /// @return Some((簇, 从该簇开始连续的簇数))
+    /// @return None 文件的簇链长度不足n + 1
+    #[inline]
+    fn cluster_run(&self, fs: &Arc<FATFileSystem>, n: u64, count: u64) -> Option<(Cluster, u64)> {
+        return self.extent_cache.lookup(fs, self.first_cluster, n, count);
+    }
+
+    /// @brief 获取文件内的第n个簇
+    #[inline]
+    fn cluster_by_relative(&self, fs: &Arc<FATFileSystem>, n: u64) -> Option<Cluster> {
+        return self.cluster_run(fs, n, 1).map(|(c, _)| c);
+    }
+
     /// @brief 确保文件从指定偏移量开始，仍有长度为len的空间。
     /// 如果文件大小不够，就尝试分配更多的空间给这个文件。
     ///
@@ -250,6 +231,7 @@ impl FATFile {
             assert_eq!(self.first_cluster, Cluster::default());
             self.first_cluster = fs.allocate_cluster(None)?;
             self.short_dir_entry.set_first_cluster(self.first_cluster);
+            self.extent_cache.invalidate();
             bytes_remain_in_cluster = fs.bytes_per_cluster();
         }
 
@@ -258,26 +240,26 @@ impl FATFile {
             let clusters_to_allocate =
                 (extra_bytes - bytes_remain_in_cluster + fs.bytes_per_cluster() - 1)
                     / fs.bytes_per_cluster();
-            let last_cluster = if let Some(c) = fs.get_last_cluster(self.first_cluster) {
-                c
-            } else {
-                warn!("FAT: last cluster not found, File = {self:?}");
-                return Err(SystemError::EINVAL);
-            };
+            let last_cluster =
+                if let Some(c) = self.extent_cache.last_cluster(fs, self.first_cluster) {
+                    c
+                } else {
+                    warn!("FAT: last cluster not found, File = {self:?}");
+                    return Err(SystemError::EINVAL);
+                };
             // 申请簇
             let mut current_cluster: Cluster = last_cluster;
             for _ in 0..clusters_to_allocate {
                 current_cluster = fs.allocate_cluster(Some(current_cluster))?;
             }
+            self.extent_cache.chain_extended();
         }
 
         // 如果文件被扩展，则清空刚刚被扩展的部分的数据
         if offset > self.size() {
             // 文件内的簇偏移
             let start_cluster: u64 = self.size() / fs.bytes_per_cluster();
-            let start_cluster: Cluster = fs
-                .get_cluster_by_relative(self.first_cluster, start_cluster as usize)
-                .unwrap();
+            let start_cluster: Cluster = self.cluster_by_relative(fs, start_cluster).unwrap();
             // 计算当前文件末尾在分区上的字节偏移量
             let start_offset: u64 =
                 fs.cluster_bytes_offset(start_cluster) + self.size() % fs.bytes_per_cluster();
@@ -286,9 +268,7 @@ impl FATFile {
             // 计算在扩展之后的最后一个簇内，文件的终止字节
             let cluster_offset_start = offset / fs.bytes_per_cluster();
             // 扩展后，文件的最后
-            let end_cluster: Cluster = fs
-                .get_cluster_by_relative(self.first_cluster, cluster_offset_start as usize)
-                .unwrap();
+            let end_cluster: Cluster = self.cluster_by_relative(fs, cluster_offset_start).unwrap();
 
             if start_cluster != end_cluster {
                 self.zero_range(fs, start_offset, start_offset + bytes_remain)?;
@@ -339,11 +319,15 @@ impl FATFile {
         }
 
         let new_last_cluster = (new_size + fs.bytes_per_cluster() - 1) / fs.bytes_per_cluster();
-        if let Some(begin_delete) =
-            fs.get_cluster_by_relative(self.first_cluster, new_last_cluster as usize)
-        {
+        if let Some(begin_delete) = self.cluster_by_relative(fs, new_last_cluster) {
+            // 保留下来的最后一个簇成为新的簇链末尾
+            if new_last_cluster > 0 {
+                let last = self.cluster_by_relative(fs, new_last_cluster - 1).unwrap();
+                fs.set_entry(last, FATEntry::EndOfChain)?;
+            }
             fs.deallocate_cluster_chain(begin_delete)?;
         };
+        self.extent_cache.invalidate();
 
         if new_size == 0 {
             assert!(new_last_cluster == 0);
@@ -1258,6 +1242,7 @@ impl ShortDirEntry {
                 first_cluster,
                 short_dir_entry: *self,
                 loc: (loc, loc),
+                extent_cache: FATExtentCache::default(),
             };
 
             // 根据当前短目录项的类型的不同，返回对应的枚举类型。
@@ -1301,6 +1286,7 @@ impl ShortDirEntry {
                 file_name: name,
                 loc,
                 short_dir_entry: *self,
+                extent_cache: FATExtentCache::default(),
             };
 
             if self.is_file() {
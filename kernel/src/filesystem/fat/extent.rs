@@ -0,0 +1,155 @@
+use alloc::collections::BTreeMap;
+
+use crate::libs::spinlock::SpinLock;
+
+use super::{
+    entry::FATEntry,
+    fs::{Cluster, FATFileSystem},
+    utils::RESERVED_CLUSTERS,
+};
+
+/// # 簇链的区段缓存
+///
+/// 把文件的簇链记录为若干个区段（一段连续的簇），键为区段第一个簇在文件内的簇序号。
+/// 区段从文件的第一个簇开始按需建立：查找从第n个簇开始的count个簇时，沿着FAT表把映射扩展到
+/// 第n + count - 1个簇，或者第n个簇所在的区段结束为止，之后对已映射部分的查找只需O(log 区段数)。
+///
+/// 截断文件时需要调用`invalidate`，追加簇时需要调用`chain_extended`。
+#[derive(Debug)]
+pub struct FATExtentCache(SpinLock<InnerExtentCache>);
+
+#[derive(Debug, Default)]
+struct InnerExtentCache {
+    /// 文件内簇序号 -> (起始簇号, 连续的簇数)
+    extents: BTreeMap<u64, (u64, u64)>,
+    /// 已经映射的簇的数量
+    mapped: u64,
+    /// 已经映射到了簇链的末尾
+    complete: bool,
+}
+
+impl Default for FATExtentCache {
+    fn default() -> Self {
+        Self(SpinLock::new(InnerExtentCache::default()))
+    }
+}
+
+impl Clone for FATExtentCache {
+    /// 复制出来的文件对象重新建立自己的缓存
+    fn clone(&self) -> Self {
+        Self::default()
+    }
+}
+
+impl FATExtentCache {
+    /// @brief 获取文件内第n个簇开始的连续簇
+    ///
+    /// @param fs 文件所在的文件系统
+    /// @param first_cluster 文件的第一个簇
+    /// @param n 文件内的簇序号（从0开始）
+    /// @param count 调用者需要的簇数。返回的连续簇数只有在区段提前结束时才会小于它
+    ///
+    /// @return Some((簇, 从该簇开始连续的簇数)) 第n个簇存在
+    /// @return None 簇链的长度不足n + 1
+    pub fn lookup(
+        &self,
+        fs: &FATFileSystem,
+        first_cluster: Cluster,
+        n: u64,
+        count: u64,
+    ) -> Option<(Cluster, u64)> {
+        let mut guard = self.0.lock();
+        if !guard.complete && guard.need_extend(n, count) {
+            guard.extend(fs, first_cluster, n, count);
+        }
+
+        let (&idx, &(start, len)) = guard.extents.range(..=n).next_back()?;
+        if n >= idx + len {
+            return None;
+        }
+        return Some((Cluster::new(start + (n - idx)), len - (n - idx)));
+    }
+
+    /// @brief 获取簇链的最后一个簇
+    pub fn last_cluster(&self, fs: &FATFileSystem, first_cluster: Cluster) -> Option<Cluster> {
+        let mut guard = self.0.lock();
+        if !guard.complete {
+            guard.extend(fs, first_cluster, u64::MAX, 1);
+        }
+        let (_, &(start, len)) = guard.extents.iter().next_back()?;
+        return Some(Cluster::new(start + len - 1));
+    }
+
+    /// @brief 簇链被截断或者第一个簇发生改变后，丢弃所有的映射
+    pub fn invalidate(&self) {
+        let mut guard = self.0.lock();
+        guard.extents.clear();
+        guard.mapped = 0;
+        guard.complete = false;
+    }
+
+    /// @brief 簇链末尾追加了新的簇，下一次查找时从已映射的最后一个簇继续扩展
+    pub fn chain_extended(&self) {
+        self.0.lock().complete = false;
+    }
+}
+
+impl InnerExtentCache {
+    /// 查找从第n个簇开始的count个簇之前，是否需要扩展映射
+    ///
+    /// 第n个簇还没有被映射，或者它位于最后一个区段、而这个区段在簇链中可能还没有结束时，需要扩展
+    fn need_extend(&self, n: u64, count: u64) -> bool {
+        if n >= self.mapped {
+            return true;
+        }
+        return self.mapped < n.saturating_add(count)
+            && self
+                .extents
+                .iter()
+                .next_back()
+                .is_some_and(|(&idx, _)| idx <= n);
+    }
+
+    /// 沿着FAT表扩展映射，直到映射了第n + count - 1个簇、第n个簇所在的区段结束，或者到达簇链末尾
+    fn extend(&mut self, fs: &FATFileSystem, first_cluster: Cluster, n: u64, count: u64) {
+        if self.mapped == 0 {
+            if first_cluster.cluster_num < RESERVED_CLUSTERS as u64 {
+                // 文件还没有分配簇
+                self.complete = true;
+                return;
+            }
+            self.extents.insert(0, (first_cluster.cluster_num, 1));
+            self.mapped = 1;
+        }
+
+        // 簇链的长度不会超过簇的总数，防止FAT表损坏形成环时死循环
+        let max_len = fs.max_cluster_number().cluster_num;
+        let target = n.saturating_add(count.max(1));
+        while self.mapped < target {
+            let (_, last) = self.extents.iter_mut().next_back().unwrap();
+            let last_cluster = last.0 + last.1 - 1;
+            match fs.get_fat_entry(Cluster::new(last_cluster)) {
+                Ok(FATEntry::Next(c)) if self.mapped < max_len => {
+                    if c.cluster_num == last_cluster + 1 {
+                        last.1 += 1;
+                        self.mapped += 1;
+                    } else {
+                        self.extents.insert(self.mapped, (c.cluster_num, 1));
+                        // 新的区段在第n个簇之后开始，说明第n个簇所在的区段已经结束
+                        let run_ended = self.mapped > n;
+                        self.mapped += 1;
+                        if run_ended {
+                            return;
+                        }
+                    }
+                }
+                Ok(_) => {
+                    self.complete = true;
+                    return;
+                }
+                // 读取FAT表出错，下次查找时重试
+                Err(_) => return,
+            }
+        }
+    }
+}
@@ -0,0 +1,348 @@
+use alloc::{sync::Arc, vec::Vec};
+use system_error::SystemError;
+
+use crate::{
+    driver::base::block::{block_device::LBA_SIZE, gendisk::GenDisk},
+    libs::spinlock::SpinLock,
+};
+
+use super::{bpb::FATType, fs::FATFileSystem, utils::RESERVED_CLUSTERS};
+
+/// 挂载时每次从磁盘读取FAT表的字节数
+const FAT_LOAD_CHUNK: usize = 64 * 1024;
+
+/// # FAT表的内存缓存
+///
+/// 挂载时把活动的FAT表整个读入内存，并据此建立空闲簇位图：
+/// - 读取表项、遍历簇链只访问内存
+/// - 分配簇只需在位图中查找
+/// - 修改表项只标记所在扇区为脏，由页面回收线程周期性地、或者在sync/syncfs/卸载时，
+///   把连续的脏扇区合并写回所有需要更新的FAT表
+pub struct FATTable(SpinLock<InnerFATTable>);
+
+struct InnerFATTable {
+    fat_type: FATType,
+    bytes_per_sector: usize,
+    /// 活动FAT表的内容
+    data: Vec<u8>,
+    /// 脏扇区位图，第i位对应FAT表内的第i个扇区
+    dirty: Vec<u64>,
+    /// 脏扇区的数量
+    dirty_sectors: usize,
+    /// 簇位图，第i位为1表示第i号簇已被使用（或者不可用）
+    used: Vec<u64>,
+    /// 最大的簇号
+    max_cluster: u64,
+    /// 空闲簇的数量
+    free_count: u64,
+}
+
+impl core::fmt::Debug for FATTable {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        let guard = self.0.lock();
+        f.debug_struct("FATTable")
+            .field("fat_bytes", &guard.data.len())
+            .field("max_cluster", &guard.max_cluster)
+            .field("free_count", &guard.free_count)
+            .finish()
+    }
+}
+
+impl FATTable {
+    pub fn new(fat_type: FATType) -> Self {
+        return Self(SpinLock::new(InnerFATTable {
+            fat_type,
+            bytes_per_sector: LBA_SIZE,
+            data: Vec::new(),
+            dirty: Vec::new(),
+            dirty_sectors: 0,
+            used: Vec::new(),
+            max_cluster: 0,
+            free_count: 0,
+        }));
+    }
+
+    /// @brief 从磁盘读入活动的FAT表，并建立空闲簇位图
+    ///
+    /// @param fs 所属的文件系统
+    pub fn load(&self, fs: &FATFileSystem) -> Result<(), SystemError> {
+        let bytes_per_sector = fs.bpb.bytes_per_sector as usize;
+        let fat_bytes = fs.fat_size() as usize * bytes_per_sector;
+        let start_lba = fs.gendisk_lba_from_offset(fs.fat_start_sector());
+
+        let mut data: Vec<u8> = vec![0; fat_bytes];
+        for (i, chunk) in data.chunks_mut(FAT_LOAD_CHUNK).enumerate() {
+            fs.gendisk
+                .read_at(chunk, start_lba + i * FAT_LOAD_CHUNK / LBA_SIZE)?;
+        }
+
+        let mut guard = self.0.lock();
+        guard.bytes_per_sector = bytes_per_sector;
+        guard.data = data;
+        guard.dirty = vec![0; fs.fat_size().div_ceil(64) as usize];
+        guard.dirty_sectors = 0;
+        guard.build_bitmap(fs.max_cluster_number().cluster_num);
+        return Ok(());
+    }
+
+    /// @brief 读取FAT表项的原始值（FAT32会去掉高4位的保留位）
+    pub fn get(&self, cluster: u64) -> Result<u32, SystemError> {
+        return self.0.lock().get(cluster);
+    }
+
+    /// @brief 设置FAT表项的原始值，并同步更新空闲簇位图
+    pub fn set(&self, cluster: u64, val: u32) -> Result<(), SystemError> {
+        return self.0.lock().set(cluster, val);
+    }
+
+    /// @brief 在[start, end)范围内寻找一个空闲簇
+    pub fn find_free(&self, start: u64, end: u64) -> Option<u64> {
+        return self.0.lock().find_free(start, end);
+    }
+
+    /// @brief 在[start, end)范围内寻找一个空闲簇，并把它的表项设置为val
+    ///
+    /// 查找和设置在同一个临界区内完成，避免两个进程分配到同一个簇
+    pub fn allocate(&self, start: u64, end: u64, val: u32) -> Result<u64, SystemError> {
+        let mut guard = self.0.lock();
+        let cluster = guard.find_free(start, end).ok_or(SystemError::ENOSPC)?;
+        guard.set(cluster, val)?;
+        return Ok(cluster);
+    }
+
+    /// @brief 当前空闲簇的数量
+    pub fn free_count(&self) -> u64 {
+        return self.0.lock().free_count;
+    }
+
+    /// @brief FAT表中是否有还没有写回磁盘的修改
+    pub fn is_dirty(&self) -> bool {
+        return self.0.lock().dirty_sectors != 0;
+    }
+
+    /// @brief 把脏扇区写回磁盘。连续的脏扇区合并成一次写操作
+    ///
+    /// @param gendisk 文件系统所在的分区
+    /// @param fat_start_lbas 需要更新的每个FAT表的起始块号（分区内）
+    pub fn flush(
+        &self,
+        gendisk: &Arc<GenDisk>,
+        fat_start_lbas: &[usize],
+    ) -> Result<(), SystemError> {
+        // 在锁内复制脏扇区的内容，写磁盘时不持有锁
+        let mut runs: Vec<(usize, Vec<u8>)> = Vec::new();
+        let lba_per_sector;
+        {
+            let mut guard = self.0.lock();
+            if guard.dirty_sectors == 0 {
+                return Ok(());
+            }
+            let bps = guard.bytes_per_sector;
+            lba_per_sector = bps / LBA_SIZE;
+            let sectors = guard.data.len() / bps;
+            let mut sector = 0;
+            while sector < sectors {
+                if !guard.is_dirty(sector) {
+                    sector += 1;
+                    continue;
+                }
+                let start = sector;
+                while sector < sectors && guard.is_dirty(sector) {
+                    guard.clear_dirty(sector);
+                    sector += 1;
+                }
+                runs.push((start, guard.data[start * bps..sector * bps].to_vec()));
+            }
+        }
+
+        let mut result = Ok(());
+        for (sector, data) in runs.iter() {
+            for lba in fat_start_lbas {
+                if let Err(e) = gendisk.write_at(data, lba + sector * lba_per_sector) {
+                    result = Err(e);
+                }
+            }
+        }
+
+        // 写回失败的扇区重新标记为脏，等待下一次写回
+        if result.is_err() {
+            let mut guard = self.0.lock();
+            let bps = guard.bytes_per_sector;
+            for (sector, data) in runs.iter() {
+                for s in *sector..*sector + data.len() / bps {
+                    guard.mark_dirty(s);
+                }
+            }
+        }
+        return result;
+    }
+}
+
+impl InnerFATTable {
+    /// 表项在FAT表内的字节偏移量
+    fn entry_offset(&self, cluster: u64) -> usize {
+        let cluster = cluster as usize;
+        match self.fat_type {
+            FATType::FAT12(_) => cluster + cluster / 2,
+            FATType::FAT16(_) => cluster * 2,
+            FATType::FAT32(_) => cluster * 4,
+        }
+    }
+
+    fn entry_size(&self) -> usize {
+        match self.fat_type {
+            FATType::FAT12(_) | FATType::FAT16(_) => 2,
+            FATType::FAT32(_) => 4,
+        }
+    }
+
+    fn read_u16(&self, off: usize) -> u16 {
+        u16::from_le_bytes([self.data[off], self.data[off + 1]])
+    }
+
+    fn read_u32(&self, off: usize) -> u32 {
+        u32::from_le_bytes(self.data[off..off + 4].try_into().unwrap())
+    }
+
+    fn get(&self, cluster: u64) -> Result<u32, SystemError> {
+        let off = self.entry_offset(cluster);
+        if off + self.entry_size() > self.data.len() {
+            return Err(SystemError::EINVAL);
+        }
+        let val = match self.fat_type {
+            FATType::FAT12(_) => {
+                let packed = self.read_u16(off);
+                // FAT12的每个表项占用1.5字节，奇数簇取高12位
+                if (cluster & 1) > 0 {
+                    (packed >> 4) as u32
+                } else {
+                    (packed & 0x0fff) as u32
+                }
+            }
+            FATType::FAT16(_) => self.read_u16(off) as u32,
+            FATType::FAT32(_) => self.read_u32(off) & 0x0fff_ffff,
+        };
+        return Ok(val);
+    }
+
+    fn set(&mut self, cluster: u64, val: u32) -> Result<(), SystemError> {
+        let off = self.entry_offset(cluster);
+        let size = self.entry_size();
+        if off + size > self.data.len() {
+            return Err(SystemError::EINVAL);
+        }
+        match self.fat_type {
+            FATType::FAT12(_) => {
+                let old = self.read_u16(off);
+                let val = (val & 0x0fff) as u16;
+                let new = if (cluster & 1) > 0 {
+                    (old & 0x000f) | (val << 4)
+                } else {
+                    (old & 0xf000) | val
+                };
+                self.data[off..off + 2].copy_from_slice(&new.to_le_bytes());
+            }
+            FATType::FAT16(_) => {
+                self.data[off..off + 2].copy_from_slice(&(val as u16).to_le_bytes());
+            }
+            FATType::FAT32(_) => {
+                // FAT32的高4位保留
+                let new = (self.read_u32(off) & 0xf000_0000) | (val & 0x0fff_ffff);
+                self.data[off..off + 4].copy_from_slice(&new.to_le_bytes());
+            }
+        }
+
+        // FAT12的表项可能跨越两个扇区
+        self.mark_dirty(off / self.bytes_per_sector);
+        self.mark_dirty((off + size - 1) / self.bytes_per_sector);
+
+        if cluster >= RESERVED_CLUSTERS as u64 && cluster <= self.max_cluster {
+            let was_used = self.test_used(cluster);
+            let now_used = val != 0;
+            if was_used != now_used {
+                self.set_used(cluster, now_used);
+                if now_used {
+                    self.free_count -= 1;
+                } else {
+                    self.free_count += 1;
+                }
+            }
+        }
+        return Ok(());
+    }
+
+    fn build_bitmap(&mut self, max_cluster: u64) {
+        // FAT表的大小可能不足以容纳所有的簇，此时超出的簇不可用
+        let max_cluster = core::cmp::min(
+            max_cluster,
+            (self.data.len() / self.entry_size()) as u64 - 1,
+        );
+        self.max_cluster = max_cluster;
+        // 位图之外的位全部视为已使用，查找时不会越界
+        self.used = vec![u64::MAX; (max_cluster as usize + 1).div_ceil(64)];
+        self.free_count = 0;
+        for cluster in RESERVED_CLUSTERS as u64..=max_cluster {
+            if self.get(cluster).unwrap_or(1) == 0 {
+                self.set_used(cluster, false);
+                self.free_count += 1;
+            }
+        }
+    }
+
+    #[inline]
+    fn test_used(&self, cluster: u64) -> bool {
+        self.used[(cluster / 64) as usize] & (1 << (cluster % 64)) != 0
+    }
+
+    #[inline]
+    fn set_used(&mut self, cluster: u64, used: bool) {
+        let word = &mut self.used[(cluster / 64) as usize];
+        if used {
+            *word |= 1 << (cluster % 64);
+        } else {
+            *word &= !(1 << (cluster % 64));
+        }
+    }
+
+    fn find_free(&self, start: u64, end: u64) -> Option<u64> {
+        let end = core::cmp::min(end, self.max_cluster + 1);
+        if start >= end {
+            return None;
+        }
+        let mut word_idx = (start / 64) as usize;
+        // 第一个字中start之前的位视为已使用
+        let mut free = !self.used[word_idx] & (u64::MAX << (start % 64));
+        loop {
+            if free != 0 {
+                let cluster = word_idx as u64 * 64 + free.trailing_zeros() as u64;
+                return if cluster < end { Some(cluster) } else { None };
+            }
+            word_idx += 1;
+            if word_idx as u64 * 64 >= end {
+                return None;
+            }
+            free = !self.used[word_idx];
+        }
+    }
+
+    #[inline]
+    fn is_dirty(&self, sector: usize) -> bool {
+        self.dirty[sector / 64] & (1 << (sector % 64)) != 0
+    }
+
+    #[inline]
+    fn mark_dirty(&mut self, sector: usize) {
+        if !self.is_dirty(sector) {
+            self.dirty[sector / 64] |= 1 << (sector % 64);
+            self.dirty_sectors += 1;
+        }
+    }
+
+    #[inline]
+    fn clear_dirty(&mut self, sector: usize) {
+        if self.is_dirty(sector) {
+            self.dirty[sector / 64] &= !(1 << (sector % 64));
+            self.dirty_sectors -= 1;
+        }
+    }
+}
@@ -14,6 +14,7 @@ use alloc::{
 
 use crate::driver::base::block::gendisk::GenDisk;
 use crate::driver::base::device::device_number::DeviceNumber;
+use crate::filesystem::vfs::dcache::DentryCacheMode;
 use crate::filesystem::vfs::file::PageCache;
 use crate::filesystem::vfs::utils::DName;
 use crate::filesystem::vfs::{Magic, SpecialNodeData, SuperBlock};
@@ -36,6 +37,7 @@ use crate::{
 };
 
 use super::entry::FATFile;
+use super::fat_table::FATTable;
 use super::{
     bpb::{BiosParameterBlock, FATType},
     entry::{FATDir, FATDirEntry, FATDirIter, FATEntry},
@@ -82,6 +84,8 @@ pub struct FATFileSystem {
     pub first_data_sector: u64,
     /// 文件系统信息结构体
     pub fs_info: Arc<LockedFATFsInfo>,
+    /// FAT表的内存缓存
+    pub fat_table: FATTable,
     /// 文件系统的根inode
     root_inode: Arc<LockedFATInode>,
 }
@@ -285,6 +289,15 @@ impl FileSystem for FATFileSystem {
         )
     }
 
+    fn dentry_cache_mode(&self) -> DentryCacheMode {
+        // FAT的文件名不区分大小写
+        DentryCacheMode::CaseInsensitive
+    }
+
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return self.sync();
+    }
+
     unsafe fn fault(&self, pfm: &mut PageFaultMessage) -> VmFaultReason {
         PageFaultHandler::filemap_fault(pfm)
     }
@@ -381,9 +394,20 @@ impl FATFileSystem {
             bpb,
             first_data_sector,
             fs_info: Arc::new(LockedFATFsInfo::new(fs_info)),
+            fat_table: FATTable::new(bpb.fat_type),
             root_inode,
         });
 
+        // 读入FAT表，并以FAT表统计出的空闲簇数量为准
+        result.fat_table.load(&result)?;
+        if let FATType::FAT32(_) = result.bpb.fat_type {
+            result
+                .fs_info
+                .0
+                .lock()
+                .update_free_count_abs(result.fat_table.free_count() as u32);
+        }
+
         // 对root inode加锁，并继续完成初始化工作
         let mut root_guard: SpinLockGuard<FATInode> = result.root_inode.0.lock();
         root_guard.inode_type = FATDirEntry::Dir(result.root_dir());
@@ -415,37 +439,11 @@ impl FATFileSystem {
             return Err(SystemError::EINVAL);
         }
 
-        let fat_type: FATType = self.bpb.fat_type;
-        // 获取FAT表的起始扇区（相对分区起始扇区的偏移量）
-        let fat_start_sector = self.fat_start_sector();
-        let bytes_per_sec = self.bpb.bytes_per_sector as u64;
-
-        // cluster对应的FAT表项在分区内的字节偏移量
-        let fat_bytes_offset =
-            fat_type.get_fat_bytes_offset(cluster, fat_start_sector, bytes_per_sec);
-
-        // FAT表项所在的分区内LBA地址
-        let fat_ent_lba = fat_bytes_offset / LBA_SIZE as u64;
-
-        // FAT表项在逻辑块内的字节偏移量
-        let blk_offset = self.get_in_block_offset(fat_bytes_offset);
-
-        let mut v: Vec<u8> = vec![0; self.bpb.bytes_per_sector as usize];
-        self.gendisk.read_at(&mut v, fat_ent_lba as usize)?;
-
-        let mut cursor = VecCursor::new(v);
-        cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
+        // 表项的原始值（FAT12的表项已经解包）
+        let entry = self.fat_table.get(current_cluster)?;
 
         let res: FATEntry = match self.bpb.fat_type {
             FATType::FAT12(_) => {
-                let mut entry = cursor.read_u16()?;
-                // 由于FAT12文件系统的FAT表，每个entry占用1.5字节，因此奇数的簇需要取高12位的值。
-                if (current_cluster & 1) > 0 {
-                    entry >>= 4;
-                } else {
-                    entry &= 0x0fff;
-                }
-
                 if entry == 0 {
                     FATEntry::Unused
                 } else if entry == 0x0ff7 {
@@ -460,8 +458,6 @@ impl FATFileSystem {
                 }
             }
             FATType::FAT16(_) => {
-                let entry = cursor.read_u16()?;
-
                 if entry == 0 {
                     FATEntry::Unused
                 } else if entry == 0xfff7 {
@@ -476,8 +472,6 @@ impl FATFileSystem {
                 }
             }
             FATType::FAT32(_) => {
-                let entry = cursor.read_u32()? & 0x0fffffff;
-
                 match entry {
                     _n if (0x0ffffff7..=0x0fffffff).contains(&current_cluster) => {
                         // 当前簇号不是一个能被获得的簇（可能是文件系统出错了）
@@ -504,50 +498,10 @@ impl FATFileSystem {
     /// @return Ok(u64) 当前簇在FAT表中，存储的信息。
     /// @return Err(SystemError) 错误码
     pub fn get_fat_entry_raw(&self, cluster: Cluster) -> Result<u64, SystemError> {
-        let current_cluster = cluster.cluster_num;
-
-        let fat_type: FATType = self.bpb.fat_type;
-        // 获取FAT表的起始扇区（相对分区起始扇区的偏移量）
-        let fat_start_sector = self.fat_start_sector();
-        let bytes_per_sec = self.bpb.bytes_per_sector as u64;
-
-        // cluster对应的FAT表项在分区内的字节偏移量
-        let fat_bytes_offset =
-            fat_type.get_fat_bytes_offset(cluster, fat_start_sector, bytes_per_sec);
-
-        // FAT表项所在的分区内LBA地址
-        let fat_ent_lba = self.gendisk_lba_from_offset(self.bytes_to_sector(fat_bytes_offset));
-
-        // FAT表项在逻辑块内的字节偏移量
-        let blk_offset = self.get_in_block_offset(fat_bytes_offset);
-
-        let mut v: Vec<u8> = vec![0; self.bpb.bytes_per_sector as usize];
-        self.gendisk.read_at(&mut v, fat_ent_lba)?;
-
-        let mut cursor = VecCursor::new(v);
-        cursor.seek(SeekFrom::SeekSet(blk_offset as i64))?;
-
-        let res = match self.bpb.fat_type {
-            FATType::FAT12(_) => {
-                let mut entry = cursor.read_u16()?;
-                entry = if (current_cluster & 0x0001) > 0 {
-                    entry >> 4
-                } else {
-                    entry & 0x0fff
-                };
-                entry as u64
-            }
-            FATType::FAT16(_) => {
-                let entry = (cursor.read_u16()?) as u64;
-                entry
-            }
-            FATType::FAT32(_) => {
-                let entry = cursor.read_u32()? & 0x0fff_ffff;
-                entry as u64
-            }
-        };
-
-        return Ok(res);
+        return self
+            .fat_table
+            .get(cluster.cluster_num)
+            .map(|entry| entry as u64);
     }
 
     /// @brief 获取当前文件系统的root inode，在分区内的字节偏移量
@@ -615,16 +569,24 @@ impl FATFileSystem {
             _ => Cluster::new(RESERVED_CLUSTERS as u64),
         };
 
-        // 寻找一个空的簇
-        let free_cluster: Cluster = match self.get_free_cluster(start_cluster, end_cluster) {
-            Ok(c) => c,
-            Err(_) if start_cluster.cluster_num > RESERVED_CLUSTERS as u64 => {
-                self.get_free_cluster(Cluster::new(RESERVED_CLUSTERS as u64), end_cluster)?
-            }
-            Err(e) => return Err(e),
-        };
+        // 寻找一个空的簇，并把它标记为簇链的结尾
+        let eoc = self.fat_entry_raw_value(FATEntry::EndOfChain);
+        let free_cluster: Cluster =
+            match self
+                .fat_table
+                .allocate(start_cluster.cluster_num, end_cluster.cluster_num, eoc)
+            {
+                Ok(c) => Cluster::new(c),
+                Err(_) if start_cluster.cluster_num > RESERVED_CLUSTERS as u64 => {
+                    Cluster::new(self.fat_table.allocate(
+                        RESERVED_CLUSTERS as u64,
+                        end_cluster.cluster_num,
+                        eoc,
+                    )?)
+                }
+                Err(e) => return Err(e),
+            };
 
-        self.set_entry(free_cluster, FATEntry::EndOfChain)?;
         // 减少空闲簇计数
         self.fs_info.0.lock().update_free_count_delta(-1);
         // 更新搜索空闲簇的参考量
@@ -902,17 +864,39 @@ impl FATFileSystem {
 
     /// @brief 执行文件系统卸载前的一些准备工作：设置好对应的标志位，并把缓存中的数据刷入磁盘
     pub fn umount(&mut self) -> Result<(), SystemError> {
-        self.fs_info.0.lock().flush(&self.gendisk)?;
-
         self.set_shut_bit_ok()?;
 
         self.set_hard_error_bit_ok()?;
 
-        self.gendisk.sync()?;
+        self.sync()?;
 
         return Ok(());
     }
 
+    /// @brief 把FsInfo、FAT表缓存以及块设备缓存中的脏数据写回磁盘
+    pub fn sync(&self) -> Result<(), SystemError> {
+        self.fs_info.0.lock().flush(&self.gendisk)?;
+        self.fat_table
+            .flush(&self.gendisk, &self.fat_copies_lba())?;
+        return self.gendisk.sync();
+    }
+
+    /// @brief 获取写回FAT表时需要更新的所有FAT表的起始块号（分区内）
+    ///
+    /// 启用了FAT表镜像时（FAT12/FAT16总是启用），需要更新所有的FAT表；否则只更新活动的FAT表
+    fn fat_copies_lba(&self) -> Vec<usize> {
+        let fat_size = self.fat_size();
+        let rsvd = self.bpb.rsvd_sec_cnt as u64;
+        let copies: Vec<u64> = match self.bpb.fat_type {
+            FATType::FAT32(_) if !self.mirroring_enabled() => vec![self.active_fat()],
+            _ => (0..self.bpb.num_fats as u64).collect(),
+        };
+        return copies
+            .into_iter()
+            .map(|i| self.gendisk_lba_from_offset(rsvd + i * fat_size))
+            .collect();
+    }
+
     /// @brief 获取文件系统的最大簇号
     pub fn max_cluster_number(&self) -> Cluster {
         match self.bpb.fat_type {
@@ -961,114 +945,12 @@ impl FATFileSystem {
         end_cluster: Cluster,
     ) -> Result<Cluster, SystemError> {
         let max_cluster: Cluster = self.max_cluster_number();
-        let mut cluster: u64 = start_cluster.cluster_num;
-
-        let fat_type: FATType = self.bpb.fat_type;
-        let fat_start_sector: u64 = self.fat_start_sector();
-        let bytes_per_sec: u64 = self.bpb.bytes_per_sector as u64;
-
-        match fat_type {
-            FATType::FAT12(_) => {
-                let part_bytes_offset: u64 =
-                    fat_type.get_fat_bytes_offset(start_cluster, fat_start_sector, bytes_per_sec);
-                let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                // 由于FAT12的FAT表不大于6K，因此直接读取6K
-                let num_lba = (6 * 1024) / LBA_SIZE;
-                let mut v: Vec<u8> = vec![0; num_lba * LBA_SIZE];
-                self.gendisk.read_at(&mut v, lba)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                let mut packed_val: u16 = cursor.read_u16()?;
-                loop {
-                    let val = if (cluster & 0x1) > 0 {
-                        packed_val >> 4
-                    } else {
-                        packed_val & 0x0fff
-                    };
-                    if val == 0 {
-                        return Ok(Cluster::new(cluster));
-                    }
-
-                    cluster += 1;
-
-                    // 磁盘无剩余空间，或者簇号达到给定的最大值
-                    if cluster == end_cluster.cluster_num || cluster == max_cluster.cluster_num {
-                        return Err(SystemError::ENOSPC);
-                    }
-
-                    packed_val = match cluster & 1 {
-                        0 => cursor.read_u16()?,
-                        _ => {
-                            let next_byte = cursor.read_u8()? as u16;
-                            (packed_val >> 8) | (next_byte << 8)
-                        }
-                    };
-                }
-            }
-            FATType::FAT16(_) => {
-                // todo: 优化这里，减少读取磁盘的次数。
-                while cluster < end_cluster.cluster_num && cluster < max_cluster.cluster_num {
-                    let part_bytes_offset: u64 = fat_type.get_fat_bytes_offset(
-                        Cluster::new(cluster),
-                        fat_start_sector,
-                        bytes_per_sec,
-                    );
-                    let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                    let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                    let mut v: Vec<u8> = vec![0; self.lba_per_sector() * LBA_SIZE];
-                    self.gendisk.read_at(&mut v, lba)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    let val = cursor.read_u16()?;
-                    // 找到空闲簇
-                    if val == 0 {
-                        return Ok(Cluster::new(val as u64));
-                    }
-                    cluster += 1;
-                }
-
-                // 磁盘无剩余空间，或者簇号达到给定的最大值
-                return Err(SystemError::ENOSPC);
-            }
-            FATType::FAT32(_) => {
-                // todo: 优化这里，减少读取磁盘的次数。
-                while cluster < end_cluster.cluster_num && cluster < max_cluster.cluster_num {
-                    let part_bytes_offset: u64 = fat_type.get_fat_bytes_offset(
-                        Cluster::new(cluster),
-                        fat_start_sector,
-                        bytes_per_sec,
-                    );
-                    let in_block_offset = self.get_in_block_offset(part_bytes_offset);
-
-                    let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(part_bytes_offset));
-
-                    let mut v: Vec<u8> = vec![0; self.lba_per_sector() * LBA_SIZE];
-                    self.gendisk.read_at(&mut v, lba)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    let val = cursor.read_u32()? & 0x0fffffff;
-
-                    if val == 0 {
-                        return Ok(Cluster::new(cluster));
-                    }
-                    cluster += 1;
-                }
-
-                // 磁盘无剩余空间，或者簇号达到给定的最大值
-                return Err(SystemError::ENOSPC);
-            }
-        }
+        let end = core::cmp::min(end_cluster.cluster_num, max_cluster.cluster_num);
+        return self
+            .fat_table
+            .find_free(start_cluster.cluster_num, end)
+            .map(Cluster::new)
+            .ok_or(SystemError::ENOSPC);
     }
 
     /// @brief 在FAT表中，设置指定的簇的信息。
@@ -1076,126 +958,47 @@ impl FATFileSystem {
     /// @param cluster 目标簇
     /// @param fat_entry 这个簇在FAT表中，存储的信息（下一个簇的簇号）
     pub fn set_entry(&self, cluster: Cluster, fat_entry: FATEntry) -> Result<(), SystemError> {
-        // fat表项在分区上的字节偏移量
-        let fat_part_bytes_offset: u64 = self.bpb.fat_type.get_fat_bytes_offset(
-            cluster,
-            self.fat_start_sector(),
-            self.bpb.bytes_per_sector as u64,
-        );
-
-        match self.bpb.fat_type {
-            FATType::FAT12(_) => {
-                // 计算要写入的值
-                let raw_val: u16 = match fat_entry {
-                    FATEntry::Unused => 0,
-                    FATEntry::Bad => 0xff7,
-                    FATEntry::EndOfChain => 0xfff,
-                    FATEntry::Next(c) => c.cluster_num as u16,
-                };
-
-                let in_block_offset = self.get_in_block_offset(fat_part_bytes_offset);
-
-                let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(fat_part_bytes_offset));
-
-                let mut v: Vec<u8> = vec![0; LBA_SIZE];
-                self.gendisk.read_at(&mut v, lba)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                let old_val: u16 = cursor.read_u16()?;
-                let new_val: u16 = if (cluster.cluster_num & 0x1) > 0 {
-                    (old_val & 0x000f) | (raw_val << 4)
-                } else {
-                    (old_val & 0xf000) | raw_val
-                };
-
-                // 写回数据到磁盘上
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-                cursor.write_u16(new_val)?;
-                self.gendisk.write_at(cursor.as_slice(), lba)?;
-                return Ok(());
-            }
-            FATType::FAT16(_) => {
-                // 计算要写入的值
-                let raw_val: u16 = match fat_entry {
-                    FATEntry::Unused => 0,
-                    FATEntry::Bad => 0xfff7,
-                    FATEntry::EndOfChain => 0xfdff,
-                    FATEntry::Next(c) => c.cluster_num as u16,
-                };
-
-                let in_block_offset = self.get_in_block_offset(fat_part_bytes_offset);
-
-                let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(fat_part_bytes_offset));
-
-                let mut v: Vec<u8> = vec![0; LBA_SIZE];
-                self.gendisk.read_at(&mut v, lba)?;
-
-                let mut cursor: VecCursor = VecCursor::new(v);
-                cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                cursor.write_u16(raw_val)?;
-                self.gendisk.write_at(cursor.as_slice(), lba)?;
-
-                return Ok(());
+        if let FATType::FAT32(_) = self.bpb.fat_type {
+            if fat_entry == FATEntry::Unused
+                && cluster.cluster_num >= 0x0ffffff7
+                && cluster.cluster_num <= 0x0fffffff
+            {
+                error!(
+                    "FAT32: Reserved Cluster {:?} cannot be marked as free",
+                    cluster
+                );
+                return Err(SystemError::EPERM);
             }
-            FATType::FAT32(_) => {
-                let fat_size: u64 = self.fat_size();
-                let bound: u64 = if self.mirroring_enabled() {
-                    1
-                } else {
-                    self.bpb.num_fats as u64
-                };
-                // debug!("set entry, bound={bound}, fat_size={fat_size}");
-                for i in 0..bound {
-                    // 当前操作的FAT表在磁盘上的字节偏移量
-                    let f_offset: u64 = fat_part_bytes_offset + i * fat_size;
-                    let in_block_offset: u64 = self.get_in_block_offset(f_offset);
-                    let lba = self.gendisk_lba_from_offset(self.bytes_to_sector(f_offset));
-
-                    // debug!("set entry, lba={lba}, in_block_offset={in_block_offset}");
-                    let mut v: Vec<u8> = vec![0; LBA_SIZE];
-                    self.gendisk.read_at(&mut v, lba)?;
-
-                    let mut cursor: VecCursor = VecCursor::new(v);
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-
-                    // FAT32的高4位保留
-                    let old_bits = cursor.read_u32()? & 0xf0000000;
-
-                    if fat_entry == FATEntry::Unused
-                        && cluster.cluster_num >= 0x0ffffff7
-                        && cluster.cluster_num <= 0x0fffffff
-                    {
-                        error!(
-                            "FAT32: Reserved Cluster {:?} cannot be marked as free",
-                            cluster
-                        );
-                        return Err(SystemError::EPERM);
-                    }
-
-                    // 计算要写入的值
-                    let mut raw_val: u32 = match fat_entry {
-                        FATEntry::Unused => 0,
-                        FATEntry::Bad => 0x0FFFFFF7,
-                        FATEntry::EndOfChain => 0x0FFFFFFF,
-                        FATEntry::Next(c) => c.cluster_num as u32,
-                    };
-
-                    // 恢复保留位
-                    raw_val |= old_bits;
-
-                    // debug!("sent entry, raw_val={raw_val}");
-
-                    cursor.seek(SeekFrom::SeekSet(in_block_offset as i64))?;
-                    cursor.write_u32(raw_val)?;
+        }
 
-                    self.gendisk.write_at(cursor.as_slice(), lba)?;
-                }
+        // 只修改内存中的FAT表并标记对应的扇区为脏，由页面回收线程周期性地写回，
+        // 或者在sync/syncfs/卸载时写回
+        return self
+            .fat_table
+            .set(cluster.cluster_num, self.fat_entry_raw_value(fat_entry));
+    }
 
-                return Ok(());
-            }
+    /// @brief 计算FAT表项在FAT表中存储的原始值
+    fn fat_entry_raw_value(&self, fat_entry: FATEntry) -> u32 {
+        match self.bpb.fat_type {
+            FATType::FAT12(_) => match fat_entry {
+                FATEntry::Unused => 0,
+                FATEntry::Bad => 0xff7,
+                FATEntry::EndOfChain => 0xfff,
+                FATEntry::Next(c) => c.cluster_num as u32 & 0xfff,
+            },
+            FATType::FAT16(_) => match fat_entry {
+                FATEntry::Unused => 0,
+                FATEntry::Bad => 0xfff7,
+                FATEntry::EndOfChain => 0xffff,
+                FATEntry::Next(c) => c.cluster_num as u32 & 0xffff,
+            },
+            FATType::FAT32(_) => match fat_entry {
+                FATEntry::Unused => 0,
+                FATEntry::Bad => 0x0FFFFFF7,
+                FATEntry::EndOfChain => 0x0FFFFFFF,
+                FATEntry::Next(c) => c.cluster_num as u32,
+            },
         }
     }
 
@@ -1300,7 +1103,10 @@ impl FATFsInfo {
     ///
     /// 请注意，除非手动调用`flush()`，否则本函数不会将数据刷入磁盘
     pub fn update_free_count_abs(&mut self, new_count: u32) {
-        self.free_count = new_count;
+        if self.free_count != new_count {
+            self.free_count = new_count;
+            self.dirty = true;
+        }
     }
 
     /// @brief 更新FsInfo中的“空闲簇统计信息“，把它加上delta.
@@ -1308,6 +1114,7 @@ impl FATFsInfo {
     /// 请注意，除非手动调用`flush()`，否则本函数不会将数据刷入磁盘
     pub fn update_free_count_delta(&mut self, delta: i32) {
         self.free_count = (self.free_count as i32 + delta) as u32;
+        self.dirty = true;
     }
 
     /// @brief 更新FsInfo中的“第一个空闲簇统计信息“为next_free.
@@ -1315,7 +1122,10 @@ impl FATFsInfo {
     /// 请注意，除非手动调用`flush()`，否则本函数不会将数据刷入磁盘
     pub fn update_next_free(&mut self, next_free: u32) {
         // 这个值是参考量，不一定要准确，仅供加速查找
-        self.next_free = next_free;
+        if self.next_free != next_free {
+            self.next_free = next_free;
+            self.dirty = true;
+        }
     }
 
     /// @brief 获取fs info 记载的第一个空闲簇。（不一定准确，仅供参考）
@@ -1330,7 +1140,10 @@ impl FATFsInfo {
     /// @brief 把fs info刷入磁盘
     ///
     /// @param partition fs info所在的分区
-    pub fn flush(&self, gendisk: &Arc<GenDisk>) -> Result<(), SystemError> {
+    pub fn flush(&mut self, gendisk: &Arc<GenDisk>) -> Result<(), SystemError> {
+        if !self.dirty {
+            return Ok(());
+        }
         if let Some(off) = self.offset {
             let in_block_offset = off % LBA_SIZE as u64;
 
@@ -1352,6 +1165,7 @@ impl FATFsInfo {
 
             gendisk.write_at(cursor.as_slice(), lba)?;
         }
+        self.dirty = false;
         return Ok(());
     }
 
@@ -1389,14 +1203,32 @@ impl IndexNode for LockedFATInode {
         buf: &mut [u8],
         _data: SpinLockGuard<FilePrivateData>,
     ) -> Result<usize, SystemError> {
+        let page_cache = self.0.lock().page_cache.clone();
+        match page_cache {
+            Some(page_cache) => page_cache.read(offset, &mut buf[0..len]),
+            None => self.read_sync(offset, &mut buf[0..len]),
+        }
+    }
+
+    fn write_at(
+        &self,
+        offset: usize,
+        len: usize,
+        buf: &[u8],
+        _data: SpinLockGuard<FilePrivateData>,
+    ) -> Result<usize, SystemError> {
+        let page_cache = self.0.lock().page_cache.clone();
+        match page_cache {
+            Some(page_cache) => page_cache.write(offset, &buf[0..len]),
+            None => self.write_sync(offset, &buf[0..len]),
+        }
+    }
+
+    fn read_sync(&self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
         match &guard.inode_type {
             FATDirEntry::File(f) | FATDirEntry::VolId(f) => {
-                let r = f.read(
-                    &guard.fs.upgrade().unwrap(),
-                    &mut buf[0..len],
-                    offset as u64,
-                );
+                let r = f.read(&guard.fs.upgrade().unwrap(), buf, offset as u64);
                 guard.update_metadata();
                 return r;
             }
@@ -1410,19 +1242,13 @@ impl IndexNode for LockedFATInode {
         }
     }
 
-    fn write_at(
-        &self,
-        offset: usize,
-        len: usize,
-        buf: &[u8],
-        _data: SpinLockGuard<FilePrivateData>,
-    ) -> Result<usize, SystemError> {
+    fn write_sync(&self, offset: usize, buf: &[u8]) -> Result<usize, SystemError> {
         let mut guard: SpinLockGuard<FATInode> = self.0.lock();
         let fs: &Arc<FATFileSystem> = &guard.fs.upgrade().unwrap();
 
         match &mut guard.inode_type {
             FATDirEntry::File(f) | FATDirEntry::VolId(f) => {
-                let r = f.write(fs, &buf[0..len], offset as u64);
+                let r = f.write(fs, buf, offset as u64);
                 guard.update_metadata();
                 return r;
             }
@@ -1521,6 +1347,9 @@ impl IndexNode for LockedFATInode {
                     }
                     Ordering::Less => {
                         file.truncate(fs, len as u64)?;
+                        if let Some(page_cache) = &guard.page_cache {
+                            page_cache.truncate(len);
+                        }
                     }
                 }
                 guard.update_metadata();
@@ -1851,6 +1680,19 @@ impl IndexNode for LockedFATInode {
             .ok_or(SystemError::EINVAL)
     }
 
+    fn sync(&self) -> Result<(), SystemError> {
+        let guard: SpinLockGuard<FATInode> = self.0.lock();
+        let page_cache = guard.page_cache.clone();
+        let fs = guard.fs.upgrade().unwrap();
+        drop(guard);
+
+        // 先把脏页写回文件系统，再把块设备缓存中的脏块写回磁盘
+        if let Some(page_cache) = page_cache {
+            page_cache.sync()?;
+        }
+        return fs.sync();
+    }
+
     fn page_cache(&self) -> Option<Arc<PageCache>> {
         self.0.lock().page_cache.clone()
     }
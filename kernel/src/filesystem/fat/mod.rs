@@ -1,4 +1,6 @@
 pub mod bpb;
 pub mod entry;
+pub mod extent;
+pub mod fat_table;
 pub mod fs;
 pub mod utils;
@@ -0,0 +1,247 @@
+//! # io_uring的工作线程池(io-wq)
+//!
+//! 可能阻塞的请求交给工作线程执行。工作线程执行请求时临时使用提交者的地址空间和文件描述符表，
+//! 请求中的用户缓冲区地址和文件描述符与在提交者中直接执行时含义相同。
+//!
+//! 所有io_uring实例共享同一个线程池：没有空闲的工作线程时按需创建，最多`IO_WQ_MAX_WORKERS`个。
+//! 空闲超过`IO_WQ_IDLE_TIMEOUT_US`的工作线程退出，至少保留一个。
+//!
+//! 等待文件就绪的请求（读写socket、管道，poll等）不会占用工作线程：文件没有就绪时，请求被挂起在文件上，
+//! 文件就绪之后再放回工作队列（见`IoPollWaker`）。因此大量长时间等待的请求不会耗尽工作线程，
+//! 工作线程只会被真正需要阻塞执行的请求（fsync、connect、磁盘读写等）占用。
+
+use core::{
+    sync::atomic::{AtomicUsize, Ordering},
+    task::Waker,
+};
+
+use alloc::{
+    boxed::Box,
+    collections::VecDeque,
+    format,
+    sync::{Arc, Weak},
+    task::Wake,
+};
+use log::warn;
+use system_error::SystemError;
+
+use crate::{
+    filesystem::vfs::file::FileDescriptorVec,
+    libs::{rwlock::RwLock, spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::ucontext::AddressSpace,
+    net::event_poll::FilePollWaiter,
+    process::{
+        kthread::{KernelThreadClosure, KernelThreadMechanism},
+        ProcessManager,
+    },
+    time::timer::{next_n_us_timer_jiffies, Timer, TimerFunction},
+};
+
+use super::{
+    cqe_res,
+    op::{IoAsyncResult, IoRequest},
+    IoRingCtx,
+};
+
+/// 工作线程数量的上限
+const IO_WQ_MAX_WORKERS: usize = 64;
+/// 工作线程空闲多久（微秒）之后退出
+const IO_WQ_IDLE_TIMEOUT_US: u64 = 10_000_000;
+/// 挂起的请求最长等待多久（微秒）重新检查一次文件，作为就绪通知之外的兜底
+const IO_WQ_POLL_SLICE_US: u64 = 100_000;
+
+static IO_WQ: SpinLock<VecDeque<IoWork>> = SpinLock::new(VecDeque::new());
+static IO_WQ_WAIT_QUEUE: WaitQueue = WaitQueue::default();
+/// 已经创建的工作线程数
+static IO_WQ_WORKERS: AtomicUsize = AtomicUsize::new(0);
+/// 正在睡眠等待请求的工作线程数
+static IO_WQ_IDLE: AtomicUsize = AtomicUsize::new(0);
+
+/// 交给工作线程的请求
+///
+/// 只持有提交者地址空间和文件描述符表的弱引用：提交者退出之后尚未执行的请求直接取消，
+/// 同时避免“文件描述符表 -> io_uring文件 -> 请求 -> 文件描述符表”的循环引用
+#[derive(Debug)]
+struct IoWork {
+    ctx: Arc<IoRingCtx>,
+    req: IoRequest,
+    vm: Weak<AddressSpace>,
+    fd_table: Weak<RwLock<FileDescriptorVec>>,
+    /// 请求挂起时等待的文件
+    waiter: Option<Arc<FilePollWaiter>>,
+}
+
+impl IoWork {
+    fn run(mut self) {
+        let res = match self.execute() {
+            IoAsyncResult::Done(res) => res,
+            IoAsyncResult::Wait(waiter) => {
+                self.waiter = Some(waiter.clone());
+                IoPollWaker::arm(self, &waiter);
+                return;
+            }
+        };
+        self.ctx.post_cqe(self.req.user_data(), cqe_res(res));
+    }
+
+    fn execute(&mut self) -> IoAsyncResult {
+        if self.ctx.is_dead() {
+            return IoAsyncResult::Done(Err(SystemError::ECANCELED));
+        }
+        let (Some(vm), Some(fd_table)) = (self.vm.upgrade(), self.fd_table.upgrade()) else {
+            return IoAsyncResult::Done(Err(SystemError::ECANCELED));
+        };
+        let _user_context = KernelThreadMechanism::use_user_context(vm, fd_table);
+        return self.req.execute_async(&self.ctx, self.waiter.take());
+    }
+}
+
+/// # 挂起在文件上等待就绪的请求
+///
+/// 文件就绪、io_uring被关闭或者兜底的定时器到期时，请求被放回工作队列，由工作线程重新检查文件是否就绪。
+/// 请求只会被放回一次
+#[derive(Debug)]
+struct IoPollWaker {
+    work: SpinLock<Option<IoWork>>,
+    timer: SpinLock<Option<Arc<Timer>>>,
+}
+
+impl IoPollWaker {
+    /// 把请求挂起在`waiter`上
+    fn arm(work: IoWork, waiter: &FilePollWaiter) {
+        let poll_waker = Arc::new(Self {
+            work: SpinLock::new(Some(work)),
+            timer: SpinLock::new(None),
+        });
+        let timer = Timer::new(
+            Box::new(IoPollTimerFunc(poll_waker.clone())),
+            next_n_us_timer_jiffies(IO_WQ_POLL_SLICE_US),
+        );
+        *poll_waker.timer.lock_irqsave() = Some(timer.clone());
+        timer.activate();
+
+        waiter.arm(Waker::from(poll_waker.clone()));
+        // 注册唤醒器之前文件可能已经就绪
+        if !waiter.poll().is_empty() {
+            poll_waker.requeue(true);
+        }
+    }
+
+    /// 把请求放回工作队列
+    ///
+    /// ## 参数
+    /// - `cancel_timer`：是否取消兜底的定时器。在定时器函数中调用时为`false`
+    fn requeue(&self, cancel_timer: bool) {
+        let Some(work) = self.work.lock_irqsave().take() else {
+            return;
+        };
+        let timer = self.timer.lock_irqsave().take();
+        if let Some(timer) = timer {
+            if cancel_timer {
+                timer.cancel();
+            }
+        }
+        io_wq_requeue(work);
+    }
+}
+
+impl Wake for IoPollWaker {
+    fn wake(self: Arc<Self>) {
+        self.requeue(true);
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        self.requeue(true);
+    }
+}
+
+#[derive(Debug)]
+struct IoPollTimerFunc(Arc<IoPollWaker>);
+
+impl TimerFunction for IoPollTimerFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        self.0.requeue(false);
+        return Ok(());
+    }
+}
+
+/// 把请求交给工作线程执行，以当前进程作为提交者
+pub fn io_wq_enqueue(ctx: Arc<IoRingCtx>, req: IoRequest) {
+    let pcb = ProcessManager::current_pcb();
+    let vm = pcb
+        .basic()
+        .user_vm()
+        .as_ref()
+        .map(Arc::downgrade)
+        .unwrap_or_default();
+    let work = IoWork {
+        ctx,
+        req,
+        vm,
+        fd_table: Arc::downgrade(&pcb.fd_table()),
+        waiter: None,
+    };
+
+    let mut queue = IO_WQ.lock_irqsave();
+    queue.push_back(work);
+    let need_worker = queue.len() > IO_WQ_IDLE.load(Ordering::SeqCst);
+    drop(queue);
+
+    if need_worker {
+        io_wq_create_worker();
+    }
+    IO_WQ_WAIT_QUEUE.wakeup(None);
+}
+
+/// 把挂起的请求放回工作队列，可以在中断上下文中调用
+///
+/// 挂起的请求一定是某个工作线程执行过的，而最后一个工作线程不会退出，因此这里只唤醒工作线程，不会创建新的工作线程
+fn io_wq_requeue(work: IoWork) {
+    IO_WQ.lock_irqsave().push_back(work);
+    IO_WQ_WAIT_QUEUE.wakeup(None);
+}
+
+/// 创建一个工作线程，已经达到上限时什么也不做
+fn io_wq_create_worker() {
+    let nr = IO_WQ_WORKERS.fetch_add(1, Ordering::SeqCst);
+    if nr >= IO_WQ_MAX_WORKERS {
+        IO_WQ_WORKERS.fetch_sub(1, Ordering::SeqCst);
+        return;
+    }
+    let closure = KernelThreadClosure::StaticEmptyClosure((&(io_wq_worker as fn() -> i32), ()));
+    if KernelThreadMechanism::create_and_run(closure, format!("io_wq_{}", nr)).is_none() {
+        IO_WQ_WORKERS.fetch_sub(1, Ordering::SeqCst);
+        warn!("io_wq: failed to create worker thread");
+    }
+}
+
+/// 工作线程的主循环
+fn io_wq_worker() -> i32 {
+    let timer = ProcessManager::current_pcb().sleep_timer();
+    // 上一次睡眠是否因为空闲超时而结束
+    let mut idle_expired = false;
+    loop {
+        let mut queue = IO_WQ.lock_irqsave();
+        if let Some(work) = queue.pop_front() {
+            drop(queue);
+            idle_expired = false;
+            work.run();
+            continue;
+        }
+
+        // 持有队列的锁检查和减少线程数，与io_wq_enqueue判断是否需要创建工作线程互斥
+        if idle_expired && IO_WQ_WORKERS.load(Ordering::SeqCst) > 1 {
+            IO_WQ_WORKERS.fetch_sub(1, Ordering::SeqCst);
+            return 0;
+        }
+
+        timer.rearm(next_n_us_timer_jiffies(IO_WQ_IDLE_TIMEOUT_US));
+        IO_WQ_IDLE.fetch_add(1, Ordering::SeqCst);
+        IO_WQ_WAIT_QUEUE.sleep_unlock_spinlock(queue);
+        // 被定时器唤醒时还在等待队列中
+        IO_WQ_WAIT_QUEUE.finish_wait();
+        IO_WQ_IDLE.fetch_sub(1, Ordering::SeqCst);
+        idle_expired = timer.timeout();
+        timer.cancel();
+    }
+}
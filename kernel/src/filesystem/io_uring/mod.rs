@@ -0,0 +1,921 @@
+//! # io_uring：基于共享环形队列的异步系统调用接口
+//!
+//! 用户程序把请求(SQE)写入提交队列，通过一次`io_uring_enter`批量提交；
+//! 内核执行完请求后把结果(CQE)写入完成队列，用户程序直接从共享内存中读取，不需要额外的系统调用。
+//!
+//! - 两个队列所在的内存在`io_uring_setup`时由内核分配并映射到调用者的地址空间，
+//!   映射地址通过`io_sqring_offsets::user_addr`和`io_cqring_offsets::user_addr`返回给用户
+//! - 已经就绪、不会阻塞的请求在提交时直接执行；可能阻塞的请求交给工作线程池(io-wq)执行，见[`io_wq`]
+//!
+//! 参考：https://code.dragonos.org.cn/xref/linux-6.6.21/io_uring/io_uring.c
+
+use core::{
+    any::Any,
+    mem::{offset_of, size_of},
+    sync::atomic::{AtomicBool, AtomicU32, Ordering},
+};
+
+use alloc::{
+    boxed::Box,
+    collections::{LinkedList, VecDeque},
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use system_error::SystemError;
+
+use crate::{
+    arch::MMArch,
+    filesystem::vfs::{
+        file::{FileMode, PageCache},
+        syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata,
+    },
+    libs::{
+        align::page_align_up,
+        mutex::Mutex,
+        spinlock::{SpinLock, SpinLockGuard},
+        wait_queue::WaitQueue,
+    },
+    mm::{
+        allocator::page_frame::{
+            allocate_page_frames, deallocate_page_frames, PageFrameCount, PhysPageFrame,
+            VirtPageFrame,
+        },
+        page::{page_manager, EntryFlags, Page, PageFlushAll},
+        syscall::ProtFlags,
+        ucontext::{AddressSpace, VMA},
+        MemoryManagementArch, PhysAddr, VirtAddr, VmFlags,
+    },
+    net::event_poll::{EPollEventType, EPollItem, EventPoll, FilePollWaiter, KernelIoctlData},
+    sched::SchedMode,
+    syscall::user_access::UserBufferReader,
+    time::{
+        jiffies::NSEC_PER_JIFFY,
+        timer::{next_n_us_timer_jiffies, Timer, TimerFunction},
+        PosixTimeSpec,
+    },
+};
+
+use self::op::IoRequest;
+
+pub mod io_wq;
+pub mod op;
+pub mod syscall;
+
+/// 提交队列的最大长度
+const IORING_MAX_ENTRIES: u32 = 32768;
+/// 完成队列的最大长度
+const IORING_MAX_CQ_ENTRIES: u32 = 2 * IORING_MAX_ENTRIES;
+
+/// 完成队列溢出，有CQE暂存在内核中（`IoRings::sq_flags`）
+const IORING_SQ_CQ_OVERFLOW: u32 = 1 << 1;
+
+bitflags! {
+    /// io_uring_setup的标志
+    pub struct IoUringSetupFlags: u32 {
+        /// 由`IoUringParams::cq_entries`指定完成队列的长度
+        const IORING_SETUP_CQSIZE = 1 << 3;
+        /// 队列长度超过上限时截断为上限，而不是返回EINVAL
+        const IORING_SETUP_CLAMP = 1 << 4;
+    }
+
+    /// 内核支持的特性，在`IoUringParams::features`中返回给用户
+    pub struct IoUringFeatures: u32 {
+        /// 提交队列和完成队列使用同一块内存
+        const IORING_FEAT_SINGLE_MMAP = 1 << 0;
+        /// 完成队列满时CQE暂存在内核中，不会丢失
+        const IORING_FEAT_NODROP = 1 << 1;
+        /// 提交之后SQE即可被用户复用
+        const IORING_FEAT_SUBMIT_STABLE = 1 << 2;
+    }
+
+    /// io_uring_enter的标志
+    pub struct IoUringEnterFlags: u32 {
+        /// 等待至少`min_complete`个请求完成
+        const IORING_ENTER_GETEVENTS = 1 << 0;
+        /// 唤醒内核提交线程（没有提交线程，忽略）
+        const IORING_ENTER_SQ_WAKEUP = 1 << 1;
+        /// 等待提交队列有空位（没有提交线程，忽略）
+        const IORING_ENTER_SQ_WAIT = 1 << 2;
+    }
+}
+
+/// 提交队列各字段相对于环形缓冲区起始地址的偏移
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct IoSqringOffsets {
+    pub head: u32,
+    pub tail: u32,
+    pub ring_mask: u32,
+    pub ring_entries: u32,
+    pub flags: u32,
+    pub dropped: u32,
+    pub array: u32,
+    pub resv1: u32,
+    /// SQE数组映射到用户地址空间中的地址
+    pub user_addr: u64,
+}
+
+/// 完成队列各字段相对于环形缓冲区起始地址的偏移
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct IoCqringOffsets {
+    pub head: u32,
+    pub tail: u32,
+    pub ring_mask: u32,
+    pub ring_entries: u32,
+    pub overflow: u32,
+    pub cqes: u32,
+    pub flags: u32,
+    pub resv1: u32,
+    /// 环形缓冲区映射到用户地址空间中的地址
+    pub user_addr: u64,
+}
+
+/// io_uring_setup的参数，内核填写队列长度、特性和各字段的偏移后写回用户空间
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct IoUringParams {
+    pub sq_entries: u32,
+    pub cq_entries: u32,
+    pub flags: u32,
+    pub sq_thread_cpu: u32,
+    pub sq_thread_idle: u32,
+    pub features: u32,
+    pub wq_fd: u32,
+    pub resv: [u32; 3],
+    pub sq_off: IoSqringOffsets,
+    pub cq_off: IoCqringOffsets,
+}
+
+/// 提交队列项
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct IoUringSqe {
+    pub opcode: u8,
+    pub flags: u8,
+    pub ioprio: u16,
+    pub fd: i32,
+    /// 文件偏移，accept、connect中为地址长度
+    pub off: u64,
+    /// 缓冲区、iovec数组或者时间的地址
+    pub addr: u64,
+    pub len: u32,
+    /// 各操作自己的标志，比如recv/send的msg_flags、poll的事件
+    pub op_flags: u32,
+    pub user_data: u64,
+    pub buf_index: u16,
+    pub personality: u16,
+    pub splice_fd_in: i32,
+    pub addr3: u64,
+    pub pad: u64,
+}
+
+/// 完成队列项
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct IoUringCqe {
+    pub user_data: u64,
+    /// 请求的返回值，出错时为负的错误码
+    pub res: i32,
+    pub flags: u32,
+}
+
+/// 队列的头尾指针，单独占一个缓存行，避免用户和内核更新不同指针时互相干扰
+#[repr(C, align(64))]
+#[derive(Debug)]
+struct IoUringHeadTail {
+    head: AtomicU32,
+    tail: AtomicU32,
+}
+
+/// 环形缓冲区开头的控制信息，之后依次是CQE数组和提交队列的索引数组
+///
+/// 提交队列由用户推进tail、内核推进head；完成队列由内核推进tail、用户推进head
+#[repr(C)]
+#[derive(Debug)]
+struct IoRings {
+    sq: IoUringHeadTail,
+    cq: IoUringHeadTail,
+    sq_ring_mask: u32,
+    cq_ring_mask: u32,
+    sq_ring_entries: u32,
+    cq_ring_entries: u32,
+    /// 因为索引越界而被丢弃的SQE数量
+    sq_dropped: AtomicU32,
+    sq_flags: AtomicU32,
+    cq_flags: AtomicU32,
+    cq_overflow: AtomicU32,
+}
+
+/// 内核分配、映射到用户地址空间的一段连续物理内存
+#[derive(Debug)]
+struct RingRegion {
+    paddr: PhysAddr,
+    count: PageFrameCount,
+    /// 在创建者地址空间中的起始地址
+    uaddr: VirtAddr,
+}
+
+impl RingRegion {
+    /// 分配至少`size`字节、已清零的内存，并映射到当前进程的地址空间
+    fn new(size: usize) -> Result<Self, SystemError> {
+        let count = PageFrameCount::from_bytes(page_align_up(size)).unwrap();
+        let (paddr, count) = unsafe { allocate_page_frames(count) }.ok_or(SystemError::ENOMEM)?;
+        unsafe {
+            core::ptr::write_bytes(
+                MMArch::phys_2_virt(paddr).unwrap().data() as *mut u8,
+                0,
+                count.bytes(),
+            )
+        };
+
+        let page_manager = page_manager();
+        let mut frame = PhysPageFrame::new(paddr);
+        for _ in 0..count.data() {
+            let page = Arc::new(Page::new(false, frame.phys_address()));
+            // 用户解除映射之后内核仍在使用这些页面，由RingRegion负责回收
+            page.write_irqsave().set_dealloc_when_zero(false);
+            page_manager.insert(frame.phys_address(), &page);
+            frame = frame.next();
+        }
+
+        let mut region = Self {
+            paddr,
+            count,
+            uaddr: VirtAddr::new(0),
+        };
+        region.uaddr = region.map()?;
+        return Ok(region);
+    }
+
+    /// 把内存映射到当前进程地址空间中的空闲区域，fork之后父子进程共享
+    fn map(&self) -> Result<VirtAddr, SystemError> {
+        let address_space = AddressSpace::current()?;
+        let mut guard = address_space.write();
+        let region = guard
+            .mappings
+            .find_free(VirtAddr::new(0), self.count.bytes())
+            .ok_or(SystemError::ENOMEM)?;
+        let vma = VMA::physmap(
+            PhysPageFrame::new(self.paddr),
+            VirtPageFrame::new(region.start()),
+            self.count,
+            VmFlags::VM_READ | VmFlags::VM_WRITE | VmFlags::VM_SHARED,
+            EntryFlags::from_prot_flags(ProtFlags::PROT_READ | ProtFlags::PROT_WRITE, true),
+            &mut guard.user_mapper.utable,
+            PageFlushAll::<MMArch>::new(),
+        )?;
+        guard.mappings.insert_vma(vma);
+        return Ok(region.start());
+    }
+
+    /// 内核访问这段内存使用的地址
+    fn kaddr(&self) -> usize {
+        return unsafe { MMArch::phys_2_virt(self.paddr) }.unwrap().data();
+    }
+}
+
+impl Drop for RingRegion {
+    fn drop(&mut self) {
+        let page_manager = page_manager();
+        let mut frame = PhysPageFrame::new(self.paddr);
+        for _ in 0..self.count.data() {
+            let page = page_manager.get_unwrap(&frame.phys_address());
+            let mut page_guard = page.write_irqsave();
+            if page_guard.map_count() == 0 {
+                drop(page_guard);
+                unsafe { deallocate_page_frames(frame, PageFrameCount::new(1)) };
+            } else {
+                // 还有进程映射着，最后一个映射解除时回收
+                page_guard.set_dealloc_when_zero(true);
+            }
+            frame = frame.next();
+        }
+    }
+}
+
+/// 等待中的超时请求
+#[derive(Debug)]
+struct IoTimeout {
+    id: u64,
+    user_data: u64,
+    /// 已完成的请求数达到该值时提前完成，`None`表示只按时间触发
+    target: Option<u64>,
+    timer: Arc<Timer>,
+}
+
+/// 完成一侧的状态，由`IoRingCtx::completion`保护
+#[derive(Debug)]
+struct IoCompletionState {
+    /// 完成队列满时暂存的CQE
+    overflow: VecDeque<IoUringCqe>,
+    /// 内核一侧的完成队列尾
+    cq_tail: u32,
+    /// 已经完成的请求数（不含超时请求本身），用于按完成数量触发的超时请求
+    completed: u64,
+    timeouts: Vec<IoTimeout>,
+    next_timeout_id: u64,
+}
+
+/// 一个io_uring实例
+#[derive(Debug)]
+pub struct IoRingCtx {
+    /// 两个队列的控制信息、CQE数组和提交队列的索引数组
+    rings: RingRegion,
+    /// SQE数组
+    sqes: RingRegion,
+    sq_entries: u32,
+    cq_entries: u32,
+    /// 内核一侧的提交队列头，提交请求时持有
+    submit_lock: Mutex<u32>,
+    completion: SpinLock<IoCompletionState>,
+    /// 等待请求完成的进程
+    cq_wait: WaitQueue,
+    epitems: SpinLock<LinkedList<Arc<EPollItem>>>,
+    /// io_uring已经被关闭，工作线程中尚未执行的请求直接取消
+    dead: AtomicBool,
+    /// 工作线程中正在等待文件就绪的请求
+    pollers: SpinLock<Vec<Arc<FilePollWaiter>>>,
+    self_ref: Weak<IoRingCtx>,
+}
+
+impl IoRingCtx {
+    /// ## 创建io_uring实例，并把队列映射到当前进程的地址空间
+    ///
+    /// ## 参数
+    /// - `entries`：提交队列的长度
+    /// - `p`：用户传入的参数，返回时填写了队列长度、特性和各字段的偏移
+    fn new(entries: u32, p: &mut IoUringParams) -> Result<Arc<Self>, SystemError> {
+        let flags = IoUringSetupFlags::from_bits(p.flags).ok_or(SystemError::EINVAL)?;
+        if p.resv.iter().any(|x| *x != 0) {
+            return Err(SystemError::EINVAL);
+        }
+        let clamp = flags.contains(IoUringSetupFlags::IORING_SETUP_CLAMP);
+
+        if entries == 0 {
+            return Err(SystemError::EINVAL);
+        }
+        if entries > IORING_MAX_ENTRIES && !clamp {
+            return Err(SystemError::EINVAL);
+        }
+        let sq_entries = entries.min(IORING_MAX_ENTRIES).next_power_of_two();
+
+        let cq_entries = if flags.contains(IoUringSetupFlags::IORING_SETUP_CQSIZE) {
+            if p.cq_entries == 0 || (p.cq_entries > IORING_MAX_CQ_ENTRIES && !clamp) {
+                return Err(SystemError::EINVAL);
+            }
+            let cq_entries = p.cq_entries.min(IORING_MAX_CQ_ENTRIES).next_power_of_two();
+            if cq_entries < sq_entries {
+                return Err(SystemError::EINVAL);
+            }
+            cq_entries
+        } else {
+            2 * sq_entries
+        };
+
+        let sq_array_off = size_of::<IoRings>() + cq_entries as usize * size_of::<IoUringCqe>();
+        let rings_size = sq_array_off + sq_entries as usize * size_of::<u32>();
+        let rings = RingRegion::new(rings_size)?;
+        let sqes = RingRegion::new(sq_entries as usize * size_of::<IoUringSqe>())?;
+
+        unsafe {
+            (rings.kaddr() as *mut IoRings).write(IoRings {
+                sq: IoUringHeadTail {
+                    head: AtomicU32::new(0),
+                    tail: AtomicU32::new(0),
+                },
+                cq: IoUringHeadTail {
+                    head: AtomicU32::new(0),
+                    tail: AtomicU32::new(0),
+                },
+                sq_ring_mask: sq_entries - 1,
+                cq_ring_mask: cq_entries - 1,
+                sq_ring_entries: sq_entries,
+                cq_ring_entries: cq_entries,
+                sq_dropped: AtomicU32::new(0),
+                sq_flags: AtomicU32::new(0),
+                cq_flags: AtomicU32::new(0),
+                cq_overflow: AtomicU32::new(0),
+            })
+        };
+
+        p.sq_entries = sq_entries;
+        p.cq_entries = cq_entries;
+        p.features = (IoUringFeatures::IORING_FEAT_SINGLE_MMAP
+            | IoUringFeatures::IORING_FEAT_NODROP
+            | IoUringFeatures::IORING_FEAT_SUBMIT_STABLE)
+            .bits();
+        p.sq_off = IoSqringOffsets {
+            head: (offset_of!(IoRings, sq) + offset_of!(IoUringHeadTail, head)) as u32,
+            tail: (offset_of!(IoRings, sq) + offset_of!(IoUringHeadTail, tail)) as u32,
+            ring_mask: offset_of!(IoRings, sq_ring_mask) as u32,
+            ring_entries: offset_of!(IoRings, sq_ring_entries) as u32,
+            flags: offset_of!(IoRings, sq_flags) as u32,
+            dropped: offset_of!(IoRings, sq_dropped) as u32,
+            array: sq_array_off as u32,
+            resv1: 0,
+            user_addr: sqes.uaddr.data() as u64,
+        };
+        p.cq_off = IoCqringOffsets {
+            head: (offset_of!(IoRings, cq) + offset_of!(IoUringHeadTail, head)) as u32,
+            tail: (offset_of!(IoRings, cq) + offset_of!(IoUringHeadTail, tail)) as u32,
+            ring_mask: offset_of!(IoRings, cq_ring_mask) as u32,
+            ring_entries: offset_of!(IoRings, cq_ring_entries) as u32,
+            overflow: offset_of!(IoRings, cq_overflow) as u32,
+            cqes: size_of::<IoRings>() as u32,
+            flags: offset_of!(IoRings, cq_flags) as u32,
+            resv1: 0,
+            user_addr: rings.uaddr.data() as u64,
+        };
+
+        return Ok(Arc::new_cyclic(|self_ref| Self {
+            rings,
+            sqes,
+            sq_entries,
+            cq_entries,
+            submit_lock: Mutex::new(0),
+            completion: SpinLock::new(IoCompletionState {
+                overflow: VecDeque::new(),
+                cq_tail: 0,
+                completed: 0,
+                timeouts: Vec::new(),
+                next_timeout_id: 0,
+            }),
+            cq_wait: WaitQueue::default(),
+            epitems: SpinLock::new(LinkedList::new()),
+            dead: AtomicBool::new(false),
+            pollers: SpinLock::new(Vec::new()),
+            self_ref: self_ref.clone(),
+        }));
+    }
+
+    #[inline]
+    fn rings(&self) -> &IoRings {
+        return unsafe { &*(self.rings.kaddr() as *const IoRings) };
+    }
+
+    #[inline]
+    fn cqes(&self) -> *mut IoUringCqe {
+        return (self.rings.kaddr() + size_of::<IoRings>()) as *mut IoUringCqe;
+    }
+
+    #[inline]
+    fn sq_array(&self) -> *const u32 {
+        return (self.cqes() as usize + self.cq_entries as usize * size_of::<IoUringCqe>())
+            as *const u32;
+    }
+
+    #[inline]
+    fn sqe_array(&self) -> *const IoUringSqe {
+        return self.sqes.kaddr() as *const IoUringSqe;
+    }
+
+    #[inline]
+    pub fn is_dead(&self) -> bool {
+        return self.dead.load(Ordering::SeqCst);
+    }
+
+    /// 完成队列中尚未被用户取走的CQE数量
+    fn cq_ready(&self) -> u32 {
+        let rings = self.rings();
+        let tail = rings.cq.tail.load(Ordering::Acquire);
+        let head = rings.cq.head.load(Ordering::Acquire);
+        return tail.wrapping_sub(head).min(self.cq_entries);
+    }
+
+    /// 提交队列中尚未被内核取走的SQE数量
+    fn sq_pending(&self) -> u32 {
+        let rings = self.rings();
+        let tail = rings.sq.tail.load(Ordering::Acquire);
+        let head = rings.sq.head.load(Ordering::Acquire);
+        return tail.wrapping_sub(head).min(self.sq_entries);
+    }
+
+    /// ## 从提交队列中取出并发起至多`to_submit`个请求
+    ///
+    /// ## 返回值
+    ///
+    /// 取出的请求数，不包括因为索引越界而被丢弃的SQE
+    fn submit(&self, to_submit: u32) -> u32 {
+        let mut head = self.submit_lock.lock();
+        let rings = self.rings();
+        let tail = rings.sq.tail.load(Ordering::Acquire);
+        let nr = tail.wrapping_sub(*head).min(self.sq_entries).min(to_submit);
+
+        let mut submitted = 0;
+        for _ in 0..nr {
+            let idx = unsafe {
+                self.sq_array()
+                    .add((*head & (self.sq_entries - 1)) as usize)
+                    .read_volatile()
+            };
+            *head = head.wrapping_add(1);
+            if idx >= self.sq_entries {
+                rings.sq_dropped.fetch_add(1, Ordering::Relaxed);
+                rings.sq.head.store(*head, Ordering::Release);
+                continue;
+            }
+            // SQE被复制到内核中，之后用户即可复用
+            let sqe = unsafe { self.sqe_array().add(idx as usize).read_volatile() };
+            rings.sq.head.store(*head, Ordering::Release);
+
+            submitted += 1;
+            self.issue(&sqe);
+        }
+        return submitted;
+    }
+
+    /// 发起一个请求：能立即完成的直接执行，否则交给工作线程
+    fn issue(&self, sqe: &IoUringSqe) {
+        let req = match IoRequest::prep(sqe) {
+            Ok(req) => req,
+            Err(e) => return self.post_cqe(sqe.user_data, e.to_posix_errno()),
+        };
+        let r = if req.is_timeout() {
+            // 超时请求在触发时才完成
+            match self.arm_timeout(sqe) {
+                Ok(()) => return,
+                Err(e) => Err(e),
+            }
+        } else if req.can_issue_inline() {
+            req.execute()
+        } else {
+            io_wq::io_wq_enqueue(self.self_ref.upgrade().unwrap(), req);
+            return;
+        };
+        self.post_cqe(sqe.user_data, cqe_res(r));
+    }
+
+    /// 写入一个请求的完成结果，并唤醒等待者
+    pub fn post_cqe(&self, user_data: u64, res: i32) {
+        let mut state = self.completion.lock_irqsave();
+        self.fill_cqe(
+            &mut state,
+            IoUringCqe {
+                user_data,
+                res,
+                flags: 0,
+            },
+        );
+        state.completed += 1;
+        self.complete_count_timeouts(&mut state);
+        drop(state);
+        self.wakeup_cq();
+    }
+
+    /// 把CQE写入完成队列，队列满时暂存到溢出列表中
+    fn fill_cqe(&self, state: &mut IoCompletionState, cqe: IoUringCqe) {
+        if !state.overflow.is_empty() || !self.commit_cqe(state, &cqe) {
+            state.overflow.push_back(cqe);
+            self.rings()
+                .sq_flags
+                .fetch_or(IORING_SQ_CQ_OVERFLOW, Ordering::Release);
+        }
+    }
+
+    /// 完成队列有空位时写入CQE，并把新的队列尾发布给用户
+    fn commit_cqe(&self, state: &mut IoCompletionState, cqe: &IoUringCqe) -> bool {
+        let rings = self.rings();
+        let head = rings.cq.head.load(Ordering::Acquire);
+        if state.cq_tail.wrapping_sub(head) >= self.cq_entries {
+            return false;
+        }
+        unsafe {
+            self.cqes()
+                .add((state.cq_tail & (self.cq_entries - 1)) as usize)
+                .write_volatile(*cqe)
+        };
+        state.cq_tail = state.cq_tail.wrapping_add(1);
+        rings.cq.tail.store(state.cq_tail, Ordering::Release);
+        return true;
+    }
+
+    /// 把溢出列表中的CQE尽量移回完成队列
+    fn flush_overflow(&self) {
+        if self.rings().sq_flags.load(Ordering::Acquire) & IORING_SQ_CQ_OVERFLOW == 0 {
+            return;
+        }
+        let mut state = self.completion.lock_irqsave();
+        while let Some(cqe) = state.overflow.front().copied() {
+            if !self.commit_cqe(&mut state, &cqe) {
+                break;
+            }
+            state.overflow.pop_front();
+        }
+        if state.overflow.is_empty() {
+            self.rings()
+                .sq_flags
+                .fetch_and(!IORING_SQ_CQ_OVERFLOW, Ordering::Release);
+        }
+    }
+
+    fn wakeup_cq(&self) {
+        self.cq_wait.wakeup_all(None);
+        let _ = EventPoll::wakeup_epoll(
+            &self.epitems,
+            Some(EPollEventType::EPOLLIN | EPollEventType::EPOLLRDNORM),
+        );
+    }
+
+    /// ## 等待完成队列中至少有`min_complete`个CQE
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EINTR)`：等待被信号打断
+    fn wait_cqes(&self, min_complete: u32) -> Result<(), SystemError> {
+        let min_complete = min_complete.min(self.cq_entries);
+        loop {
+            self.flush_overflow();
+            if self.cq_ready() >= min_complete {
+                return Ok(());
+            }
+            let r = wq_wait_event_interruptible!(
+                self.cq_wait,
+                self.cq_ready() >= min_complete
+                    || (self.rings().sq_flags.load(Ordering::Acquire) & IORING_SQ_CQ_OVERFLOW != 0
+                        && self.cq_ready() < self.cq_entries),
+                {}
+            );
+            if r.is_err() {
+                return Err(SystemError::EINTR);
+            }
+        }
+    }
+
+    /// ## 发起超时请求
+    ///
+    /// `sqe.addr`指向超时时间，`sqe.off`不为0时，在此之后又完成了`off`个请求也会提前完成（返回0），
+    /// 超时触发时返回`-ETIME`
+    fn arm_timeout(&self, sqe: &IoUringSqe) -> Result<(), SystemError> {
+        // 暂不支持IORING_TIMEOUT_ABS等标志
+        if sqe.len != 1 || sqe.op_flags != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let reader = UserBufferReader::new(
+            sqe.addr as *const PosixTimeSpec,
+            size_of::<PosixTimeSpec>(),
+            true,
+        )?;
+        let mut ts = PosixTimeSpec::default();
+        reader.copy_one_from_user(&mut ts, 0)?;
+        if ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1_000_000_000 {
+            return Err(SystemError::EINVAL);
+        }
+        let delay_ns = (ts.tv_sec as u64)
+            .saturating_mul(1_000_000_000)
+            .saturating_add(ts.tv_nsec as u64);
+
+        let mut state = self.completion.lock_irqsave();
+        let id = state.next_timeout_id;
+        state.next_timeout_id += 1;
+        let target = if sqe.off == 0 {
+            None
+        } else {
+            Some(state.completed + sqe.off)
+        };
+        let timer = Timer::new(
+            Box::new(IoTimeoutFunc {
+                ctx: self.self_ref.clone(),
+                id,
+            }),
+            next_n_us_timer_jiffies(delay_ns / 1000),
+        );
+        state.timeouts.push(IoTimeout {
+            id,
+            user_data: sqe.user_data,
+            target,
+            timer: timer.clone(),
+        });
+        if delay_ns < NSEC_PER_JIFFY as u64 {
+            timer.activate_hres(delay_ns);
+        } else {
+            timer.activate();
+        }
+        return Ok(());
+    }
+
+    /// 完成数量已经达到要求的超时请求提前完成
+    fn complete_count_timeouts(&self, state: &mut IoCompletionState) {
+        let completed = state.completed;
+        while let Some(pos) = state
+            .timeouts
+            .iter()
+            .position(|t| t.target.is_some_and(|target| completed >= target))
+        {
+            let timeout = state.timeouts.swap_remove(pos);
+            timeout.timer.cancel();
+            self.fill_cqe(
+                state,
+                IoUringCqe {
+                    user_data: timeout.user_data,
+                    res: 0,
+                    flags: 0,
+                },
+            );
+        }
+    }
+
+    /// 超时请求的定时器触发
+    fn timeout_expired(&self, id: u64) {
+        let mut state = self.completion.lock_irqsave();
+        let Some(pos) = state.timeouts.iter().position(|t| t.id == id) else {
+            // 已经因为完成数量达到要求而完成
+            return;
+        };
+        let timeout = state.timeouts.swap_remove(pos);
+        self.fill_cqe(
+            &mut state,
+            IoUringCqe {
+                user_data: timeout.user_data,
+                res: SystemError::ETIME.to_posix_errno(),
+                flags: 0,
+            },
+        );
+        drop(state);
+        self.wakeup_cq();
+    }
+
+    /// 登记工作线程中等待文件就绪的请求，io_uring关闭时取消等待
+    pub fn add_poller(&self, waiter: Arc<FilePollWaiter>) {
+        self.pollers.lock_irqsave().push(waiter.clone());
+        // 关闭时可能已经遍历过pollers
+        if self.is_dead() {
+            waiter.cancel();
+        }
+    }
+
+    pub fn remove_poller(&self, waiter: &Arc<FilePollWaiter>) {
+        self.pollers
+            .lock_irqsave()
+            .retain(|x| !Arc::ptr_eq(x, waiter));
+    }
+
+    /// io_uring文件被关闭：取消所有超时请求和工作线程中尚未执行的请求
+    fn cancel_all(&self) {
+        self.dead.store(true, Ordering::SeqCst);
+        let timeouts = core::mem::take(&mut self.completion.lock_irqsave().timeouts);
+        for timeout in timeouts {
+            timeout.timer.cancel();
+        }
+        for waiter in self.pollers.lock_irqsave().iter() {
+            waiter.cancel();
+        }
+    }
+}
+
+/// 把请求的执行结果转换为CQE中的返回值
+pub fn cqe_res(r: Result<usize, SystemError>) -> i32 {
+    match r {
+        Ok(n) => n.min(i32::MAX as usize) as i32,
+        Err(e) => e.to_posix_errno(),
+    }
+}
+
+/// 超时请求的定时器函数
+#[derive(Debug)]
+struct IoTimeoutFunc {
+    ctx: Weak<IoRingCtx>,
+    id: u64,
+}
+
+impl TimerFunction for IoTimeoutFunc {
+    fn run(&mut self) -> Result<(), SystemError> {
+        if let Some(ctx) = self.ctx.upgrade() {
+            ctx.timeout_expired(self.id);
+        }
+        return Ok(());
+    }
+}
+
+/// io_uring_setup返回的文件描述符对应的inode
+#[derive(Debug)]
+pub struct IoUringInode {
+    ctx: Arc<IoRingCtx>,
+}
+
+impl IoUringInode {
+    fn new(ctx: Arc<IoRingCtx>) -> Self {
+        Self { ctx }
+    }
+
+    pub fn ctx(&self) -> &Arc<IoRingCtx> {
+        &self.ctx
+    }
+
+    pub fn remove_epoll(&self, epoll: &Weak<SpinLock<EventPoll>>) -> Result<(), SystemError> {
+        let is_remove = !self
+            .ctx
+            .epitems
+            .lock_irqsave()
+            .extract_if(|x| x.epoll().ptr_eq(epoll))
+            .collect::<Vec<_>>()
+            .is_empty();
+
+        if is_remove {
+            return Ok(());
+        }
+
+        Err(SystemError::ENOENT)
+    }
+}
+
+impl Drop for IoUringInode {
+    fn drop(&mut self) {
+        self.ctx.cancel_all();
+    }
+}
+
+impl IndexNode for IoUringInode {
+    fn open(
+        &self,
+        _data: SpinLockGuard<FilePrivateData>,
+        _mode: &FileMode,
+    ) -> Result<(), SystemError> {
+        Ok(())
+    }
+
+    fn close(&self, _data: SpinLockGuard<FilePrivateData>) -> Result<(), SystemError> {
+        Ok(())
+    }
+
+    fn read_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &mut [u8],
+        _data: SpinLockGuard<FilePrivateData>,
+    ) -> Result<usize, SystemError> {
+        Err(SystemError::EINVAL)
+    }
+
+    fn write_at(
+        &self,
+        _offset: usize,
+        _len: usize,
+        _buf: &[u8],
+        _data: SpinLockGuard<FilePrivateData>,
+    ) -> Result<usize, SystemError> {
+        Err(SystemError::EINVAL)
+    }
+
+    /// # 检查io_uring的状态
+    ///
+    /// - 完成队列中有CQE（包括暂存在内核中的）时可读
+    /// - 提交队列没有满时可写
+    fn poll(&self, _private_data: &FilePrivateData) -> Result<usize, SystemError> {
+        let ctx = &self.ctx;
+        let mut events = EPollEventType::empty();
+        if ctx.cq_ready() != 0
+            || ctx.rings().sq_flags.load(Ordering::Acquire) & IORING_SQ_CQ_OVERFLOW != 0
+        {
+            events |= EPollEventType::EPOLLIN | EPollEventType::EPOLLRDNORM;
+        }
+        if ctx.sq_pending() < ctx.sq_entries {
+            events |= EPollEventType::EPOLLOUT | EPollEventType::EPOLLWRNORM;
+        }
+        return Ok(events.bits() as usize);
+    }
+
+    fn metadata(&self) -> Result<Metadata, SystemError> {
+        let meta = Metadata {
+            mode: ModeType::from_bits_truncate(0o600),
+            file_type: FileType::File,
+            ..Default::default()
+        };
+        Ok(meta)
+    }
+
+    fn page_cache(&self) -> Option<Arc<PageCache>> {
+        None
+    }
+
+    fn kernel_ioctl(
+        &self,
+        arg: Arc<dyn KernelIoctlData>,
+        _data: &FilePrivateData,
+    ) -> Result<usize, SystemError> {
+        let epitem = arg
+            .arc_any()
+            .downcast::<EPollItem>()
+            .map_err(|_| SystemError::EFAULT)?;
+        self.ctx.epitems.lock_irqsave().push_back(epitem);
+        Ok(0)
+    }
+
+    fn fs(&self) -> Arc<dyn FileSystem> {
+        panic!("io_uring does not have a filesystem")
+    }
+
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
+    fn as_any_ref(&self) -> &dyn Any {
+        self
+    }
+
+    fn list(&self) -> Result<Vec<String>, SystemError> {
+        Err(SystemError::EINVAL)
+    }
+}
@@ -0,0 +1,303 @@
+//! io_uring支持的请求类型及其执行
+//!
+//! 请求复用对应系统调用的实现，在提交者（或借用了提交者地址空间和文件描述符表的工作线程）中执行
+
+use alloc::sync::Arc;
+use num_traits::FromPrimitive;
+use system_error::SystemError;
+
+use crate::{
+    filesystem::vfs::{
+        file::File,
+        syscall::{IoVec, IoVecs},
+        FileType,
+    },
+    net::{
+        event_poll::{EPollEventType, FilePollWaiter},
+        syscall::SockAddr,
+    },
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall,
+    },
+};
+
+use super::{IoRingCtx, IoUringSqe};
+
+/// 请求类型，编号与Linux一致
+#[derive(Debug, Clone, Copy, PartialEq, Eq, FromPrimitive)]
+pub enum IoUringOpcode {
+    Nop = 0,
+    Readv = 1,
+    Writev = 2,
+    Fsync = 3,
+    PollAdd = 6,
+    Timeout = 11,
+    Accept = 13,
+    Connect = 16,
+    Read = 22,
+    Write = 23,
+    Send = 26,
+    Recv = 27,
+}
+
+bitflags! {
+    /// SQE的标志
+    pub struct IoSqeFlags: u8 {
+        /// 总是交给工作线程执行
+        const IOSQE_ASYNC = 1 << 4;
+    }
+}
+
+/// 工作线程执行请求的结果
+pub enum IoAsyncResult {
+    /// 请求已经执行完成
+    Done(Result<usize, SystemError>),
+    /// 文件还没有就绪，需要挂起在等待者上，文件就绪之后再执行
+    Wait(Arc<FilePollWaiter>),
+}
+
+/// 一个已经通过检查的请求，SQE已经复制到内核中
+#[derive(Debug, Clone, Copy)]
+pub struct IoRequest {
+    opcode: IoUringOpcode,
+    flags: IoSqeFlags,
+    sqe: IoUringSqe,
+}
+
+impl IoRequest {
+    /// ## 检查SQE
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EINVAL)`：不支持的请求类型或者标志
+    pub fn prep(sqe: &IoUringSqe) -> Result<Self, SystemError> {
+        let opcode = IoUringOpcode::from_u8(sqe.opcode).ok_or(SystemError::EINVAL)?;
+        // 暂不支持请求链接、固定文件等标志
+        let flags = IoSqeFlags::from_bits(sqe.flags).ok_or(SystemError::EINVAL)?;
+        return Ok(Self {
+            opcode,
+            flags,
+            sqe: *sqe,
+        });
+    }
+
+    #[inline]
+    pub fn user_data(&self) -> u64 {
+        self.sqe.user_data
+    }
+
+    #[inline]
+    pub fn is_timeout(&self) -> bool {
+        self.opcode == IoUringOpcode::Timeout
+    }
+
+    /// 请求需要等待文件上的哪些事件才能不阻塞地执行，`None`表示不需要等待文件就绪
+    fn wait_events(&self) -> Option<EPollEventType> {
+        match self.opcode {
+            IoUringOpcode::Read
+            | IoUringOpcode::Readv
+            | IoUringOpcode::Recv
+            | IoUringOpcode::Accept => Some(EPollEventType::EPOLLIN),
+            IoUringOpcode::Write | IoUringOpcode::Writev | IoUringOpcode::Send => {
+                Some(EPollEventType::EPOLLOUT)
+            }
+            IoUringOpcode::PollAdd => Some(self.poll_events()),
+            _ => None,
+        }
+    }
+
+    /// poll请求关心的事件，总是包含EPOLLERR和EPOLLHUP
+    fn poll_events(&self) -> EPollEventType {
+        EPollEventType::from_bits_truncate(self.sqe.op_flags)
+            | EPollEventType::EPOLLERR
+            | EPollEventType::EPOLLHUP
+    }
+
+    /// ## 请求能否在提交时直接执行
+    ///
+    /// 文件已经就绪时直接执行，否则交给工作线程，避免阻塞提交者
+    pub fn can_issue_inline(&self) -> bool {
+        if self.flags.contains(IoSqeFlags::IOSQE_ASYNC) {
+            return false;
+        }
+        let events = match self.opcode {
+            IoUringOpcode::Nop => return true,
+            IoUringOpcode::Fsync | IoUringOpcode::Connect => return false,
+            _ => match self.wait_events() {
+                Some(events) => events,
+                None => return false,
+            },
+        };
+        // 文件描述符无效时直接执行，返回EBADF
+        let Some(file) = current_file(self.sqe.fd) else {
+            return true;
+        };
+        return match file.poll() {
+            Ok(ready) => EPollEventType::from_bits_truncate(ready as u32)
+                .intersects(events | EPollEventType::EPOLLERR | EPollEventType::EPOLLHUP),
+            // 不支持poll的普通文件和块设备读写时可能等待磁盘I/O，但不会无限期阻塞
+            Err(_) => is_seekable(&file),
+        };
+    }
+
+    /// ## 执行请求
+    ///
+    /// ## 返回值
+    ///
+    /// 与对应的系统调用相同
+    pub fn execute(&self) -> Result<usize, SystemError> {
+        let sqe = &self.sqe;
+        let len = sqe.len as usize;
+        match self.opcode {
+            IoUringOpcode::Nop => Ok(0),
+            IoUringOpcode::Read => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                let mut writer = UserBufferWriter::new(sqe.addr as *mut u8, len, true)?;
+                let buf = writer.buffer::<u8>(0)?;
+                match self.file_offset(&file) {
+                    Some(offset) => file.pread(offset, len, buf),
+                    None => file.read(len, buf),
+                }
+            }
+            IoUringOpcode::Write => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                let reader = UserBufferReader::new(sqe.addr as *const u8, len, true)?;
+                let buf = reader.read_from_user::<u8>(0)?;
+                match self.file_offset(&file) {
+                    Some(offset) => file.pwrite(offset, len, buf),
+                    None => file.write(len, buf),
+                }
+            }
+            IoUringOpcode::Readv => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                let mut iovecs = unsafe { IoVecs::from_user(sqe.addr as *const IoVec, len, true) }?;
+                let mut data = iovecs.new_buf(true);
+                let n = match self.file_offset(&file) {
+                    Some(offset) => file.pread(offset, data.len(), &mut data)?,
+                    None => file.read(data.len(), &mut data)?,
+                };
+                iovecs.scatter(&data[..n]);
+                Ok(n)
+            }
+            IoUringOpcode::Writev => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                let iovecs = unsafe { IoVecs::from_user(sqe.addr as *const IoVec, len, false) }?;
+                let data = iovecs.gather();
+                match self.file_offset(&file) {
+                    Some(offset) => file.pwrite(offset, data.len(), &data),
+                    None => file.write(data.len(), &data),
+                }
+            }
+            IoUringOpcode::Fsync => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                file.fsync().map(|_| 0)
+            }
+            IoUringOpcode::PollAdd => {
+                let file = current_file(sqe.fd).ok_or(SystemError::EBADF)?;
+                let ready = EPollEventType::from_bits_truncate(file.poll()? as u32);
+                Ok((ready & self.poll_events()).bits() as usize)
+            }
+            IoUringOpcode::Accept => Syscall::accept4(
+                sqe.fd as usize,
+                sqe.addr as *mut SockAddr,
+                sqe.off as *mut u32,
+                sqe.op_flags,
+            ),
+            IoUringOpcode::Connect => Syscall::connect(
+                sqe.fd as usize,
+                sqe.addr as *const SockAddr,
+                sqe.off as usize,
+            ),
+            IoUringOpcode::Send => {
+                let reader = UserBufferReader::new(sqe.addr as *const u8, len, true)?;
+                let buf = reader.read_from_user::<u8>(0)?;
+                Syscall::sendto(sqe.fd as usize, buf, sqe.op_flags, core::ptr::null(), 0)
+            }
+            IoUringOpcode::Recv => {
+                let mut writer = UserBufferWriter::new(sqe.addr as *mut u8, len, true)?;
+                let buf = writer.buffer::<u8>(0)?;
+                Syscall::recvfrom(
+                    sqe.fd as usize,
+                    buf,
+                    sqe.op_flags,
+                    core::ptr::null_mut(),
+                    core::ptr::null_mut(),
+                )
+            }
+            // 超时请求由IoRingCtx处理
+            IoUringOpcode::Timeout => Err(SystemError::EINVAL),
+        }
+    }
+
+    /// ## 在工作线程中执行请求
+    ///
+    /// 需要等待文件就绪的请求先检查文件是否就绪。没有就绪时返回`Wait`，由工作线程把请求挂起在文件上，
+    /// 等待期间不占用工作线程；文件就绪之后再次调用本函数执行请求。io_uring被关闭时等待被取消
+    ///
+    /// ## 参数
+    /// - `waiter`：上一次调用返回的等待者，第一次调用时为`None`
+    pub fn execute_async(
+        &self,
+        ctx: &IoRingCtx,
+        waiter: Option<Arc<FilePollWaiter>>,
+    ) -> IoAsyncResult {
+        let Some(events) = self.wait_events() else {
+            return IoAsyncResult::Done(self.execute());
+        };
+        let waiter = match waiter {
+            Some(waiter) => waiter,
+            None => {
+                let Some(file) = current_file(self.sqe.fd) else {
+                    return IoAsyncResult::Done(Err(SystemError::EBADF));
+                };
+                match FilePollWaiter::new(
+                    file,
+                    events | EPollEventType::EPOLLERR | EPollEventType::EPOLLHUP,
+                ) {
+                    Ok(waiter) => {
+                        let waiter = Arc::new(waiter);
+                        ctx.add_poller(waiter.clone());
+                        waiter
+                    }
+                    // 不支持epoll的文件直接执行，可能会阻塞工作线程
+                    Err(_) => return IoAsyncResult::Done(self.execute()),
+                }
+            }
+        };
+
+        if waiter.is_cancelled() {
+            ctx.remove_poller(&waiter);
+            return IoAsyncResult::Done(Err(SystemError::ECANCELED));
+        }
+        let ready = waiter.poll();
+        if ready.is_empty() {
+            return IoAsyncResult::Wait(waiter);
+        }
+        ctx.remove_poller(&waiter);
+        drop(waiter);
+
+        if self.opcode == IoUringOpcode::PollAdd {
+            return IoAsyncResult::Done(Ok((ready & self.poll_events()).bits() as usize));
+        }
+        return IoAsyncResult::Done(self.execute());
+    }
+
+    /// 读写使用的文件偏移。偏移为-1或者文件不支持定位时，使用并更新文件自己的偏移
+    fn file_offset(&self, file: &File) -> Option<usize> {
+        if self.sqe.off == u64::MAX || !is_seekable(file) {
+            return None;
+        }
+        return Some(self.sqe.off as usize);
+    }
+}
+
+/// 按当前进程的文件描述符表查找文件
+fn current_file(fd: i32) -> Option<Arc<File>> {
+    ProcessManager::current_pcb().get_file(fd)
+}
+
+/// 普通文件和块设备支持按偏移读写
+fn is_seekable(file: &File) -> bool {
+    matches!(file.file_type(), FileType::File | FileType::BlockDevice)
+}
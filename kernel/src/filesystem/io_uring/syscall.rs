@@ -0,0 +1,120 @@
+use core::mem::size_of;
+
+use alloc::sync::Arc;
+use system_error::SystemError;
+
+use crate::{
+    filesystem::vfs::file::{File, FileMode},
+    process::ProcessManager,
+    syscall::{
+        user_access::{UserBufferReader, UserBufferWriter},
+        Syscall,
+    },
+};
+
+use super::{IoRingCtx, IoUringEnterFlags, IoUringInode, IoUringParams};
+
+impl Syscall {
+    /// # 创建io_uring实例
+    ///
+    /// 提交队列和完成队列在这里直接映射到调用者的地址空间，映射地址通过
+    /// `params.sq_off.user_addr`（SQE数组）和`params.cq_off.user_addr`（环形缓冲区）返回，
+    /// 不需要再用mmap映射
+    ///
+    /// ## 参数
+    /// - `entries`：提交队列的长度，会向上取整到2的幂
+    /// - `params`：用户空间的`IoUringParams`，返回时填写了队列长度、特性和各字段的偏移
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：io_uring的文件描述符
+    /// - `Err(SystemError)`：创建失败
+    ///
+    /// See: https://man7.org/linux/man-pages/man2/io_uring_setup.2.html
+    pub fn io_uring_setup(entries: u32, params: *mut IoUringParams) -> Result<usize, SystemError> {
+        let mut p = IoUringParams::default();
+        UserBufferReader::new(
+            params as *const IoUringParams,
+            size_of::<IoUringParams>(),
+            true,
+        )?
+        .copy_one_from_user(&mut p, 0)?;
+
+        let ctx = IoRingCtx::new(entries, &mut p)?;
+        UserBufferWriter::new(params, size_of::<IoUringParams>(), true)?.copy_one_to_user(&p, 0)?;
+
+        let inode = Arc::new(IoUringInode::new(ctx));
+        let file = File::new(inode, FileMode::O_RDWR | FileMode::O_CLOEXEC)?;
+        let binding = ProcessManager::current_pcb().fd_table();
+        let mut fd_table_guard = binding.write();
+        let fd = fd_table_guard.alloc_fd(file, None).map(|x| x as usize);
+        return fd;
+    }
+
+    /// # 提交请求并等待完成
+    ///
+    /// ## 参数
+    /// - `fd`：io_uring的文件描述符
+    /// - `to_submit`：最多从提交队列中取出的请求数
+    /// - `min_complete`：指定了`IORING_ENTER_GETEVENTS`时，等待完成队列中至少有这么多个CQE
+    /// - `flags`：`IoUringEnterFlags`
+    /// - `sig`：等待期间使用的信号掩码，暂不支持，必须为空
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：提交的请求数
+    /// - `Err(SystemError::EINTR)`：没有提交任何请求，并且等待被信号打断
+    ///
+    /// See: https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+    pub fn io_uring_enter(
+        fd: i32,
+        to_submit: u32,
+        min_complete: u32,
+        flags: u32,
+        sig: usize,
+        _sigsz: usize,
+    ) -> Result<usize, SystemError> {
+        let flags = IoUringEnterFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        if sig != 0 {
+            return Err(SystemError::EINVAL);
+        }
+
+        let file = ProcessManager::current_pcb()
+            .fd_table()
+            .read()
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        let inode = file.inode();
+        let ctx = inode
+            .as_any_ref()
+            .downcast_ref::<IoUringInode>()
+            .ok_or(SystemError::EOPNOTSUPP_OR_ENOTSUP)?
+            .ctx();
+
+        ctx.flush_overflow();
+        let submitted = if to_submit != 0 {
+            ctx.submit(to_submit)
+        } else {
+            0
+        };
+
+        if flags.contains(IoUringEnterFlags::IORING_ENTER_GETEVENTS) {
+            if let Err(e) = ctx.wait_cqes(min_complete) {
+                if submitted == 0 {
+                    return Err(e);
+                }
+            }
+        }
+        return Ok(submitted as usize);
+    }
+
+    /// # 注册固定文件、缓冲区等资源
+    ///
+    /// 暂不支持
+    pub fn io_uring_register(
+        _fd: i32,
+        _opcode: u32,
+        _arg: usize,
+        _nr_args: u32,
+    ) -> Result<usize, SystemError> {
+        return Err(SystemError::EINVAL);
+    }
+}
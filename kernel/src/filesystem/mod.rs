@@ -2,6 +2,7 @@ pub mod devfs;
 pub mod devpts;
 pub mod eventfd;
 pub mod fat;
+pub mod io_uring;
 pub mod kernfs;
 pub mod mbr;
 pub mod procfs;
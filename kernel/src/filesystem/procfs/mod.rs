@@ -23,8 +23,9 @@ use crate::{
         rwlock::RwLock,
         spinlock::{SpinLock, SpinLockGuard},
     },
-    mm::allocator::page_frame::FrameAllocator,
+    mm::allocator::{page_frame::FrameAllocator, pcp::pcp_get},
     process::{Pid, ProcessManager},
+    smp::cpu::smp_cpu_manager,
     time::PosixTimeSpec,
 };
 
@@ -50,6 +51,8 @@ pub enum ProcFileType {
     ProcMeminfo = 1,
     /// kmsg
     ProcKmsg = 2,
+    /// 每CPU页帧缓存的统计信息
+    ProcPcpinfo = 3,
     //todo: 其他文件类型
     ///默认文件类型
     Default,
@@ -61,6 +64,7 @@ impl From<u8> for ProcFileType {
             0 => ProcFileType::ProcStatus,
             1 => ProcFileType::ProcMeminfo,
             2 => ProcFileType::ProcKmsg,
+            3 => ProcFileType::ProcPcpinfo,
             _ => ProcFileType::Default,
         }
     }
@@ -266,6 +270,42 @@ impl ProcFSInode {
         return Ok((data.len() * size_of::<u8>()) as i64);
     }
 
+    /// 打开 pcpinfo 文件
+    fn open_pcpinfo(&self, pdata: &mut ProcfsFilePrivateData) -> Result<i64, SystemError> {
+        let data: &mut Vec<u8> = &mut pdata.data;
+
+        data.append(
+            &mut "cpu\tcached\talloc_hit\talloc_miss\trefill\tfree_hit\tdrain\n"
+                .as_bytes()
+                .to_owned(),
+        );
+
+        for cpu in smp_cpu_manager().present_cpus().iter_cpu() {
+            if let Some(pcp) = pcp_get(cpu) {
+                let stat = pcp.stat();
+                data.append(
+                    &mut format!(
+                        "{}\t{}\t{}\t{}\t{}\t{}\t{}\n",
+                        cpu.data(),
+                        pcp.cached_pages(),
+                        stat.alloc_hit(),
+                        stat.alloc_miss(),
+                        stat.refill(),
+                        stat.free_hit(),
+                        stat.drain()
+                    )
+                    .as_bytes()
+                    .to_owned(),
+                );
+            }
+        }
+
+        // 去除多余的\0
+        self.trim_string(data);
+
+        return Ok((data.len() * size_of::<u8>()) as i64);
+    }
+
     /// proc文件系统读取函数
     fn proc_read(
         &self,
@@ -382,6 +422,23 @@ impl ProcFS {
             panic!("create meminfo error");
         }
 
+        // 创建pcpinfo文件
+        let binding = inode.create(
+            "pcpinfo",
+            FileType::File,
+            ModeType::from_bits_truncate(0o444),
+        );
+        if let Ok(pcpinfo) = binding {
+            let pcpinfo_file = pcpinfo
+                .as_any_ref()
+                .downcast_ref::<LockedProcFSInode>()
+                .unwrap();
+            pcpinfo_file.0.lock().fdata.pid = Pid::new(0);
+            pcpinfo_file.0.lock().fdata.ftype = ProcFileType::ProcPcpinfo;
+        } else {
+            panic!("create pcpinfo error");
+        }
+
         // 创建kmsg文件
         let binding = inode.create("kmsg", FileType::File, ModeType::from_bits_truncate(0o444));
         if let Ok(kmsg) = binding {
@@ -466,6 +523,7 @@ impl IndexNode for LockedProcFSInode {
         let file_size = match inode.fdata.ftype {
             ProcFileType::ProcStatus => inode.open_status(&mut private_data)?,
             ProcFileType::ProcMeminfo => inode.open_meminfo(&mut private_data)?,
+            ProcFileType::ProcPcpinfo => inode.open_pcpinfo(&mut private_data)?,
             _ => {
                 todo!()
             }
@@ -523,6 +581,9 @@ impl IndexNode for LockedProcFSInode {
             ProcFileType::ProcMeminfo => {
                 return inode.proc_read(offset, len, buf, &mut private_data)
             }
+            ProcFileType::ProcPcpinfo => {
+                return inode.proc_read(offset, len, buf, &mut private_data)
+            }
             ProcFileType::ProcKmsg => (),
             ProcFileType::Default => (),
         };
@@ -22,8 +22,8 @@ use alloc::{
 use system_error::SystemError;
 
 use super::vfs::{
-    file::FilePrivateData, syscall::ModeType, utils::DName, FileSystem, FileSystemMaker, FsInfo,
-    IndexNode, InodeId, Metadata, SpecialNodeData,
+    dcache::DentryCacheMode, file::FilePrivateData, syscall::ModeType, utils::DName, FileSystem,
+    FileSystemMaker, FsInfo, IndexNode, InodeId, Metadata, SpecialNodeData,
 };
 
 use linkme::distributed_slice;
@@ -95,6 +95,10 @@ impl FileSystem for RamFS {
     fn super_block(&self) -> SuperBlock {
         self.super_block.read().clone()
     }
+
+    fn dentry_cache_mode(&self) -> DentryCacheMode {
+        DentryCacheMode::CaseSensitive
+    }
 }
 
 impl RamFS {
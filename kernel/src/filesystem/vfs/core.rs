@@ -18,6 +18,7 @@ use crate::{
 };
 
 use super::{
+    dcache,
     fcntl::AtFlags,
     file::FileMode,
     mount::{init_mountlist, MOUNT_LIST},
@@ -111,6 +112,8 @@ fn migrate_virtual_filesystem(new_fs: Arc<dyn FileSystem>) -> Result<(), SystemE
         __ROOT_INODE = Some(new_root_inode.clone());
         drop(old_root_inode);
     }
+    // 旧的根文件系统的目录项不会再被访问
+    dcache::clear();
 
     info!("VFS: Migrate filesystems done!");
 
@@ -346,3 +349,21 @@ pub fn do_umount2(
     };
     return do_umount();
 }
+
+/// # sync_all_filesystems - 把所有已挂载的文件系统缓存的数据写回设备
+///
+/// 根文件系统不在挂载表中，需要单独处理。某个文件系统写回失败时，继续写回其他的文件系统
+///
+/// ## 返回值
+///
+/// - Ok(()): 全部写回成功
+/// - Err(SystemError): 最后一个失败的文件系统返回的错误
+pub fn sync_all_filesystems() -> Result<(), SystemError> {
+    let mut result = ROOT_INODE().fs().sync_fs();
+    for fs in MOUNT_LIST().filesystems() {
+        if let Err(e) = fs.sync_fs() {
+            result = Err(e);
+        }
+    }
+    return result;
+}
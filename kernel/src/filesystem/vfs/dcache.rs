@@ -0,0 +1,206 @@
+//! 目录项缓存
+//!
+//! 以(挂载的文件系统, 父目录inode, 文件名)为键缓存`MountFSInode::find`的结果，
+//! 命中时不需要进入具体文件系统的查找流程，也不需要分配内存。
+//! 查找失败(ENOENT)的结果以负目录项的形式缓存，避免反复在磁盘上查找不存在的文件。
+//!
+//! 缓存由固定数量的哈希桶组成，每个桶有自己的锁，桶内按最近使用的顺序排列，桶满时淘汰最久未使用的目录项。
+//! 目录发生变化（创建、删除、重命名）时需要使相应的目录项失效，挂载点发生变化时清空整个缓存。
+//!
+//! 只有内容完全由VFS操作改变的文件系统才能使用目录项缓存（见`FileSystem::dentry_cache_mode`），
+//! procfs、devfs、sysfs等内容动态变化的文件系统不使用缓存。
+
+use alloc::{
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use crate::libs::spinlock::SpinLock;
+
+use super::{mount::MountFSInode, IndexNode, MountFS};
+
+/// 哈希桶的数量
+const DCACHE_BUCKETS: usize = 1024;
+/// 每个哈希桶最多容纳的目录项数量
+const DCACHE_BUCKET_SIZE: usize = 8;
+
+const FNV_OFFSET_BASIS: u64 = 0xcbf2_9ce4_8422_2325;
+const FNV_PRIME: u64 = 0x0100_0000_01b3;
+
+lazy_static! {
+    static ref DCACHE: Vec<SpinLock<DCacheBucket>> = (0..DCACHE_BUCKETS)
+        .map(|_| SpinLock::new(DCacheBucket::new()))
+        .collect();
+}
+
+/// 文件系统使用目录项缓存的方式
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DentryCacheMode {
+    /// 不使用目录项缓存
+    Disabled,
+    /// 文件名区分大小写
+    CaseSensitive,
+    /// 文件名不区分大小写（如FAT），比较文件名时统一转换为大写
+    CaseInsensitive,
+}
+
+/// 目录项缓存的查找结果
+pub enum DCacheLookup {
+    /// 命中。None表示命中了负目录项，即文件不存在
+    Hit(Option<Arc<MountFSInode>>),
+    /// 未命中。查找完成后应该使用这个值调用`insert`，以便丢弃查找期间已经失效的结果
+    Miss(u64),
+}
+
+/// 查找目录项缓存使用的键
+pub struct DKey<'a> {
+    pub mount_fs: &'a Arc<MountFS>,
+    /// 父目录在具体文件系统中的inode
+    pub parent: &'a Arc<dyn IndexNode>,
+    pub name: &'a str,
+    pub mode: DentryCacheMode,
+}
+
+struct DEntry {
+    hash: u64,
+    mount_fs: Weak<MountFS>,
+    /// 持有弱引用，保证父目录的inode被释放之前，它的地址不会被其他inode复用
+    parent: Weak<dyn IndexNode>,
+    name: String,
+    /// None表示负目录项
+    inode: Option<Arc<MountFSInode>>,
+}
+
+struct DCacheBucket {
+    /// 每次有目录项失效时加一，用于丢弃查找期间已经失效的结果
+    generation: u64,
+    /// 按最近使用的顺序排列，最后一个是最近使用的
+    entries: Vec<DEntry>,
+}
+
+impl DCacheBucket {
+    fn new() -> Self {
+        Self {
+            generation: 0,
+            entries: Vec::new(),
+        }
+    }
+
+    fn position(&self, key: &DKey, hash: u64) -> Option<usize> {
+        self.entries
+            .iter()
+            .position(|entry| entry.hash == hash && key.matches(entry))
+    }
+}
+
+impl<'a> DKey<'a> {
+    fn hash(&self) -> u64 {
+        let mut hash = FNV_OFFSET_BASIS;
+        let mut feed = |x: u64| hash = (hash ^ x).wrapping_mul(FNV_PRIME);
+        feed(Arc::as_ptr(self.mount_fs) as usize as u64);
+        feed(Arc::as_ptr(self.parent) as *const u8 as usize as u64);
+        if self.mode == DentryCacheMode::CaseInsensitive {
+            self.name
+                .chars()
+                .flat_map(char::to_uppercase)
+                .for_each(|c| feed(c as u64));
+        } else {
+            self.name.bytes().for_each(|b| feed(b as u64));
+        }
+        return hash;
+    }
+
+    fn matches(&self, entry: &DEntry) -> bool {
+        if !core::ptr::eq(entry.mount_fs.as_ptr(), Arc::as_ptr(self.mount_fs))
+            || !core::ptr::eq(
+                entry.parent.as_ptr() as *const u8,
+                Arc::as_ptr(self.parent) as *const u8,
+            )
+        {
+            return false;
+        }
+        if self.mode == DentryCacheMode::CaseInsensitive {
+            return entry
+                .name
+                .chars()
+                .flat_map(char::to_uppercase)
+                .eq(self.name.chars().flat_map(char::to_uppercase));
+        }
+        return entry.name == self.name;
+    }
+
+    #[inline]
+    fn bucket(hash: u64) -> &'static SpinLock<DCacheBucket> {
+        &DCACHE[(hash % DCACHE_BUCKETS as u64) as usize]
+    }
+}
+
+/// @brief 在目录项缓存中查找
+pub fn lookup(key: &DKey) -> DCacheLookup {
+    let hash = key.hash();
+    let mut bucket = DKey::bucket(hash).lock_irqsave();
+    match bucket.position(key, hash) {
+        Some(pos) => {
+            let inode = bucket.entries[pos].inode.clone();
+            // 移动到桶的末尾，标记为最近使用
+            bucket.entries[pos..].rotate_left(1);
+            return DCacheLookup::Hit(inode);
+        }
+        None => return DCacheLookup::Miss(bucket.generation),
+    }
+}
+
+/// @brief 把查找结果加入目录项缓存
+///
+/// @param key 查找使用的键
+/// @param generation `lookup`未命中时返回的值
+/// @param inode 查找到的inode，None表示文件不存在
+pub fn insert(key: &DKey, generation: u64, inode: Option<Arc<MountFSInode>>) {
+    let hash = key.hash();
+    let mut bucket = DKey::bucket(hash).lock_irqsave();
+    if bucket.generation != generation {
+        // 查找期间目录发生了变化，结果可能已经过期
+        return;
+    }
+    let evicted = if let Some(pos) = bucket.position(key, hash) {
+        Some(bucket.entries.remove(pos))
+    } else if bucket.entries.len() >= DCACHE_BUCKET_SIZE {
+        Some(bucket.entries.remove(0))
+    } else {
+        None
+    };
+    bucket.entries.push(DEntry {
+        hash,
+        mount_fs: Arc::downgrade(key.mount_fs),
+        parent: Arc::downgrade(key.parent),
+        name: String::from(key.name),
+        inode,
+    });
+    // 释放inode可能会进入具体的文件系统，不在持有锁的时候进行
+    drop(bucket);
+    drop(evicted);
+}
+
+/// @brief 使目录项失效。目录中的文件被创建、删除或者重命名之后调用
+pub fn invalidate(key: &DKey) {
+    let hash = key.hash();
+    let mut bucket = DKey::bucket(hash).lock_irqsave();
+    let removed = bucket
+        .position(key, hash)
+        .map(|pos| bucket.entries.remove(pos));
+    bucket.generation += 1;
+    drop(bucket);
+    drop(removed);
+}
+
+/// @brief 清空目录项缓存。挂载点发生变化时调用
+pub fn clear() {
+    for bucket in DCACHE.iter() {
+        let mut bucket = bucket.lock_irqsave();
+        let entries = core::mem::take(&mut bucket.entries);
+        bucket.generation += 1;
+        drop(bucket);
+        drop(entries);
+    }
+}
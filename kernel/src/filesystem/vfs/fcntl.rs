@@ -106,3 +106,23 @@ bitflags! {
 
 /// for F_[GET|SET]FL
 pub const FD_CLOEXEC: u32 = 1;
+
+/// fadvise64 syscall advice
+///
+/// see: https://code.dragonos.org.cn/xref/linux-6.6.21/include/uapi/linux/fadvise.h
+#[derive(Debug, Copy, Clone, Eq, PartialEq, FromPrimitive, ToPrimitive)]
+#[repr(u32)]
+pub enum FadviseAdvice {
+    /// No further special treatment.
+    Normal = 0,
+    /// Expect random page references.
+    Random = 1,
+    /// Expect sequential page references.
+    Sequential = 2,
+    /// Will need these pages.
+    WillNeed = 3,
+    /// Don't need these pages.
+    DontNeed = 4,
+    /// Data will be accessed once.
+    NoReuse = 5,
+}
@@ -1,6 +1,7 @@
-use core::sync::atomic::{AtomicUsize, Ordering};
+use core::sync::atomic::{AtomicPtr, AtomicUsize, Ordering};
 
 use alloc::{
+    boxed::Box,
     string::String,
     sync::{Arc, Weak},
     vec::Vec,
@@ -9,10 +10,15 @@ use kdepends::xarray::XArray;
 use log::error;
 use system_error::SystemError;
 
-use super::{Dirent, FileType, IndexNode, InodeId, Metadata, SpecialNodeData};
+use super::{
+    fcntl::FadviseAdvice,
+    readahead::{self, FileRaState, RaWindow},
+    Dirent, FileType, IndexNode, InodeId, Metadata, SpecialNodeData,
+};
 use crate::filesystem::eventfd::EventFdInode;
+use crate::filesystem::io_uring::IoUringInode;
 use crate::{
-    arch::MMArch,
+    arch::{mm::LockedFrameAllocator, MMArch},
     driver::{
         base::{block::SeekFrom, device::DevicePrivateData},
         tty::tty_device::TtyFilePrivateData,
@@ -20,12 +26,16 @@ use crate::{
     filesystem::procfs::ProcfsFilePrivateData,
     ipc::pipe::{LockedPipeInode, PipeFsPrivateData},
     libs::{rwlock::RwLock, spinlock::SpinLock},
-    mm::{page::Page, MemoryManagementArch},
+    mm::{
+        allocator::page_frame::{FrameAllocator, PageFrameCount},
+        page::{page_manager, page_reclaimer_lock_irqsave, Page, PageFlags, PageReclaimer},
+        MemoryManagementArch, PhysAddr,
+    },
     net::{
         event_poll::{EPollItem, EPollPrivateData, EventPoll},
         socket::SocketInode,
     },
-    process::{cred::Cred, ProcessManager},
+    process::{cred::Cred, resource::RLimit64, ProcessManager},
 };
 
 /// 文件私有信息的枚举类型
@@ -123,34 +133,34 @@ impl FileMode {
 }
 
 /// 页面缓存
+///
+/// 以文件内的页号为索引缓存文件页。普通文件的read/write和mmap缺页都经过页面缓存：
+/// 缺页时通过`IndexNode::read_sync`读入，写入时只修改缓存页并标记为脏，
+/// 由页面回收线程异步回写，或者在fsync时通过`sync`强制回写。
 pub struct PageCache {
     xarray: SpinLock<XArray<Arc<Page>>>,
     inode: Option<Weak<dyn IndexNode>>,
+    self_ref: Weak<PageCache>,
 }
 
 impl core::fmt::Debug for PageCache {
     fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
         f.debug_struct("PageCache")
-            .field(
-                "xarray",
-                &self
-                    .xarray
-                    .lock()
-                    .range(0..((MMArch::PAGE_ADDRESS_SIZE >> MMArch::PAGE_SHIFT) as u64))
-                    .map(|(_, r)| (*r).clone())
-                    .collect::<Vec<Arc<Page>>>(),
-            )
+            .field("xarray", &self.pages())
             .finish()
     }
 }
 
 impl PageCache {
+    /// 页号的上限，用于遍历xarray
+    const MAX_INDEX: u64 = (MMArch::PAGE_ADDRESS_SIZE >> MMArch::PAGE_SHIFT) as u64;
+
     pub fn new(inode: Option<Weak<dyn IndexNode>>) -> Arc<PageCache> {
-        let page_cache = Self {
+        Arc::new_cyclic(|self_ref| Self {
             xarray: SpinLock::new(XArray::new()),
             inode,
-        };
-        Arc::new(page_cache)
+            self_ref: self_ref.clone(),
+        })
     }
 
     pub fn inode(&self) -> Option<Weak<dyn IndexNode>> {
@@ -179,6 +189,407 @@ impl PageCache {
     pub fn set_inode(&mut self, inode: Weak<dyn IndexNode>) {
         self.inode = Some(inode)
     }
+
+    /// 获取缓存中的所有页面
+    fn pages(&self) -> Vec<Arc<Page>> {
+        self.xarray
+            .lock()
+            .range(0..Self::MAX_INDEX)
+            .map(|(_, r)| (*r).clone())
+            .collect()
+    }
+
+    fn inode_arc(&self) -> Result<Arc<dyn IndexNode>, SystemError> {
+        self.inode
+            .as_ref()
+            .and_then(|inode| inode.upgrade())
+            .ok_or(SystemError::EIO)
+    }
+
+    /// # 获取页面的内容
+    ///
+    /// ## Safety
+    ///
+    /// 调用者需要保证页面在使用期间不会被释放
+    pub unsafe fn page_data<'a>(paddr: PhysAddr) -> &'a mut [u8] {
+        core::slice::from_raw_parts_mut(
+            MMArch::phys_2_virt(paddr).unwrap().data() as *mut u8,
+            MMArch::PAGE_SIZE,
+        )
+    }
+
+    /// # 创建一个缓存页并加入页面缓存
+    ///
+    /// 先分配物理页并调用`fill`填充内容，再把页面加入缓存。
+    /// 如果在填充期间其他进程已经创建了同一个页面，则释放新页，返回已有的页面。
+    fn create_page<F>(&self, index: usize, fill: F) -> Result<Arc<Page>, SystemError>
+    where
+        F: FnOnce(&mut [u8]) -> Result<(), SystemError>,
+    {
+        let paddr = unsafe { LockedFrameAllocator.allocate_one() }.ok_or(SystemError::ENOMEM)?;
+        if let Err(e) = fill(unsafe { Self::page_data(paddr) }) {
+            unsafe { LockedFrameAllocator.free_one(paddr) };
+            return Err(e);
+        }
+        return Ok(self.insert_frame(index, paddr));
+    }
+
+    /// # 把已经填充好内容的物理页加入页面缓存
+    ///
+    /// 如果其他进程已经创建了同一个页面，则释放`paddr`，返回已有的页面
+    fn insert_frame(&self, index: usize, paddr: PhysAddr) -> Arc<Page> {
+        let mut guard = self.xarray.lock();
+        let mut cursor = guard.cursor_mut(index as u64);
+        if let Some(page) = cursor.load() {
+            let page = (*page).clone();
+            drop(guard);
+            unsafe { LockedFrameAllocator.free_one(paddr) };
+            return page;
+        }
+
+        let page = Arc::new(Page::new(true, paddr));
+        page.add_flags(PageFlags::PG_LRU | PageFlags::PG_UPTODATE);
+        page.write_irqsave()
+            .set_page_cache_index(self.self_ref.upgrade(), Some(index));
+        cursor.store(page.clone());
+        drop(guard);
+
+        page_manager().insert(paddr, &page);
+        page_reclaimer_lock_irqsave().insert_page(paddr, &page);
+        return page;
+    }
+
+    /// # 分配物理连续的页帧，用于预读
+    ///
+    /// 优先分配不超过`max`的最大的2的幂个页帧，内存紧张时逐次减半
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok((PhysAddr, usize))`: 起始物理地址和页帧数量，每个页帧都可以单独释放
+    fn allocate_frames(max: usize) -> Result<(PhysAddr, usize), SystemError> {
+        let mut nr = 1 << max.ilog2();
+        loop {
+            if let Some((paddr, _)) =
+                unsafe { LockedFrameAllocator.allocate(PageFrameCount::new(nr)) }
+            {
+                return Ok((paddr, nr));
+            }
+            if nr == 1 {
+                return Err(SystemError::ENOMEM);
+            }
+            nr /= 2;
+        }
+    }
+
+    /// # 获取文件页，不在缓存中时从存储设备读入
+    ///
+    /// ## 参数
+    ///
+    /// - `index`: 文件内的页号
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok((page, major))`: `major`为true表示发生了磁盘I/O
+    pub fn get_or_read_page(&self, index: usize) -> Result<(Arc<Page>, bool), SystemError> {
+        if let Some(page) = self.get_page(index) {
+            page.mark_accessed();
+            return Ok((page, false));
+        }
+
+        let inode = self.inode_arc()?;
+        let file_size = inode.metadata()?.size as usize;
+        let page = self.create_page(index, |data| {
+            let start = index * MMArch::PAGE_SIZE;
+            let len = core::cmp::min(MMArch::PAGE_SIZE, file_size.saturating_sub(start));
+            if len > 0 {
+                inode.read_sync(start, &mut data[..len])?;
+            }
+            data[len..].fill(0);
+            Ok(())
+        })?;
+        return Ok((page, true));
+    }
+
+    /// # 经由页面缓存读取文件
+    ///
+    /// ## 参数
+    ///
+    /// - `offset`: 文件内的字节偏移量
+    /// - `buf`: 读出缓冲区，最多读取buf.len()个字节
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(usize)`: 成功读取的字节数，到达文件末尾时返回0
+    pub fn read(&self, offset: usize, buf: &mut [u8]) -> Result<usize, SystemError> {
+        let file_size = self.inode_arc()?.metadata()?.size as usize;
+        if offset >= file_size {
+            return Ok(0);
+        }
+        let len = core::cmp::min(buf.len(), file_size - offset);
+
+        let mut done = 0;
+        while done < len {
+            let pos = offset + done;
+            let page_offset = pos & (MMArch::PAGE_SIZE - 1);
+            let n = core::cmp::min(MMArch::PAGE_SIZE - page_offset, len - done);
+            let (page, _) = self.get_or_read_page(pos >> MMArch::PAGE_SHIFT)?;
+            let data = unsafe { Self::page_data(page.read_irqsave().phys_address()) };
+            buf[done..done + n].copy_from_slice(&data[page_offset..page_offset + n]);
+            done += n;
+        }
+        return Ok(len);
+    }
+
+    /// # 依次把文件中一段范围所在的缓存页交给`actor`，不复制数据
+    ///
+    /// 供sendfile/splice使用：`actor`可以直接以缓存页为源缓冲区写出数据，或者保存页面的引用。
+    ///
+    /// ## 参数
+    ///
+    /// - `offset`: 文件内的字节偏移量
+    /// - `len`: 最多处理的字节数，超出文件末尾的部分被忽略
+    /// - `actor`: 处理页面中的一段数据`(page, page_offset, len)`，返回它处理了的字节数。
+    ///   返回值小于`len`时停止
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(usize)`: 处理了的字节数。已经处理了一部分数据之后出错时，返回已经处理的字节数
+    pub fn for_each_page<F>(
+        &self,
+        offset: usize,
+        len: usize,
+        mut actor: F,
+    ) -> Result<usize, SystemError>
+    where
+        F: FnMut(&Arc<Page>, usize, usize) -> Result<usize, SystemError>,
+    {
+        let file_size = self.inode_arc()?.metadata()?.size as usize;
+        let len = core::cmp::min(len, file_size.saturating_sub(offset));
+
+        let mut done = 0;
+        while done < len {
+            let pos = offset + done;
+            let page_offset = pos & (MMArch::PAGE_SIZE - 1);
+            let n = core::cmp::min(MMArch::PAGE_SIZE - page_offset, len - done);
+            let r = self
+                .get_or_read_page(pos >> MMArch::PAGE_SHIFT)
+                .and_then(|(page, _)| actor(&page, page_offset, n));
+            match r {
+                Ok(written) => {
+                    done += written;
+                    if written < n {
+                        break;
+                    }
+                }
+                Err(e) if done == 0 => return Err(e),
+                Err(_) => break,
+            }
+        }
+        return Ok(done);
+    }
+
+    /// # 经由页面缓存写入文件
+    ///
+    /// 文件范围内的写入只修改缓存页并标记为脏；会扩展文件的写入需要分配存储空间，
+    /// 因此直接写入存储设备，再同步更新已缓存的页面。
+    ///
+    /// ## 参数
+    ///
+    /// - `offset`: 文件内的字节偏移量
+    /// - `buf`: 要写入的数据
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(usize)`: 成功写入的字节数
+    pub fn write(&self, offset: usize, buf: &[u8]) -> Result<usize, SystemError> {
+        let inode = self.inode_arc()?;
+        let file_size = inode.metadata()?.size as usize;
+        if offset + buf.len() > file_size {
+            let len = inode.write_sync(offset, buf)?;
+            self.update_cached(offset, &buf[..len]);
+            return Ok(len);
+        }
+
+        let mut done = 0;
+        while done < buf.len() {
+            let pos = offset + done;
+            let index = pos >> MMArch::PAGE_SHIFT;
+            let page_offset = pos & (MMArch::PAGE_SIZE - 1);
+            let n = core::cmp::min(MMArch::PAGE_SIZE - page_offset, buf.len() - done);
+
+            // 整页覆盖时不需要先从磁盘读入
+            let page = if n == MMArch::PAGE_SIZE {
+                match self.get_page(index) {
+                    Some(page) => page,
+                    None => self.create_page(index, |_| Ok(()))?,
+                }
+            } else {
+                self.get_or_read_page(index)?.0
+            };
+
+            let data = unsafe { Self::page_data(page.read_irqsave().phys_address()) };
+            data[page_offset..page_offset + n].copy_from_slice(&buf[done..done + n]);
+            page.add_flags(PageFlags::PG_DIRTY);
+            page.mark_accessed();
+            done += n;
+        }
+        return Ok(buf.len());
+    }
+
+    /// 把已经直接写入存储设备的数据同步到缓存页中
+    fn update_cached(&self, offset: usize, buf: &[u8]) {
+        let mut done = 0;
+        while done < buf.len() {
+            let pos = offset + done;
+            let page_offset = pos & (MMArch::PAGE_SIZE - 1);
+            let n = core::cmp::min(MMArch::PAGE_SIZE - page_offset, buf.len() - done);
+            if let Some(page) = self.get_page(pos >> MMArch::PAGE_SHIFT) {
+                let data = unsafe { Self::page_data(page.read_irqsave().phys_address()) };
+                data[page_offset..page_offset + n].copy_from_slice(&buf[done..done + n]);
+            }
+            done += n;
+        }
+    }
+
+    /// # 回写所有脏页
+    pub fn sync(&self) -> Result<(), SystemError> {
+        for page in self.pages() {
+            if page.flags().contains(PageFlags::PG_DIRTY) {
+                PageReclaimer::page_writeback(&page, false)?;
+            }
+        }
+        return Ok(());
+    }
+
+    /// # 预读一个窗口内的页面
+    ///
+    /// 窗口内连续的缺失页分配物理连续的页帧，直接读入页帧，已经缓存的页面不会重复读取。
+    ///
+    /// ## 参数
+    ///
+    /// - `window`: 预读的范围，以及需要打上`PG_READAHEAD`标记的页
+    pub fn readahead(&self, window: RaWindow) -> Result<(), SystemError> {
+        let inode = self.inode_arc()?;
+        let file_size = inode.metadata()?.size as usize;
+        let end = core::cmp::min(
+            window.start.saturating_add(window.nr),
+            file_size.div_ceil(MMArch::PAGE_SIZE),
+        );
+
+        let mut index = window.start;
+        while index < end {
+            if self.get_page(index).is_some() {
+                index += 1;
+                continue;
+            }
+            let mut run_end = index + 1;
+            while run_end < end && self.get_page(run_end).is_none() {
+                run_end += 1;
+            }
+
+            while index < run_end {
+                // 页帧在线性映射区中连续，一次读操作可以直接填充整段
+                let (paddr, nr) = Self::allocate_frames(run_end - index)?;
+                let data = unsafe {
+                    core::slice::from_raw_parts_mut(
+                        MMArch::phys_2_virt(paddr).unwrap().data() as *mut u8,
+                        nr * MMArch::PAGE_SIZE,
+                    )
+                };
+                let start = index * MMArch::PAGE_SIZE;
+                let len = core::cmp::min(data.len(), file_size - start);
+                if let Err(e) = inode.read_sync(start, &mut data[..len]) {
+                    for i in 0..nr {
+                        unsafe { LockedFrameAllocator.free_one(paddr + i * MMArch::PAGE_SIZE) };
+                    }
+                    return Err(e);
+                }
+                data[len..].fill(0);
+
+                for i in 0..nr {
+                    self.insert_frame(index + i, paddr + i * MMArch::PAGE_SIZE);
+                }
+                index += nr;
+            }
+        }
+
+        if let Some(page) = window
+            .marker
+            .filter(|marker| *marker < end)
+            .and_then(|marker| self.get_page(marker))
+        {
+            page.add_flags(PageFlags::PG_READAHEAD);
+        }
+        return Ok(());
+    }
+
+    /// # 文件被截断后，丢弃超出文件长度的缓存页，并把最后一页中超出的部分清零
+    ///
+    /// ## 参数
+    ///
+    /// - `len`: 截断后的文件长度
+    pub fn truncate(&self, len: usize) {
+        let first = len.div_ceil(MMArch::PAGE_SIZE) as u64;
+        let removed: Vec<(u64, Arc<Page>)> = self
+            .xarray
+            .lock()
+            .range(first..Self::MAX_INDEX)
+            .map(|(index, r)| (index, (*r).clone()))
+            .collect();
+
+        for (index, page) in removed {
+            page.remove_flags(PageFlags::PG_DIRTY);
+            self.evict_page(index as usize, page);
+        }
+
+        let tail = len & (MMArch::PAGE_SIZE - 1);
+        if tail != 0 {
+            if let Some(page) = self.get_page(len >> MMArch::PAGE_SHIFT) {
+                let data = unsafe { Self::page_data(page.read_irqsave().phys_address()) };
+                data[tail..].fill(0);
+            }
+        }
+    }
+
+    /// # 丢弃一段范围内干净且没有被映射的缓存页，用于fadvise(POSIX_FADV_DONTNEED)
+    ///
+    /// ## 参数
+    ///
+    /// - `start`: 起始页号
+    /// - `end`: 结束页号（不包含）
+    pub fn invalidate(&self, start: usize, end: usize) {
+        let pages: Vec<(u64, Arc<Page>)> = self
+            .xarray
+            .lock()
+            .range(start as u64..core::cmp::min(end as u64, Self::MAX_INDEX))
+            .map(|(index, r)| (index, (*r).clone()))
+            .collect();
+
+        for (index, page) in pages {
+            if page.flags().contains(PageFlags::PG_DIRTY) || page.read_irqsave().map_count() > 0 {
+                continue;
+            }
+            self.evict_page(index as usize, page);
+        }
+    }
+
+    /// 把页面移出页面缓存
+    ///
+    /// 仍被映射的页面在最后一次解除映射时释放；没有被映射的页面在最后一个引用消失时释放
+    fn evict_page(&self, index: usize, page: Arc<Page>) {
+        self.remove_page(index);
+        let paddr = page.read_irqsave().phys_address();
+        page_reclaimer_lock_irqsave().remove_page(&paddr);
+
+        let mut guard = page.write_irqsave();
+        if guard.map_count() > 0 {
+            guard.set_dealloc_when_zero(true);
+        } else {
+            guard.set_free_on_drop();
+            drop(guard);
+            page_manager().remove_page(&paddr);
+        }
+    }
 }
 
 /// @brief 抽象文件结构体
@@ -196,6 +607,8 @@ pub struct File {
     pub private_data: SpinLock<FilePrivateData>,
     /// 文件的凭证
     cred: Cred,
+    /// 预读状态
+    ra_state: SpinLock<FileRaState>,
 }
 
 impl File {
@@ -220,6 +633,7 @@ impl File {
             readdir_subdirs_name: SpinLock::new(Vec::default()),
             private_data: SpinLock::new(FilePrivateData::default()),
             cred: ProcessManager::current_pcb().cred(),
+            ra_state: SpinLock::new(FileRaState::new()),
         };
         f.inode.open(f.private_data.lock(), &mode)?;
 
@@ -297,6 +711,12 @@ impl File {
             return Err(SystemError::ENOBUFS);
         }
 
+        if let Some(page_cache) = self.inode.page_cache() {
+            let file_size = self.inode.metadata()?.size as usize;
+            let ra_len = core::cmp::min(len, file_size.saturating_sub(offset));
+            readahead::file_read_readahead(&page_cache, &self.ra_state, offset, ra_len);
+        }
+
         let len = self
             .inode
             .read_at(offset, len, buf, self.private_data.lock())
@@ -350,6 +770,11 @@ impl File {
                 }
             })?;
 
+        // 同步写：等待数据落盘之后再返回
+        if self.mode().intersects(FileMode::O_SYNC | FileMode::O_DSYNC) {
+            self.inode.sync()?;
+        }
+
         if update_offset {
             self.offset
                 .fetch_add(len, core::sync::atomic::Ordering::SeqCst);
@@ -358,6 +783,16 @@ impl File {
         Ok(len)
     }
 
+    /// 获取文件的当前偏移量
+    pub fn pos(&self) -> usize {
+        self.offset.load(Ordering::SeqCst)
+    }
+
+    /// 把文件的当前偏移量向后移动`len`个字节
+    pub fn advance_pos(&self, len: usize) {
+        self.offset.fetch_add(len, Ordering::SeqCst);
+    }
+
     /// @brief 获取文件的元数据
     pub fn metadata(&self) -> Result<Metadata, SystemError> {
         return self.inode.metadata();
@@ -495,6 +930,7 @@ impl File {
             readdir_subdirs_name: SpinLock::new(self.readdir_subdirs_name.lock().clone()),
             private_data: SpinLock::new(self.private_data.lock().clone()),
             cred: self.cred.clone(),
+            ra_state: SpinLock::new(self.ra_state.lock().clone()),
         };
         // 调用inode的open方法，让inode知道有新的文件打开了这个inode
         if self
@@ -563,6 +999,67 @@ impl File {
         return Ok(());
     }
 
+    /// 文件的预读状态
+    pub fn ra_state(&self) -> &SpinLock<FileRaState> {
+        &self.ra_state
+    }
+
+    /// # 向内核声明文件的访问模式
+    ///
+    /// ## 参数
+    ///
+    /// - `offset`: 起始字节偏移量
+    /// - `len`: 字节数，为0时表示直到文件末尾
+    /// - `advice`: 访问模式
+    pub fn fadvise(
+        &self,
+        offset: usize,
+        len: usize,
+        advice: FadviseAdvice,
+    ) -> Result<(), SystemError> {
+        if self.file_type == FileType::Pipe {
+            return Err(SystemError::ESPIPE);
+        }
+        // 不经过页面缓存的文件忽略访问模式
+        let page_cache = match self.inode.page_cache() {
+            Some(page_cache) => page_cache,
+            None => return Ok(()),
+        };
+
+        let start = offset >> MMArch::PAGE_SHIFT;
+        let end = if len == 0 {
+            usize::MAX
+        } else {
+            offset.saturating_add(len).div_ceil(MMArch::PAGE_SIZE)
+        };
+        match advice {
+            FadviseAdvice::Normal => self
+                .ra_state
+                .lock()
+                .set_ra_pages(readahead::RA_DEFAULT_MAX_PAGES),
+            FadviseAdvice::Random => self.ra_state.lock().set_ra_pages(0),
+            FadviseAdvice::Sequential => self
+                .ra_state
+                .lock()
+                .set_ra_pages(readahead::RA_DEFAULT_MAX_PAGES * 2),
+            FadviseAdvice::WillNeed => {
+                let file_size = self.inode.metadata()?.size as usize;
+                let end = core::cmp::min(end, file_size.div_ceil(MMArch::PAGE_SIZE));
+                if end > start {
+                    readahead::force_readahead(&page_cache, start, end - start);
+                }
+            }
+            FadviseAdvice::DontNeed => page_cache.invalidate(start, end),
+            FadviseAdvice::NoReuse => {}
+        }
+        return Ok(());
+    }
+
+    /// @brief 把文件的脏数据（页面缓存中的脏页以及块设备缓存中的脏块）写回存储设备
+    pub fn fsync(&self) -> Result<(), SystemError> {
+        self.inode.sync()
+    }
+
     /// ## 向该文件添加一个EPollItem对象
     ///
     /// 在文件状态发生变化时，需要向epoll通知
@@ -603,6 +1100,9 @@ impl File {
                 inode.inner().lock().remove_epoll(epoll)
             }
             _ => {
+                if let Some(inode) = self.inode.downcast_ref::<IoUringInode>() {
+                    return inode.remove_epoll(epoll);
+                }
                 let inode = self
                     .inode
                     .downcast_ref::<EventFdInode>()
@@ -632,27 +1132,127 @@ impl Drop for File {
     }
 }
 
-/// @brief pcb里面的文件描述符数组
+/// 文件描述符表的最大长度，RLIMIT_NOFILE不能超过这个值（与Linux的nr_open默认值相同）
+pub const NR_OPEN: usize = 1 << 20;
+/// RLIMIT_NOFILE的默认软限制
+pub const DEFAULT_NOFILE_CUR: usize = 1024;
+/// 第一段槽位数的log2，之后每一段的长度翻倍
+const FD_CHUNK_BASE_SHIFT: usize = 6;
+const FD_CHUNK_BASE: usize = 1 << FD_CHUNK_BASE_SHIFT;
+/// 段的数量，所有段加起来能够容纳`NR_OPEN`个文件描述符
+const FD_CHUNK_COUNT: usize = NR_OPEN.trailing_zeros() as usize - FD_CHUNK_BASE_SHIFT + 1;
+const BITS_PER_WORD: usize = usize::BITS as usize;
+
+/// 一个文件描述符对应的槽位。每个槽位单独加锁，查找不同的文件描述符互不竞争
+type FdSlot = SpinLock<Option<Arc<File>>>;
+
+/// ## 文件描述符表的槽位
+///
+/// 槽位分段存放，第k段有`FD_CHUNK_BASE << k`个槽位。段分配之后在`FdChunks`被释放之前不会移动，
+/// 段指针用原子操作发布。`FdChunks`与[`FileDescriptorVec`]分开共享（见`ProcessBasicInfo::fd_chunks`），
+/// 因此查找文件时既不需要持有文件描述符表的锁，也不会访问文件描述符表本身，见[`FdChunks::get_file`]
+#[derive(Debug)]
+pub struct FdChunks {
+    chunks: [AtomicPtr<FdSlot>; FD_CHUNK_COUNT],
+}
+
+impl FdChunks {
+    fn new() -> Self {
+        return Self {
+            chunks: core::array::from_fn(|_| AtomicPtr::new(core::ptr::null_mut())),
+        };
+    }
+
+    /// ## 不持有文件描述符表的锁，根据文件描述符序号获取文件
+    ///
+    /// 只访问用原子操作发布的段指针和自带锁的槽位，可以与持有写锁的分配、释放操作并发执行。
+    /// 与之并发关闭的文件描述符，可能返回关闭之前的文件，这与持有读锁时先于关闭完成查找是一样的
+    pub fn get_file(&self, fd: i32) -> Option<Arc<File>> {
+        if !FileDescriptorVec::validate_fd(fd) {
+            return None;
+        }
+        return self.slot(fd as usize)?.lock().clone();
+    }
+
+    /// 文件描述符对应的槽位，所在的段还没有分配时返回None
+    fn slot(&self, fd: usize) -> Option<&FdSlot> {
+        if fd >= NR_OPEN {
+            return None;
+        }
+        let (k, offset) = fd_chunk_index(fd);
+        let chunk = self.chunks[k].load(Ordering::Acquire);
+        if chunk.is_null() {
+            return None;
+        }
+        return Some(unsafe { &*chunk.add(offset) });
+    }
+
+    /// 分配并发布第k段，只能由持有文件描述符表写锁的[`FileDescriptorVec::expand`]调用
+    fn publish(&self, k: usize) {
+        let len = FD_CHUNK_BASE << k;
+        let mut chunk = Vec::with_capacity(len);
+        chunk.resize_with(len, || SpinLock::new(None));
+        let ptr = Box::into_raw(chunk.into_boxed_slice()) as *mut FdSlot;
+        // 槽位初始化完成之后再发布，与slot中的Acquire配对
+        self.chunks[k].store(ptr, Ordering::Release);
+    }
+}
+
+impl Drop for FdChunks {
+    fn drop(&mut self) {
+        for (k, chunk) in self.chunks.iter().enumerate() {
+            let ptr = chunk.load(Ordering::Acquire);
+            if ptr.is_null() {
+                break;
+            }
+            let len = FD_CHUNK_BASE << k;
+            drop(unsafe { Box::from_raw(core::ptr::slice_from_raw_parts_mut(ptr, len)) });
+        }
+    }
+}
+
+/// ## pcb里面的文件描述符表
+///
+/// 槽位存放在[`FdChunks`]中，按需分配，直到RLIMIT_NOFILE。查找文件不需要持有表的锁，
+/// 分配和释放文件描述符仍然需要持有表的写锁，用位图查找最小的空闲文件描述符
 #[derive(Debug)]
 pub struct FileDescriptorVec {
-    /// 当前进程打开的文件描述符
-    fds: Vec<Option<Arc<File>>>,
+    chunks: Arc<FdChunks>,
+    /// 已经分配的槽位数，总是`FD_CHUNK_BASE`的倍数
+    max_fds: usize,
+    /// 已经打开的文件描述符
+    open_fds: Vec<usize>,
+    /// 设置了close-on-exec的文件描述符
+    close_on_exec: Vec<usize>,
+    /// 小于这个值的文件描述符都已经打开，查找空闲的文件描述符从这里开始
+    next_fd: usize,
+    /// RLIMIT_NOFILE，能够打开的文件描述符都小于软限制
+    nofile: RLimit64,
 }
+
 impl Default for FileDescriptorVec {
     fn default() -> Self {
         Self::new()
     }
 }
-impl FileDescriptorVec {
-    pub const PROCESS_MAX_FD: usize = 1024;
 
+impl FileDescriptorVec {
     #[inline(never)]
     pub fn new() -> FileDescriptorVec {
-        let mut data = Vec::with_capacity(FileDescriptorVec::PROCESS_MAX_FD);
-        data.resize(FileDescriptorVec::PROCESS_MAX_FD, None);
-
-        // 初始化文件描述符数组结构体
-        return FileDescriptorVec { fds: data };
+        let mut res = FileDescriptorVec {
+            chunks: Arc::new(FdChunks::new()),
+            max_fds: 0,
+            open_fds: Vec::new(),
+            close_on_exec: Vec::new(),
+            next_fd: 0,
+            nofile: RLimit64 {
+                rlim_cur: DEFAULT_NOFILE_CUR as u64,
+                rlim_max: NR_OPEN as u64,
+            },
+        };
+        // 大部分进程打开的文件不多，先只分配第一段
+        res.expand(1).unwrap();
+        return res;
     }
 
     /// @brief 克隆一个文件描述符数组
@@ -660,11 +1260,17 @@ impl FileDescriptorVec {
     /// @return FileDescriptorVec 克隆后的文件描述符数组
     pub fn clone(&self) -> FileDescriptorVec {
         let mut res = FileDescriptorVec::new();
-        for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-            if let Some(file) = &self.fds[i] {
-                if let Some(file) = file.try_clone() {
-                    res.fds[i] = Some(Arc::new(file));
-                }
+        res.nofile = self.nofile;
+        for (fd, file) in self.iter() {
+            if let Some(file) = file.try_clone() {
+                let fd = fd as usize;
+                res.expand(fd + 1).unwrap();
+                res.install(fd, Arc::new(file));
+                set_bit(
+                    &mut res.close_on_exec,
+                    fd,
+                    test_bit(&self.close_on_exec, fd),
+                );
             }
         }
         return res;
@@ -672,13 +1278,11 @@ impl FileDescriptorVec {
 
     /// 返回 `已经打开的` 文件描述符的数量
     pub fn fd_open_count(&self) -> usize {
-        let mut size = 0;
-        for fd in &self.fds {
-            if fd.is_some() {
-                size += 1;
-            }
-        }
-        return size;
+        return self
+            .open_fds
+            .iter()
+            .map(|word| word.count_ones() as usize)
+            .sum();
     }
 
     /// @brief 判断文件描述符序号是否合法
@@ -688,7 +1292,46 @@ impl FileDescriptorVec {
     /// @return false 不合法
     #[inline]
     pub fn validate_fd(fd: i32) -> bool {
-        return !(fd < 0 || fd as usize > FileDescriptorVec::PROCESS_MAX_FD);
+        return fd >= 0 && (fd as usize) < NR_OPEN;
+    }
+
+    /// 文件描述符表的槽位，用于不持有表的锁查找文件
+    pub fn chunks(&self) -> Arc<FdChunks> {
+        return self.chunks.clone();
+    }
+
+    /// RLIMIT_NOFILE
+    pub fn rlimit_nofile(&self) -> RLimit64 {
+        return self.nofile;
+    }
+
+    /// ## 设置RLIMIT_NOFILE
+    ///
+    /// 已经打开的、不小于新的软限制的文件描述符不受影响
+    ///
+    /// ## 参数
+    /// - `nofile`：新的限制
+    /// - `can_raise_max`：调用者是否有权提高硬限制（CAP_SYS_RESOURCE）
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EINVAL)`：软限制大于硬限制
+    /// - `Err(SystemError::EPERM)`：硬限制超过了`NR_OPEN`，或者无权提高硬限制
+    pub fn set_rlimit_nofile(
+        &mut self,
+        nofile: RLimit64,
+        can_raise_max: bool,
+    ) -> Result<(), SystemError> {
+        if nofile.rlim_cur > nofile.rlim_max {
+            return Err(SystemError::EINVAL);
+        }
+        if nofile.rlim_max > NR_OPEN as u64 {
+            return Err(SystemError::EPERM);
+        }
+        if nofile.rlim_max > self.nofile.rlim_max && !can_raise_max {
+            return Err(SystemError::EPERM);
+        }
+        self.nofile = nofile;
+        return Ok(());
     }
 
     /// 申请文件描述符，并把文件对象存入其中。
@@ -703,24 +1346,39 @@ impl FileDescriptorVec {
     /// - `Ok(i32)` 申请成功，返回申请到的文件描述符
     /// - `Err(SystemError)` 申请失败，返回错误码，并且，file对象将被drop掉
     pub fn alloc_fd(&mut self, file: File, fd: Option<i32>) -> Result<i32, SystemError> {
-        if let Some(new_fd) = fd {
-            let x = &mut self.fds[new_fd as usize];
-            if x.is_none() {
-                *x = Some(Arc::new(file));
-                return Ok(new_fd);
-            } else {
-                return Err(SystemError::EBADF);
-            }
-        } else {
-            // 没有指定要申请的文件描述符编号
-            for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-                if self.fds[i].is_none() {
-                    self.fds[i] = Some(Arc::new(file));
-                    return Ok(i as i32);
+        let fd = match fd {
+            Some(fd) => {
+                if fd < 0 || fd as u64 >= self.nofile.rlim_cur {
+                    return Err(SystemError::EBADF);
+                }
+                let fd = fd as usize;
+                self.expand(fd + 1)?;
+                if test_bit(&self.open_fds, fd) {
+                    return Err(SystemError::EBADF);
                 }
+                fd
             }
+            // 没有指定要申请的文件描述符编号
+            None => self.find_free_fd(0)?,
+        };
+        self.install(fd, Arc::new(file));
+        return Ok(fd as i32);
+    }
+
+    /// ## 查找不小于`start`的最小的空闲文件描述符
+    ///
+    /// 需要时扩大文件描述符表，但不会占用找到的文件描述符
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EMFILE)`：达到了RLIMIT_NOFILE
+    pub fn find_free_fd(&mut self, start: usize) -> Result<usize, SystemError> {
+        let start = start.max(self.next_fd);
+        let fd = find_next_zero_bit(&self.open_fds, start).unwrap_or(self.max_fds.max(start));
+        if fd as u64 >= self.nofile.rlim_cur {
             return Err(SystemError::EMFILE);
         }
+        self.expand(fd + 1)?;
+        return Ok(fd);
     }
 
     /// 根据文件描述符序号，获取文件结构体的Arc指针
@@ -729,10 +1387,7 @@ impl FileDescriptorVec {
     ///
     /// - `fd` 文件描述符序号
     pub fn get_file_by_fd(&self, fd: i32) -> Option<Arc<File>> {
-        if !FileDescriptorVec::validate_fd(fd) {
-            return None;
-        }
-        self.fds[fd as usize].clone()
+        return self.chunks.get_file(fd);
     }
 
     /// 释放文件描述符，同时关闭文件。
@@ -741,35 +1396,138 @@ impl FileDescriptorVec {
     ///
     /// - `fd` 文件描述符序号
     pub fn drop_fd(&mut self, fd: i32) -> Result<Arc<File>, SystemError> {
-        self.get_file_by_fd(fd).ok_or(SystemError::EBADF)?;
-
-        // 把文件描述符数组对应位置设置为空
-        let file = self.fds[fd as usize].take().unwrap();
-
+        if !FileDescriptorVec::validate_fd(fd) {
+            return Err(SystemError::EBADF);
+        }
+        let fd = fd as usize;
+        let file = self
+            .slot(fd)
+            .and_then(|slot| slot.lock().take())
+            .ok_or(SystemError::EBADF)?;
+
+        set_bit(&mut self.open_fds, fd, false);
+        set_bit(&mut self.close_on_exec, fd, false);
+        if fd < self.next_fd {
+            self.next_fd = fd;
+        }
         return Ok(file);
     }
 
+    /// ## 设置文件描述符的close-on-exec标志
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EBADF)`：文件描述符没有打开
+    pub fn set_close_on_exec(&mut self, fd: i32, close_on_exec: bool) -> Result<(), SystemError> {
+        let file = self.get_file_by_fd(fd).ok_or(SystemError::EBADF)?;
+        file.set_close_on_exec(close_on_exec);
+        set_bit(&mut self.close_on_exec, fd as usize, close_on_exec);
+        return Ok(());
+    }
+
     #[allow(dead_code)]
     pub fn iter(&self) -> FileDescriptorIterator {
         return FileDescriptorIterator::new(self);
     }
 
     pub fn close_on_exec(&mut self) {
-        for i in 0..FileDescriptorVec::PROCESS_MAX_FD {
-            if let Some(file) = &self.fds[i] {
-                let to_drop = file.close_on_exec();
-                if to_drop {
-                    if let Err(r) = self.drop_fd(i as i32) {
-                        error!(
-                            "Failed to close file: pid = {:?}, fd = {}, error = {:?}",
-                            ProcessManager::current_pcb().pid(),
-                            i,
-                            r
-                        );
-                    }
-                }
+        let mut fd = 0;
+        while let Some(i) = find_next_bit(&self.close_on_exec, fd) {
+            if let Err(r) = self.drop_fd(i as i32) {
+                error!(
+                    "Failed to close file: pid = {:?}, fd = {}, error = {:?}",
+                    ProcessManager::current_pcb().pid(),
+                    i,
+                    r
+                );
             }
+            fd = i + 1;
+        }
+    }
+
+    /// 把文件放入空闲的槽位`fd`，槽位已经分配
+    fn install(&mut self, fd: usize, file: Arc<File>) {
+        set_bit(&mut self.open_fds, fd, true);
+        set_bit(&mut self.close_on_exec, fd, file.close_on_exec());
+        if fd == self.next_fd {
+            self.next_fd = find_next_zero_bit(&self.open_fds, fd + 1).unwrap_or(self.max_fds);
+        }
+        *self.slot(fd).unwrap().lock() = Some(file);
+    }
+
+    /// ## 分配新的段，直到至少有`nr`个槽位
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EMFILE)`：超过了`NR_OPEN`
+    fn expand(&mut self, nr: usize) -> Result<(), SystemError> {
+        if nr > NR_OPEN {
+            return Err(SystemError::EMFILE);
+        }
+        while self.max_fds < nr {
+            let k = (self.max_fds / FD_CHUNK_BASE + 1).trailing_zeros() as usize;
+            self.chunks.publish(k);
+
+            self.max_fds += FD_CHUNK_BASE << k;
+            self.open_fds.resize(self.max_fds / BITS_PER_WORD, 0);
+            self.close_on_exec.resize(self.max_fds / BITS_PER_WORD, 0);
+        }
+        return Ok(());
+    }
+
+    /// 文件描述符对应的槽位，所在的段还没有分配时返回None
+    fn slot(&self, fd: usize) -> Option<&FdSlot> {
+        return self.chunks.slot(fd);
+    }
+}
+
+/// 文件描述符所在的段，以及在段中的偏移
+#[inline(always)]
+fn fd_chunk_index(fd: usize) -> (usize, usize) {
+    let biased = fd + FD_CHUNK_BASE;
+    let order = (usize::BITS - 1 - biased.leading_zeros()) as usize;
+    return (order - FD_CHUNK_BASE_SHIFT, biased - (1 << order));
+}
+
+#[inline(always)]
+fn test_bit(words: &[usize], bit: usize) -> bool {
+    return words
+        .get(bit / BITS_PER_WORD)
+        .is_some_and(|word| word & (1 << (bit % BITS_PER_WORD)) != 0);
+}
+
+#[inline(always)]
+fn set_bit(words: &mut [usize], bit: usize, value: bool) {
+    let mask = 1 << (bit % BITS_PER_WORD);
+    if value {
+        words[bit / BITS_PER_WORD] |= mask;
+    } else {
+        words[bit / BITS_PER_WORD] &= !mask;
+    }
+}
+
+/// 从`start`开始查找第一个为1的位，按字扫描
+fn find_next_bit(words: &[usize], start: usize) -> Option<usize> {
+    let mut idx = start / BITS_PER_WORD;
+    // 屏蔽start之前的位
+    let mut word = *words.get(idx)? & (usize::MAX << (start % BITS_PER_WORD));
+    loop {
+        if word != 0 {
+            return Some(idx * BITS_PER_WORD + word.trailing_zeros() as usize);
+        }
+        idx += 1;
+        word = *words.get(idx)?;
+    }
+}
+
+/// 从`start`开始查找第一个为0的位，按字扫描
+fn find_next_zero_bit(words: &[usize], start: usize) -> Option<usize> {
+    let mut idx = start / BITS_PER_WORD;
+    let mut word = *words.get(idx)? | !(usize::MAX << (start % BITS_PER_WORD));
+    loop {
+        if word != usize::MAX {
+            return Some(idx * BITS_PER_WORD + word.trailing_ones() as usize);
         }
+        idx += 1;
+        word = *words.get(idx)?;
     }
 }
 
@@ -789,11 +1547,10 @@ impl<'a> Iterator for FileDescriptorIterator<'a> {
     type Item = (i32, Arc<File>);
 
     fn next(&mut self) -> Option<Self::Item> {
-        while self.index < FileDescriptorVec::PROCESS_MAX_FD {
-            let fd = self.index as i32;
-            self.index += 1;
-            if let Some(file) = self.fds.get_file_by_fd(fd) {
-                return Some((fd, file));
+        while let Some(fd) = find_next_bit(&self.fds.open_fds, self.index) {
+            self.index = fd + 1;
+            if let Some(file) = self.fds.get_file_by_fd(fd as i32) {
+                return Some((fd as i32, file));
             }
         }
         return None;
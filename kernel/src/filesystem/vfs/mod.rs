@@ -1,8 +1,11 @@
 pub mod core;
+pub mod dcache;
 pub mod fcntl;
 pub mod file;
 pub mod mount;
 pub mod open;
+pub mod readahead;
+pub mod splice;
 pub mod syscall;
 pub mod utils;
 
@@ -26,6 +29,7 @@ use crate::{
 
 use self::{
     core::generate_inode_id,
+    dcache::DentryCacheMode,
     file::{FileMode, PageCache},
     syscall::ModeType,
     utils::DName,
@@ -181,6 +185,28 @@ pub trait IndexNode: Any + Sync + Send + Debug + CastFromSync {
         _data: SpinLockGuard<FilePrivateData>,
     ) -> Result<usize, SystemError>;
 
+    /// @brief 绕过页缓存，直接从存储设备读取inode的数据。页缓存缺页时通过本函数读入页面
+    ///
+    /// @param offset 起始位置在Inode中的偏移量
+    /// @param buf 缓冲区，读取buf.len()个字节
+    ///
+    /// @return 成功：Ok(读取的字节数)
+    ///         失败：Err(Posix错误码)
+    fn read_sync(&self, _offset: usize, _buf: &mut [u8]) -> Result<usize, SystemError> {
+        return Err(SystemError::ENOSYS);
+    }
+
+    /// @brief 绕过页缓存，直接把数据写入存储设备。页缓存通过本函数回写脏页
+    ///
+    /// @param offset 起始位置在Inode中的偏移量
+    /// @param buf 缓冲区，写入buf.len()个字节
+    ///
+    /// @return 成功：Ok(写入的字节数)
+    ///         失败：Err(Posix错误码)
+    fn write_sync(&self, _offset: usize, _buf: &[u8]) -> Result<usize, SystemError> {
+        return Err(SystemError::ENOSYS);
+    }
+
     /// @brief 获取当前inode的状态。
     ///
     /// @return PollStatus结构体
@@ -486,6 +512,13 @@ pub trait IndexNode: Any + Sync + Send + Debug + CastFromSync {
         return Ok(());
     }
 
+    /// ## 把inode所在的文件系统缓存的数据写回设备，用于syncfs
+    ///
+    /// 管道、套接字、eventfd等不属于任何文件系统的inode需要覆盖本函数，与Linux一样什么都不做
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return self.fs().sync_fs();
+    }
+
     /// ## 创建一个特殊文件节点
     /// - _filename: 文件名
     /// - _mode: 权限信息
@@ -615,41 +648,29 @@ impl dyn IndexNode {
         // result: 上一个被找到的inode
         // rest_path: 还没有查找的路径
         let (mut result, mut rest_path) = if let Some(rest) = path.strip_prefix('/') {
-            (ROOT_INODE().clone(), String::from(rest))
+            (ROOT_INODE().clone(), rest)
         } else {
             // 是相对路径
-            (self.find(".")?, String::from(path))
+            (self.find(".")?, path)
         };
 
-        // 逐级查找文件
+        // 逐级查找文件，每一级的名字都是原路径的切片，不需要分配内存
         while !rest_path.is_empty() {
             // 当前这一级不是文件夹
             if result.metadata()?.file_type != FileType::Dir {
                 return Err(SystemError::ENOTDIR);
             }
 
-            let name;
-
-            // 寻找“/”
-            match rest_path.find('/') {
-                Some(pos) => {
-                    // 找到了，设置下一个要查找的名字
-                    name = String::from(&rest_path[0..pos]);
-                    // 剩余的路径字符串
-                    rest_path = String::from(&rest_path[pos + 1..]);
-                }
-                None => {
-                    name = rest_path;
-                    rest_path = String::new();
-                }
-            }
+            // 寻找“/”，设置下一个要查找的名字以及剩余的路径
+            let (name, rest) = rest_path.split_once('/').unwrap_or((rest_path, ""));
+            rest_path = rest;
 
             // 遇到连续多个"/"的情况
             if name.is_empty() {
                 continue;
             }
 
-            let inode = result.find(&name)?;
+            let inode = result.find(name)?;
 
             // 处理符号链接的问题
             if inode.metadata()?.file_type == FileType::SymLink && max_follow_times > 0 {
@@ -662,12 +683,11 @@ impl dyn IndexNode {
                     SpinLock::new(FilePrivateData::Unused).lock(),
                 )?;
 
-                // 将读到的数据转换为utf8字符串（先转为str，再转为String）
-                let link_path = String::from(
-                    ::core::str::from_utf8(&content[..len]).map_err(|_| SystemError::ENOTDIR)?,
-                );
+                // 将读到的数据转换为utf8字符串
+                let link_path =
+                    ::core::str::from_utf8(&content[..len]).map_err(|_| SystemError::ENOTDIR)?;
 
-                let new_path = link_path + "/" + &rest_path;
+                let new_path = format!("{link_path}/{rest_path}");
                 // 继续查找符号链接
                 return result.lookup_follow_symlink(&new_path, max_follow_times - 1);
             } else {
@@ -820,6 +840,20 @@ pub trait FileSystem: Any + Sync + Send + Debug {
 
     fn super_block(&self) -> SuperBlock;
 
+    /// @brief 文件系统使用目录项缓存的方式
+    ///
+    /// 只有目录内容只会通过VFS接口改变的文件系统才能启用目录项缓存，默认不启用
+    fn dentry_cache_mode(&self) -> DentryCacheMode {
+        DentryCacheMode::Disabled
+    }
+
+    /// @brief 把文件系统缓存在内存中的元数据和数据写回设备
+    ///
+    /// 没有自己的缓存的文件系统不需要实现
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
     unsafe fn fault(&self, _pfm: &mut PageFaultMessage) -> VmFaultReason {
         panic!(
             "fault() has not yet been implemented for filesystem: {}",
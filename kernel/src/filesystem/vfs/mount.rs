@@ -8,6 +8,7 @@ use alloc::{
     collections::BTreeMap,
     string::{String, ToString},
     sync::{Arc, Weak},
+    vec::Vec,
 };
 use system_error::SystemError;
 
@@ -23,6 +24,7 @@ use crate::{
 };
 
 use super::{
+    dcache::{self, DCacheLookup, DKey, DentryCacheMode},
     file::{FileMode, PageCache},
     syscall::ModeType,
     utils::DName,
@@ -175,6 +177,44 @@ impl MountFSInode {
         .overlaid_inode());
     }
 
+    /// 构造当前目录下名为`name`的目录项在目录项缓存中的键
+    fn dkey<'a>(&'a self, name: &'a str) -> DKey<'a> {
+        DKey {
+            mount_fs: &self.mount_fs,
+            parent: &self.inner_inode,
+            name,
+            mode: self.mount_fs.inner_filesystem.dentry_cache_mode(),
+        }
+    }
+
+    /// 先查找目录项缓存，未命中时再调用`do_find`，并把结果（包括文件不存在）加入缓存
+    fn cached_find(&self, name: &str) -> Result<Arc<MountFSInode>, SystemError> {
+        let key = self.dkey(name);
+        if key.mode == DentryCacheMode::Disabled {
+            return self.do_find(name);
+        }
+        let generation = match dcache::lookup(&key) {
+            DCacheLookup::Hit(Some(inode)) => return Ok(inode),
+            DCacheLookup::Hit(None) => return Err(SystemError::ENOENT),
+            DCacheLookup::Miss(generation) => generation,
+        };
+        let result = self.do_find(name);
+        match &result {
+            Ok(inode) => dcache::insert(&key, generation, Some(inode.clone())),
+            Err(SystemError::ENOENT) => dcache::insert(&key, generation, None),
+            Err(_) => {}
+        }
+        return result;
+    }
+
+    /// 当前目录下名为`name`的目录项发生了变化，使其在目录项缓存中失效
+    fn dcache_invalidate(&self, name: &str) {
+        let key = self.dkey(name);
+        if key.mode != DentryCacheMode::Disabled {
+            dcache::invalidate(&key);
+        }
+    }
+
     pub(super) fn do_parent(&self) -> Result<Arc<MountFSInode>, SystemError> {
         if self.is_mountpoint_root()? {
             // 当前inode是它所在的文件系统的root inode
@@ -207,12 +247,15 @@ impl MountFSInode {
         if self.metadata()?.file_type != FileType::Dir {
             return Err(SystemError::ENOTDIR);
         }
-        return self
+        let mount_fs = self
             .mount_fs
             .mountpoints
             .lock()
             .remove(&self.inner_inode.metadata()?.inode_id)
-            .ok_or(SystemError::ENOENT);
+            .ok_or(SystemError::ENOENT)?;
+        // 挂载点发生了变化，缓存中的目录项可能指向被卸载的文件系统
+        dcache::clear();
+        return Ok(mount_fs);
     }
 
     fn do_absolute_path(&self, len: usize) -> Result<String, SystemError> {
@@ -246,7 +289,9 @@ impl IndexNode for MountFSInode {
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
         let inner_inode = self
             .inner_inode
-            .create_with_data(name, file_type, mode, data)?;
+            .create_with_data(name, file_type, mode, data);
+        self.dcache_invalidate(name);
+        let inner_inode = inner_inode?;
         return Ok(Arc::new_cyclic(|self_ref| MountFSInode {
             inner_inode,
             mount_fs: self.mount_fs.clone(),
@@ -310,7 +355,9 @@ impl IndexNode for MountFSInode {
         file_type: FileType,
         mode: ModeType,
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
-        let inner_inode = self.inner_inode.create(name, file_type, mode)?;
+        let inner_inode = self.inner_inode.create(name, file_type, mode);
+        self.dcache_invalidate(name);
+        let inner_inode = inner_inode?;
         return Ok(Arc::new_cyclic(|self_ref| MountFSInode {
             inner_inode,
             mount_fs: self.mount_fs.clone(),
@@ -319,7 +366,9 @@ impl IndexNode for MountFSInode {
     }
 
     fn link(&self, name: &str, other: &Arc<dyn IndexNode>) -> Result<(), SystemError> {
-        return self.inner_inode.link(name, other);
+        let r = self.inner_inode.link(name, other);
+        self.dcache_invalidate(name);
+        return r;
     }
 
     /// @brief 在挂载文件系统中删除文件/文件夹
@@ -332,7 +381,9 @@ impl IndexNode for MountFSInode {
             return Err(SystemError::EBUSY);
         }
         // 调用内层的inode的方法来删除这个inode
-        return self.inner_inode.unlink(name);
+        let r = self.inner_inode.unlink(name);
+        self.dcache_invalidate(name);
+        return r;
     }
 
     #[inline]
@@ -345,7 +396,7 @@ impl IndexNode for MountFSInode {
         }
         // 调用内层的rmdir的方法来删除这个inode
         let r = self.inner_inode.rmdir(name);
-
+        self.dcache_invalidate(name);
         return r;
     }
 
@@ -356,7 +407,14 @@ impl IndexNode for MountFSInode {
         target: &Arc<dyn IndexNode>,
         new_name: &str,
     ) -> Result<(), SystemError> {
-        return self.inner_inode.move_to(old_name, target, new_name);
+        let r = self.inner_inode.move_to(old_name, target, new_name);
+        self.dcache_invalidate(old_name);
+        match target.clone().downcast_arc::<MountFSInode>() {
+            Some(target) => target.dcache_invalidate(new_name),
+            // 无法确定目标目录，只能清空整个缓存
+            None => dcache::clear(),
+        }
+        return r;
     }
 
     fn find(&self, name: &str) -> Result<Arc<dyn IndexNode>, SystemError> {
@@ -372,7 +430,9 @@ impl IndexNode for MountFSInode {
             // 在当前目录下查找
             // 直接调用当前inode所在的文件系统的find方法进行查找
             // 由于向下查找可能会跨越文件系统的边界，因此需要尝试替换inode
-            _ => self.do_find(name).map(|inode| inode as Arc<dyn IndexNode>),
+            _ => self
+                .cached_find(name)
+                .map(|inode| inode as Arc<dyn IndexNode>),
         }
     }
 
@@ -434,6 +494,8 @@ impl IndexNode for MountFSInode {
             .mountpoints
             .lock()
             .insert(metadata.inode_id, new_mount_fs.clone());
+        // 挂载点下原有的目录项已经被新的文件系统覆盖
+        dcache::clear();
 
         let mount_path = self.absolute_path();
 
@@ -455,6 +517,7 @@ impl IndexNode for MountFSInode {
             .mountpoints
             .lock()
             .insert(metadata.inode_id, new_mount_fs.clone());
+        dcache::clear();
 
         // MOUNT_LIST().remove(from.absolute_path()?);
         // MOUNT_LIST().insert(self.absolute_path()?, new_mount_fs.clone());
@@ -479,7 +542,9 @@ impl IndexNode for MountFSInode {
         mode: ModeType,
         dev_t: DeviceNumber,
     ) -> Result<Arc<dyn IndexNode>, SystemError> {
-        let inner_inode = self.inner_inode.mknod(filename, mode, dev_t)?;
+        let inner_inode = self.inner_inode.mknod(filename, mode, dev_t);
+        self.dcache_invalidate(filename);
+        let inner_inode = inner_inode?;
         return Ok(Arc::new_cyclic(|self_ref| MountFSInode {
             inner_inode,
             mount_fs: self.mount_fs.clone(),
@@ -545,6 +610,10 @@ impl FileSystem for MountFS {
         SuperBlock::new(Magic::MOUNT_MAGIC, MOUNTFS_BLOCK_SIZE, MOUNTFS_MAX_NAMELEN)
     }
 
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        self.inner_filesystem.sync_fs()
+    }
+
     unsafe fn fault(&self, pfm: &mut PageFaultMessage) -> VmFaultReason {
         self.inner_filesystem.fault(pfm)
     }
@@ -716,6 +785,12 @@ impl MountList {
     pub fn remove<T: Into<MountPath>>(&self, path: T) -> Option<Arc<MountFS>> {
         self.0.write().remove(&path.into())
     }
+
+    /// # filesystems - 获取挂载表中的所有文件系统
+    #[inline]
+    pub fn filesystems(&self) -> Vec<Arc<MountFS>> {
+        self.0.read().values().cloned().collect()
+    }
 }
 
 impl Debug for MountList {
@@ -0,0 +1,340 @@
+//! 文件预读
+//!
+//! 按需预读：每个打开的文件记录一个预读窗口，检测到顺序访问时窗口逐步增大。
+//! 窗口末尾的一段是“异步部分”，其第一页带有`PG_READAHEAD`标记，
+//! 读到该页时由预读线程在后台读入下一个窗口，使磁盘I/O与进程的处理重叠。
+//!
+//! 参考：https://code.dragonos.org.cn/xref/linux-6.6.21/mm/readahead.c
+
+use alloc::{collections::VecDeque, string::ToString, sync::Arc};
+use system_error::SystemError;
+use unified_init::macros::unified_init;
+
+use crate::{
+    arch::MMArch,
+    init::initcall::INITCALL_CORE,
+    libs::{spinlock::SpinLock, wait_queue::WaitQueue},
+    mm::{page::PageFlags, MemoryManagementArch, VmFlags},
+    process::kthread::{KernelThreadClosure, KernelThreadMechanism},
+};
+
+use super::file::PageCache;
+
+/// 默认的预读窗口上限（页数），即128KB
+pub const RA_DEFAULT_MAX_PAGES: usize = 128 * 1024 / MMArch::PAGE_SIZE;
+/// 预读队列的最大长度，队列满时丢弃新的预读请求
+const RA_QUEUE_MAX: usize = 64;
+
+static RA_QUEUE: SpinLock<VecDeque<RaWork>> = SpinLock::new(VecDeque::new());
+static RA_WAIT_QUEUE: WaitQueue = WaitQueue::default();
+
+/// 一次预读的范围
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RaWindow {
+    /// 起始页号
+    pub start: usize,
+    /// 页数
+    pub nr: usize,
+    /// 需要打上`PG_READAHEAD`标记的页号
+    pub marker: Option<usize>,
+}
+
+/// 交给预读线程的异步预读请求
+struct RaWork {
+    page_cache: Arc<PageCache>,
+    window: RaWindow,
+}
+
+/// # 每个打开的文件的预读状态
+#[derive(Debug, Clone)]
+pub struct FileRaState {
+    /// 当前预读窗口的起始页号
+    start: usize,
+    /// 当前预读窗口的页数
+    size: usize,
+    /// 窗口末尾异步部分的页数
+    async_size: usize,
+    /// 预读窗口的上限，为0时表示关闭预读
+    ra_pages: usize,
+    /// 上一次读取的最后一页
+    prev_index: Option<usize>,
+}
+
+impl Default for FileRaState {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl FileRaState {
+    pub const fn new() -> Self {
+        Self {
+            start: 0,
+            size: 0,
+            async_size: 0,
+            ra_pages: RA_DEFAULT_MAX_PAGES,
+            prev_index: None,
+        }
+    }
+
+    #[inline]
+    pub fn ra_pages(&self) -> usize {
+        self.ra_pages
+    }
+
+    /// 设置预读窗口的上限，由fadvise调整
+    pub fn set_ra_pages(&mut self, ra_pages: usize) {
+        self.ra_pages = ra_pages;
+        self.size = self.size.min(ra_pages);
+        self.async_size = self.async_size.min(self.size);
+    }
+
+    /// 第一次预读的窗口大小：较小的请求放大4倍或2倍
+    fn init_size(&self, req: usize) -> usize {
+        let size = req.next_power_of_two();
+        let size = if size <= self.ra_pages / 32 {
+            size * 4
+        } else if size <= self.ra_pages / 4 {
+            size * 2
+        } else {
+            self.ra_pages
+        };
+        size.min(self.ra_pages)
+    }
+
+    /// 顺序访问时窗口的增长：小窗口放大4倍，否则翻倍
+    fn next_size(&self, cur: usize) -> usize {
+        let size = if cur < self.ra_pages / 16 {
+            cur * 4
+        } else {
+            cur * 2
+        };
+        size.clamp(1, self.ra_pages.max(1))
+    }
+
+    fn window(&self) -> RaWindow {
+        RaWindow {
+            start: self.start,
+            nr: self.size,
+            marker: if self.async_size > 0 {
+                Some(self.start + self.size - self.async_size)
+            } else {
+                None
+            },
+        }
+    }
+
+    /// # 缓存缺页时调用，返回需要同步读入的窗口
+    ///
+    /// ## 参数
+    ///
+    /// - `index`: 缺失的页号
+    /// - `req`: 本次读请求从`index`开始还需要的页数
+    pub fn on_miss(&mut self, index: usize, req: usize) -> RaWindow {
+        let req = req.max(1);
+        if self.ra_pages == 0 {
+            // 预读被关闭，只读请求的范围
+            self.start = index;
+            self.size = req;
+            self.async_size = 0;
+        } else if index == self.start + self.size
+            || self.prev_index.is_some_and(|prev| prev + 1 == index)
+        {
+            // 顺序访问，扩大窗口
+            self.start = index;
+            self.size = self.next_size(self.size.max(req)).max(req);
+            self.async_size = self.size.saturating_sub(req);
+        } else {
+            self.start = index;
+            self.size = self.init_size(req).max(req);
+            self.async_size = self.size.saturating_sub(req);
+        }
+        return self.window();
+    }
+
+    /// # 读到带有`PG_READAHEAD`标记的页时调用，返回需要异步读入的下一个窗口
+    pub fn on_marker(&mut self, index: usize, req: usize) -> Option<RaWindow> {
+        if self.ra_pages == 0 {
+            return None;
+        }
+        if self.async_size > 0 && index == self.start + self.size - self.async_size {
+            // 正好读到了上一个窗口的异步部分，接着往后预读
+            self.start += self.size;
+            self.size = self.next_size(self.size);
+        } else {
+            // 标记来自其他的读者，或者预读状态已经被改变，从当前位置重新开始
+            self.start = index + 1;
+            self.size = self.next_size(req.max(1));
+        }
+        self.async_size = self.size;
+        return Some(self.window());
+    }
+
+    /// # mmap缺页时调用，返回需要同步读入的窗口
+    ///
+    /// 设置了`MADV_SEQUENTIAL`的映射按顺序读处理；否则读入缺页地址周围的页面。
+    pub fn on_fault_miss(&mut self, index: usize, vm_flags: VmFlags) -> Option<RaWindow> {
+        if vm_flags.contains(VmFlags::VM_RAND_READ) || self.ra_pages == 0 {
+            return None;
+        }
+        if vm_flags.contains(VmFlags::VM_SEQ_READ) {
+            return Some(self.on_miss(index, self.ra_pages));
+        }
+        self.start = index.saturating_sub(self.ra_pages / 2);
+        self.size = self.ra_pages;
+        self.async_size = self.ra_pages / 4;
+        return Some(self.window());
+    }
+
+    pub fn set_prev_index(&mut self, index: usize) {
+        self.prev_index = Some(index);
+    }
+}
+
+/// # 普通读操作的预读
+///
+/// 在从页面缓存中复制数据之前调用：对缺失的页进行同步预读，对带有标记的页发起异步预读。
+///
+/// ## 参数
+///
+/// - `page_cache`: 文件的页面缓存
+/// - `ra`: 文件的预读状态
+/// - `offset`: 读操作的字节偏移量
+/// - `len`: 读操作的字节数（已经按文件大小截断）
+pub fn file_read_readahead(
+    page_cache: &Arc<PageCache>,
+    ra: &SpinLock<FileRaState>,
+    offset: usize,
+    len: usize,
+) {
+    if len == 0 {
+        return;
+    }
+    let first = offset >> MMArch::PAGE_SHIFT;
+    let end = (offset + len - 1) / MMArch::PAGE_SIZE + 1;
+
+    let mut index = first;
+    while index < end {
+        match page_cache.get_page(index) {
+            Some(page) => {
+                if page.flags().contains(PageFlags::PG_READAHEAD) {
+                    page.remove_flags(PageFlags::PG_READAHEAD);
+                    if let Some(window) = ra.lock().on_marker(index, end - index) {
+                        submit_async(page_cache, window);
+                    }
+                }
+                index += 1;
+            }
+            None => {
+                let window = ra.lock().on_miss(index, end - index);
+                // 预读失败不影响读操作本身，缺失的页面会在读取时逐页重试
+                let _ = page_cache.readahead(window);
+                index = window.start + window.nr;
+            }
+        }
+    }
+    ra.lock().set_prev_index(end - 1);
+}
+
+/// # 文件映射缺页时的预读
+///
+/// ## 参数
+///
+/// - `page_cache`: 文件的页面缓存
+/// - `ra`: 映射所属文件的预读状态
+/// - `index`: 缺页在文件中的页号
+/// - `vm_flags`: 缺页所在VMA的标志，由madvise设置
+pub fn filemap_fault_readahead(
+    page_cache: &Arc<PageCache>,
+    ra: &SpinLock<FileRaState>,
+    index: usize,
+    vm_flags: VmFlags,
+) {
+    if vm_flags.contains(VmFlags::VM_RAND_READ) {
+        return;
+    }
+    match page_cache.get_page(index) {
+        Some(page) => {
+            if page.flags().contains(PageFlags::PG_READAHEAD) {
+                page.remove_flags(PageFlags::PG_READAHEAD);
+                if let Some(window) = ra.lock().on_marker(index, 1) {
+                    submit_async(page_cache, window);
+                }
+            }
+        }
+        None => {
+            let window = ra.lock().on_fault_miss(index, vm_flags);
+            if let Some(window) = window {
+                let _ = page_cache.readahead(window);
+            }
+        }
+    }
+    ra.lock().set_prev_index(index);
+}
+
+/// # 强制预读一段范围，用于fadvise(POSIX_FADV_WILLNEED)和madvise(MADV_WILLNEED)
+///
+/// 范围按预读窗口上限切分后交给预读线程，不等待读入完成
+pub fn force_readahead(page_cache: &Arc<PageCache>, start: usize, nr: usize) {
+    let mut index = start;
+    let end = start.saturating_add(nr);
+    while index < end {
+        let n = (end - index).min(RA_DEFAULT_MAX_PAGES);
+        if !submit_async(
+            page_cache,
+            RaWindow {
+                start: index,
+                nr: n,
+                marker: None,
+            },
+        ) {
+            break;
+        }
+        index += n;
+    }
+}
+
+/// 把预读请求加入队列并唤醒预读线程。队列已满时返回false
+fn submit_async(page_cache: &Arc<PageCache>, window: RaWindow) -> bool {
+    let mut queue = RA_QUEUE.lock_irqsave();
+    if queue.len() >= RA_QUEUE_MAX {
+        return false;
+    }
+    if !queue
+        .iter()
+        .any(|w| Arc::ptr_eq(&w.page_cache, page_cache) && w.window == window)
+    {
+        queue.push_back(RaWork {
+            page_cache: page_cache.clone(),
+            window,
+        });
+    }
+    drop(queue);
+    RA_WAIT_QUEUE.wakeup(None);
+    return true;
+}
+
+#[unified_init(INITCALL_CORE)]
+fn readahead_init() -> Result<(), SystemError> {
+    let closure = KernelThreadClosure::StaticEmptyClosure((&(readahead_thread as fn() -> i32), ()));
+    KernelThreadMechanism::create_and_run(closure, "kreadahead".to_string())
+        .ok_or("")
+        .expect("create kreadahead thread failed");
+    Ok(())
+}
+
+/// 预读线程执行的函数
+fn readahead_thread() -> i32 {
+    loop {
+        let mut queue = RA_QUEUE.lock_irqsave();
+        let work = match queue.pop_front() {
+            Some(work) => work,
+            None => {
+                RA_WAIT_QUEUE.sleep_unlock_spinlock(queue);
+                continue;
+            }
+        };
+        drop(queue);
+        let _ = work.page_cache.readahead(work.window);
+    }
+}
@@ -0,0 +1,361 @@
+//! # 在内核中搬运文件数据：sendfile、splice、tee、vmsplice、copy_file_range
+//!
+//! 普通文件的数据直接从页面缓存中取出，不经过用户态，也不需要中间缓冲区：
+//! - 放进管道时只保存缓存页的引用（见`PipeBuffer`），数据在读出管道时才被访问
+//! - 写到socket或者其他文件时直接以缓存页为源缓冲区
+//!
+//! 管道之间移动或者复制数据时只移动或者复制数据段的引用。没有页面缓存的文件（socket、设备等）读到内核缓冲区中中转。
+
+use alloc::{sync::Arc, vec::Vec};
+use system_error::SystemError;
+
+use crate::{
+    arch::MMArch,
+    ipc::pipe::{LockedPipeInode, PipeBuffer},
+    libs::casting::DowncastArc,
+    mm::MemoryManagementArch,
+};
+
+use super::{
+    file::{File, FileMode},
+    readahead, FileType,
+};
+
+bitflags! {
+    /// splice、tee、vmsplice的标志
+    pub struct SpliceFlags: u32 {
+        /// 尽量移动页面而不是复制，只是提示
+        const SPLICE_F_MOVE = 1;
+        /// 管道操作不阻塞
+        const SPLICE_F_NONBLOCK = 2;
+        /// 之后还有更多的数据，只是提示
+        const SPLICE_F_MORE = 4;
+        /// vmsplice时把用户的页面交给内核，只是提示
+        const SPLICE_F_GIFT = 8;
+    }
+}
+
+/// 一次调用最多搬运的字节数，与Linux的MAX_RW_COUNT相同
+pub const MAX_RW_COUNT: usize = (i32::MAX as usize) & !(MMArch::PAGE_SIZE - 1);
+
+/// 如果文件是管道，返回管道的inode
+pub fn file_pipe(file: &File) -> Option<Arc<LockedPipeInode>> {
+    if file.file_type() != FileType::Pipe {
+        return None;
+    }
+    return file.inode().downcast_arc::<LockedPipeInode>();
+}
+
+/// 管道操作是否不阻塞
+#[inline]
+fn pipe_nonblock(file: &File, flags: SpliceFlags) -> bool {
+    flags.contains(SpliceFlags::SPLICE_F_NONBLOCK) || file.mode().contains(FileMode::O_NONBLOCK)
+}
+
+/// ## 从文件中读出最多`len`个字节，依次交给`actor`
+///
+/// 有页面缓存的文件交出缓存页的引用，其他文件一次读出一个页面大小的数据。
+///
+/// ## 参数
+/// - `offset`：读取的位置，`None`表示从文件的当前位置读取并更新它
+/// - `actor`：返回它接受了的字节数，少于交给它的数据时停止
+///
+/// ## 返回值
+/// - `Ok(usize)`：被`actor`接受的字节数
+fn read_source<F>(
+    file: &File,
+    offset: Option<usize>,
+    len: usize,
+    mut actor: F,
+) -> Result<usize, SystemError>
+where
+    F: FnMut(PipeBuffer) -> Result<usize, SystemError>,
+{
+    file.readable()?;
+    let inode = file.inode();
+    let page_cache = match file.file_type() {
+        FileType::File => inode.page_cache(),
+        _ => None,
+    };
+
+    if let Some(page_cache) = page_cache {
+        let pos = offset.unwrap_or_else(|| file.pos());
+        let file_size = inode.metadata()?.size as usize;
+        let ra_len = core::cmp::min(len, file_size.saturating_sub(pos));
+        readahead::file_read_readahead(&page_cache, file.ra_state(), pos, ra_len);
+
+        let n = page_cache.for_each_page(pos, len, |page, page_offset, n| {
+            actor(PipeBuffer::from_page(page.clone(), page_offset, n))
+        })?;
+        if offset.is_none() {
+            file.advance_pos(n);
+        }
+        return Ok(n);
+    }
+
+    let mut buf = vec![0u8; core::cmp::min(len, MMArch::PAGE_SIZE)];
+    let n = match offset {
+        Some(offset) => file.pread(offset, buf.len(), &mut buf)?,
+        None => file.read(buf.len(), &mut buf)?,
+    };
+    if n == 0 {
+        return Ok(0);
+    }
+    buf.truncate(n);
+    return actor(PipeBuffer::from_bytes(buf));
+}
+
+/// 把一段数据写到文件中，`offset`为`None`时写到文件的当前位置
+fn write_sink(file: &File, offset: Option<usize>, data: &[u8]) -> Result<usize, SystemError> {
+    match offset {
+        Some(offset) => file.pwrite(offset, data.len(), data),
+        None => file.write(data.len(), data),
+    }
+}
+
+/// 把文件中的数据以页面引用的形式放进管道
+fn file_to_pipe(
+    in_file: &File,
+    offset: Option<usize>,
+    pipe: &LockedPipeInode,
+    len: usize,
+    nonblock: bool,
+) -> Result<usize, SystemError> {
+    let room = pipe.wait_room(nonblock)?;
+    let mut bufs = Vec::new();
+    let n = read_source(in_file, offset, core::cmp::min(len, room), |buf| {
+        let n = buf.len();
+        bufs.push(buf);
+        Ok(n)
+    })?;
+    pipe.push_buffers(bufs)?;
+    return Ok(n);
+}
+
+/// 把管道中的数据直接写到文件中，没有写出的数据留在管道中
+fn pipe_to_file(
+    pipe: &LockedPipeInode,
+    out_file: &File,
+    offset: Option<usize>,
+    len: usize,
+    nonblock: bool,
+) -> Result<usize, SystemError> {
+    out_file.writeable()?;
+    if pipe.wait_data(nonblock)? == 0 {
+        return Ok(0);
+    }
+
+    let mut bufs = pipe.take_buffers(len)?.into_iter();
+    let mut rest = Vec::new();
+    let mut done = 0;
+    let mut result = Ok(());
+    for mut buf in bufs.by_ref() {
+        match write_sink(out_file, offset.map(|x| x + done), buf.as_slice()) {
+            Ok(n) => {
+                done += n;
+                buf.advance(n);
+                if !buf.is_empty() {
+                    rest.push(buf);
+                    break;
+                }
+            }
+            Err(e) => {
+                rest.push(buf);
+                result = Err(e);
+                break;
+            }
+        }
+    }
+    rest.extend(bufs);
+    pipe.return_buffers(rest);
+
+    if done == 0 {
+        result?;
+    }
+    return Ok(done);
+}
+
+/// 在两个管道之间移动数据段
+fn pipe_to_pipe(
+    in_pipe: &LockedPipeInode,
+    out_pipe: &LockedPipeInode,
+    len: usize,
+    nonblock: bool,
+) -> Result<usize, SystemError> {
+    if core::ptr::eq(in_pipe, out_pipe) {
+        return Err(SystemError::EINVAL);
+    }
+    if in_pipe.wait_data(nonblock)? == 0 {
+        return Ok(0);
+    }
+    let room = out_pipe.wait_room(nonblock)?;
+    let bufs = in_pipe.take_buffers(core::cmp::min(len, room))?;
+    let n = bufs.iter().map(|buf| buf.len()).sum();
+    out_pipe.push_buffers(bufs)?;
+    return Ok(n);
+}
+
+/// ## sendfile：把`in_file`中的数据写到`out_file`
+///
+/// ## 参数
+/// - `offset`：读取`in_file`的位置，`None`表示从文件的当前位置读取并更新它
+///
+/// ## 返回值
+/// - `Ok(usize)`：写出的字节数
+pub fn do_sendfile(
+    in_file: &File,
+    out_file: &File,
+    offset: Option<usize>,
+    len: usize,
+) -> Result<usize, SystemError> {
+    let len = core::cmp::min(len, MAX_RW_COUNT);
+    out_file.writeable()?;
+    if let Some(pipe) = file_pipe(out_file) {
+        let nonblock = pipe_nonblock(out_file, SpliceFlags::empty());
+        return file_to_pipe(in_file, offset, &pipe, len, nonblock);
+    }
+    return read_source(in_file, offset, len, |buf| {
+        write_sink(out_file, None, buf.as_slice())
+    });
+}
+
+/// ## splice：在管道和文件之间搬运数据，两端至少有一端是管道
+///
+/// ## 参数
+/// - `in_offset`、`out_offset`：文件一端的读写位置，`None`表示使用并更新文件的当前位置。管道一端必须为`None`
+///
+/// ## 返回值
+/// - `Ok(usize)`：搬运的字节数
+pub fn do_splice(
+    in_file: &File,
+    in_offset: Option<usize>,
+    out_file: &File,
+    out_offset: Option<usize>,
+    len: usize,
+    flags: SpliceFlags,
+) -> Result<usize, SystemError> {
+    let len = core::cmp::min(len, MAX_RW_COUNT);
+    in_file.readable()?;
+    out_file.writeable()?;
+    match (file_pipe(in_file), file_pipe(out_file)) {
+        (Some(in_pipe), Some(out_pipe)) => {
+            if in_offset.is_some() || out_offset.is_some() {
+                return Err(SystemError::ESPIPE);
+            }
+            let nonblock = pipe_nonblock(in_file, flags) || pipe_nonblock(out_file, flags);
+            pipe_to_pipe(&in_pipe, &out_pipe, len, nonblock)
+        }
+        (Some(in_pipe), None) => {
+            if in_offset.is_some() {
+                return Err(SystemError::ESPIPE);
+            }
+            pipe_to_file(
+                &in_pipe,
+                out_file,
+                out_offset,
+                len,
+                pipe_nonblock(in_file, flags),
+            )
+        }
+        (None, Some(out_pipe)) => {
+            if out_offset.is_some() {
+                return Err(SystemError::ESPIPE);
+            }
+            file_to_pipe(
+                in_file,
+                in_offset,
+                &out_pipe,
+                len,
+                pipe_nonblock(out_file, flags),
+            )
+        }
+        (None, None) => Err(SystemError::EINVAL),
+    }
+}
+
+/// ## tee：把`in_file`管道中的数据复制到`out_file`管道中，不消费`in_file`中的数据
+///
+/// 两个管道共享数据段的内存，不复制数据
+pub fn do_tee(
+    in_file: &File,
+    out_file: &File,
+    len: usize,
+    flags: SpliceFlags,
+) -> Result<usize, SystemError> {
+    let (Some(in_pipe), Some(out_pipe)) = (file_pipe(in_file), file_pipe(out_file)) else {
+        return Err(SystemError::EINVAL);
+    };
+    if Arc::ptr_eq(&in_pipe, &out_pipe) {
+        return Err(SystemError::EINVAL);
+    }
+    in_file.readable()?;
+    out_file.writeable()?;
+    let nonblock = pipe_nonblock(in_file, flags) || pipe_nonblock(out_file, flags);
+    if in_pipe.wait_data(nonblock)? == 0 {
+        return Ok(0);
+    }
+    let room = out_pipe.wait_room(nonblock)?;
+    let bufs = in_pipe.peek_buffers(core::cmp::min(len, room));
+    let n = bufs.iter().map(|buf| buf.len()).sum();
+    out_pipe.push_buffers(bufs)?;
+    return Ok(n);
+}
+
+/// ## vmsplice：把用户缓冲区中的数据放进管道
+///
+/// ## 返回值
+/// - `Ok(usize)`：放进管道的字节数，管道的空间不足时只放入一部分
+pub fn do_vmsplice(out_file: &File, data: &[u8], flags: SpliceFlags) -> Result<usize, SystemError> {
+    let pipe = file_pipe(out_file).ok_or(SystemError::EBADF)?;
+    out_file.writeable()?;
+    if data.is_empty() {
+        return Ok(0);
+    }
+    let room = pipe.wait_room(pipe_nonblock(out_file, flags))?;
+    let data = &data[..core::cmp::min(data.len(), room)];
+    let bufs = data
+        .chunks(MMArch::PAGE_SIZE)
+        .map(|chunk| PipeBuffer::from_bytes(chunk.to_vec()))
+        .collect();
+    pipe.push_buffers(bufs)?;
+    return Ok(data.len());
+}
+
+/// ## copy_file_range：在两个普通文件之间复制数据
+///
+/// 数据从源文件的缓存页直接写入目标文件，不经过中间缓冲区
+///
+/// ## 参数
+/// - `in_offset`、`out_offset`：读写的位置，`None`表示使用并更新文件的当前位置
+pub fn do_copy_file_range(
+    in_file: &File,
+    in_offset: Option<usize>,
+    out_file: &File,
+    out_offset: Option<usize>,
+    len: usize,
+) -> Result<usize, SystemError> {
+    if in_file.file_type() != FileType::File || out_file.file_type() != FileType::File {
+        return Err(SystemError::EINVAL);
+    }
+    out_file.writeable()?;
+    if out_file.mode().contains(FileMode::O_APPEND) {
+        return Err(SystemError::EBADF);
+    }
+
+    let len = core::cmp::min(len, MAX_RW_COUNT);
+    // 同一个文件中重叠的范围
+    if Arc::ptr_eq(&in_file.inode(), &out_file.inode()) {
+        let in_pos = in_offset.unwrap_or_else(|| in_file.pos());
+        let out_pos = out_offset.unwrap_or_else(|| out_file.pos());
+        if in_pos < out_pos + len && out_pos < in_pos + len {
+            return Err(SystemError::EINVAL);
+        }
+    }
+
+    let mut done = 0;
+    return read_source(in_file, in_offset, len, |buf| {
+        let n = write_sink(out_file, out_offset.map(|x| x + done), buf.as_slice())?;
+        done += n;
+        Ok(n)
+    });
+}
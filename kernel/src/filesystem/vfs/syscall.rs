@@ -11,7 +11,7 @@ use crate::{
     driver::base::{block::SeekFrom, device::device_number::DeviceNumber},
     filesystem::vfs::{core as Vcore, file::FileDescriptorVec},
     libs::rwlock::RwLockWriteGuard,
-    mm::{verify_area, VirtAddr},
+    mm::{page::PageReclaimer, verify_area, VirtAddr},
     process::ProcessManager,
     syscall::{
         user_access::{self, check_and_clone_cstr, UserBufferWriter},
@@ -22,9 +22,12 @@ use crate::{
 
 use super::{
     core::{do_mkdir_at, do_remove_dir, do_unlink_at},
-    fcntl::{AtFlags, FcntlCommand, FD_CLOEXEC},
+    fcntl::{AtFlags, FadviseAdvice, FcntlCommand, FD_CLOEXEC},
     file::{File, FileMode},
     open::{do_faccessat, do_fchmodat, do_sys_open, do_utimensat, do_utimes},
+    splice::{
+        do_copy_file_range, do_sendfile, do_splice, do_tee, do_vmsplice, file_pipe, SpliceFlags,
+    },
     utils::{rsplit_path, user_path_at},
     Dirent, FileType, IndexNode, SuperBlock, FSMAKER, MAX_PATHLEN, ROOT_INODE,
     VFS_MAX_FOLLOW_SYMLINK_TIMES,
@@ -556,16 +559,9 @@ impl Syscall {
     /// @return Ok(usize) 成功读取的数据的字节数
     /// @return Err(SystemError) 读取失败，返回posix错误码
     pub fn read(fd: i32, buf: &mut [u8]) -> Result<usize, SystemError> {
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-
-        let file = fd_table_guard.get_file_by_fd(fd);
-        if file.is_none() {
-            return Err(SystemError::EBADF);
-        }
-        // drop guard 以避免无法调度的问题
-        drop(fd_table_guard);
-        let file = file.unwrap();
+        let file = ProcessManager::current_pcb()
+            .get_file(fd)
+            .ok_or(SystemError::EBADF)?;
 
         return file.read(buf.len(), buf);
     }
@@ -578,15 +574,10 @@ impl Syscall {
     /// @return Ok(usize) 成功写入的数据的字节数
     /// @return Err(SystemError) 写入失败，返回posix错误码
     pub fn write(fd: i32, buf: &[u8]) -> Result<usize, SystemError> {
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-
-        let file = fd_table_guard
-            .get_file_by_fd(fd)
+        let file = ProcessManager::current_pcb()
+            .get_file(fd)
             .ok_or(SystemError::EBADF)?;
 
-        // drop guard 以避免无法调度的问题
-        drop(fd_table_guard);
         return file.write(buf.len(), buf);
     }
 
@@ -606,14 +597,10 @@ impl Syscall {
             _ => Err(SystemError::EINVAL),
         }?;
 
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-        let file = fd_table_guard
-            .get_file_by_fd(fd)
+        let file = ProcessManager::current_pcb()
+            .get_file(fd)
             .ok_or(SystemError::EBADF)?;
 
-        // drop guard 以避免无法调度的问题
-        drop(fd_table_guard);
         return file.lseek(seek);
     }
 
@@ -625,16 +612,9 @@ impl Syscall {
     /// - `len`: 要读取的字节数
     /// - `offset`: 文件偏移量
     pub fn pread(fd: i32, buf: &mut [u8], len: usize, offset: usize) -> Result<usize, SystemError> {
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-
-        let file = fd_table_guard.get_file_by_fd(fd);
-        if file.is_none() {
-            return Err(SystemError::EBADF);
-        }
-        // drop guard 以避免无法调度的问题
-        drop(fd_table_guard);
-        let file = file.unwrap();
+        let file = ProcessManager::current_pcb()
+            .get_file(fd)
+            .ok_or(SystemError::EBADF)?;
 
         return file.pread(offset, len, buf);
     }
@@ -647,16 +627,9 @@ impl Syscall {
     /// - `len`: 要写入的字节数
     /// - `offset`: 文件偏移量
     pub fn pwrite(fd: i32, buf: &[u8], len: usize, offset: usize) -> Result<usize, SystemError> {
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-
-        let file = fd_table_guard.get_file_by_fd(fd);
-        if file.is_none() {
-            return Err(SystemError::EBADF);
-        }
-        // drop guard 以避免无法调度的问题
-        drop(fd_table_guard);
-        let file = file.unwrap();
+        let file = ProcessManager::current_pcb()
+            .get_file(fd)
+            .ok_or(SystemError::EBADF)?;
 
         return file.pwrite(offset, len, buf);
     }
@@ -770,7 +743,7 @@ impl Syscall {
         let dirent =
             unsafe { (buf.as_mut_ptr() as *mut Dirent).as_mut() }.ok_or(SystemError::EFAULT)?;
 
-        if fd < 0 || fd as usize > FileDescriptorVec::PROCESS_MAX_FD {
+        if !FileDescriptorVec::validate_fd(fd) {
             return Err(SystemError::EBADF);
         }
 
@@ -1142,27 +1115,20 @@ impl Syscall {
         // debug!("fcntl ({cmd:?}) fd: {fd}, arg={arg}");
         match cmd {
             FcntlCommand::DupFd | FcntlCommand::DupFdCloexec => {
-                if arg < 0 || arg as usize >= FileDescriptorVec::PROCESS_MAX_FD {
+                if !FileDescriptorVec::validate_fd(arg) {
+                    return Err(SystemError::EINVAL);
+                }
+                let binding = ProcessManager::current_pcb().fd_table();
+                let mut fd_table_guard = binding.write();
+                if fd_table_guard.get_file_by_fd(fd).is_none() {
                     return Err(SystemError::EBADF);
                 }
-                let arg = arg as usize;
-                for i in arg..FileDescriptorVec::PROCESS_MAX_FD {
-                    let binding = ProcessManager::current_pcb().fd_table();
-                    let mut fd_table_guard = binding.write();
-                    if fd_table_guard.get_file_by_fd(i as i32).is_none() {
-                        if cmd == FcntlCommand::DupFd {
-                            return Self::do_dup2(fd, i as i32, &mut fd_table_guard);
-                        } else {
-                            return Self::do_dup3(
-                                fd,
-                                i as i32,
-                                FileMode::O_CLOEXEC,
-                                &mut fd_table_guard,
-                            );
-                        }
-                    }
+                let i = fd_table_guard.find_free_fd(arg as usize)? as i32;
+                if cmd == FcntlCommand::DupFd {
+                    return Self::do_dup2(fd, i, &mut fd_table_guard);
+                } else {
+                    return Self::do_dup3(fd, i, FileMode::O_CLOEXEC, &mut fd_table_guard);
                 }
-                return Err(SystemError::EMFILE);
             }
             FcntlCommand::GetFd => {
                 // Get file descriptor flags.
@@ -1184,20 +1150,9 @@ impl Syscall {
             FcntlCommand::SetFd => {
                 // Set file descriptor flags.
                 let binding = ProcessManager::current_pcb().fd_table();
-                let fd_table_guard = binding.write();
-
-                if let Some(file) = fd_table_guard.get_file_by_fd(fd) {
-                    // drop guard 以避免无法调度的问题
-                    drop(fd_table_guard);
-                    let arg = arg as u32;
-                    if arg & FD_CLOEXEC != 0 {
-                        file.set_close_on_exec(true);
-                    } else {
-                        file.set_close_on_exec(false);
-                    }
-                    return Ok(0);
-                }
-                return Err(SystemError::EBADF);
+                let mut fd_table_guard = binding.write();
+                fd_table_guard.set_close_on_exec(fd, arg as u32 & FD_CLOEXEC != 0)?;
+                return Ok(0);
             }
 
             FcntlCommand::GetFlags => {
@@ -1269,6 +1224,197 @@ impl Syscall {
         return Err(SystemError::EBADF);
     }
 
+    /// # fsync系统调用
+    ///
+    /// 把文件在页面缓存以及块设备缓存中的脏数据写回存储设备
+    pub fn fsync(fd: i32) -> Result<usize, SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        return file.fsync().map(|_| 0);
+    }
+
+    /// # sync系统调用
+    ///
+    /// 回写页面缓存中的所有脏页，然后把所有文件系统缓存的数据写回设备
+    pub fn sync() -> Result<usize, SystemError> {
+        PageReclaimer::writeback_dirty_pages();
+        Vcore::sync_all_filesystems()?;
+        return Ok(0);
+    }
+
+    /// # syncfs系统调用
+    ///
+    /// 回写页面缓存中的所有脏页，然后把fd所在的文件系统缓存的数据写回设备
+    pub fn syncfs(fd: i32) -> Result<usize, SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        PageReclaimer::writeback_dirty_pages();
+        file.inode().sync_fs()?;
+        return Ok(0);
+    }
+
+    /// # fadvise64系统调用
+    ///
+    /// 声明文件在[offset, offset + len)范围内的访问模式，用于调整预读
+    pub fn fadvise64(
+        fd: i32,
+        offset: usize,
+        len: usize,
+        advice: FadviseAdvice,
+    ) -> Result<usize, SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        return file.fadvise(offset, len, advice).map(|_| 0);
+    }
+
+    /// 读取用户传入的文件偏移量，空指针表示使用文件的当前位置
+    fn splice_offset_from_user(offset: *const i64) -> Result<Option<usize>, SystemError> {
+        if offset.is_null() {
+            return Ok(None);
+        }
+        let reader = UserBufferReader::new(offset, size_of::<i64>(), true)?;
+        let offset = *reader.read_one_from_user::<i64>(0)?;
+        if offset < 0 {
+            return Err(SystemError::EINVAL);
+        }
+        return Ok(Some(offset as usize));
+    }
+
+    /// 把更新后的文件偏移量写回用户传入的指针
+    fn splice_offset_to_user(ptr: *mut i64, offset: Option<usize>) -> Result<(), SystemError> {
+        if let Some(offset) = offset {
+            let mut writer = UserBufferWriter::new(ptr, size_of::<i64>(), true)?;
+            writer.copy_one_to_user(&(offset as i64), 0)?;
+        }
+        return Ok(());
+    }
+
+    /// 获取splice类系统调用的源文件和目标文件
+    fn splice_files(in_fd: i32, out_fd: i32) -> Result<(Arc<File>, Arc<File>), SystemError> {
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let in_file = fd_table_guard
+            .get_file_by_fd(in_fd)
+            .ok_or(SystemError::EBADF)?;
+        let out_file = fd_table_guard
+            .get_file_by_fd(out_fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+        return Ok((in_file, out_file));
+    }
+
+    /// # sendfile系统调用
+    ///
+    /// 把`in_fd`中的数据直接写到`out_fd`，普通文件的数据直接从页面缓存中取出，不经过用户态
+    ///
+    /// ## 参数
+    /// - `offset`：读取`in_fd`的位置，返回时更新为读完之后的位置。为空时使用并更新`in_fd`的当前位置
+    pub fn sendfile(
+        out_fd: i32,
+        in_fd: i32,
+        offset: *mut i64,
+        count: usize,
+    ) -> Result<usize, SystemError> {
+        let (in_file, out_file) = Self::splice_files(in_fd, out_fd)?;
+        let pos = Self::splice_offset_from_user(offset)?;
+        let n = do_sendfile(&in_file, &out_file, pos, count)?;
+        Self::splice_offset_to_user(offset, pos.map(|x| x + n))?;
+        return Ok(n);
+    }
+
+    /// # splice系统调用
+    ///
+    /// 在管道和文件（或者另一个管道）之间搬运数据，不经过用户态。
+    /// 从普通文件搬到管道时管道只保存页面缓存中的页面的引用
+    pub fn splice(
+        fd_in: i32,
+        off_in: *mut i64,
+        fd_out: i32,
+        off_out: *mut i64,
+        len: usize,
+        flags: u32,
+    ) -> Result<usize, SystemError> {
+        let flags = SpliceFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        let (in_file, out_file) = Self::splice_files(fd_in, fd_out)?;
+        let in_pos = Self::splice_offset_from_user(off_in)?;
+        let out_pos = Self::splice_offset_from_user(off_out)?;
+        let n = do_splice(&in_file, in_pos, &out_file, out_pos, len, flags)?;
+        Self::splice_offset_to_user(off_in, in_pos.map(|x| x + n))?;
+        Self::splice_offset_to_user(off_out, out_pos.map(|x| x + n))?;
+        return Ok(n);
+    }
+
+    /// # tee系统调用
+    ///
+    /// 把管道`fd_in`中的数据复制到管道`fd_out`中，不消费`fd_in`中的数据
+    pub fn tee(fd_in: i32, fd_out: i32, len: usize, flags: u32) -> Result<usize, SystemError> {
+        let flags = SpliceFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        let (in_file, out_file) = Self::splice_files(fd_in, fd_out)?;
+        return do_tee(&in_file, &out_file, len, flags);
+    }
+
+    /// # vmsplice系统调用
+    ///
+    /// 把用户缓冲区中的数据放进管道`fd`。`fd`是管道的读端时，与readv相同
+    pub fn vmsplice(fd: i32, iov: usize, count: usize, flags: u32) -> Result<usize, SystemError> {
+        let flags = SpliceFlags::from_bits(flags).ok_or(SystemError::EINVAL)?;
+        let binding = ProcessManager::current_pcb().fd_table();
+        let fd_table_guard = binding.read();
+        let file = fd_table_guard
+            .get_file_by_fd(fd)
+            .ok_or(SystemError::EBADF)?;
+        // drop guard 以避免无法调度的问题
+        drop(fd_table_guard);
+
+        if file.mode().accmode() == FileMode::O_RDONLY.bits() {
+            file_pipe(&file).ok_or(SystemError::EBADF)?;
+            return Self::readv(fd, iov, count);
+        }
+        // IoVecs会进行用户态检验
+        let iovecs = unsafe { IoVecs::from_user(iov as *const IoVec, count, false) }?;
+        let data = iovecs.gather();
+        return do_vmsplice(&file, &data, flags);
+    }
+
+    /// # copy_file_range系统调用
+    ///
+    /// 在两个普通文件之间复制数据，数据从源文件的缓存页直接写入目标文件
+    pub fn copy_file_range(
+        fd_in: i32,
+        off_in: *mut i64,
+        fd_out: i32,
+        off_out: *mut i64,
+        len: usize,
+        flags: u32,
+    ) -> Result<usize, SystemError> {
+        if flags != 0 {
+            return Err(SystemError::EINVAL);
+        }
+        let (in_file, out_file) = Self::splice_files(fd_in, fd_out)?;
+        let in_pos = Self::splice_offset_from_user(off_in)?;
+        let out_pos = Self::splice_offset_from_user(off_out)?;
+        let n = do_copy_file_range(&in_file, in_pos, &out_file, out_pos, len)?;
+        Self::splice_offset_to_user(off_in, in_pos.map(|x| x + n))?;
+        Self::splice_offset_to_user(off_out, out_pos.map(|x| x + n))?;
+        return Ok(n);
+    }
+
     fn do_fstat(fd: i32) -> Result<PosixKstat, SystemError> {
         let binding = ProcessManager::current_pcb().fd_table();
         let fd_table_guard = binding.read();
@@ -23,7 +23,7 @@ use crate::{
     },
     mm::init::mm_init,
     process::{kthread::kthread_init, process_init, ProcessManager},
-    sched::SchedArch,
+    sched::{sched_cpu_activate, SchedArch},
     smp::{early_smp_init, SMPArch},
     syscall::Syscall,
     time::{
@@ -46,6 +46,7 @@ pub fn start_kernel() -> ! {
     do_start_kernel();
 
     CurrentSchedArch::initial_setup_sched_local();
+    sched_cpu_activate();
 
     CurrentSchedArch::enable_sched_local();
 
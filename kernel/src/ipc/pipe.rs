@@ -1,12 +1,16 @@
 use crate::{
+    arch::MMArch,
     filesystem::vfs::{
-        core::generate_inode_id, file::FileMode, syscall::ModeType, FilePrivateData, FileSystem,
-        FileType, IndexNode, Metadata,
+        core::generate_inode_id,
+        file::{FileMode, PageCache},
+        syscall::ModeType,
+        FilePrivateData, FileSystem, FileType, IndexNode, Metadata,
     },
     libs::{
         spinlock::{SpinLock, SpinLockGuard},
         wait_queue::WaitQueue,
     },
+    mm::{page::Page, MemoryManagementArch},
     net::event_poll::{EPollEventType, EPollItem, EventPoll},
     process::ProcessState,
     sched::SchedMode,
@@ -14,14 +18,93 @@ use crate::{
 };
 
 use alloc::{
-    collections::LinkedList,
+    collections::{LinkedList, VecDeque},
     sync::{Arc, Weak},
     vec::Vec,
 };
 use system_error::SystemError;
 
-/// 我们设定pipe_buff的总大小为1024字节
-const PIPE_BUFF_SIZE: usize = 1024;
+/// 管道的容量，与Linux默认的16个页面相同
+const PIPE_BUFF_SIZE: usize = 16 * MMArch::PAGE_SIZE;
+
+/// 管道中一段数据所在的内存
+#[derive(Debug, Clone)]
+enum PipeBufData {
+    /// 写入管道时复制进来的数据。tee之后被多个管道共享，不再追加数据
+    Bytes(Arc<Vec<u8>>),
+    /// splice/sendfile放进管道的页面缓存中的页面，不复制数据。
+    /// 页面在管道持有期间被移出页面缓存时，由`Page`在最后一个引用消失时释放
+    Page(Arc<Page>),
+}
+
+/// # 管道中的一段数据
+///
+/// 管道由若干段数据组成，每段数据引用一块内存中的`[offset, offset + len)`。
+/// 从页面缓存splice进来的数据只持有页面的引用，读出或者splice到其他文件时才访问页面的内容。
+#[derive(Debug, Clone)]
+pub struct PipeBuffer {
+    data: PipeBufData,
+    offset: usize,
+    len: usize,
+}
+
+impl PipeBuffer {
+    /// 引用页面缓存中的一个页面中的`[offset, offset + len)`
+    pub fn from_page(page: Arc<Page>, offset: usize, len: usize) -> Self {
+        debug_assert!(offset + len <= MMArch::PAGE_SIZE);
+        Self {
+            data: PipeBufData::Page(page),
+            offset,
+            len,
+        }
+    }
+
+    pub fn from_bytes(bytes: Vec<u8>) -> Self {
+        let len = bytes.len();
+        Self {
+            data: PipeBufData::Bytes(Arc::new(bytes)),
+            offset: 0,
+            len,
+        }
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// 这段数据的内容
+    pub fn as_slice(&self) -> &[u8] {
+        match &self.data {
+            PipeBufData::Bytes(bytes) => &bytes[self.offset..self.offset + self.len],
+            PipeBufData::Page(page) => {
+                // 管道持有页面的引用，页面在此期间不会被释放
+                let data = unsafe { PageCache::page_data(page.read_irqsave().phys_address()) };
+                &data[self.offset..self.offset + self.len]
+            }
+        }
+    }
+
+    /// 丢弃开头的`n`个字节
+    pub fn advance(&mut self, n: usize) {
+        debug_assert!(n <= self.len);
+        self.offset += n;
+        self.len -= n;
+    }
+
+    /// 拆出开头的`n`个字节，两段数据共享同一块内存
+    fn split_to(&mut self, n: usize) -> Self {
+        let mut head = self.clone();
+        head.len = n;
+        self.advance(n);
+        head
+    }
+}
 
 #[derive(Debug, Clone)]
 pub struct PipeFsPrivateData {
@@ -51,10 +134,9 @@ pub struct LockedPipeInode {
 pub struct InnerPipeInode {
     self_ref: Weak<LockedPipeInode>,
     /// 管道内可读的数据数
-    valid_cnt: i32,
-    read_pos: i32,
-    write_pos: i32,
-    data: [u8; PIPE_BUFF_SIZE],
+    valid_cnt: usize,
+    /// 管道中的数据
+    bufs: VecDeque<PipeBuffer>,
     /// INode 元数据
     metadata: Metadata,
     reader: u32,
@@ -86,7 +168,7 @@ impl InnerPipeInode {
 
         if mode.contains(FileMode::O_WRONLY) {
             // 管道内数据未满
-            if self.valid_cnt as usize != PIPE_BUFF_SIZE {
+            if self.valid_cnt != PIPE_BUFF_SIZE {
                 events.insert(EPollEventType::EPOLLIN & EPollEventType::EPOLLWRNORM);
             }
 
@@ -100,12 +182,87 @@ impl InnerPipeInode {
     }
 
     pub fn add_epoll(&mut self, epitem: Arc<EPollItem>) -> Result<(), SystemError> {
-        self.epitems.lock().push_back(epitem);
+        self.epitems.lock_irqsave().push_back(epitem);
         Ok(())
     }
 
     fn buf_full(&self) -> bool {
-        return self.valid_cnt as usize == PIPE_BUFF_SIZE;
+        return self.valid_cnt >= PIPE_BUFF_SIZE;
+    }
+
+    /// 把数据复制到管道的末尾，尽量追加到最后一段数据中
+    fn push_bytes(&mut self, buf: &[u8]) {
+        self.valid_cnt += buf.len();
+        let mut buf = buf;
+        if let Some(last) = self.bufs.back_mut() {
+            if let PipeBufData::Bytes(bytes) = &mut last.data {
+                // 数据段只从头部消费，所以末尾总是和Vec的末尾对齐
+                if let Some(bytes) = Arc::get_mut(bytes) {
+                    let n = buf.len().min(MMArch::PAGE_SIZE.saturating_sub(bytes.len()));
+                    bytes.extend_from_slice(&buf[..n]);
+                    last.len += n;
+                    buf = &buf[n..];
+                }
+            }
+        }
+        for chunk in buf.chunks(MMArch::PAGE_SIZE) {
+            self.bufs.push_back(PipeBuffer::from_bytes(chunk.to_vec()));
+        }
+    }
+
+    /// 从管道的头部复制数据到`buf`中，返回复制的字节数
+    fn pop_bytes(&mut self, buf: &mut [u8]) -> usize {
+        let mut done = 0;
+        while done < buf.len() {
+            let Some(front) = self.bufs.front_mut() else {
+                break;
+            };
+            let n = front.len().min(buf.len() - done);
+            buf[done..done + n].copy_from_slice(&front.as_slice()[..n]);
+            front.advance(n);
+            if front.is_empty() {
+                self.bufs.pop_front();
+            }
+            done += n;
+        }
+        self.valid_cnt -= done;
+        return done;
+    }
+
+    /// 从管道的头部取出最多`len`字节的数据段
+    fn take_buffers(&mut self, len: usize) -> Vec<PipeBuffer> {
+        let mut bufs = Vec::new();
+        let mut done = 0;
+        while done < len {
+            let Some(front) = self.bufs.front_mut() else {
+                break;
+            };
+            let buf = if front.len() > len - done {
+                front.split_to(len - done)
+            } else {
+                self.bufs.pop_front().unwrap()
+            };
+            done += buf.len();
+            bufs.push(buf);
+        }
+        self.valid_cnt -= done;
+        return bufs;
+    }
+
+    /// 复制管道头部最多`len`字节的数据段，数据段和管道共享内存
+    fn peek_buffers(&self, len: usize) -> Vec<PipeBuffer> {
+        let mut bufs = Vec::new();
+        let mut done = 0;
+        for buf in self.bufs.iter() {
+            if done >= len {
+                break;
+            }
+            let mut buf = buf.clone();
+            buf.len = buf.len.min(len - done);
+            done += buf.len;
+            bufs.push(buf);
+        }
+        return bufs;
     }
 
     pub fn remove_epoll(&self, epoll: &Weak<SpinLock<EventPoll>>) -> Result<(), SystemError> {
@@ -129,9 +286,7 @@ impl LockedPipeInode {
         let inner = InnerPipeInode {
             self_ref: Weak::default(),
             valid_cnt: 0,
-            read_pos: 0,
-            write_pos: 0,
-            data: [0; PIPE_BUFF_SIZE],
+            bufs: VecDeque::new(),
 
             metadata: Metadata {
                 dev_id: 0,
@@ -178,6 +333,99 @@ impl LockedPipeInode {
         let inode = self.inner.lock();
         return !inode.buf_full() || inode.reader == 0;
     }
+
+    /// ## 等待管道中有数据可读，供splice/tee使用
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：管道中可读的字节数。写端全部关闭并且没有数据时返回0
+    /// - `Err(SystemError::EINTR)`：等待时被信号打断
+    pub fn wait_data(&self, nonblock: bool) -> Result<usize, SystemError> {
+        loop {
+            let inode = self.inner.lock();
+            if inode.valid_cnt > 0 || inode.writer == 0 {
+                return Ok(inode.valid_cnt);
+            }
+            drop(inode);
+            if nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            let r = wq_wait_event_interruptible!(self.read_wait_queue, self.readable(), {});
+            if r.is_err() {
+                return Err(SystemError::EINTR);
+            }
+        }
+    }
+
+    /// ## 等待管道中有空闲的空间，供splice/tee/vmsplice使用
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：管道中空闲的字节数
+    /// - `Err(SystemError::EPIPE)`：读端已经全部关闭
+    /// - `Err(SystemError::EINTR)`：等待时被信号打断
+    pub fn wait_room(&self, nonblock: bool) -> Result<usize, SystemError> {
+        loop {
+            let inode = self.inner.lock();
+            if inode.reader == 0 {
+                return Err(SystemError::EPIPE);
+            }
+            if !inode.buf_full() {
+                return Ok(PIPE_BUFF_SIZE - inode.valid_cnt);
+            }
+            drop(inode);
+            if nonblock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            let r = wq_wait_event_interruptible!(self.write_wait_queue, self.writeable(), {});
+            if r.is_err() {
+                return Err(SystemError::EINTR);
+            }
+        }
+    }
+
+    /// 把数据段放进管道的末尾，并唤醒读者。数据段的内存不会被复制
+    pub fn push_buffers(&self, bufs: Vec<PipeBuffer>) -> Result<(), SystemError> {
+        if bufs.is_empty() {
+            return Ok(());
+        }
+        let mut inode = self.inner.lock();
+        for buf in bufs {
+            inode.valid_cnt += buf.len();
+            inode.bufs.push_back(buf);
+        }
+        self.read_wait_queue
+            .wakeup(Some(ProcessState::Blocked(true)));
+        EventPoll::wakeup_epoll(
+            &inode.epitems,
+            Some(EPollEventType::EPOLLIN | EPollEventType::EPOLLRDNORM),
+        )
+    }
+
+    /// 从管道的头部取出最多`len`字节的数据段，并唤醒写者
+    pub fn take_buffers(&self, len: usize) -> Result<Vec<PipeBuffer>, SystemError> {
+        let mut inode = self.inner.lock();
+        let bufs = inode.take_buffers(len);
+        self.write_wait_queue
+            .wakeup(Some(ProcessState::Blocked(true)));
+        EventPoll::wakeup_epoll(
+            &inode.epitems,
+            Some(EPollEventType::EPOLLOUT | EPollEventType::EPOLLWRNORM),
+        )?;
+        return Ok(bufs);
+    }
+
+    /// 把`take_buffers`取出之后没有用完的数据段按原来的顺序放回管道的头部
+    pub fn return_buffers(&self, bufs: Vec<PipeBuffer>) {
+        let mut inode = self.inner.lock();
+        for buf in bufs.into_iter().rev() {
+            inode.valid_cnt += buf.len();
+            inode.bufs.push_front(buf);
+        }
+    }
+
+    /// 复制管道头部最多`len`字节的数据段而不消费它们，数据段与管道共享内存
+    pub fn peek_buffers(&self, len: usize) -> Vec<PipeBuffer> {
+        return self.inner.lock().peek_buffers(len);
+    }
 }
 
 impl IndexNode for LockedPipeInode {
@@ -231,29 +479,8 @@ impl IndexNode for LockedPipeInode {
             inode = self.inner.lock();
         }
 
-        let mut num = inode.valid_cnt as usize;
-        //决定要输出的字节
-        let start = inode.read_pos as usize;
-        //如果读端希望读取的字节数大于有效字节数，则输出有效字节
-        let mut end = (inode.valid_cnt as usize + inode.read_pos as usize) % PIPE_BUFF_SIZE;
-        //如果读端希望读取的字节数少于有效字节数，则输出希望读取的字节
-        if len < inode.valid_cnt as usize {
-            end = (len + inode.read_pos as usize) % PIPE_BUFF_SIZE;
-            num = len;
-        }
-
-        // 从管道拷贝数据到用户的缓冲区
-
-        if end < start {
-            buf[0..(PIPE_BUFF_SIZE - start)].copy_from_slice(&inode.data[start..PIPE_BUFF_SIZE]);
-            buf[(PIPE_BUFF_SIZE - start)..num].copy_from_slice(&inode.data[0..end]);
-        } else {
-            buf[0..num].copy_from_slice(&inode.data[start..end]);
-        }
-
-        //更新读位置以及valid_cnt
-        inode.read_pos = (inode.read_pos + num as i32) % PIPE_BUFF_SIZE as i32;
-        inode.valid_cnt -= num as i32;
+        // 从管道拷贝数据到用户的缓冲区，最多拷贝len个字节
+        let num = inode.pop_bytes(&mut buf[..len]);
 
         // 读完以后如果未读完，则唤醒下一个读者
         if inode.valid_cnt > 0 {
@@ -299,7 +526,7 @@ impl IndexNode for LockedPipeInode {
     fn metadata(&self) -> Result<crate::filesystem::vfs::Metadata, SystemError> {
         let inode = self.inner.lock();
         let mut metadata = inode.metadata.clone();
-        metadata.size = inode.data.len() as i64;
+        metadata.size = PIPE_BUFF_SIZE as i64;
 
         return Ok(metadata);
     }
@@ -366,7 +593,7 @@ impl IndexNode for LockedPipeInode {
 
         // 如果管道空间不够
 
-        while len + inode.valid_cnt as usize > PIPE_BUFF_SIZE {
+        while len + inode.valid_cnt > PIPE_BUFF_SIZE {
             // 唤醒读端
             self.read_wait_queue
                 .wakeup(Some(ProcessState::Blocked(true)));
@@ -386,23 +613,11 @@ impl IndexNode for LockedPipeInode {
             inode = self.inner.lock();
         }
 
-        // 决定要输入的字节
-        let start = inode.write_pos as usize;
-        let end = (inode.write_pos as usize + len) % PIPE_BUFF_SIZE;
         // 从用户的缓冲区拷贝数据到管道
-
-        if end < start {
-            inode.data[start..PIPE_BUFF_SIZE].copy_from_slice(&buf[0..(PIPE_BUFF_SIZE - start)]);
-            inode.data[0..end].copy_from_slice(&buf[(PIPE_BUFF_SIZE - start)..len]);
-        } else {
-            inode.data[start..end].copy_from_slice(&buf[0..len]);
-        }
-        // 更新写位置以及valid_cnt
-        inode.write_pos = (inode.write_pos + len as i32) % PIPE_BUFF_SIZE as i32;
-        inode.valid_cnt += len as i32;
+        inode.push_bytes(&buf[0..len]);
 
         // 写完后还有位置，则唤醒下一个写者
-        if (inode.valid_cnt as usize) < PIPE_BUFF_SIZE {
+        if inode.valid_cnt < PIPE_BUFF_SIZE {
             self.write_wait_queue
                 .wakeup(Some(ProcessState::Blocked(true)));
         }
@@ -437,6 +652,10 @@ impl IndexNode for LockedPipeInode {
         todo!()
     }
 
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
     fn list(&self) -> Result<alloc::vec::Vec<alloc::string::String>, SystemError> {
         return Err(SystemError::ENOSYS);
     }
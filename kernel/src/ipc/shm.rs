@@ -7,7 +7,7 @@ use crate::{
     },
     mm::{
         allocator::page_frame::{FrameAllocator, PageFrameCount, PhysPageFrame},
-        page::{page_manager_lock_irqsave, Page},
+        page::{page_manager, Page},
         PhysAddr,
     },
     process::{Pid, ProcessManager},
@@ -162,13 +162,13 @@ impl ShmManager {
         let phys_page =
             unsafe { LockedFrameAllocator.allocate(page_count) }.ok_or(SystemError::EINVAL)?;
         // 创建共享内存page，并添加到PAGE_MANAGER中
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         let mut cur_phys = PhysPageFrame::new(phys_page.0);
         for _ in 0..page_count.data() {
             let page = Arc::new(Page::new(true, cur_phys.phys_address()));
             page.write_irqsave().set_shm_id(shm_id);
             let paddr = cur_phys.phys_address();
-            page_manager_guard.insert(paddr, &page);
+            page_manager.insert(paddr, &page);
             cur_phys = cur_phys.next();
         }
 
@@ -320,11 +320,11 @@ impl ShmManager {
         let id = kernel_shm.kern_ipc_perm.id;
         let map_count = kernel_shm.map_count();
 
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         if map_count > 0 {
             // 设置共享内存物理页当映射计数等于0时可被回收
             for _ in 0..count.data() {
-                let page = page_manager_guard.get_unwrap(&cur_phys.phys_address());
+                let page = page_manager.get_unwrap(&cur_phys.phys_address());
                 page.write_irqsave().set_dealloc_when_zero(true);
 
                 cur_phys = cur_phys.next();
@@ -336,11 +336,11 @@ impl ShmManager {
             // 释放共享内存物理页
             for _ in 0..count.data() {
                 let paddr = cur_phys.phys_address();
+                // 先将物理页面对应的Page从PAGE_MANAGER中删去，再释放页帧
+                page_manager.remove_page(&paddr);
                 unsafe {
                     LockedFrameAllocator.free(paddr, PageFrameCount::new(1));
                 }
-                // 将已回收的物理页面对应的Page从PAGE_MANAGER中删去
-                page_manager_guard.remove_page(&paddr);
                 cur_phys = cur_phys.next();
             }
 
@@ -436,13 +436,13 @@ impl KernelShm {
 
     /// 共享内存段的映射计数（有多少个不同的VMA映射）
     pub fn map_count(&self) -> usize {
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         let mut id_set: HashSet<usize> = HashSet::new();
         let mut cur_phys = PhysPageFrame::new(self.shm_start_paddr);
         let page_count = PageFrameCount::from_bytes(page_align_up(self.shm_size)).unwrap();
 
         for _ in 0..page_count.data() {
-            let page = page_manager_guard.get(&cur_phys.phys_address()).unwrap();
+            let page = page_manager.get(&cur_phys.phys_address()).unwrap();
             id_set.extend(
                 page.read_irqsave()
                     .anon_vma()
@@ -20,7 +20,7 @@ use crate::{
     libs::spinlock::SpinLock,
     mm::{
         allocator::page_frame::{PageFrameCount, PhysPageFrame, VirtPageFrame},
-        page::{page_manager_lock_irqsave, EntryFlags, PageFlushAll},
+        page::{page_manager, EntryFlags, PageFlushAll},
         syscall::ProtFlags,
         ucontext::{AddressSpace, VMA},
         VirtAddr, VmFlags,
@@ -371,7 +371,7 @@ impl Syscall {
                 vma.unmap(&mut address_write_guard.user_mapper.utable, flusher);
 
                 // 将该虚拟内存区域映射到共享内存区域
-                let mut page_manager_guard = page_manager_lock_irqsave();
+                let page_manager = page_manager();
                 let mut virt = VirtPageFrame::new(vaddr);
                 for _ in 0..count.data() {
                     let r = unsafe {
@@ -385,7 +385,7 @@ impl Syscall {
                     r.flush();
 
                     // 将vma加入到对应Page的anon_vma
-                    page_manager_guard
+                    page_manager
                         .get_unwrap(&phys.phys_address())
                         .write_irqsave()
                         .insert_vma(vma.clone());
@@ -441,10 +441,9 @@ impl Syscall {
             .0;
 
         // 如果物理页的shm_id为None，代表不是共享页
-        let mut page_manager_guard = page_manager_lock_irqsave();
-        let page = page_manager_guard.get(&paddr).ok_or(SystemError::EINVAL)?;
+        let page_manager = page_manager();
+        let page = page_manager.get(&paddr).ok_or(SystemError::EINVAL)?;
         let shm_id = page.read_irqsave().shm_id().ok_or(SystemError::EINVAL)?;
-        drop(page_manager_guard);
 
         // 获取对应共享页管理信息
         let mut shm_manager_guard = shm_manager_lock();
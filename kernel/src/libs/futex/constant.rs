@@ -52,3 +52,11 @@ pub const FUTEX_OWNER_DIED: u32 = 0x40000000;
 #[allow(dead_code)]
 pub const FUTEX_TID_MASK: u32 = 0x3fffffff;
 pub const FUTEX_BITSET_MATCH_ANY: u32 = 0xffffffff;
+
+/// futex_waitv一次最多等待的futex数
+pub const FUTEX_WAITV_MAX: usize = 128;
+/// futex2的标志：futex的大小为32位，目前只支持这一种
+pub const FUTEX2_SIZE_U32: u32 = 0x02;
+pub const FUTEX2_SIZE_MASK: u32 = 0x03;
+/// futex2的标志：进程私有的futex
+pub const FUTEX2_PRIVATE: u32 = 128;
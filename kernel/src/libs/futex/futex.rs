@@ -1,16 +1,16 @@
 use alloc::{
-    collections::LinkedList,
+    collections::VecDeque,
     sync::{Arc, Weak},
+    vec::Vec,
 };
 use core::hash::{Hash, Hasher};
 use core::{
     intrinsics::{likely, unlikely},
     mem,
-    sync::atomic::AtomicU64,
+    sync::atomic::{fence, AtomicBool, AtomicU32, AtomicU64, AtomicUsize, Ordering},
 };
 use log::warn;
 
-use hashbrown::HashMap;
 use system_error::SystemError;
 
 use crate::{
@@ -19,131 +19,447 @@ use crate::{
     libs::spinlock::{SpinLock, SpinLockGuard},
     mm::{ucontext::AddressSpace, MemoryManagementArch, VirtAddr},
     process::{Pid, ProcessControlBlock, ProcessManager},
-    sched::{schedule, SchedMode},
+    sched::{prio::MAX_PRIO, rt_mutex_setprio, schedule, SchedMode},
+    smp::cpu::smp_cpu_manager,
     syscall::user_access::{UserBufferReader, UserBufferWriter},
     time::{
-        timer::{next_n_us_timer_jiffies, Timer, WakeUpHelper},
+        timer::{next_n_us_timer_jiffies, Timer},
         PosixTimeSpec,
     },
 };
 
 use super::constant::*;
 
+/// futex哈希表中每个cpu对应的bucket数
+const FUTEX_HASH_BUCKETS_PER_CPU: usize = 256;
+/// FutexObj不在任何bucket中
+const FUTEX_NOT_QUEUED: usize = usize::MAX;
+/// 2^64 / φ，用于把key的哈希值均匀地分散到各个bucket
+const GOLDEN_RATIO_64: u64 = 0x61C8_8646_80B5_83EB;
+/// 优先级继承沿着等待链向上传递的最大深度，与Linux的max_lock_depth相同
+const FUTEX_PI_MAX_CHAIN_DEPTH: usize = 1024;
+
 static mut FUTEX_DATA: Option<FutexData> = None;
 
+/// 全局的futex哈希表
+///
+/// bucket的数量在初始化时按cpu数确定，之后不再变化。每个bucket单独加锁，
+/// 不同futex上的操作通常落在不同的bucket上，互不竞争
 pub struct FutexData {
-    data: SpinLock<HashMap<FutexKey, FutexHashBucket>>,
+    buckets: Vec<FutexHashBucket>,
+    /// 哈希值右移的位数，移位之后的结果就是bucket的下标
+    hash_shift: u32,
 }
 
 impl FutexData {
-    pub fn futex_map() -> SpinLockGuard<'static, HashMap<FutexKey, FutexHashBucket>> {
-        unsafe { FUTEX_DATA.as_ref().unwrap().data.lock() }
+    #[inline(always)]
+    fn get() -> &'static FutexData {
+        unsafe { FUTEX_DATA.as_ref().unwrap() }
     }
 
-    pub fn try_remove(key: &FutexKey) -> Option<FutexHashBucket> {
-        unsafe {
-            let mut guard = FUTEX_DATA.as_ref().unwrap().data.lock();
-            if let Some(futex) = guard.get(key) {
-                if futex.chain.is_empty() {
-                    return guard.remove(key);
-                }
-            }
+    /// 获取下标为`idx`的bucket
+    #[inline(always)]
+    pub fn bucket(idx: usize) -> &'static FutexHashBucket {
+        &Self::get().buckets[idx]
+    }
+
+    /// 计算key所在bucket的下标
+    #[inline(always)]
+    pub fn hash_index(key: &FutexKey) -> usize {
+        (key.hash_u64() >> Self::get().hash_shift) as usize
+    }
+
+    /// 获取key所在的bucket
+    #[inline(always)]
+    pub fn hash_bucket(key: &FutexKey) -> &'static FutexHashBucket {
+        Self::bucket(Self::hash_index(key))
+    }
+
+    /// ## 同时锁住两个bucket
+    ///
+    /// 按下标从小到大的顺序加锁，避免死锁。两个下标相同时只加一次锁，第二个返回值为None
+    ///
+    /// ## 返回值
+    /// - 依次是`idx1`和`idx2`对应的bucket的锁
+    pub fn lock_two(
+        idx1: usize,
+        idx2: usize,
+    ) -> (
+        SpinLockGuard<'static, FutexQueue>,
+        Option<SpinLockGuard<'static, FutexQueue>>,
+    ) {
+        if idx1 == idx2 {
+            return (Self::bucket(idx1).lock(), None);
         }
-        None
+        if idx1 < idx2 {
+            let guard1 = Self::bucket(idx1).lock();
+            let guard2 = Self::bucket(idx2).lock();
+            return (guard1, Some(guard2));
+        }
+        let guard2 = Self::bucket(idx2).lock();
+        let guard1 = Self::bucket(idx1).lock();
+        return (guard1, Some(guard2));
     }
 }
 
 pub struct Futex;
 
-// 对于同一个futex的进程或线程将会在这个bucket等待
+/// 哈希到同一个bucket的futex，等待的进程或线程都在这个bucket上排队
 pub struct FutexHashBucket {
-    // 该futex维护的等待队列
-    chain: LinkedList<Arc<FutexObj>>,
+    /// 在这个bucket上排队（或者正准备排队）的进程数，为0时唤醒不需要加锁
+    waiters: AtomicUsize,
+    queue: SpinLock<FutexQueue>,
 }
 
 impl FutexHashBucket {
-    /// ## 判断是否在bucket里
-    pub fn contains(&self, futex_q: &FutexObj) -> bool {
-        self.chain
-            .iter()
-            .filter(|x| futex_q.pcb.ptr_eq(&x.pcb) && x.key == futex_q.key)
-            .count()
-            != 0
+    fn new(idx: usize) -> Self {
+        Self {
+            waiters: AtomicUsize::new(0),
+            queue: SpinLock::new(FutexQueue {
+                idx,
+                chain: VecDeque::new(),
+                pi_states: Vec::new(),
+            }),
+        }
+    }
+
+    #[inline(always)]
+    pub fn lock(&self) -> SpinLockGuard<FutexQueue> {
+        self.queue.lock_irqsave()
+    }
+
+    /// ## 判断bucket上是否可能有等待者，不需要加锁
+    ///
+    /// 等待者先增加计数再读取futex的值，唤醒者先修改futex的值再检查计数，两边之间都有内存屏障。
+    /// 因此唤醒者看到计数为0时，之后的等待者一定能读到修改后的值，不会错过唤醒
+    #[inline(always)]
+    pub fn has_waiters(&self) -> bool {
+        fence(Ordering::SeqCst);
+        self.waiters.load(Ordering::SeqCst) != 0
+    }
+}
+
+/// bucket中被锁保护的等待队列
+pub struct FutexQueue {
+    /// 所在bucket的下标
+    idx: usize,
+    // 等待队列，可能包含哈希到同一个bucket的不同futex
+    chain: VecDeque<Arc<FutexObj>>,
+    /// 哈希到这个bucket、并且有进程在等待的PI futex。PI futex的等待者在各自的pi_state中排队
+    pi_states: Vec<Arc<FutexPiState>>,
+}
+
+impl FutexQueue {
+    #[inline(always)]
+    fn waiters(&self) -> &'static AtomicUsize {
+        &FutexData::bucket(self.idx).waiters
+    }
+
+    /// 增加等待者计数，需要在读取futex的值之前调用
+    #[inline(always)]
+    pub fn waiters_inc(&self) {
+        self.waiters().fetch_add(1, Ordering::SeqCst);
+    }
+
+    #[inline(always)]
+    pub fn waiters_dec(&self) {
+        self.waiters().fetch_sub(1, Ordering::SeqCst);
     }
 
     /// 让futex_q在该bucket上挂起
     ///
-    /// 进入该函数前，需要关中断
+    /// 进入该函数前，需要关中断。等待者计数应当已经增加
     #[inline(always)]
     pub fn sleep_no_sched(&mut self, futex_q: Arc<FutexObj>) -> Result<(), SystemError> {
         assert!(!CurrentIrqArch::is_irq_enabled());
-        self.chain.push_back(futex_q);
-
         ProcessManager::mark_sleep(true)?;
+        self.enqueue(futex_q);
 
         Ok(())
     }
 
-    /// ## 唤醒队列中的最多nr_wake个进程
+    /// 把futex_q加入等待队列，不修改进程状态。等待者计数应当已经增加
+    #[inline(always)]
+    pub fn enqueue(&mut self, futex_q: Arc<FutexObj>) {
+        futex_q.bucket.store(self.idx, Ordering::SeqCst);
+        self.chain.push_back(futex_q);
+    }
+
+    /// 查找key对应的pi_state
+    fn find_pi_state(&self, key: &FutexKey) -> Option<Arc<FutexPiState>> {
+        self.pi_states.iter().find(|ps| ps.key == *key).cloned()
+    }
+
+    /// ## 让futex_q在PI futex上排队
+    ///
+    /// 等待者计数应当已经增加
+    fn enqueue_pi(&mut self, futex_q: &Arc<FutexObj>, pi_state: &Arc<FutexPiState>) {
+        futex_q.bucket.store(self.idx, Ordering::SeqCst);
+        *futex_q.pi_state.lock_irqsave() = Some(pi_state.clone());
+        pi_state
+            .inner
+            .lock_irqsave()
+            .waiters
+            .push_back(futex_q.clone());
+        if let Some(pcb) = futex_q.pcb.upgrade() {
+            pcb.futex_pi_irqsave().blocked_on = Some(pi_state.clone());
+        }
+    }
+
+    /// 把pi_state从bucket和持有者中删除，在最后一个等待者离开时调用
+    fn detach_pi_state(&mut self, pi_state: &Arc<FutexPiState>) {
+        self.pi_states.retain(|x| !Arc::ptr_eq(x, pi_state));
+        if let Some(owner) = pi_state.owner() {
+            owner
+                .futex_pi_irqsave()
+                .held
+                .retain(|x| !Arc::ptr_eq(x, pi_state));
+        }
+    }
+
+    /// ## 唤醒队列中等待key的最多nr_wake个进程
+    ///
+    /// 只唤醒等待的bitset与`bitset`有交集的进程
     ///
     /// return: 唤醒的进程数
-    #[inline(always)]
-    pub fn wake_up(
+    pub fn wake_up(&mut self, key: &FutexKey, bitset: u32, nr_wake: u32) -> usize {
+        let waiters = self.waiters();
+        let mut count = 0;
+        self.chain.retain(|futex_q| {
+            // 等待requeue到PI futex上的进程只能通过FUTEX_CMP_REQUEUE_PI唤醒
+            if count >= nr_wake as usize
+                || futex_q.bitset & bitset == 0
+                || futex_q.requeue_pi_key.is_some()
+                || *futex_q.key.lock() != *key
+            {
+                return true;
+            }
+
+            // 先离开队列再唤醒，被唤醒的进程看到自己不在队列中就知道是正常唤醒
+            futex_q.bucket.store(FUTEX_NOT_QUEUED, Ordering::SeqCst);
+            waiters.fetch_sub(1, Ordering::SeqCst);
+            if let Some(pcb) = futex_q.pcb.upgrade() {
+                ProcessManager::wakeup(&pcb).ok();
+            }
+            count += 1;
+            false
+        });
+        count
+    }
+
+    /// ## 把等待key1的最多nr_requeue个进程转移到key2上
+    ///
+    /// ## 参数
+    /// - `target`：key2所在bucket的队列，与当前bucket相同时为None
+    ///
+    /// ## 返回值
+    /// - 转移的进程数
+    pub fn requeue(
         &mut self,
-        key: FutexKey,
-        bitset: Option<u32>,
-        nr_wake: u32,
-    ) -> Result<usize, SystemError> {
+        target: Option<&mut FutexQueue>,
+        key1: &FutexKey,
+        key2: &FutexKey,
+        nr_requeue: u32,
+    ) -> usize {
         let mut count = 0;
-        let mut pop_count = 0;
-        while let Some(futex_q) = self.chain.pop_front() {
-            if futex_q.key == key {
-                // TODO: 考虑优先级继承的机制
-
-                if let Some(bitset) = bitset {
-                    if futex_q.bitset != bitset {
-                        self.chain.push_back(futex_q);
-                        continue;
-                    }
+        let Some(target) = target else {
+            for futex_q in self.chain.iter() {
+                if count >= nr_requeue as usize {
+                    break;
                 }
-
-                // 唤醒
-                if futex_q.pcb.upgrade().is_some() {
-                    self.remove(futex_q.clone());
-                    ProcessManager::wakeup(&futex_q.pcb.upgrade().unwrap())?;
+                let mut key = futex_q.key.lock();
+                if *key == *key1 && futex_q.requeue_pi_key.is_none() {
+                    *key = key2.clone();
+                    count += 1;
                 }
+            }
+            return count;
+        };
 
-                // 判断唤醒数
-                count += 1;
-                if count >= nr_wake {
-                    break;
+        let waiters = self.waiters();
+        self.chain.retain(|futex_q| {
+            if count >= nr_requeue as usize
+                || futex_q.requeue_pi_key.is_some()
+                || *futex_q.key.lock() != *key1
+            {
+                return true;
+            }
+            *futex_q.key.lock() = key2.clone();
+            futex_q.bucket.store(target.idx, Ordering::SeqCst);
+            waiters.fetch_sub(1, Ordering::SeqCst);
+            target.waiters_inc();
+            target.chain.push_back(futex_q.clone());
+            count += 1;
+            false
+        });
+        count
+    }
+
+    /// ## 将FutexObj从bucket中删除
+    ///
+    /// 在PI futex上等待的，同时从pi_state中删除，并重新计算持有者的优先级
+    pub fn remove(&mut self, futex: &Arc<FutexObj>) {
+        let pi_state = futex.pi_state.lock_irqsave().take();
+        match pi_state {
+            Some(pi_state) => {
+                let empty = {
+                    let mut inner = pi_state.inner.lock_irqsave();
+                    inner.waiters.retain(|x| !Arc::ptr_eq(x, futex));
+                    inner.waiters.is_empty()
+                };
+                if let Some(pcb) = futex.pcb.upgrade() {
+                    pcb.futex_pi_irqsave().blocked_on = None;
+                }
+                if empty {
+                    self.detach_pi_state(&pi_state);
+                }
+                if let Some(owner) = pi_state.owner() {
+                    Futex::pi_adjust_prio(owner);
                 }
-            } else {
-                self.chain.push_back(futex_q);
             }
-            // 判断是否循环完队列了
-            pop_count += 1;
-            if pop_count >= self.chain.len() {
-                break;
+            None => self.chain.retain(|x| !Arc::ptr_eq(x, futex)),
+        }
+        futex.bucket.store(FUTEX_NOT_QUEUED, Ordering::SeqCst);
+        self.waiters_dec();
+    }
+}
+
+/// ## 优先级继承futex的内核状态
+///
+/// 第一个进程在PI futex上等待时创建，同时挂在futex所在的bucket和持有者的`FutexPiTaskState`上，
+/// 最后一个等待者离开时删除。持有者的有效优先级不低于所有等待者中最高的优先级
+#[derive(Debug)]
+pub struct FutexPiState {
+    key: FutexKey,
+    inner: SpinLock<InnerFutexPiState>,
+}
+
+#[derive(Debug)]
+struct InnerFutexPiState {
+    /// 持有futex的进程，退出后为空
+    owner: Weak<ProcessControlBlock>,
+    /// 等待者，按到达的顺序排列
+    waiters: VecDeque<Arc<FutexObj>>,
+}
+
+impl FutexPiState {
+    fn new(key: FutexKey, owner: &Arc<ProcessControlBlock>) -> Self {
+        Self {
+            key,
+            inner: SpinLock::new(InnerFutexPiState {
+                owner: Arc::downgrade(owner),
+                waiters: VecDeque::new(),
+            }),
+        }
+    }
+
+    fn owner(&self) -> Option<Arc<ProcessControlBlock>> {
+        self.inner.lock_irqsave().owner.upgrade()
+    }
+
+    /// 优先级最高的等待者，优先级相同时先到先得
+    fn top_waiter(&self) -> Option<Arc<FutexObj>> {
+        let inner = self.inner.lock_irqsave();
+        let mut top: Option<(i32, &Arc<FutexObj>)> = None;
+        for waiter in inner.waiters.iter() {
+            let prio = waiter.prio();
+            if top.map_or(true, |(top_prio, _)| prio < top_prio) {
+                top = Some((prio, waiter));
             }
         }
-        Ok(count as usize)
+        return top.map(|(_, waiter)| waiter.clone());
     }
 
-    /// 将FutexObj从bucket中删除
-    pub fn remove(&mut self, futex: Arc<FutexObj>) {
-        self.chain
-            .extract_if(|x| Arc::ptr_eq(x, &futex))
-            .for_each(drop);
+    /// 等待者中最高的优先级，没有等待者时为`MAX_PRIO`
+    fn top_waiter_prio(&self) -> i32 {
+        self.inner
+            .lock_irqsave()
+            .waiters
+            .iter()
+            .map(|waiter| waiter.prio())
+            .min()
+            .unwrap_or(MAX_PRIO)
     }
 }
 
+/// 进程与优先级继承futex有关的状态
+#[derive(Debug, Default)]
+pub struct FutexPiTaskState {
+    /// 持有的、有进程在等待的PI futex
+    held: Vec<Arc<FutexPiState>>,
+    /// 正在等待的PI futex
+    blocked_on: Option<Arc<FutexPiState>>,
+}
+
+/// 在持有bucket的锁时尝试获取PI futex的结果
+enum FutexPiLock {
+    /// 已经获取到锁
+    Acquired,
+    /// 锁被其他进程持有，需要在返回的pi_state上等待
+    Contended(Arc<FutexPiState>),
+}
+
 #[derive(Debug)]
 pub struct FutexObj {
     pcb: Weak<ProcessControlBlock>,
-    key: FutexKey,
+    /// 等待的futex，requeue时会改变。只在持有所在bucket的锁时访问
+    key: SpinLock<FutexKey>,
     bitset: u32,
-    // TODO: 优先级继承
+    /// 所在bucket的下标，不在任何bucket中时为`FUTEX_NOT_QUEUED`。只在持有所在bucket的锁时修改
+    bucket: AtomicUsize,
+    /// 在PI futex上等待时所在的pi_state
+    pi_state: SpinLock<Option<Arc<FutexPiState>>>,
+    /// 解锁者已经把PI futex直接交给了这个等待者
+    pi_acquired: AtomicBool,
+    /// FUTEX_WAIT_REQUEUE_PI的目标PI futex
+    requeue_pi_key: Option<FutexKey>,
+}
+
+impl FutexObj {
+    fn new(
+        pcb: &Arc<ProcessControlBlock>,
+        key: FutexKey,
+        bitset: u32,
+        requeue_pi_key: Option<FutexKey>,
+    ) -> Self {
+        Self {
+            pcb: Arc::downgrade(pcb),
+            key: SpinLock::new(key),
+            bitset,
+            bucket: AtomicUsize::new(FUTEX_NOT_QUEUED),
+            pi_state: SpinLock::new(None),
+            pi_acquired: AtomicBool::new(false),
+            requeue_pi_key,
+        }
+    }
+
+    /// 等待者当前的有效优先级
+    fn prio(&self) -> i32 {
+        self.pcb
+            .upgrade()
+            .map(|pcb| pcb.sched_info().prio_data.read_irqsave().prio)
+            .unwrap_or(MAX_PRIO)
+    }
+
+    /// ## 如果还在某个bucket中，则把自己从中删除
+    ///
+    /// ## 返回值
+    /// - true: 之前还在队列中，说明不是被唤醒操作唤醒的
+    fn unqueue(self: &Arc<Self>) -> bool {
+        loop {
+            let idx = self.bucket.load(Ordering::SeqCst);
+            if idx == FUTEX_NOT_QUEUED {
+                return false;
+            }
+            let mut queue = FutexData::bucket(idx).lock();
+            // 加锁之前可能被requeue到了其他bucket，或者已经被唤醒
+            if self.bucket.load(Ordering::SeqCst) != idx {
+                continue;
+            }
+            queue.remove(self);
+            return true;
+        }
+    }
 }
 
 pub enum FutexAccess {
@@ -167,6 +483,17 @@ pub struct FutexKey {
     key: InnerFutexKey,
 }
 
+impl FutexKey {
+    /// 用来选择bucket的哈希值。与`Hash`一样只使用地址，相等的key哈希值一定相同
+    fn hash_u64(&self) -> u64 {
+        let word = match &self.key {
+            InnerFutexKey::Shared(key) => key.i_seq.rotate_left(32) ^ key.page_offset,
+            InnerFutexKey::Private(key) => key.address,
+        };
+        return (word + self.offset as u64).wrapping_mul(GOLDEN_RATIO_64);
+    }
+}
+
 /// 不同进程间通过文件共享futex变量，表明该变量在文件中的位置
 #[derive(Hash, PartialEq, Eq, Clone, Debug)]
 pub struct SharedKey {
@@ -208,10 +535,16 @@ impl PartialEq for PrivateKey {
 
 impl Futex {
     /// ### 初始化FUTEX_DATA
+    ///
+    /// bucket的数量为cpu数的`FUTEX_HASH_BUCKETS_PER_CPU`倍，向上取整到2的幂
     pub fn init() {
+        let nr_cpus = smp_cpu_manager().possible_cpus_count().max(1) as usize;
+        let size = (FUTEX_HASH_BUCKETS_PER_CPU * nr_cpus).next_power_of_two();
+        let buckets = (0..size).map(FutexHashBucket::new).collect();
         unsafe {
             FUTEX_DATA = Some(FutexData {
-                data: SpinLock::new(HashMap::new()),
+                buckets,
+                hash_shift: u64::BITS - size.trailing_zeros(),
             })
         };
     }
@@ -234,97 +567,66 @@ impl Futex {
             flags.contains(FutexFlag::FLAGS_SHARED),
             FutexAccess::FutexRead,
         )?;
-
-        let mut futex_map_guard = FutexData::futex_map();
-        let bucket = futex_map_guard.get_mut(&key);
-        let bucket_mut = match bucket {
-            Some(bucket) => bucket,
-            None => {
-                let bucket = FutexHashBucket {
-                    chain: LinkedList::new(),
-                };
-                futex_map_guard.insert(key.clone(), bucket);
-                futex_map_guard.get_mut(&key).unwrap()
-            }
-        };
+        let bucket = FutexData::hash_bucket(&key);
 
         // 使用UserBuffer读取futex
         let user_reader =
             UserBufferReader::new(uaddr.as_ptr::<u32>(), core::mem::size_of::<u32>(), true)?;
 
+        let pcb = ProcessManager::current_pcb();
+        // 设置超时定时器，使用进程自己的睡眠定时器，不需要每次分配
+        let timer = abs_time.map(|time| Self::arm_sleep_timer(&pcb, &time));
+        let cancel_timer = || {
+            if let Some(timer) = &timer {
+                timer.cancel();
+            }
+        };
+
+        let futex_q = Arc::new(FutexObj::new(&pcb, key, bitset, None));
+
+        let mut queue = bucket.lock();
+        // 先增加等待者计数再读取futex的值，与futex_wake中的无锁检查配对
+        queue.waiters_inc();
+
         // 从用户空间读取到futex的val
         let mut uval = 0;
 
         // 读取
         // 这里只尝试一种方式去读取用户空间，与linux不太一致
         // 对于linux，如果bucket被锁住时读取失败，将会将bucket解锁后重新读取
-        user_reader.copy_one_from_user::<u32>(&mut uval, 0)?;
+        let r = user_reader.copy_one_from_user::<u32>(&mut uval, 0);
 
         // 不满足wait条件，返回错误
-        if uval != val {
+        if r.is_err() || uval != val {
+            queue.waiters_dec();
+            drop(queue);
+            cancel_timer();
+            r?;
             return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
         }
 
-        let pcb = ProcessManager::current_pcb();
-        // 创建超时计时器任务
-        let mut timer = None;
-        if let Some(time) = abs_time {
-            let wakeup_helper = WakeUpHelper::new(pcb.clone());
-
-            let sec = time.tv_sec;
-            let nsec = time.tv_nsec;
-            let jiffies = next_n_us_timer_jiffies((nsec / 1000 + sec * 1_000_000) as u64);
-
-            let wake_up = Timer::new(wakeup_helper, jiffies);
-
-            wake_up.activate();
-            timer = Some(wake_up);
-        }
-
-        let futex_q = Arc::new(FutexObj {
-            pcb: Arc::downgrade(&pcb),
-            key: key.clone(),
-            bitset,
-        });
-        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
         // 满足条件则将当前进程在该bucket上挂起
-        bucket_mut.sleep_no_sched(futex_q.clone()).map_err(|e| {
+        if let Err(e) = queue.sleep_no_sched(futex_q.clone()) {
             warn!("error:{e:?}");
-            e
-        })?;
-        drop(futex_map_guard);
-        drop(irq_guard);
+            queue.waiters_dec();
+            drop(queue);
+            cancel_timer();
+            return Err(e);
+        }
+        drop(queue);
         schedule(SchedMode::SM_NONE);
 
         // 被唤醒后的检查
-        let mut futex_map_guard = FutexData::futex_map();
-        let bucket = futex_map_guard.get_mut(&key);
-        let bucket_mut = match bucket {
-            // 如果该pcb不在链表里面了或者该链表已经被释放，就证明是正常的Wake操作
-            Some(bucket_mut) => {
-                if !bucket_mut.contains(&futex_q) {
-                    // 取消定时器任务
-                    if let Some(timer) = timer {
-                        timer.cancel();
-                    }
-                    return Ok(0);
-                }
-                // 非正常唤醒，返回交给下层
-                bucket_mut
-            }
-            None => {
-                // 取消定时器任务
-                if let Some(timer) = timer {
-                    timer.cancel();
-                }
-                return Ok(0);
-            }
-        };
+        let timeout = timer.as_ref().is_some_and(|timer| timer.timeout());
+        cancel_timer();
 
-        // 如果是超时唤醒，则返回错误
-        if timer.is_some() && timer.clone().unwrap().timeout() {
-            bucket_mut.remove(futex_q);
+        // 如果已经不在队列中，就证明是正常的Wake操作
+        if !futex_q.unqueue() {
+            return Ok(0);
+        }
 
+        // 如果是超时唤醒，则返回错误
+        if timeout {
             return Err(SystemError::ETIMEDOUT);
         }
 
@@ -336,13 +638,6 @@ impl Futex {
         // 到这里之后，前面的唤醒条件都不满足，则是被信号唤醒
         // 需要处理信号然后重启futex系统调用
 
-        // 取消定时器任务
-        if let Some(timer) = timer {
-            if !timer.timeout() {
-                timer.cancel();
-            }
-        }
-
         Ok(0)
     }
 
@@ -363,19 +658,15 @@ impl Futex {
             flags.contains(FutexFlag::FLAGS_SHARED),
             FutexAccess::FutexRead,
         )?;
-        let mut binding = FutexData::futex_map();
-        let bucket_mut = binding.get_mut(&key).ok_or(SystemError::EINVAL)?;
+        let bucket = FutexData::hash_bucket(&key);
 
-        // 确保后面的唤醒操作是有意义的
-        if bucket_mut.chain.is_empty() {
+        // 没有等待者时不需要加锁，这是无竞争的解锁最常见的情况
+        if !bucket.has_waiters() {
             return Ok(0);
         }
-        // 从队列中唤醒
-        let count = bucket_mut.wake_up(key.clone(), Some(bitset), nr_wake)?;
-
-        drop(binding);
 
-        FutexData::try_remove(&key);
+        // 从队列中唤醒
+        let count = bucket.lock().wake_up(&key, bitset, nr_wake);
 
         Ok(count)
     }
@@ -394,9 +685,9 @@ impl Futex {
             return Err(SystemError::EINVAL);
         }
 
-        // 暂时不支持优先级继承
-        if requeue_pi {
-            return Err(SystemError::ENOSYS);
+        // 转移到PI futex时，只有第一个等待者可以直接获取锁，其余的都在PI futex上排队
+        if requeue_pi && (nr_wake != 1 || cmpval.is_none()) {
+            return Err(SystemError::EINVAL);
         }
 
         let key1 = Self::get_futex_key(
@@ -415,6 +706,10 @@ impl Futex {
             return Err(SystemError::EINVAL);
         }
 
+        let (mut queue1, mut queue2) =
+            FutexData::lock_two(FutexData::hash_index(&key1), FutexData::hash_index(&key2));
+
+        // 持有bucket的锁时比较，与futex_wait中的检查互斥
         if likely(cmpval.is_some()) {
             let uval_reader =
                 UserBufferReader::new(uaddr1.as_ptr::<u32>(), core::mem::size_of::<u32>(), true)?;
@@ -426,32 +721,27 @@ impl Futex {
             }
         }
 
-        let mut futex_data_guard = FutexData::futex_map();
-        if !requeue_pi {
-            // 唤醒nr_wake个进程
-            let bucket_1_mut = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
-            let ret = bucket_1_mut.wake_up(key1.clone(), None, nr_wake as u32)?;
-            // 将bucket1中最多nr_requeue个任务转移到bucket2
-            for _ in 0..nr_requeue {
-                let bucket_1_mut = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
-                let futex_q = bucket_1_mut.chain.pop_front();
-                match futex_q {
-                    Some(futex_q) => {
-                        let bucket_2_mut =
-                            futex_data_guard.get_mut(&key2).ok_or(SystemError::EINVAL)?;
-                        bucket_2_mut.chain.push_back(futex_q);
-                    }
-                    None => {
-                        break;
-                    }
-                }
-            }
+        if requeue_pi {
+            return Self::futex_requeue_pi(
+                &mut queue1,
+                queue2.as_deref_mut(),
+                uaddr2,
+                &key1,
+                &key2,
+                nr_requeue as u32,
+            );
+        }
 
-            return Ok(ret);
-        } else {
-            // 暂时不支持优先级继承
-            todo!()
+        // 唤醒nr_wake个进程
+        let ret = queue1.wake_up(&key1, FUTEX_BITSET_MATCH_ANY, nr_wake as u32);
+        // 将key1上最多nr_requeue个任务转移到key2
+        let requeued = queue1.requeue(queue2.as_deref_mut(), &key1, &key2, nr_requeue as u32);
+
+        // FUTEX_CMP_REQUEUE返回唤醒和转移的总数，FUTEX_REQUEUE只返回唤醒的数量
+        if cmpval.is_some() {
+            return Ok(ret + requeued);
         }
+        return Ok(ret);
     }
 
     /// ### 唤醒futex上的进程的同时进行一些操作
@@ -474,28 +764,598 @@ impl Futex {
             FutexAccess::FutexWrite,
         )?;
 
-        let mut futex_data_guard = FutexData::futex_map();
-        let bucket1 = futex_data_guard.get_mut(&key1).ok_or(SystemError::EINVAL)?;
-        let mut wake_count = 0;
+        let (mut queue1, mut queue2) =
+            FutexData::lock_two(FutexData::hash_index(&key1), FutexData::hash_index(&key2));
+
+        // 持有两个bucket的锁时修改uaddr2，等待者不会在修改和唤醒之间错过唤醒
+        // TODO:retry?
+        let ret = Self::futex_atomic_op_inuser(op as u32, uaddr2)?;
 
         // 唤醒uaddr1中的进程
-        wake_count += bucket1.wake_up(key1, None, nr_wake as u32)?;
-
-        match Self::futex_atomic_op_inuser(op as u32, uaddr2) {
-            Ok(ret) => {
-                // 操作成功则唤醒uaddr2中的进程
-                if ret {
-                    let bucket2 = futex_data_guard.get_mut(&key2).ok_or(SystemError::EINVAL)?;
-                    wake_count += bucket2.wake_up(key2, None, nr_wake2 as u32)?;
-                }
+        let mut wake_count = queue1.wake_up(&key1, FUTEX_BITSET_MATCH_ANY, nr_wake as u32);
+
+        // 操作成功则唤醒uaddr2中的进程
+        if ret {
+            let queue2 = queue2.as_deref_mut().unwrap_or(&mut *queue1);
+            wake_count += queue2.wake_up(&key2, FUTEX_BITSET_MATCH_ANY, nr_wake2 as u32);
+        }
+
+        Ok(wake_count)
+    }
+
+    /// ## 把等待key1的进程转移到PI futex key2上
+    ///
+    /// 第一个等待者先尝试获取key2，获取成功就直接唤醒它。其余最多`nr_requeue`个等待者
+    /// 在key2的pi_state上排队，并提升key2持有者的优先级
+    ///
+    /// ## 参数
+    /// - `target`：key2所在bucket的队列，与key1所在bucket相同时为None
+    ///
+    /// ## 返回值
+    /// - 唤醒和转移的进程总数
+    fn futex_requeue_pi(
+        queue: &mut FutexQueue,
+        target: Option<&mut FutexQueue>,
+        uaddr2: VirtAddr,
+        key1: &FutexKey,
+        key2: &FutexKey,
+        nr_requeue: u32,
+    ) -> Result<usize, SystemError> {
+        // 等待key1的进程必须都是通过FUTEX_WAIT_REQUEUE_PI等待key2的
+        if queue
+            .chain
+            .iter()
+            .any(|q| *q.key.lock() == *key1 && q.requeue_pi_key.as_ref() != Some(key2))
+        {
+            return Err(SystemError::EINVAL);
+        }
+
+        let limit = nr_requeue as usize + 1;
+        let waiters = queue.waiters();
+        let mut moved = Vec::new();
+        queue.chain.retain(|futex_q| {
+            if moved.len() >= limit || *futex_q.key.lock() != *key1 {
+                return true;
             }
+            futex_q.bucket.store(FUTEX_NOT_QUEUED, Ordering::SeqCst);
+            waiters.fetch_sub(1, Ordering::SeqCst);
+            moved.push(futex_q.clone());
+            false
+        });
+        let target = match target {
+            Some(target) => target,
+            None => queue,
+        };
+
+        let mut count = 0;
+        let mut pi_state: Option<Arc<FutexPiState>> = None;
+        for futex_q in moved {
+            let Some(pcb) = futex_q.pcb.upgrade() else {
+                continue;
+            };
+            let ps = match &pi_state {
+                Some(ps) => ps.clone(),
+                None => match Self::futex_lock_pi_atomic(target, uaddr2, key2, &pcb, false) {
+                    Ok(FutexPiLock::Acquired) => {
+                        // 替第一个等待者拿到了锁，直接唤醒它
+                        *futex_q.key.lock() = key2.clone();
+                        futex_q.pi_acquired.store(true, Ordering::SeqCst);
+                        ProcessManager::wakeup(&pcb).ok();
+                        count += 1;
+                        continue;
+                    }
+                    Ok(FutexPiLock::Contended(ps)) => {
+                        pi_state = Some(ps.clone());
+                        ps
+                    }
+                    Err(e) => {
+                        // 唤醒没有转移成功的等待者，由它们自己返回用户态重试
+                        ProcessManager::wakeup(&pcb).ok();
+                        if count == 0 {
+                            return Err(e);
+                        }
+                        continue;
+                    }
+                },
+            };
+            *futex_q.key.lock() = key2.clone();
+            target.waiters_inc();
+            target.enqueue_pi(&futex_q, &ps);
+            count += 1;
+        }
+
+        if let Some(owner) = pi_state.and_then(|ps| ps.owner()) {
+            Self::pi_adjust_prio(owner);
+        }
+        return Ok(count);
+    }
+
+    /// ## 等待futex的值改变，被唤醒后转移到PI futex上等待
+    ///
+    /// 与FUTEX_CMP_REQUEUE_PI配合使用，实现条件变量：唤醒时直接在uaddr2上排队，而不是被唤醒后再去竞争锁
+    ///
+    /// ## 返回值
+    /// - `Ok(0)`：已经获取到uaddr2
+    /// - `Err(SystemError::EAGAIN_OR_EWOULDBLOCK)`：futex的值不等于`val`，或者没有被转移到uaddr2上
+    pub fn futex_wait_requeue_pi(
+        uaddr: VirtAddr,
+        flags: FutexFlag,
+        val: u32,
+        abs_time: Option<PosixTimeSpec>,
+        uaddr2: VirtAddr,
+    ) -> Result<usize, SystemError> {
+        let shared = flags.contains(FutexFlag::FLAGS_SHARED);
+        let key1 = Self::get_futex_key(uaddr, shared, FutexAccess::FutexRead)?;
+        let key2 = Self::get_futex_key(uaddr2, shared, FutexAccess::FutexWrite)?;
+        if key1 == key2 {
+            return Err(SystemError::EINVAL);
+        }
+
+        let pcb = ProcessManager::current_pcb();
+        let timer = abs_time.map(|time| Self::arm_sleep_timer(&pcb, &time));
+        let futex_q = Arc::new(FutexObj::new(
+            &pcb,
+            key1.clone(),
+            FUTEX_BITSET_MATCH_ANY,
+            Some(key2.clone()),
+        ));
+        let r = Self::do_futex_wait_requeue_pi(uaddr, val, uaddr2, &key1, &key2, &futex_q, &timer);
+        if let Some(timer) = timer {
+            timer.cancel();
+        }
+        return r;
+    }
+
+    fn do_futex_wait_requeue_pi(
+        uaddr: VirtAddr,
+        val: u32,
+        uaddr2: VirtAddr,
+        key1: &FutexKey,
+        key2: &FutexKey,
+        futex_q: &Arc<FutexObj>,
+        timer: &Option<Arc<Timer>>,
+    ) -> Result<usize, SystemError> {
+        let mut queue = FutexData::hash_bucket(key1).lock();
+        queue.waiters_inc();
+        let uval = match Self::get_futex_value(uaddr) {
+            Ok(uval) => uval,
             Err(e) => {
-                // TODO:retry?
+                queue.waiters_dec();
                 return Err(e);
             }
+        };
+        if uval != val {
+            queue.waiters_dec();
+            return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+        }
+        if let Err(e) = queue.sleep_no_sched(futex_q.clone()) {
+            queue.waiters_dec();
+            return Err(e);
         }
+        drop(queue);
+        schedule(SchedMode::SM_NONE);
 
-        Ok(wake_count)
+        let timeout = timer.as_ref().is_some_and(|timer| timer.timeout());
+        let queued = futex_q.unqueue();
+        if !queued && futex_q.pi_acquired.swap(false, Ordering::SeqCst) {
+            return Ok(0);
+        }
+        if timeout {
+            return Err(SystemError::ETIMEDOUT);
+        }
+        if Self::signal_pending() {
+            return Err(SystemError::EINTR);
+        }
+        // 没有被转移到uaddr2上就被唤醒了
+        if *futex_q.key.lock() != *key2 {
+            return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+        }
+        // 已经转移到了uaddr2上，但还没有拿到锁，继续等待
+        return Self::futex_lock_pi_wait(uaddr2, key2, futex_q, timer, false);
+    }
+
+    /// ## 获取优先级继承futex
+    ///
+    /// futex的值是持有者的tid，有其他进程在等待时还带有`FUTEX_WAITERS`。
+    /// 锁被其他进程持有时在内核中排队等待，并把持有者的优先级提升到等待者中最高的优先级
+    ///
+    /// ## 参数
+    /// - `abs_time`：超时时间，已经转换为相对时间
+    /// - `trylock`：为true时不等待，对应FUTEX_TRYLOCK_PI
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EDEADLK)`：当前进程已经持有了这个futex
+    /// - `Err(SystemError::ESRCH)`：futex的持有者不存在
+    pub fn futex_lock_pi(
+        uaddr: VirtAddr,
+        flags: FutexFlag,
+        abs_time: Option<PosixTimeSpec>,
+        trylock: bool,
+    ) -> Result<usize, SystemError> {
+        let key = Self::get_futex_key(
+            uaddr,
+            flags.contains(FutexFlag::FLAGS_SHARED),
+            FutexAccess::FutexWrite,
+        )?;
+        let pcb = ProcessManager::current_pcb();
+        let timer = abs_time.map(|time| Self::arm_sleep_timer(&pcb, &time));
+        let futex_q = Arc::new(FutexObj::new(
+            &pcb,
+            key.clone(),
+            FUTEX_BITSET_MATCH_ANY,
+            None,
+        ));
+        let r = Self::futex_lock_pi_wait(uaddr, &key, &futex_q, &timer, trylock);
+        if let Some(timer) = timer {
+            timer.cancel();
+        }
+        return r;
+    }
+
+    /// 反复尝试获取PI futex，获取不到时在pi_state上睡眠，直到解锁者把锁交给当前进程
+    fn futex_lock_pi_wait(
+        uaddr: VirtAddr,
+        key: &FutexKey,
+        futex_q: &Arc<FutexObj>,
+        timer: &Option<Arc<Timer>>,
+        trylock: bool,
+    ) -> Result<usize, SystemError> {
+        let pcb = ProcessManager::current_pcb();
+        loop {
+            let mut queue = FutexData::hash_bucket(key).lock();
+            let pi_state = match Self::futex_lock_pi_atomic(&mut queue, uaddr, key, &pcb, trylock)?
+            {
+                FutexPiLock::Acquired => return Ok(0),
+                FutexPiLock::Contended(pi_state) => pi_state,
+            };
+
+            queue.waiters_inc();
+            queue.enqueue_pi(futex_q, &pi_state);
+            if let Err(e) = ProcessManager::mark_sleep(true) {
+                queue.remove(futex_q);
+                return Err(e);
+            }
+            // 提升持有者的优先级，并沿着它等待的PI futex继续向上传递
+            if let Some(owner) = pi_state.owner() {
+                Self::pi_adjust_prio(owner);
+            }
+            drop(queue);
+            schedule(SchedMode::SM_NONE);
+
+            let timeout = timer.as_ref().is_some_and(|timer| timer.timeout());
+            // 不在队列中并且带有pi_acquired标记，说明解锁者已经把锁交给了当前进程
+            if !futex_q.unqueue() && futex_q.pi_acquired.swap(false, Ordering::SeqCst) {
+                return Ok(0);
+            }
+            if timeout {
+                return Err(SystemError::ETIMEDOUT);
+            }
+            if Self::signal_pending() {
+                return Err(SystemError::EINTR);
+            }
+            // 持有者退出等情况下被唤醒，重新尝试获取
+        }
+    }
+
+    /// ## 在持有bucket的锁时尝试替`task`获取PI futex
+    ///
+    /// 获取不到时设置`FUTEX_WAITERS`，让持有者解锁时进入内核，并准备好等待所需的pi_state
+    fn futex_lock_pi_atomic(
+        queue: &mut FutexQueue,
+        uaddr: VirtAddr,
+        key: &FutexKey,
+        task: &Arc<ProcessControlBlock>,
+        trylock: bool,
+    ) -> Result<FutexPiLock, SystemError> {
+        let tid = task.pid().data() as u32;
+        loop {
+            let uval = Self::get_futex_value(uaddr)?;
+            let owner_tid = uval & FUTEX_TID_MASK;
+            if owner_tid == tid {
+                return Err(SystemError::EDEADLK);
+            }
+            let pi_state = queue.find_pi_state(key);
+
+            if owner_tid == 0 {
+                // 锁是空闲的。之前的持有者可能已经退出，保留FUTEX_OWNER_DIED交给用户态处理
+                let mut newval = tid | (uval & FUTEX_OWNER_DIED);
+                if pi_state.is_some() {
+                    newval |= FUTEX_WAITERS;
+                }
+                if Self::cmpxchg_futex_value(uaddr, uval, newval)? != uval {
+                    continue;
+                }
+                if let Some(pi_state) = pi_state {
+                    Self::set_pi_owner(&pi_state, task);
+                    Self::pi_adjust_prio(task.clone());
+                }
+                return Ok(FutexPiLock::Acquired);
+            }
+
+            if trylock {
+                return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+            }
+            if uval & FUTEX_WAITERS == 0
+                && Self::cmpxchg_futex_value(uaddr, uval, uval | FUTEX_WAITERS)? != uval
+            {
+                continue;
+            }
+
+            if let Some(pi_state) = pi_state {
+                // 持有者已经退出，并且没有通过robust list释放锁
+                if pi_state.owner().is_none() {
+                    return Err(SystemError::ESRCH);
+                }
+                return Ok(FutexPiLock::Contended(pi_state));
+            }
+            let owner =
+                ProcessManager::find(Pid::new(owner_tid as usize)).ok_or(SystemError::ESRCH)?;
+            let pi_state = Arc::new(FutexPiState::new(key.clone(), &owner));
+            owner.futex_pi_irqsave().held.push(pi_state.clone());
+            queue.pi_states.push(pi_state.clone());
+            return Ok(FutexPiLock::Contended(pi_state));
+        }
+    }
+
+    /// ## 释放优先级继承futex
+    ///
+    /// 有等待者时，把锁直接交给优先级最高的等待者，并恢复当前进程的优先级
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::EPERM)`：当前进程不是futex的持有者
+    pub fn futex_unlock_pi(uaddr: VirtAddr, flags: FutexFlag) -> Result<usize, SystemError> {
+        let key = Self::get_futex_key(
+            uaddr,
+            flags.contains(FutexFlag::FLAGS_SHARED),
+            FutexAccess::FutexWrite,
+        )?;
+        let pcb = ProcessManager::current_pcb();
+        let tid = pcb.pid().data() as u32;
+
+        let mut queue = FutexData::hash_bucket(&key).lock();
+        loop {
+            let uval = Self::get_futex_value(uaddr)?;
+            if uval & FUTEX_TID_MASK != tid {
+                return Err(SystemError::EPERM);
+            }
+
+            let pi_state = queue.find_pi_state(&key);
+            let top = pi_state.as_ref().and_then(|ps| ps.top_waiter());
+            let (Some(pi_state), Some(top)) = (pi_state, top) else {
+                // 没有等待者，直接释放
+                if Self::cmpxchg_futex_value(uaddr, uval, 0)? != uval {
+                    continue;
+                }
+                return Ok(0);
+            };
+            let Some(new_owner) = top.pcb.upgrade() else {
+                // 等待者已经退出
+                queue.remove(&top);
+                continue;
+            };
+
+            let remaining = pi_state.inner.lock_irqsave().waiters.len() > 1;
+            let mut newval = new_owner.pid().data() as u32;
+            if remaining {
+                newval |= FUTEX_WAITERS;
+            }
+            if Self::cmpxchg_futex_value(uaddr, uval, newval)? != uval {
+                continue;
+            }
+
+            // 先设置标记再离开队列，等待者看到自己不在队列中时一定能看到标记
+            top.pi_acquired.store(true, Ordering::SeqCst);
+            queue.remove(&top);
+            if remaining {
+                Self::set_pi_owner(&pi_state, &new_owner);
+                Self::pi_adjust_prio(new_owner.clone());
+            }
+            Self::pi_adjust_prio(pcb.clone());
+            ProcessManager::wakeup(&new_owner).ok();
+            return Ok(0);
+        }
+    }
+
+    /// 把pi_state转交给新的持有者
+    fn set_pi_owner(pi_state: &Arc<FutexPiState>, new_owner: &Arc<ProcessControlBlock>) {
+        let old_owner = mem::replace(
+            &mut pi_state.inner.lock_irqsave().owner,
+            Arc::downgrade(new_owner),
+        );
+        if let Some(old_owner) = old_owner.upgrade() {
+            old_owner
+                .futex_pi_irqsave()
+                .held
+                .retain(|x| !Arc::ptr_eq(x, pi_state));
+            Self::pi_adjust_prio(old_owner);
+        }
+        new_owner.futex_pi_irqsave().held.push(pi_state.clone());
+    }
+
+    /// ## 重新计算进程的有效优先级
+    ///
+    /// 有效优先级取进程自己的优先级和它持有的PI futex上所有等待者的优先级中最高的一个。
+    /// 优先级改变之后，沿着进程正在等待的PI futex把变化传递给那个futex的持有者
+    pub fn pi_adjust_prio(pcb: Arc<ProcessControlBlock>) {
+        let mut pcb = pcb;
+        for _ in 0..FUTEX_PI_MAX_CHAIN_DEPTH {
+            let (held, blocked_on) = {
+                let state = pcb.futex_pi_irqsave();
+                (state.held.clone(), state.blocked_on.clone())
+            };
+            let normal_prio = pcb.sched_info().prio_data.read_irqsave().normal_prio;
+            let prio = held
+                .iter()
+                .map(|ps| ps.top_waiter_prio())
+                .fold(normal_prio, i32::min);
+
+            if !rt_mutex_setprio(&pcb, prio) {
+                return;
+            }
+            match blocked_on.and_then(|ps| ps.owner()) {
+                Some(owner) => pcb = owner,
+                None => return,
+            }
+        }
+    }
+
+    /// ## 进程退出时放弃它持有的PI futex
+    ///
+    /// 唤醒每个futex上优先级最高的等待者，让它重新尝试获取锁。应当在`exit_robust_list`之后调用，
+    /// 此时robust futex的值已经被清除了持有者
+    pub fn exit_pi_state_list(pcb: &Arc<ProcessControlBlock>) {
+        let held = mem::take(&mut pcb.futex_pi_irqsave().held);
+        for pi_state in held {
+            let mut queue = FutexData::hash_bucket(&pi_state.key).lock();
+            pi_state.inner.lock_irqsave().owner = Weak::new();
+            if let Some(top) = pi_state.top_waiter() {
+                queue.remove(&top);
+                if let Some(waiter) = top.pcb.upgrade() {
+                    ProcessManager::wakeup(&waiter).ok();
+                }
+            }
+        }
+    }
+
+    /// ## 同时等待多个futex，任意一个被唤醒就返回
+    ///
+    /// ## 参数
+    /// - `futexes`：每个futex的地址、标志和期望的值
+    /// - `abs_time`：超时时间，已经转换为相对时间
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：被唤醒的futex在`futexes`中的下标
+    /// - `Err(SystemError::EAGAIN_OR_EWOULDBLOCK)`：某个futex的值与期望的值不同
+    pub fn futex_wait_multiple(
+        futexes: &[(VirtAddr, FutexFlag, u32)],
+        abs_time: Option<PosixTimeSpec>,
+    ) -> Result<usize, SystemError> {
+        let mut keys = Vec::with_capacity(futexes.len());
+        for (uaddr, flags, _) in futexes {
+            keys.push(Self::get_futex_key(
+                *uaddr,
+                flags.contains(FutexFlag::FLAGS_SHARED),
+                FutexAccess::FutexRead,
+            )?);
+        }
+
+        let pcb = ProcessManager::current_pcb();
+        let timer = abs_time.map(|time| Self::arm_sleep_timer(&pcb, &time));
+        let r = loop {
+            let futex_qs: Vec<Arc<FutexObj>> = keys
+                .iter()
+                .map(|key| {
+                    Arc::new(FutexObj::new(
+                        &pcb,
+                        key.clone(),
+                        FUTEX_BITSET_MATCH_ANY,
+                        None,
+                    ))
+                })
+                .collect();
+
+            // 先把进程标记为睡眠再逐个排队，任何一个futex上的唤醒都不会丢失
+            let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+            let mut r = ProcessManager::mark_sleep(true);
+            let mut nr_queued = 0;
+            if r.is_ok() {
+                for (i, futex_q) in futex_qs.iter().enumerate() {
+                    let (uaddr, _, val) = futexes[i];
+                    let mut queue = FutexData::hash_bucket(&keys[i]).lock();
+                    queue.waiters_inc();
+                    match Self::get_futex_value(uaddr) {
+                        Ok(uval) if uval == val => {}
+                        Ok(_) => r = Err(SystemError::EAGAIN_OR_EWOULDBLOCK),
+                        Err(e) => r = Err(e),
+                    }
+                    if r.is_err() {
+                        queue.waiters_dec();
+                        break;
+                    }
+                    queue.enqueue(futex_q.clone());
+                    nr_queued += 1;
+                }
+                if r.is_err() {
+                    // 取消睡眠
+                    ProcessManager::wakeup(&pcb).ok();
+                }
+            }
+            drop(irq_guard);
+            if r.is_ok() {
+                schedule(SchedMode::SM_NONE);
+            }
+
+            let timeout = timer.as_ref().is_some_and(|timer| timer.timeout());
+            let mut woken = None;
+            for (i, futex_q) in futex_qs.iter().take(nr_queued).enumerate() {
+                if !futex_q.unqueue() && woken.is_none() {
+                    woken = Some(i);
+                }
+            }
+            if let Some(i) = woken {
+                break Ok(i);
+            }
+            if let Err(e) = r {
+                break Err(e);
+            }
+            if timeout {
+                break Err(SystemError::ETIMEDOUT);
+            }
+            if Self::signal_pending() {
+                break Err(SystemError::EINTR);
+            }
+        };
+        if let Some(timer) = timer {
+            timer.cancel();
+        }
+        return r;
+    }
+
+    /// 启动当前进程的睡眠定时器，`time`为相对时间
+    fn arm_sleep_timer(pcb: &Arc<ProcessControlBlock>, time: &PosixTimeSpec) -> Arc<Timer> {
+        let jiffies =
+            next_n_us_timer_jiffies((time.tv_nsec / 1000 + time.tv_sec * 1_000_000) as u64);
+        let timer = pcb.sleep_timer();
+        timer.rearm(jiffies);
+        return timer;
+    }
+
+    /// ## 把绝对超时时间转换为相对于现在的时间
+    ///
+    /// 目前所有时钟都以实时时钟计时，CLOCK_MONOTONIC和CLOCK_REALTIME的绝对时间都按实时时钟换算
+    pub fn abs_to_relative_timeout(abs_time: PosixTimeSpec) -> PosixTimeSpec {
+        let now = PosixTimeSpec::now();
+        let ns = ((abs_time.tv_sec - now.tv_sec) * 1_000_000_000
+            + (abs_time.tv_nsec - now.tv_nsec))
+            .max(0);
+        return PosixTimeSpec::new(ns / 1_000_000_000, ns % 1_000_000_000);
+    }
+
+    fn signal_pending() -> bool {
+        ProcessManager::current_pcb()
+            .sig_info_irqsave()
+            .sig_pending()
+            .signal()
+            .bits()
+            != 0
+    }
+
+    fn get_futex_value(uaddr: VirtAddr) -> Result<u32, SystemError> {
+        let reader = UserBufferReader::new(uaddr.as_ptr::<u32>(), mem::size_of::<u32>(), true)?;
+        return Ok(*reader.read_one_from_user::<u32>(0)?);
+    }
+
+    /// ## 原子地比较并交换用户空间的futex的值
+    ///
+    /// ## 返回值
+    /// - 交换之前futex的值，与`old`相等说明交换成功
+    fn cmpxchg_futex_value(uaddr: VirtAddr, old: u32, new: u32) -> Result<u32, SystemError> {
+        let mut writer = UserBufferWriter::new(uaddr.as_ptr::<u32>(), mem::size_of::<u32>(), true)?;
+        let ptr = writer.buffer::<u32>(0)?.as_mut_ptr();
+        let atomic = unsafe { &*(ptr as *const AtomicU32) };
+        return match atomic.compare_exchange(old, new, Ordering::SeqCst, Ordering::SeqCst) {
+            Ok(v) | Err(v) => Ok(v),
+        };
     }
 
     fn get_futex_key(
@@ -642,6 +1502,20 @@ impl Futex {
     }
 }
 
+/// futex_waitv中的一个futex，与Linux的`struct futex_waitv`相同
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FutexWaitv {
+    /// 期望的值
+    pub val: u64,
+    /// futex的用户空间地址
+    pub uaddr: u64,
+    /// FUTEX2_*标志
+    pub flags: u32,
+    /// 保留，必须为0
+    pub reserved: u32,
+}
+
 //用于指示在处理robust list是最多处理多少个条目
 const ROBUST_LIST_LIMIT: isize = 2048;
 
@@ -1,14 +1,17 @@
+use core::mem::size_of;
+
+use alloc::vec::Vec;
 use system_error::SystemError;
 
 use crate::{
     mm::{verify_area, VirtAddr},
-    syscall::Syscall,
-    time::PosixTimeSpec,
+    syscall::{user_access::UserBufferReader, Syscall},
+    time::{syscall::PosixClockID, PosixTimeSpec},
 };
 
 use super::{
     constant::*,
-    futex::{Futex, RobustListHead},
+    futex::{Futex, FutexWaitv, RobustListHead},
 };
 
 impl Syscall {
@@ -43,6 +46,12 @@ impl Syscall {
             }
         }
 
+        // 只有FUTEX_WAIT的超时时间是相对时间，其余命令的都是绝对时间
+        let timeout = match cmd {
+            FutexArg::FUTEX_WAIT => timeout,
+            _ => timeout.map(Futex::abs_to_relative_timeout),
+        };
+
         match cmd {
             FutexArg::FUTEX_WAIT => {
                 return Futex::futex_wait(uaddr, flags, val, timeout, FUTEX_BITSET_MATCH_ANY);
@@ -88,23 +97,28 @@ impl Syscall {
                     val3 as i32,
                 );
             }
-            FutexArg::FUTEX_LOCK_PI => {
-                todo!()
-            }
-            FutexArg::FUTEX_LOCK_PI2 => {
-                todo!()
+            FutexArg::FUTEX_LOCK_PI | FutexArg::FUTEX_LOCK_PI2 => {
+                return Futex::futex_lock_pi(uaddr, flags, timeout, false);
             }
             FutexArg::FUTEX_UNLOCK_PI => {
-                todo!()
+                return Futex::futex_unlock_pi(uaddr, flags);
             }
             FutexArg::FUTEX_TRYLOCK_PI => {
-                todo!()
+                return Futex::futex_lock_pi(uaddr, flags, None, true);
             }
             FutexArg::FUTEX_WAIT_REQUEUE_PI => {
-                todo!()
+                return Futex::futex_wait_requeue_pi(uaddr, flags, val, timeout, uaddr2);
             }
             FutexArg::FUTEX_CMP_REQUEUE_PI => {
-                todo!()
+                return Futex::futex_requeue(
+                    uaddr,
+                    flags,
+                    uaddr2,
+                    val as i32,
+                    val2 as i32,
+                    Some(val3),
+                    true,
+                );
             }
             _ => {
                 return Err(SystemError::ENOSYS);
@@ -112,6 +126,80 @@ impl Syscall {
         }
     }
 
+    /// futex命令的第四个参数是否为超时时间，其余命令把它当作val2
+    pub fn futex_has_timeout(operation: FutexFlag) -> bool {
+        let cmd = FutexArg::from_bits_truncate(operation.bits() & FutexFlag::FUTEX_CMD_MASK.bits());
+        return matches!(
+            cmd,
+            FutexArg::FUTEX_WAIT
+                | FutexArg::FUTEX_WAIT_BITSET
+                | FutexArg::FUTEX_LOCK_PI
+                | FutexArg::FUTEX_LOCK_PI2
+                | FutexArg::FUTEX_WAIT_REQUEUE_PI
+        );
+    }
+
+    /// # 同时等待多个futex
+    ///
+    /// ## 参数
+    /// - `waiters`：用户空间的`FutexWaitv`数组
+    /// - `nr_futexes`：数组的长度，最多`FUTEX_WAITV_MAX`
+    /// - `flags`：保留，必须为0
+    /// - `timeout`：绝对超时时间，为空时一直等待
+    /// - `clockid`：超时时间使用的时钟，只能是CLOCK_MONOTONIC或CLOCK_REALTIME
+    ///
+    /// ## 返回值
+    /// - `Ok(usize)`：被唤醒的futex在数组中的下标
+    ///
+    /// See: https://docs.kernel.org/userspace-api/futex2.html
+    pub fn futex_waitv(
+        waiters: *const FutexWaitv,
+        nr_futexes: u32,
+        flags: u32,
+        timeout: *const PosixTimeSpec,
+        clockid: i32,
+    ) -> Result<usize, SystemError> {
+        let nr_futexes = nr_futexes as usize;
+        if flags != 0 || nr_futexes == 0 || nr_futexes > FUTEX_WAITV_MAX {
+            return Err(SystemError::EINVAL);
+        }
+
+        let timeout = if timeout.is_null() {
+            None
+        } else {
+            let clockid = PosixClockID::try_from(clockid)?;
+            if clockid != PosixClockID::Realtime && clockid != PosixClockID::Monotonic {
+                return Err(SystemError::EINVAL);
+            }
+            let reader = UserBufferReader::new(timeout, size_of::<PosixTimeSpec>(), true)?;
+            Some(Futex::abs_to_relative_timeout(
+                *reader.read_one_from_user::<PosixTimeSpec>(0)?,
+            ))
+        };
+
+        let reader = UserBufferReader::new(waiters, size_of::<FutexWaitv>() * nr_futexes, true)?;
+        let mut futexes = Vec::with_capacity(nr_futexes);
+        for waiter in reader.read_from_user::<FutexWaitv>(0)? {
+            if waiter.flags & !(FUTEX2_SIZE_MASK | FUTEX2_PRIVATE) != 0
+                || waiter.flags & FUTEX2_SIZE_MASK != FUTEX2_SIZE_U32
+                || waiter.reserved != 0
+                || waiter.val > u32::MAX as u64
+            {
+                return Err(SystemError::EINVAL);
+            }
+            let uaddr = VirtAddr::new(waiter.uaddr as usize);
+            verify_area(uaddr, size_of::<u32>())?;
+
+            let mut flags = FutexFlag::FLAGS_MATCH_NONE;
+            if waiter.flags & FUTEX2_PRIVATE == 0 {
+                flags.insert(FutexFlag::FLAGS_SHARED);
+            }
+            futexes.push((uaddr, flags, waiter.val as u32));
+        }
+
+        return Futex::futex_wait_multiple(&futexes, timeout);
+    }
+
     pub fn set_robust_list(head_uaddr: VirtAddr, len: usize) -> Result<usize, SystemError> {
         //判断用户空间地址的合法性
         verify_area(head_uaddr, core::mem::size_of::<u32>())?;
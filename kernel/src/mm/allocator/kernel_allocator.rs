@@ -14,13 +14,14 @@ use core::{
 };
 
 use super::{
+    kmem_cache::kmem_cache_find,
     page_frame::{FrameAllocator, PageFrameCount},
     slab::{slab_init_state, SLABALLOCATOR},
+    zeroed_pages::zeroed_page_allocate,
 };
 
 /// 类kmalloc的分配器应当实现的trait
 pub trait LocalAlloc {
-    #[allow(dead_code)]
     unsafe fn local_alloc(&self, layout: Layout) -> *mut u8;
     unsafe fn local_alloc_zeroed(&self, layout: Layout) -> *mut u8;
     unsafe fn local_dealloc(&self, ptr: *mut u8, layout: Layout);
@@ -69,7 +70,7 @@ impl LocalAlloc for KernelAllocator {
                 .map(|x| x.as_mut_ptr())
                 .unwrap_or(core::ptr::null_mut());
         } else {
-            if let Some(ref mut slab) = SLABALLOCATOR {
+            if let Some(ref slab) = SLABALLOCATOR {
                 return slab.allocate(layout);
             };
             return core::ptr::null_mut();
@@ -78,17 +79,28 @@ impl LocalAlloc for KernelAllocator {
 
     unsafe fn local_alloc_zeroed(&self, layout: Layout) -> *mut u8 {
         if allocator_select_condition(layout) {
+            // 单页的请求直接使用预先清零的页帧
+            if layout.size() <= MMArch::PAGE_SIZE {
+                return zeroed_page_allocate()
+                    .and_then(|phys| MMArch::phys_2_virt(phys))
+                    .map(|virt| virt.data() as *mut u8)
+                    .unwrap_or(core::ptr::null_mut());
+            }
             return self
                 .alloc_in_buddy(layout)
                 .map(|x| {
                     let ptr: *mut u8 = x.as_mut_ptr();
-                    core::ptr::write_bytes(ptr, 0, x.len());
+                    core::ptr::write_bytes(ptr, 0, layout.size());
                     ptr
                 })
                 .unwrap_or(core::ptr::null_mut());
         } else {
-            if let Some(ref mut slab) = SLABALLOCATOR {
-                return slab.allocate(layout);
+            if let Some(ref slab) = SLABALLOCATOR {
+                let ptr = slab.allocate(layout);
+                if !ptr.is_null() {
+                    core::ptr::write_bytes(ptr, 0, layout.size());
+                }
+                return ptr;
             };
             return core::ptr::null_mut();
         }
@@ -97,7 +109,7 @@ impl LocalAlloc for KernelAllocator {
     unsafe fn local_dealloc(&self, ptr: *mut u8, layout: Layout) {
         if allocator_select_condition(layout) || ((ptr as usize) % 4096) == 0 {
             self.free_in_buddy(ptr, layout)
-        } else if let Some(ref mut slab) = SLABALLOCATOR {
+        } else if let Some(ref slab) = SLABALLOCATOR {
             slab.deallocate(ptr, layout).unwrap()
         }
     }
@@ -106,7 +118,17 @@ impl LocalAlloc for KernelAllocator {
 /// 为内核slab分配器实现GlobalAlloc特性
 unsafe impl GlobalAlloc for KernelAllocator {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        let r = self.local_alloc_zeroed(layout);
+        // 固定大小的热点对象由对应的对象缓存分配
+        if let Some(cache) = kmem_cache_find(layout) {
+            let r = cache
+                .alloc()
+                .map(|x| x.as_ptr())
+                .unwrap_or(core::ptr::null_mut());
+            alloc_debug_log(klog_types::LogSource::Slab, layout, r);
+            return r;
+        }
+
+        let r = self.local_alloc(layout);
         if allocator_select_condition(layout) {
             alloc_debug_log(klog_types::LogSource::Buddy, layout, r);
         } else {
@@ -116,6 +138,19 @@ unsafe impl GlobalAlloc for KernelAllocator {
     }
 
     unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        if let Some(cache) = kmem_cache_find(layout) {
+            let r = cache
+                .alloc()
+                .map(|x| {
+                    let ptr = x.as_ptr();
+                    core::ptr::write_bytes(ptr, 0, layout.size());
+                    ptr
+                })
+                .unwrap_or(core::ptr::null_mut());
+            alloc_debug_log(klog_types::LogSource::Slab, layout, r);
+            return r;
+        }
+
         let r = self.local_alloc_zeroed(layout);
         if allocator_select_condition(layout) {
             alloc_debug_log(klog_types::LogSource::Buddy, layout, r);
@@ -126,6 +161,12 @@ unsafe impl GlobalAlloc for KernelAllocator {
     }
 
     unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        if let (Some(cache), Some(nptr)) = (kmem_cache_find(layout), NonNull::new(ptr)) {
+            dealloc_debug_log(klog_types::LogSource::Slab, layout, ptr);
+            cache.free(nptr);
+            return;
+        }
+
         if allocator_select_condition(layout) || ((ptr as usize) % 4096) == 0 {
             dealloc_debug_log(klog_types::LogSource::Buddy, layout, ptr);
         } else {
@@ -0,0 +1,322 @@
+//! 具名对象缓存(kmem_cache)
+//!
+//! 为频繁创建和销毁的固定大小对象提供专用的缓存。每个缓存在每个CPU上都有一个对象弹匣，
+//! 大部分的分配/释放只会访问当前CPU的弹匣，只有在弹匣为空或已满时，
+//! 才批量地向通用的内核分配器申请或者归还对象。
+//!
+//! 缓存按对象大小登记在索引表中，接管全局分配器中大小相同、对齐要求不超过缓存的请求，
+//! 因此进程控制块、VMA、页面描述符等对象通过`Arc::new()`分配时也会经过对应的缓存。
+//! 查找只需要一次数组访问，不会拖慢其他大小的分配。与Linux的slab合并类似，
+//! 大小相同的其他对象也会共用同一个缓存。
+//!
+//! 对象交给全局分配器的调用者之后会被整体覆盖，因此缓存不支持构造函数。
+
+use core::{
+    alloc::Layout,
+    intrinsics::{likely, unlikely},
+    ptr::{null_mut, NonNull},
+    sync::atomic::{AtomicPtr, AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, vec::Vec};
+use log::{info, warn};
+use system_error::SystemError;
+
+use crate::{
+    libs::spinlock::SpinLock,
+    mm::{
+        page::Page,
+        percpu::{PerCpu, PerCpuVar},
+        ucontext::LockedVMA,
+    },
+    net::event_poll::EPollItem,
+    process::ProcessControlBlock,
+    smp::cpu::ProcessorId,
+    time::timer::Timer,
+    KERNEL_ALLOCATOR,
+};
+
+use super::{
+    kernel_allocator::LocalAlloc,
+    slab::{slab_init_state, Magazine, SlabStat},
+};
+
+/// 缓存索引的粒度（字节）。对象的大小必须是它的整数倍
+const KMEM_CACHE_GRAIN: usize = 8;
+/// 可以创建缓存的最大对象大小（一页）
+const KMEM_CACHE_MAX_SIZE: usize = 4096;
+const KMEM_CACHE_INDEX_NUM: usize = KMEM_CACHE_MAX_SIZE / KMEM_CACHE_GRAIN + 1;
+
+/// 按对象大小索引的缓存表，下标为`size / KMEM_CACHE_GRAIN`。
+/// 缓存创建之后不会被销毁，因此查找时不需要加锁
+static KMEM_CACHE_INDEX: [AtomicPtr<KmemCache>; KMEM_CACHE_INDEX_NUM] =
+    [const { AtomicPtr::new(null_mut()) }; KMEM_CACHE_INDEX_NUM];
+/// 创建缓存时持有的锁
+static KMEM_CACHE_CREATE_LOCK: SpinLock<()> = SpinLock::new(());
+
+/// 计算`size`在缓存索引表中的下标
+#[inline(always)]
+fn kmem_cache_index(size: usize) -> Option<usize> {
+    if size == 0 || size > KMEM_CACHE_MAX_SIZE || size % KMEM_CACHE_GRAIN != 0 {
+        return None;
+    }
+    return Some(size / KMEM_CACHE_GRAIN);
+}
+
+/// 单个CPU上的对象缓存
+#[derive(Debug)]
+struct KmemCpuCache {
+    magazine: SpinLock<Magazine>,
+    stat: SlabStat,
+}
+
+impl KmemCpuCache {
+    fn new() -> Self {
+        Self {
+            magazine: SpinLock::new(Magazine::EMPTY),
+            stat: SlabStat::default(),
+        }
+    }
+}
+
+/// 缓存的统计信息（所有CPU的总和）
+#[derive(Debug, Default, Clone, Copy)]
+pub struct KmemCacheStat {
+    /// 直接从CPU弹匣中分配成功的次数
+    pub alloc_hit: usize,
+    /// CPU弹匣为空，需要向通用分配器申请的次数
+    pub alloc_miss: usize,
+    /// 批量补充的次数
+    pub refill: usize,
+    /// 释放的次数
+    pub free: usize,
+    /// 批量归还的次数
+    pub drain: usize,
+    /// 缓存在CPU弹匣中的对象数
+    pub cached: usize,
+}
+
+impl KmemCacheStat {
+    /// 正在使用的对象数
+    pub fn active(&self) -> usize {
+        (self.alloc_hit + self.alloc_miss).saturating_sub(self.free)
+    }
+}
+
+/// 具名对象缓存
+#[derive(Debug)]
+pub struct KmemCache {
+    name: &'static str,
+    layout: Layout,
+    cpu_caches: PerCpuVar<KmemCpuCache>,
+}
+
+impl KmemCache {
+    /// ## 创建一个对象缓存
+    ///
+    /// ## 参数
+    ///
+    /// - `name`：缓存的名字
+    /// - `layout`：对象的内存布局
+    ///
+    /// ## 返回值
+    ///
+    /// - `Ok(cache)`：创建的缓存。已经存在大小相同的缓存时，返回已有的缓存
+    /// - `Err(SystemError::EINVAL)`：对象的大小不能由缓存管理
+    /// - `Err(SystemError::EEXIST)`：已经存在大小相同、但对齐要求更低的缓存
+    pub fn create(name: &'static str, layout: Layout) -> Result<&'static KmemCache, SystemError> {
+        let layout = layout.pad_to_align();
+        let idx = kmem_cache_index(layout.size()).ok_or(SystemError::EINVAL)?;
+        let _guard = KMEM_CACHE_CREATE_LOCK.lock_irqsave();
+
+        let old = KMEM_CACHE_INDEX[idx].load(Ordering::Acquire);
+        if !old.is_null() {
+            let old = unsafe { &*old };
+            // 已经从旧缓存分配出去的对象不一定满足新的对齐要求，不能换成新的缓存
+            if layout.align() > old.layout.align() {
+                return Err(SystemError::EEXIST);
+            }
+            return Ok(old);
+        }
+
+        let mut data = Vec::with_capacity(PerCpu::MAX_CPU_NUM as usize);
+        for _ in 0..PerCpu::MAX_CPU_NUM {
+            data.push(KmemCpuCache::new());
+        }
+        let cache = Box::leak(Box::new(KmemCache {
+            name,
+            layout,
+            cpu_caches: PerCpuVar::new(data).unwrap(),
+        }));
+
+        KMEM_CACHE_INDEX[idx].store(cache, Ordering::Release);
+        return Ok(cache);
+    }
+
+    pub fn name(&self) -> &'static str {
+        self.name
+    }
+
+    pub fn layout(&self) -> Layout {
+        self.layout
+    }
+
+    /// 从当前CPU的弹匣中分配一个对象，弹匣为空时，从通用分配器批量补充
+    ///
+    /// ## 返回值
+    ///
+    /// 内存不足时返回`None`
+    pub fn alloc(&self) -> Option<NonNull<u8>> {
+        let cpu_cache = self.cpu_caches.get();
+        let mut mag = cpu_cache.magazine.lock_irqsave();
+
+        if likely(!mag.is_empty()) {
+            cpu_cache.stat.inc_alloc_hit();
+            return NonNull::new(mag.pop().unwrap());
+        }
+
+        cpu_cache.stat.inc_alloc_miss();
+        let size = self.layout.size();
+        for _ in 0..Magazine::batch(size) {
+            let ptr = unsafe { KERNEL_ALLOCATOR.local_alloc(self.layout) };
+            if unlikely(ptr.is_null()) {
+                break;
+            }
+            mag.push(ptr);
+        }
+        if unlikely(mag.is_empty()) {
+            return None;
+        }
+        cpu_cache.stat.inc_refill();
+        return NonNull::new(mag.pop().unwrap());
+    }
+
+    /// 把对象释放到当前CPU的弹匣中。超过高水位时，把一批对象归还给通用分配器
+    ///
+    /// ## Safety
+    ///
+    /// `ptr`必须是从这个缓存中分配的对象
+    pub unsafe fn free(&self, ptr: NonNull<u8>) {
+        let cpu_cache = self.cpu_caches.get();
+        let mut mag = cpu_cache.magazine.lock_irqsave();
+
+        let size = self.layout.size();
+        if unlikely(mag.len() >= Magazine::limit(size)) {
+            for _ in 0..Magazine::batch(size) {
+                let Some(obj) = mag.pop() else {
+                    break;
+                };
+                KERNEL_ALLOCATOR.local_dealloc(obj, self.layout);
+            }
+            cpu_cache.stat.inc_drain();
+        }
+
+        mag.push(ptr.as_ptr());
+        cpu_cache.stat.inc_free_hit();
+    }
+
+    /// 把所有CPU弹匣中的对象归还给通用分配器
+    pub fn shrink(&self) {
+        for cpu in 0..PerCpu::MAX_CPU_NUM {
+            let cpu_cache = unsafe { self.cpu_caches.force_get(ProcessorId::new(cpu)) };
+            let mut mag = cpu_cache.magazine.lock_irqsave();
+            if mag.is_empty() {
+                continue;
+            }
+            while let Some(obj) = mag.pop() {
+                unsafe { KERNEL_ALLOCATOR.local_dealloc(obj, self.layout) };
+            }
+            cpu_cache.stat.inc_drain();
+        }
+    }
+
+    /// 获取缓存的统计信息
+    pub fn stat(&self) -> KmemCacheStat {
+        let mut stat = KmemCacheStat::default();
+        for cpu in 0..PerCpu::MAX_CPU_NUM {
+            let cpu_cache = unsafe { self.cpu_caches.force_get(ProcessorId::new(cpu)) };
+            stat.alloc_hit += cpu_cache.stat.alloc_hit();
+            stat.alloc_miss += cpu_cache.stat.alloc_miss();
+            stat.refill += cpu_cache.stat.refill();
+            stat.free += cpu_cache.stat.free_hit();
+            stat.drain += cpu_cache.stat.drain();
+            stat.cached += cpu_cache.magazine.lock_irqsave().len();
+        }
+        return stat;
+    }
+}
+
+/// `Arc<T>`在堆上分配的内存布局（强、弱引用计数加上对象本身）
+pub fn arc_layout<T>() -> Layout {
+    Layout::new::<[AtomicUsize; 2]>()
+        .extend(Layout::new::<T>())
+        .unwrap()
+        .0
+        .pad_to_align()
+}
+
+/// 查找接管`layout`的缓存
+///
+/// 缓存的对象大小必须和`layout`相同，对齐要求不能超过缓存的对齐
+#[inline]
+pub fn kmem_cache_find(layout: Layout) -> Option<&'static KmemCache> {
+    if unlikely(!slab_init_state()) {
+        return None;
+    }
+    let idx = kmem_cache_index(layout.size())?;
+    let cache = KMEM_CACHE_INDEX[idx].load(Ordering::Acquire);
+    if cache.is_null() {
+        return None;
+    }
+    let cache = unsafe { &*cache };
+    if unlikely(layout.align() > cache.layout.align()) {
+        return None;
+    }
+    return Some(cache);
+}
+
+/// 获取所有已创建的缓存
+#[allow(dead_code)]
+pub fn kmem_caches() -> Vec<&'static KmemCache> {
+    KMEM_CACHE_INDEX
+        .iter()
+        .map(|slot| slot.load(Ordering::Acquire))
+        .filter(|cache| !cache.is_null())
+        .map(|cache| unsafe { &*cache })
+        .collect()
+}
+
+/// 把所有缓存中的对象归还给通用分配器
+#[allow(dead_code)]
+pub fn kmem_cache_shrink_all() {
+    for cache in kmem_caches() {
+        cache.shrink();
+    }
+}
+
+/// 为频繁创建和销毁的内核对象创建缓存
+///
+/// 需要在slab分配器和每CPU变量可用之后调用
+pub fn kmem_cache_init() {
+    let caches = [
+        ("process_control_block", arc_layout::<ProcessControlBlock>()),
+        ("vm_area", arc_layout::<LockedVMA>()),
+        ("page", arc_layout::<Page>()),
+        ("timer", arc_layout::<Timer>()),
+        ("epoll_item", arc_layout::<EPollItem>()),
+    ];
+    for (name, layout) in caches {
+        match KmemCache::create(name, layout) {
+            Ok(cache) if cache.name() != name => {
+                info!("kmem_cache '{}' is merged into '{}'", name, cache.name());
+            }
+            Ok(_) => {}
+            Err(e) => {
+                warn!(
+                    "Failed to create kmem_cache '{}' ({:?}): {:?}",
+                    name, layout, e
+                );
+            }
+        }
+    }
+}
@@ -1,5 +1,8 @@
 pub mod buddy;
 pub mod bump;
 pub mod kernel_allocator;
+pub mod kmem_cache;
 pub mod page_frame;
+pub mod pcp;
 pub mod slab;
+pub mod zeroed_pages;
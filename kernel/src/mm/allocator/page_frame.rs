@@ -6,8 +6,7 @@ use core::{
 use crate::{
     arch::{mm::LockedFrameAllocator, MMArch},
     ipc::shm::shm_manager_lock,
-    libs::spinlock::SpinLockGuard,
-    mm::{MemoryManagementArch, PhysAddr, VirtAddr},
+    mm::{page::page_manager, MemoryManagementArch, PhysAddr, VirtAddr},
 };
 
 /// @brief 物理页帧的表示
@@ -316,6 +315,12 @@ pub trait FrameAllocator {
     unsafe fn allocate_one(&mut self) -> Option<PhysAddr> {
         return self.allocate(PageFrameCount::new(1)).map(|(addr, _)| addr);
     }
+    // @brief 分配一个内容全为0的页帧
+    unsafe fn allocate_one_zeroed(&mut self) -> Option<PhysAddr> {
+        let phys = self.allocate_one()?;
+        MMArch::write_bytes(MMArch::phys_2_virt(phys).unwrap(), 0, MMArch::PAGE_SIZE);
+        return Some(phys);
+    }
     // @brief 通过地址释放一个页帧
     unsafe fn free_one(&mut self, address: PhysAddr) {
         return self.free(address, PageFrameCount::new(1));
@@ -335,6 +340,9 @@ impl<T: FrameAllocator> FrameAllocator for &mut T {
     unsafe fn allocate_one(&mut self) -> Option<PhysAddr> {
         return T::allocate_one(self);
     }
+    unsafe fn allocate_one_zeroed(&mut self) -> Option<PhysAddr> {
+        return T::allocate_one_zeroed(self);
+    }
     unsafe fn free_one(&mut self, address: PhysAddr) {
         return T::free_one(self, address);
     }
@@ -355,30 +363,31 @@ pub unsafe fn allocate_page_frames(count: PageFrameCount) -> Option<(PhysAddr, P
 ///
 /// @param frame 要释放的第一个页帧
 /// @param count 要释放的页帧数量 (必须是2的n次幂)
-pub unsafe fn deallocate_page_frames(
-    frame: PhysPageFrame,
-    count: PageFrameCount,
-    page_manager_guard: &mut SpinLockGuard<'_, crate::mm::page::PageManager>,
-) {
-    unsafe {
-        LockedFrameAllocator.free(frame.phys_address(), count);
-    }
-
+pub unsafe fn deallocate_page_frames(frame: PhysPageFrame, count: PageFrameCount) {
+    // 先把Page从PAGE_MANAGER中删去，再把页帧还给分配器。
+    // 否则页帧可能在这期间被其他CPU重新分配，并插入新的Page，随后被这里误删
+    let page_manager = page_manager();
+    let first = frame;
     let mut frame = frame;
     for _ in 0..count.data() {
         let paddr = frame.phys_address();
-        let page = page_manager_guard.get(&paddr);
+        let page = page_manager.get(&paddr);
 
         if let Some(page) = page {
             // 如果page是共享页，将其共享页信息从SHM_MANAGER中删去
+            // 页面缓存中的页也是共享页，但没有共享页id
             let page_guard = page.read_irqsave();
-            if page_guard.shared() {
-                shm_manager_lock().free_id(&page_guard.shm_id().unwrap());
+            if let Some(shm_id) = page_guard.shm_id() {
+                shm_manager_lock().free_id(&shm_id);
             }
         }
 
         // 将已回收的物理页面对应的Page从PAGE_MANAGER中删去
-        page_manager_guard.remove_page(&paddr);
+        page_manager.remove_page(&paddr);
         frame = frame.next();
     }
+
+    unsafe {
+        LockedFrameAllocator.free(first.phys_address(), count);
+    }
 }
@@ -0,0 +1,381 @@
+//! 每CPU页帧缓存(per-cpu pages)
+//!
+//! 在全局伙伴分配器的前面，为每个CPU维护小阶数页帧的冷热空闲链表。
+//! 大部分的单页分配/释放只会访问当前CPU的链表，
+//! 只有在链表为空（批量补充）或超过高水位（批量归还）时，才需要获取伙伴分配器的全局锁。
+
+use core::{
+    intrinsics::{likely, unlikely},
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use alloc::vec::Vec;
+
+use crate::{
+    arch::MMArch,
+    libs::{lazy_init::Lazy, spinlock::SpinLock},
+    mm::{
+        percpu::{PerCpu, PerCpuVar},
+        PhysAddr,
+    },
+    smp::cpu::ProcessorId,
+};
+
+use super::{
+    buddy::BuddyAllocator,
+    page_frame::{FrameAllocator, PageFrameCount, PageFrameUsage},
+    zeroed_pages::zeroed_pages_drain,
+};
+
+/// 由每CPU缓存管理的最大页阶数（包含），即最多缓存 2^PCP_MAX_ORDER 个页帧大小的块
+pub const PCP_MAX_ORDER: usize = 3;
+const PCP_ORDERS: usize = PCP_MAX_ORDER + 1;
+
+/// 每个链表的容量（块数）
+const PCP_CAPACITY: usize = 64;
+/// 0阶链表的高水位。超过高水位时，把最冷的一批块归还给伙伴分配器
+const PCP_HIGH: usize = 64;
+/// 0阶链表每次与伙伴分配器交换的块数
+const PCP_BATCH: usize = 16;
+
+/// 全局伙伴分配器的类型
+type InnerAllocator = SpinLock<Option<BuddyAllocator<MMArch>>>;
+
+static PER_CPU_PAGES: Lazy<PerCpuVar<PerCpuPages>> = PerCpuVar::define_lazy();
+
+/// 单个阶数的空闲块链表
+///
+/// 使用定长的环形缓冲区实现，避免在页帧分配路径上再去分配内存。
+/// 头部是最近释放的（热的）块，尾部是最久未使用的（冷的）块。
+#[derive(Debug)]
+struct PcpList {
+    blocks: [PhysAddr; PCP_CAPACITY],
+    head: usize,
+    len: usize,
+}
+
+impl PcpList {
+    const EMPTY: Self = Self::new();
+
+    const fn new() -> Self {
+        Self {
+            blocks: [PhysAddr::new(0); PCP_CAPACITY],
+            head: 0,
+            len: 0,
+        }
+    }
+
+    #[inline(always)]
+    fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// 把块放到头部（热端）
+    #[inline]
+    fn push_hot(&mut self, addr: PhysAddr) {
+        debug_assert!(self.len < PCP_CAPACITY);
+        self.head = (self.head + PCP_CAPACITY - 1) % PCP_CAPACITY;
+        self.blocks[self.head] = addr;
+        self.len += 1;
+    }
+
+    /// 把块放到尾部（冷端）
+    #[inline]
+    fn push_cold(&mut self, addr: PhysAddr) {
+        debug_assert!(self.len < PCP_CAPACITY);
+        self.blocks[(self.head + self.len) % PCP_CAPACITY] = addr;
+        self.len += 1;
+    }
+
+    /// 从头部取出最热的块
+    #[inline]
+    fn pop_hot(&mut self) -> Option<PhysAddr> {
+        if self.len == 0 {
+            return None;
+        }
+        let addr = self.blocks[self.head];
+        self.head = (self.head + 1) % PCP_CAPACITY;
+        self.len -= 1;
+        return Some(addr);
+    }
+
+    /// 从尾部取出最冷的块
+    #[inline]
+    fn pop_cold(&mut self) -> Option<PhysAddr> {
+        if self.len == 0 {
+            return None;
+        }
+        self.len -= 1;
+        return Some(self.blocks[(self.head + self.len) % PCP_CAPACITY]);
+    }
+}
+
+/// 每CPU缓存的统计信息
+#[derive(Debug, Default)]
+pub struct PcpStat {
+    /// 直接从本CPU缓存中分配成功的次数
+    alloc_hit: AtomicUsize,
+    /// 本CPU缓存为空，需要从伙伴分配器补充的次数
+    alloc_miss: AtomicUsize,
+    /// 批量从伙伴分配器补充的次数
+    refill: AtomicUsize,
+    /// 释放到本CPU缓存的次数
+    free_hit: AtomicUsize,
+    /// 批量归还给伙伴分配器的次数
+    drain: AtomicUsize,
+}
+
+impl PcpStat {
+    pub fn alloc_hit(&self) -> usize {
+        self.alloc_hit.load(Ordering::Relaxed)
+    }
+
+    pub fn alloc_miss(&self) -> usize {
+        self.alloc_miss.load(Ordering::Relaxed)
+    }
+
+    pub fn refill(&self) -> usize {
+        self.refill.load(Ordering::Relaxed)
+    }
+
+    pub fn free_hit(&self) -> usize {
+        self.free_hit.load(Ordering::Relaxed)
+    }
+
+    pub fn drain(&self) -> usize {
+        self.drain.load(Ordering::Relaxed)
+    }
+}
+
+/// 单个CPU的页帧缓存
+#[derive(Debug)]
+pub struct PerCpuPages {
+    lists: SpinLock<[PcpList; PCP_ORDERS]>,
+    /// 当前缓存的页帧总数（以页为单位）
+    cached: AtomicUsize,
+    stat: PcpStat,
+}
+
+impl PerCpuPages {
+    fn new() -> Self {
+        Self {
+            lists: SpinLock::new([PcpList::EMPTY; PCP_ORDERS]),
+            cached: AtomicUsize::new(0),
+            stat: PcpStat::default(),
+        }
+    }
+
+    pub fn stat(&self) -> &PcpStat {
+        &self.stat
+    }
+
+    /// 当前CPU缓存中的页帧数
+    pub fn cached_pages(&self) -> usize {
+        self.cached.load(Ordering::Relaxed)
+    }
+
+    /// 指定阶数的链表的高水位
+    #[inline(always)]
+    const fn high(order: usize) -> usize {
+        let h = PCP_HIGH >> order;
+        if h < 2 {
+            2
+        } else {
+            h
+        }
+    }
+
+    /// 指定阶数的链表每次与伙伴分配器交换的块数
+    #[inline(always)]
+    const fn batch(order: usize) -> usize {
+        let b = PCP_BATCH >> order;
+        if b < 1 {
+            1
+        } else {
+            b
+        }
+    }
+
+    /// 从本缓存中分配一个阶数为`order`的块，缓存为空时，从伙伴分配器批量补充
+    unsafe fn allocate(&self, inner: &InnerAllocator, order: usize) -> Option<PhysAddr> {
+        let mut lists = self.lists.lock_irqsave();
+        let list = &mut lists[order];
+
+        if likely(!list.is_empty()) {
+            self.stat.alloc_hit.fetch_add(1, Ordering::Relaxed);
+            self.cached.fetch_sub(1 << order, Ordering::Relaxed);
+            return list.pop_hot();
+        }
+
+        self.stat.alloc_miss.fetch_add(1, Ordering::Relaxed);
+
+        // 批量补充。新补充的块是冷的，放到尾部
+        let count = PageFrameCount::new(1 << order);
+        let mut filled = 0;
+        if let Some(ref mut allocator) = *inner.lock_irqsave() {
+            for _ in 0..Self::batch(order) {
+                if let Some((addr, _)) = allocator.allocate(count) {
+                    list.push_cold(addr);
+                    filled += 1;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        if unlikely(filled == 0) {
+            return None;
+        }
+        self.stat.refill.fetch_add(1, Ordering::Relaxed);
+        self.cached
+            .fetch_add((filled - 1) << order, Ordering::Relaxed);
+        return list.pop_hot();
+    }
+
+    /// 把一个阶数为`order`的块释放到本缓存中。超过高水位时，把最冷的一批块归还给伙伴分配器
+    unsafe fn free(&self, inner: &InnerAllocator, addr: PhysAddr, order: usize) {
+        let mut lists = self.lists.lock_irqsave();
+        let list = &mut lists[order];
+
+        if unlikely(list.len >= Self::high(order)) {
+            let count = PageFrameCount::new(1 << order);
+            let mut drained = 0;
+            if let Some(ref mut allocator) = *inner.lock_irqsave() {
+                for _ in 0..Self::batch(order) {
+                    if let Some(cold) = list.pop_cold() {
+                        allocator.free(cold, count);
+                        drained += 1;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            self.stat.drain.fetch_add(1, Ordering::Relaxed);
+            self.cached.fetch_sub(drained << order, Ordering::Relaxed);
+        }
+
+        list.push_hot(addr);
+        self.cached.fetch_add(1 << order, Ordering::Relaxed);
+        self.stat.free_hit.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// 把本缓存中的所有块归还给伙伴分配器
+    unsafe fn drain_all(&self, inner: &InnerAllocator) {
+        let mut lists = self.lists.lock_irqsave();
+        if self.cached_pages() == 0 {
+            return;
+        }
+        if let Some(ref mut allocator) = *inner.lock_irqsave() {
+            for (order, list) in lists.iter_mut().enumerate() {
+                let count = PageFrameCount::new(1 << order);
+                while let Some(addr) = list.pop_cold() {
+                    allocator.free(addr, count);
+                }
+            }
+            self.cached.store(0, Ordering::Relaxed);
+            self.stat.drain.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// 如果`count`个页帧可以由每CPU缓存管理，则返回对应的阶数
+#[inline(always)]
+fn pcp_order(count: PageFrameCount) -> Option<usize> {
+    let n = count.data();
+    if n.is_power_of_two() && n <= (1 << PCP_MAX_ORDER) {
+        return Some(n.trailing_zeros() as usize);
+    }
+    return None;
+}
+
+/// 初始化每CPU页帧缓存
+///
+/// 需要在内核堆初始化之后调用。在此之前，所有的页帧分配都直接访问伙伴分配器。
+pub fn pcp_init() {
+    let mut data = Vec::with_capacity(PerCpu::MAX_CPU_NUM as usize);
+    for _ in 0..PerCpu::MAX_CPU_NUM {
+        data.push(PerCpuPages::new());
+    }
+    PER_CPU_PAGES.init(PerCpuVar::new(data).unwrap());
+}
+
+/// 获取指定CPU的页帧缓存（用于统计信息的展示）
+pub fn pcp_get(cpu: ProcessorId) -> Option<&'static PerCpuPages> {
+    let pcp = PER_CPU_PAGES.try_get()?;
+    if cpu.data() >= PerCpu::MAX_CPU_NUM {
+        return None;
+    }
+    return Some(unsafe { pcp.force_get(cpu) });
+}
+
+/// 分配`count`个页帧（`count`必须是2的幂）
+///
+/// 小阶数的请求优先从当前CPU的缓存中分配，其余的请求直接交给伙伴分配器。
+/// 当伙伴分配器无法满足请求时，会把所有CPU缓存的页帧归还之后重试一次。
+pub unsafe fn pcp_allocate(
+    inner: &InnerAllocator,
+    count: PageFrameCount,
+) -> Option<(PhysAddr, PageFrameCount)> {
+    if let (Some(order), Some(pcp)) = (pcp_order(count), PER_CPU_PAGES.try_get()) {
+        if let Some(addr) = pcp.get().allocate(inner, order) {
+            return Some((addr, count));
+        }
+    } else if let Some(ref mut allocator) = *inner.lock_irqsave() {
+        if let Some(r) = allocator.allocate(count) {
+            return Some(r);
+        }
+    } else {
+        return None;
+    }
+
+    // 内存不足，回收零页池和所有CPU缓存的页帧后重试
+    zeroed_pages_drain();
+    pcp_drain_all(inner);
+    if let Some(ref mut allocator) = *inner.lock_irqsave() {
+        return allocator.allocate(count);
+    }
+    return None;
+}
+
+/// 释放`count`个页帧（`count`必须是2的幂）
+pub unsafe fn pcp_free(inner: &InnerAllocator, address: PhysAddr, count: PageFrameCount) {
+    if let (Some(order), Some(pcp)) = (pcp_order(count), PER_CPU_PAGES.try_get()) {
+        pcp.get().free(inner, address, order);
+        return;
+    }
+
+    if let Some(ref mut allocator) = *inner.lock_irqsave() {
+        allocator.free(address, count);
+    }
+}
+
+/// 获取页帧的使用情况。缓存在每CPU链表中的页帧被视为空闲页帧
+pub unsafe fn pcp_usage(inner: &InnerAllocator) -> Option<PageFrameUsage> {
+    let usage = inner.lock_irqsave().as_mut()?.usage();
+    // 每CPU缓存的计数是在释放伙伴分配器的锁之后读取的，并发的归还可能使它暂时大于已使用的页帧数
+    let used = usage.used().data().saturating_sub(pcp_cached_pages());
+    return Some(PageFrameUsage::new(
+        PageFrameCount::new(used),
+        usage.total(),
+    ));
+}
+
+/// 所有CPU缓存的页帧总数
+pub fn pcp_cached_pages() -> usize {
+    let Some(pcp) = PER_CPU_PAGES.try_get() else {
+        return 0;
+    };
+    (0..PerCpu::MAX_CPU_NUM)
+        .map(|cpu| unsafe { pcp.force_get(ProcessorId::new(cpu)) }.cached_pages())
+        .sum()
+}
+
+/// 把所有CPU缓存的页帧归还给伙伴分配器
+pub unsafe fn pcp_drain_all(inner: &InnerAllocator) {
+    let Some(pcp) = PER_CPU_PAGES.try_get() else {
+        return;
+    };
+    for cpu in 0..PerCpu::MAX_CPU_NUM {
+        pcp.force_get(ProcessorId::new(cpu)).drain_all(inner);
+    }
+}
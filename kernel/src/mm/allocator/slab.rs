@@ -1,10 +1,34 @@
-use core::{alloc::Layout, ptr::NonNull, sync::atomic::AtomicBool};
+//! slab分配器
+//!
+//! 全局的`ZoneAllocator`按大小类管理2K以内的对象，由一把自旋锁保护。
+//! 在它的前面，每个CPU为每个大小类维护一个对象弹匣(magazine)：
+//! 大部分的小对象分配/释放只会访问当前CPU的弹匣，
+//! 只有在弹匣为空（批量补充）或已满（批量归还）时，才需要获取全局锁。
 
-use alloc::boxed::Box;
+use core::{
+    alloc::Layout,
+    intrinsics::{likely, unlikely},
+    ptr::NonNull,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{boxed::Box, vec::Vec};
 use log::debug;
 use slabmalloc::*;
 
-use crate::{arch::MMArch, mm::MemoryManagementArch, KERNEL_ALLOCATOR};
+use crate::{
+    arch::MMArch,
+    libs::{
+        lazy_init::Lazy,
+        spinlock::{SpinLock, SpinLockGuard},
+    },
+    mm::{
+        percpu::{PerCpu, PerCpuVar},
+        MemoryManagementArch,
+    },
+    smp::cpu::ProcessorId,
+    KERNEL_ALLOCATOR,
+};
 
 // 全局slab分配器
 pub(crate) static mut SLABALLOCATOR: Option<SlabAllocator> = None;
@@ -14,10 +38,251 @@ pub(crate) static mut SLABINITSTATE: AtomicBool = AtomicBool::new(false);
 
 static SLAB_CALLBACK: SlabCallback = SlabCallback;
 
+static SLAB_MAGAZINES: Lazy<PerCpuVar<SlabMagazines>> = PerCpuVar::define_lazy();
+
+/// 大小类的数量（8字节到2K）
+const SLAB_SIZE_CLASSES: usize = ZoneAllocator::MAX_BASE_SIZE_CLASSES;
+
+/// 弹匣的最大容量（对象数）
+pub(super) const MAGAZINE_CAPACITY: usize = 32;
+/// 弹匣的最小容量（对象数）
+const MAGAZINE_MIN: usize = 8;
+
+/// 对象弹匣
+///
+/// 使用定长的栈实现，避免在分配路径上再去分配内存。栈顶是最近释放的（热的）对象。
+#[derive(Debug)]
+pub(super) struct Magazine {
+    objs: [usize; MAGAZINE_CAPACITY],
+    len: usize,
+}
+
+impl Magazine {
+    pub(super) const EMPTY: Self = Self::new();
+
+    pub(super) const fn new() -> Self {
+        Self {
+            objs: [0; MAGAZINE_CAPACITY],
+            len: 0,
+        }
+    }
+
+    #[inline(always)]
+    pub(super) fn len(&self) -> usize {
+        self.len
+    }
+
+    #[inline(always)]
+    pub(super) fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    #[inline]
+    pub(super) fn push(&mut self, ptr: *mut u8) {
+        debug_assert!(self.len < MAGAZINE_CAPACITY);
+        self.objs[self.len] = ptr as usize;
+        self.len += 1;
+    }
+
+    #[inline]
+    pub(super) fn pop(&mut self) -> Option<*mut u8> {
+        if self.len == 0 {
+            return None;
+        }
+        self.len -= 1;
+        return Some(self.objs[self.len] as *mut u8);
+    }
+
+    /// 对象大小为`size`的弹匣的高水位。大对象缓存得少一些，避免每个CPU占用过多内存
+    #[inline(always)]
+    pub(super) const fn limit(size: usize) -> usize {
+        let n = MMArch::PAGE_SIZE * 4 / size;
+        if n < MAGAZINE_MIN {
+            MAGAZINE_MIN
+        } else if n > MAGAZINE_CAPACITY {
+            MAGAZINE_CAPACITY
+        } else {
+            n
+        }
+    }
+
+    /// 对象大小为`size`的弹匣每次批量补充/归还的对象数
+    #[inline(always)]
+    pub(super) const fn batch(size: usize) -> usize {
+        Self::limit(size) / 2
+    }
+}
+
+/// 对象缓存的统计信息
+#[derive(Debug, Default)]
+pub struct SlabStat {
+    /// 直接从本CPU弹匣中分配成功的次数
+    alloc_hit: AtomicUsize,
+    /// 本CPU弹匣为空，需要批量补充的次数
+    alloc_miss: AtomicUsize,
+    /// 批量补充成功的次数
+    refill: AtomicUsize,
+    /// 释放到本CPU弹匣的次数
+    free_hit: AtomicUsize,
+    /// 批量归还的次数
+    drain: AtomicUsize,
+}
+
+impl SlabStat {
+    pub fn alloc_hit(&self) -> usize {
+        self.alloc_hit.load(Ordering::Relaxed)
+    }
+
+    pub fn alloc_miss(&self) -> usize {
+        self.alloc_miss.load(Ordering::Relaxed)
+    }
+
+    pub fn refill(&self) -> usize {
+        self.refill.load(Ordering::Relaxed)
+    }
+
+    pub fn free_hit(&self) -> usize {
+        self.free_hit.load(Ordering::Relaxed)
+    }
+
+    pub fn drain(&self) -> usize {
+        self.drain.load(Ordering::Relaxed)
+    }
+
+    #[inline(always)]
+    pub(super) fn inc_alloc_hit(&self) {
+        self.alloc_hit.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub(super) fn inc_alloc_miss(&self) {
+        self.alloc_miss.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub(super) fn inc_refill(&self) {
+        self.refill.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub(super) fn inc_free_hit(&self) {
+        self.free_hit.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub(super) fn inc_drain(&self) {
+        self.drain.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// 第`class`个大小类的对象大小
+#[inline(always)]
+const fn class_size(class: usize) -> usize {
+    8 << class
+}
+
+/// 第`class`个大小类在全局`ZoneAllocator`中使用的内存布局
+#[inline(always)]
+fn class_layout(class: usize) -> Layout {
+    unsafe { Layout::from_size_align_unchecked(class_size(class), 8) }
+}
+
+/// 如果`layout`可以由每CPU弹匣服务，则返回对应的大小类
+///
+/// slab页中的对象按照大小类的大小对齐，因此对齐要求不超过大小类的请求，
+/// 可以复用弹匣中任意一个同大小类的对象
+#[inline(always)]
+fn magazine_class(layout: Layout) -> Option<usize> {
+    let size = ZoneAllocator::get_max_size(layout.size())?;
+    if unlikely(layout.align() > size) {
+        return None;
+    }
+    return Some(size.trailing_zeros() as usize - 3);
+}
+
+/// 单个CPU的slab对象弹匣
+#[derive(Debug)]
+pub struct SlabMagazines {
+    mags: SpinLock<[Magazine; SLAB_SIZE_CLASSES]>,
+    /// 当前缓存的对象总大小（字节）
+    cached: AtomicUsize,
+    stat: SlabStat,
+}
+
+impl SlabMagazines {
+    fn new() -> Self {
+        Self {
+            mags: SpinLock::new([Magazine::EMPTY; SLAB_SIZE_CLASSES]),
+            cached: AtomicUsize::new(0),
+            stat: SlabStat::default(),
+        }
+    }
+
+    pub fn stat(&self) -> &SlabStat {
+        &self.stat
+    }
+
+    /// 当前CPU弹匣中缓存的对象总大小（字节）
+    pub fn cached_bytes(&self) -> usize {
+        self.cached.load(Ordering::Relaxed)
+    }
+
+    /// 从本CPU的弹匣中分配一个对象，弹匣为空时，从全局的ZoneAllocator批量补充
+    unsafe fn allocate(&self, slab: &SlabAllocator, class: usize) -> *mut u8 {
+        let size = class_size(class);
+        let mut mags = self.mags.lock_irqsave();
+        let mag = &mut mags[class];
+
+        if likely(!mag.is_empty()) {
+            self.stat.inc_alloc_hit();
+            self.cached.fetch_sub(size, Ordering::Relaxed);
+            return mag.pop().unwrap();
+        }
+
+        self.stat.inc_alloc_miss();
+        let filled = slab.zone_allocate_bulk(class_layout(class), Magazine::batch(size), mag);
+        self.stat.inc_refill();
+        self.cached
+            .fetch_add((filled - 1) * size, Ordering::Relaxed);
+        return mag.pop().unwrap();
+    }
+
+    /// 把一个对象释放到本CPU的弹匣中。超过高水位时，把一批对象归还给全局的ZoneAllocator
+    unsafe fn free(&self, slab: &SlabAllocator, ptr: *mut u8, class: usize) {
+        let size = class_size(class);
+        let mut mags = self.mags.lock_irqsave();
+        let mag = &mut mags[class];
+
+        if unlikely(mag.len() >= Magazine::limit(size)) {
+            let drained = slab.zone_free_bulk(class_layout(class), Magazine::batch(size), mag);
+            self.stat.inc_drain();
+            self.cached.fetch_sub(drained * size, Ordering::Relaxed);
+        }
+
+        mag.push(ptr);
+        self.cached.fetch_add(size, Ordering::Relaxed);
+        self.stat.inc_free_hit();
+    }
+
+    /// 把本CPU弹匣中的所有对象归还给全局的ZoneAllocator
+    unsafe fn drain_all(&self, slab: &SlabAllocator) {
+        let mut mags = self.mags.lock_irqsave();
+        if self.cached_bytes() == 0 {
+            return;
+        }
+        for (class, mag) in mags.iter_mut().enumerate() {
+            let len = mag.len();
+            slab.zone_free_bulk(class_layout(class), len, mag);
+        }
+        self.cached.store(0, Ordering::Relaxed);
+        self.stat.inc_drain();
+    }
+}
+
 /// slab分配器，实际为一堆小的allocator，可以在里面装4K的page
 /// 利用这些allocator可以为对象分配不同大小的空间
 pub(crate) struct SlabAllocator {
-    zone: ZoneAllocator<'static>,
+    zone: SpinLock<ZoneAllocator<'static>>,
 }
 
 impl SlabAllocator {
@@ -25,37 +290,41 @@ impl SlabAllocator {
     pub fn new() -> SlabAllocator {
         debug!("trying to new a slab_allocator");
         SlabAllocator {
-            zone: ZoneAllocator::new(),
+            zone: SpinLock::new(ZoneAllocator::new()),
         }
     }
 
     /// 为对象（2K以内）分配内存空间
-    pub(crate) unsafe fn allocate(&mut self, layout: Layout) -> *mut u8 {
-        match self.zone.allocate(layout) {
-            Ok(nptr) => nptr.as_ptr(),
-            Err(AllocationError::OutOfMemory) => {
-                let boxed_page = ObjectPage::new();
-                let leaked_page = Box::leak(boxed_page);
-                self.zone
-                    .refill(layout, leaked_page)
-                    .expect("Could not refill?");
-                self.zone
-                    .allocate(layout)
-                    .expect("Should succeed after refill")
-                    .as_ptr()
+    pub(crate) unsafe fn allocate(&self, layout: Layout) -> *mut u8 {
+        if let (Some(class), Some(mags)) = (magazine_class(layout), SLAB_MAGAZINES.try_get()) {
+            return mags.get().allocate(self, class);
+        }
+
+        let mut zone = self.zone.lock_irqsave();
+        loop {
+            match zone.allocate(layout) {
+                Ok(nptr) => return nptr.as_ptr(),
+                Err(AllocationError::OutOfMemory) => {
+                    zone = self.refill(zone, layout);
+                }
+                Err(AllocationError::InvalidLayout) => panic!("Can't allocate this size"),
             }
-            Err(AllocationError::InvalidLayout) => panic!("Can't allocate this size"),
         }
     }
 
     /// 释放内存空间
     pub(crate) unsafe fn deallocate(
-        &mut self,
+        &self,
         ptr: *mut u8,
         layout: Layout,
     ) -> Result<(), AllocationError> {
         if let Some(nptr) = NonNull::new(ptr) {
+            if let (Some(class), Some(mags)) = (magazine_class(layout), SLAB_MAGAZINES.try_get()) {
+                mags.get().free(self, ptr, class);
+                return Ok(());
+            }
             self.zone
+                .lock_irqsave()
                 .deallocate(nptr, layout, &SLAB_CALLBACK)
                 .expect("Couldn't deallocate");
             return Ok(());
@@ -63,6 +332,64 @@ impl SlabAllocator {
             return Ok(());
         }
     }
+
+    /// 为`layout`对应的大小类补充一个slab页
+    ///
+    /// 向伙伴分配器申请页面时不持有全局锁，返回重新获取的锁
+    unsafe fn refill<'a>(
+        &'a self,
+        zone: SpinLockGuard<'a, ZoneAllocator<'static>>,
+        layout: Layout,
+    ) -> SpinLockGuard<'a, ZoneAllocator<'static>> {
+        drop(zone);
+        let boxed_page = ObjectPage::new();
+        let leaked_page = Box::leak(boxed_page);
+        let mut zone = self.zone.lock_irqsave();
+        zone.refill(layout, leaked_page).expect("Could not refill?");
+        return zone;
+    }
+
+    /// 从全局的ZoneAllocator中分配`count`个对象放入弹匣
+    ///
+    /// ## 返回值
+    ///
+    /// 放入弹匣的对象数
+    unsafe fn zone_allocate_bulk(&self, layout: Layout, count: usize, mag: &mut Magazine) -> usize {
+        let mut zone = self.zone.lock_irqsave();
+        let mut filled = 0;
+        while filled < count {
+            match zone.allocate(layout) {
+                Ok(nptr) => {
+                    mag.push(nptr.as_ptr());
+                    filled += 1;
+                }
+                Err(AllocationError::OutOfMemory) => {
+                    zone = self.refill(zone, layout);
+                }
+                Err(AllocationError::InvalidLayout) => panic!("Can't allocate this size"),
+            }
+        }
+        return filled;
+    }
+
+    /// 把弹匣中的`count`个对象归还给全局的ZoneAllocator
+    ///
+    /// ## 返回值
+    ///
+    /// 实际归还的对象数
+    unsafe fn zone_free_bulk(&self, layout: Layout, count: usize, mag: &mut Magazine) -> usize {
+        let mut zone = self.zone.lock_irqsave();
+        let mut drained = 0;
+        while drained < count {
+            let Some(ptr) = mag.pop() else {
+                break;
+            };
+            zone.deallocate(NonNull::new_unchecked(ptr), layout, &SLAB_CALLBACK)
+                .expect("Couldn't deallocate");
+            drained += 1;
+        }
+        return drained;
+    }
 }
 
 /// 初始化slab分配器
@@ -72,19 +399,64 @@ pub unsafe fn slab_init() {
     SLABINITSTATE = true.into();
 }
 
+/// 初始化每CPU的slab对象弹匣
+///
+/// 需要在slab分配器初始化之后调用。在此之前，所有的小对象分配都直接访问全局的ZoneAllocator。
+pub fn slab_magazine_init() {
+    let mut data = Vec::with_capacity(PerCpu::MAX_CPU_NUM as usize);
+    for _ in 0..PerCpu::MAX_CPU_NUM {
+        data.push(SlabMagazines::new());
+    }
+    SLAB_MAGAZINES.init(PerCpuVar::new(data).unwrap());
+}
+
 // 查看slab初始化状态
 pub fn slab_init_state() -> bool {
     unsafe { *SLABINITSTATE.get_mut() }
 }
 
+/// 获取slab的使用情况。缓存在每CPU弹匣中的对象被视为空闲空间
 pub unsafe fn slab_usage() -> SlabUsage {
-    if let Some(ref mut slab) = SLABALLOCATOR {
-        slab.zone.usage()
+    if let Some(ref slab) = SLABALLOCATOR {
+        let usage = slab.zone.lock_irqsave().usage();
+        let cached = slab_magazine_cached_bytes() as u64;
+        SlabUsage::new(usage.total(), usage.free() + cached)
     } else {
         SlabUsage::new(0, 0)
     }
 }
 
+/// 获取指定CPU的slab对象弹匣（用于统计信息的展示）
+#[allow(dead_code)]
+pub fn slab_magazines_get(cpu: ProcessorId) -> Option<&'static SlabMagazines> {
+    let mags = SLAB_MAGAZINES.try_get()?;
+    if cpu.data() >= PerCpu::MAX_CPU_NUM {
+        return None;
+    }
+    return Some(unsafe { mags.force_get(cpu) });
+}
+
+/// 所有CPU弹匣中缓存的对象总大小（字节）
+pub fn slab_magazine_cached_bytes() -> usize {
+    let Some(mags) = SLAB_MAGAZINES.try_get() else {
+        return 0;
+    };
+    (0..PerCpu::MAX_CPU_NUM)
+        .map(|cpu| unsafe { mags.force_get(ProcessorId::new(cpu)) }.cached_bytes())
+        .sum()
+}
+
+/// 把所有CPU弹匣中的对象归还给全局的ZoneAllocator，使空闲的slab页可以被归还给伙伴分配器
+#[allow(dead_code)]
+pub unsafe fn slab_drain_all() {
+    let (Some(slab), Some(mags)) = (SLABALLOCATOR.as_ref(), SLAB_MAGAZINES.try_get()) else {
+        return;
+    };
+    for cpu in 0..PerCpu::MAX_CPU_NUM {
+        mags.force_get(ProcessorId::new(cpu)).drain_all(slab);
+    }
+}
+
 /// 归还slab_page给buddy的回调
 pub struct SlabCallback;
 impl CallBack for SlabCallback {
@@ -0,0 +1,180 @@
+//! 预先清零的页帧池
+//!
+//! 需要零页的分配（页表、匿名页、`alloc_zeroed`等）优先从池中取出已经清零的页帧，
+//! 省去在分配路径上清零整页的开销。池由idle进程在CPU空闲时补充。
+
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::{
+    arch::{mm::LockedFrameAllocator, MMArch},
+    libs::spinlock::SpinLock,
+    mm::{MemoryManagementArch, PhysAddr},
+};
+
+use super::page_frame::FrameAllocator;
+
+/// 池的容量（页帧数）
+const ZEROED_POOL_CAPACITY: usize = 256;
+/// idle进程每次补充的页帧数。补充完一批之后，idle进程会重新检查是否需要调度
+const ZEROED_POOL_IDLE_BATCH: usize = 8;
+/// 空闲页帧少于这个数量时，不再补充池，避免和真正的分配争抢内存
+const ZEROED_POOL_MIN_FREE: usize = ZEROED_POOL_CAPACITY * 4;
+
+static ZEROED_PAGES: SpinLock<ZeroedPagePool> = SpinLock::new(ZeroedPagePool::new());
+/// 池中的页帧数，用于不加锁地判断池是否为空或已满
+static ZEROED_PAGES_LEN: AtomicUsize = AtomicUsize::new(0);
+static ZEROED_PAGES_STAT: ZeroedPagesStat = ZeroedPagesStat::new();
+
+#[derive(Debug)]
+struct ZeroedPagePool {
+    pages: [PhysAddr; ZEROED_POOL_CAPACITY],
+    len: usize,
+}
+
+impl ZeroedPagePool {
+    const fn new() -> Self {
+        Self {
+            pages: [PhysAddr::new(0); ZEROED_POOL_CAPACITY],
+            len: 0,
+        }
+    }
+
+    #[inline]
+    fn push(&mut self, addr: PhysAddr) -> bool {
+        if self.len >= ZEROED_POOL_CAPACITY {
+            return false;
+        }
+        self.pages[self.len] = addr;
+        self.len += 1;
+        ZEROED_PAGES_LEN.store(self.len, Ordering::Relaxed);
+        return true;
+    }
+
+    #[inline]
+    fn pop(&mut self) -> Option<PhysAddr> {
+        if self.len == 0 {
+            return None;
+        }
+        self.len -= 1;
+        ZEROED_PAGES_LEN.store(self.len, Ordering::Relaxed);
+        return Some(self.pages[self.len]);
+    }
+}
+
+/// 零页池的统计信息
+#[derive(Debug)]
+pub struct ZeroedPagesStat {
+    /// 从池中取到零页的次数
+    hit: AtomicUsize,
+    /// 池为空，在分配路径上清零的次数
+    miss: AtomicUsize,
+    /// idle进程清零的页帧数
+    filled: AtomicUsize,
+}
+
+impl ZeroedPagesStat {
+    const fn new() -> Self {
+        Self {
+            hit: AtomicUsize::new(0),
+            miss: AtomicUsize::new(0),
+            filled: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn hit(&self) -> usize {
+        self.hit.load(Ordering::Relaxed)
+    }
+
+    pub fn miss(&self) -> usize {
+        self.miss.load(Ordering::Relaxed)
+    }
+
+    pub fn filled(&self) -> usize {
+        self.filled.load(Ordering::Relaxed)
+    }
+}
+
+#[allow(dead_code)]
+pub fn zeroed_pages_stat() -> &'static ZeroedPagesStat {
+    &ZEROED_PAGES_STAT
+}
+
+/// 池中的页帧数
+#[allow(dead_code)]
+pub fn zeroed_pages_count() -> usize {
+    ZEROED_PAGES_LEN.load(Ordering::Relaxed)
+}
+
+#[inline(always)]
+unsafe fn clear_page(addr: PhysAddr) {
+    MMArch::write_bytes(MMArch::phys_2_virt(addr).unwrap(), 0, MMArch::PAGE_SIZE);
+}
+
+/// ## 分配一个内容全为0的页帧
+///
+/// 优先从零页池中取，池为空时从全局页帧分配器分配并清零
+///
+/// ## 返回值
+///
+/// 内存不足时返回`None`
+pub unsafe fn zeroed_page_allocate() -> Option<PhysAddr> {
+    if ZEROED_PAGES_LEN.load(Ordering::Relaxed) != 0 {
+        if let Some(addr) = ZEROED_PAGES.lock_irqsave().pop() {
+            ZEROED_PAGES_STAT.hit.fetch_add(1, Ordering::Relaxed);
+            return Some(addr);
+        }
+    }
+
+    ZEROED_PAGES_STAT.miss.fetch_add(1, Ordering::Relaxed);
+    let addr = LockedFrameAllocator.allocate_one()?;
+    clear_page(addr);
+    return Some(addr);
+}
+
+/// ## 在idle进程中补充零页池
+///
+/// 每次最多清零`ZEROED_POOL_IDLE_BATCH`个页帧，清零时不持有池的锁
+///
+/// ## 返回值
+///
+/// 本次是否补充了页帧。返回`true`时，调用者应该在检查调度之后再次调用
+pub fn zeroed_pages_idle_refill() -> bool {
+    if ZEROED_PAGES_LEN.load(Ordering::Relaxed) >= ZEROED_POOL_CAPACITY {
+        return false;
+    }
+    if unsafe { LockedFrameAllocator.usage() }.free().data() < ZEROED_POOL_MIN_FREE {
+        return false;
+    }
+
+    let mut filled = 0;
+    while filled < ZEROED_POOL_IDLE_BATCH
+        && ZEROED_PAGES_LEN.load(Ordering::Relaxed) < ZEROED_POOL_CAPACITY
+    {
+        let Some(addr) = (unsafe { LockedFrameAllocator.allocate_one() }) else {
+            break;
+        };
+        unsafe { clear_page(addr) };
+
+        if !ZEROED_PAGES.lock_irqsave().push(addr) {
+            unsafe { LockedFrameAllocator.free_one(addr) };
+            break;
+        }
+        filled += 1;
+    }
+
+    ZEROED_PAGES_STAT
+        .filled
+        .fetch_add(filled, Ordering::Relaxed);
+    return filled != 0;
+}
+
+/// 把零页池中的所有页帧归还给页帧分配器（内存不足时调用）
+pub unsafe fn zeroed_pages_drain() {
+    if ZEROED_PAGES_LEN.load(Ordering::Relaxed) == 0 {
+        return;
+    }
+    let mut pool = ZEROED_PAGES.lock_irqsave();
+    while let Some(addr) = pool.pop() {
+        LockedFrameAllocator.free_one(addr);
+    }
+}
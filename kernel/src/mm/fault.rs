@@ -6,12 +6,14 @@ use core::{
 };
 
 use alloc::sync::Arc;
+use system_error::SystemError;
 
 use crate::{
     arch::{mm::PageMapper, MMArch},
+    filesystem::vfs::readahead,
     libs::align::align_down,
     mm::{
-        page::{page_manager_lock_irqsave, EntryFlags},
+        page::{page_manager, EntryFlags, Flusher, PageFlush},
         ucontext::LockedVMA,
         VirtAddr, VmFaultReason, VmFlags,
     },
@@ -21,8 +23,10 @@ use crate::{
 use crate::mm::MemoryManagementArch;
 
 use super::{
-    allocator::page_frame::FrameAllocator,
-    page::{page_reclaimer_lock_irqsave, Page, PageFlags},
+    allocator::page_frame::{
+        deallocate_page_frames, FrameAllocator, PageFrameCount, PhysPageFrame,
+    },
+    page::{Page, PageFlags},
 };
 
 bitflags! {
@@ -253,8 +257,8 @@ impl PageFaultHandler {
                 klog_types::LogSource::Buddy,
             );
             let paddr = mapper.translate(address).unwrap().0;
-            let mut page_manager_guard = page_manager_lock_irqsave();
-            let page = page_manager_guard.get_unwrap(&paddr);
+            let page_manager = page_manager();
+            let page = page_manager.get_unwrap(&paddr);
             page.write_irqsave().insert_vma(vma.clone());
             VmFaultReason::VM_FAULT_COMPLETED
         } else {
@@ -326,10 +330,10 @@ impl PageFaultHandler {
             MMArch::PAGE_SIZE,
         );
 
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
 
         // 新页加入页管理器中
-        page_manager_guard.insert(cow_page_phys, &cow_page);
+        page_manager.insert(cow_page_phys, &cow_page);
         cow_page.write_irqsave().set_page_cache_index(
             cache_page.read_irqsave().page_cache(),
             cache_page.read_irqsave().index(),
@@ -377,7 +381,7 @@ impl PageFaultHandler {
         let cache_page = pfm.page.clone().expect("no cache_page in PageFaultMessage");
 
         // 将pagecache页设为脏页，以便回收时能够回写
-        cache_page.write_irqsave().add_flags(PageFlags::PG_DIRTY);
+        cache_page.add_flags(PageFlags::PG_DIRTY);
         ret = ret.union(Self::finish_fault(pfm));
 
         ret
@@ -423,6 +427,15 @@ impl PageFaultHandler {
         // TODO https://code.dragonos.org.cn/xref/linux-6.6.21/mm/memory.c#do_numa_page
     }
 
+    /// 修改了已经存在的页表项之后，刷新所有加载了VMA所在地址空间的cpu的TLB
+    fn flush_tlb_page(vma: &Arc<LockedVMA>, flush: PageFlush<MMArch>) {
+        let space = vma.lock_irqsave().address_space().and_then(|s| s.upgrade());
+        match space {
+            Some(space) => space.tlb().batch().consume(flush),
+            None => flush.flush(),
+        }
+    }
+
     /// 处理写保护页面的写保护异常
     /// ## 参数
     ///
@@ -437,10 +450,8 @@ impl PageFaultHandler {
         let mapper = &mut pfm.mapper;
 
         let old_paddr = mapper.translate(address).unwrap().0;
-        let mut page_manager = page_manager_lock_irqsave();
-        let old_page = page_manager.get_unwrap(&old_paddr);
+        let old_page = page_manager().get_unwrap(&old_paddr);
         let map_count = old_page.read_irqsave().map_count();
-        drop(page_manager);
 
         let mut entry = mapper.get_entry(address, 0).unwrap();
         let new_flags = entry.flags().set_write(true).set_dirty(true);
@@ -452,7 +463,7 @@ impl PageFaultHandler {
             entry.set_flags(new_flags);
             table.set_entry(i, entry);
 
-            old_page.write_irqsave().add_flags(PageFlags::PG_DIRTY);
+            old_page.add_flags(PageFlags::PG_DIRTY);
 
             VmFaultReason::VM_FAULT_COMPLETED
         } else if vma.is_anonymous() {
@@ -464,15 +475,15 @@ impl PageFaultHandler {
                 table.set_entry(i, entry);
                 VmFaultReason::VM_FAULT_COMPLETED
             } else if let Some(flush) = mapper.map(address, new_flags) {
-                let mut page_manager_guard = page_manager_lock_irqsave();
-                let old_page = page_manager_guard.get_unwrap(&old_paddr);
-                old_page.write_irqsave().remove_vma(&vma);
-                // drop(page_manager_guard);
+                let page_manager = page_manager();
+                let old_page = page_manager.get_unwrap(&old_paddr);
+                // 其他地址空间可能同时解除了对原来的页的映射，由最后一个解除映射的一方释放它
+                let claimed = old_page.write_irqsave().remove_vma_and_claim_free(&vma);
 
-                flush.flush();
+                // 其他cpu上可能还缓存着指向原来的页的表项
+                Self::flush_tlb_page(&vma, flush);
                 let paddr = mapper.translate(address).unwrap().0;
-                // let mut page_manager_guard = page_manager_lock_irqsave();
-                let page = page_manager_guard.get_unwrap(&paddr);
+                let page = page_manager.get_unwrap(&paddr);
                 page.write_irqsave().insert_vma(vma.clone());
 
                 (MMArch::phys_2_virt(paddr).unwrap().data() as *mut u8).copy_from_nonoverlapping(
@@ -480,6 +491,11 @@ impl PageFaultHandler {
                     MMArch::PAGE_SIZE,
                 );
 
+                if claimed {
+                    drop(old_page);
+                    deallocate_page_frames(PhysPageFrame::new(old_paddr), PageFrameCount::new(1));
+                }
+
                 VmFaultReason::VM_FAULT_COMPLETED
             } else {
                 VmFaultReason::VM_FAULT_OOM
@@ -487,15 +503,15 @@ impl PageFaultHandler {
         } else {
             // 私有文件映射，必须拷贝页面
             if let Some(flush) = mapper.map(address, new_flags) {
-                let mut page_manager_guard = page_manager_lock_irqsave();
-                let old_page = page_manager_guard.get_unwrap(&old_paddr);
-                old_page.write_irqsave().remove_vma(&vma);
-                // drop(page_manager_guard);
+                let page_manager = page_manager();
+                let old_page = page_manager.get_unwrap(&old_paddr);
+                // 其他地址空间可能同时解除了对原来的页的映射，由最后一个解除映射的一方释放它
+                let claimed = old_page.write_irqsave().remove_vma_and_claim_free(&vma);
 
-                flush.flush();
+                // 其他cpu上可能还缓存着指向原来的页的表项
+                Self::flush_tlb_page(&vma, flush);
                 let paddr = mapper.translate(address).unwrap().0;
-                // let mut page_manager_guard = page_manager_lock_irqsave();
-                let page = page_manager_guard.get_unwrap(&paddr);
+                let page = page_manager.get_unwrap(&paddr);
                 page.write_irqsave().insert_vma(vma.clone());
 
                 (MMArch::phys_2_virt(paddr).unwrap().data() as *mut u8).copy_from_nonoverlapping(
@@ -503,6 +519,11 @@ impl PageFaultHandler {
                     MMArch::PAGE_SIZE,
                 );
 
+                if claimed {
+                    drop(old_page);
+                    deallocate_page_frames(PhysPageFrame::new(old_paddr), PageFrameCount::new(1));
+                }
+
                 VmFaultReason::VM_FAULT_COMPLETED
             } else {
                 VmFaultReason::VM_FAULT_OOM
@@ -610,7 +631,7 @@ impl PageFaultHandler {
         for pgoff in start_pgoff..=end_pgoff {
             if let Some(page) = page_cache.get_page(pgoff) {
                 let page_guard = page.read_irqsave();
-                if page_guard.flags().contains(PageFlags::PG_UPTODATE) {
+                if page.flags().contains(PageFlags::PG_UPTODATE) {
                     let phys = page_guard.phys_address();
 
                     let address =
@@ -639,46 +660,27 @@ impl PageFaultHandler {
         let file = vma_guard.vm_file().expect("no vm_file in vma");
         let page_cache = file.inode().page_cache().unwrap();
         let file_pgoff = pfm.file_pgoff.expect("no file_pgoff");
-        let mapper = &mut pfm.mapper;
         let mut ret = VmFaultReason::empty();
 
-        if let Some(page) = page_cache.get_page(file_pgoff) {
-            // TODO 异步从磁盘中预读页面进PageCache
-
-            // 直接将PageCache中的页面作为要映射的页面
-            pfm.page = Some(page.clone());
-        } else {
-            // TODO 同步预读
-            //涉及磁盘IO，返回标志为VM_FAULT_MAJOR
-            ret = VmFaultReason::VM_FAULT_MAJOR;
-            // let mut buf: Vec<u8> = vec![0; MMArch::PAGE_SIZE];
-
-            let allocator = mapper.allocator_mut();
-
-            // 分配一个物理页面作为加入PageCache的新页
-            let new_cache_page = allocator.allocate_one().unwrap();
-            // (MMArch::phys_2_virt(new_cache_page).unwrap().data() as *mut u8)
-            //     .copy_from_nonoverlapping(buf.as_mut_ptr(), MMArch::PAGE_SIZE);
-            file.pread(
-                file_pgoff * MMArch::PAGE_SIZE,
-                MMArch::PAGE_SIZE,
-                core::slice::from_raw_parts_mut(
-                    MMArch::phys_2_virt(new_cache_page).unwrap().data() as *mut u8,
-                    MMArch::PAGE_SIZE,
-                ),
-            )
-            .expect("failed to read file to create pagecache page");
-
-            let page = Arc::new(Page::new(true, new_cache_page));
-            pfm.page = Some(page.clone());
-
-            page.write_irqsave().add_flags(PageFlags::PG_LRU);
-            page_manager_lock_irqsave().insert(new_cache_page, &page);
-            page_reclaimer_lock_irqsave().insert_page(new_cache_page, &page);
-            page_cache.add_page(file_pgoff, &page);
+        // 缺页不在缓存中时，同步读入缺页附近的页面；读到预读标记时在后台预读后续页面
+        let cached = page_cache.get_page(file_pgoff).is_some();
+        readahead::filemap_fault_readahead(
+            &page_cache,
+            file.ra_state(),
+            file_pgoff,
+            *vma_guard.vm_flags(),
+        );
 
-            page.write_irqsave()
-                .set_page_cache_index(Some(page_cache), Some(file_pgoff));
+        match page_cache.get_or_read_page(file_pgoff) {
+            Ok((page, major)) => {
+                if major || !cached {
+                    //涉及磁盘IO，返回标志为VM_FAULT_MAJOR
+                    ret = VmFaultReason::VM_FAULT_MAJOR;
+                }
+                pfm.page = Some(page);
+            }
+            Err(SystemError::ENOMEM) => return VmFaultReason::VM_FAULT_OOM,
+            Err(_) => return VmFaultReason::VM_FAULT_SIGBUS,
         }
         ret
     }
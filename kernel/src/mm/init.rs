@@ -9,7 +9,11 @@ use crate::{
     ipc::shm::shm_manager_init,
     libs::printk::PrintkWriter,
     mm::{
-        allocator::slab::slab_init,
+        allocator::{
+            kmem_cache::kmem_cache_init,
+            pcp::pcp_init,
+            slab::{slab_init, slab_magazine_init},
+        },
         mmio_buddy::mmio_init,
         page::{page_manager_init, page_reclaimer_init},
     },
@@ -52,6 +56,11 @@ pub unsafe fn mm_init() {
 
     // init slab
     slab_init();
+    // enable per-cpu page frame cache
+    pcp_init();
+    // enable per-cpu slab magazines and kernel object caches
+    slab_magazine_init();
+    kmem_cache_init();
 
     // enable mmio
     mmio_init();
@@ -1,8 +1,13 @@
 use system_error::SystemError;
 
-use crate::arch::{mm::PageMapper, MMArch};
+use crate::{
+    arch::{mm::PageMapper, MMArch},
+    filesystem::vfs::readahead,
+};
 
-use super::{page::Flusher, syscall::MadvFlags, ucontext::LockedVMA, VmFlags};
+use super::{
+    page::Flusher, syscall::MadvFlags, ucontext::LockedVMA, MemoryManagementArch, VmFlags,
+};
 
 impl LockedVMA {
     pub fn do_madvise(
@@ -20,7 +25,13 @@ impl LockedVMA {
             }
 
             MadvFlags::MADV_WILLNEED => {
-                // TODO
+                // 文件映射：在后台把整个区域预读进页面缓存
+                if let (Some(file), Some(pgoff)) = (vma.vm_file(), vma.file_page_offset()) {
+                    if let Some(page_cache) = file.inode().page_cache() {
+                        let nr = vma.region().size() >> MMArch::PAGE_SHIFT;
+                        readahead::force_readahead(&page_cache, pgoff, nr);
+                    }
+                }
             }
 
             MadvFlags::MADV_COLD => {
@@ -1,23 +1,24 @@
-use alloc::string::ToString;
+use alloc::{string::ToString, vec::Vec};
 use core::{
     fmt::{self, Debug, Error, Formatter},
+    hint::spin_loop,
     marker::PhantomData,
     mem,
     ops::Add,
-    sync::atomic::{compiler_fence, Ordering},
+    sync::atomic::{compiler_fence, AtomicU64, AtomicUsize, Ordering},
 };
 use system_error::SystemError;
 use unified_init::macros::unified_init;
 
 use alloc::sync::Arc;
-use hashbrown::{HashMap, HashSet};
+use hashbrown::HashSet;
 use log::{error, info};
 use lru::LruCache;
 
 use crate::{
-    arch::{interrupt::ipi::send_ipi, mm::LockedFrameAllocator, MMArch},
-    exception::ipi::{IpiKind, IpiTarget},
-    filesystem::vfs::{file::PageCache, FilePrivateData},
+    arch::{mm::LockedFrameAllocator, CurrentIrqArch, MMArch},
+    exception::InterruptArch,
+    filesystem::vfs::file::PageCache,
     init::initcall::INITCALL_CORE,
     ipc::shm::ShmId,
     libs::{
@@ -30,6 +31,7 @@ use crate::{
 
 use super::{
     allocator::page_frame::{FrameAllocator, PageFrameCount},
+    memblock::mem_block_manager,
     syscall::ProtFlags,
     ucontext::LockedVMA,
     MemoryManagementArch, PageTableKind, PhysAddr, VirtAddr,
@@ -44,12 +46,12 @@ pub const PAGE_4K_SIZE: usize = 1 << PAGE_4K_SHIFT;
 pub const PAGE_2M_SIZE: usize = 1 << PAGE_2M_SHIFT;
 
 /// 全局物理页信息管理器
-pub static mut PAGE_MANAGER: Option<SpinLock<PageManager>> = None;
+static mut PAGE_MANAGER: Option<PageManager> = None;
 
 /// 初始化PAGE_MANAGER
 pub fn page_manager_init() {
     info!("page_manager_init");
-    let page_manager = SpinLock::new(PageManager::new());
+    let page_manager = PageManager::new();
 
     compiler_fence(Ordering::SeqCst);
     unsafe { PAGE_MANAGER = Some(page_manager) };
@@ -58,45 +60,158 @@ pub fn page_manager_init() {
     info!("page_manager_init done");
 }
 
-pub fn page_manager_lock_irqsave() -> SpinLockGuard<'static, PageManager> {
-    unsafe { PAGE_MANAGER.as_ref().unwrap().lock_irqsave() }
+#[inline(always)]
+pub fn page_manager() -> &'static PageManager {
+    unsafe { PAGE_MANAGER.as_ref().unwrap() }
 }
 
-// 物理页管理器
+/// 物理页管理器
+///
+/// 使用以物理页帧号为下标的线性数组(memmap)保存每个物理页对应的`Page`，
+/// 数组的大小在初始化时根据memblock中的可用物理内存确定。
+/// 查找、插入、删除都只访问对应页帧的槽位，不需要获取全局锁。
 pub struct PageManager {
-    phys2page: HashMap<PhysAddr, Arc<Page>>,
+    memmap: Vec<PageSlot>,
 }
 
 impl PageManager {
     pub fn new() -> Self {
-        Self {
-            phys2page: HashMap::new(),
-        }
+        let max_pfn = mem_block_manager()
+            .to_iter_available()
+            .map(|area| area.area_end_aligned().data() >> MMArch::PAGE_SHIFT)
+            .max()
+            .unwrap_or(0);
+
+        let mut memmap = Vec::with_capacity(max_pfn);
+        memmap.resize_with(max_pfn, PageSlot::new);
+        info!(
+            "memmap: {} page slots, {} KB",
+            max_pfn,
+            (max_pfn * mem::size_of::<PageSlot>()) >> 10
+        );
+
+        Self { memmap }
+    }
+
+    #[inline(always)]
+    fn slot(&self, paddr: &PhysAddr) -> Option<&PageSlot> {
+        self.memmap.get(paddr.data() >> MMArch::PAGE_SHIFT)
     }
 
     pub fn contains(&self, paddr: &PhysAddr) -> bool {
-        self.phys2page.contains_key(paddr)
+        self.slot(paddr)
+            .map(|slot| !slot.is_empty())
+            .unwrap_or(false)
     }
 
-    pub fn get(&mut self, paddr: &PhysAddr) -> Option<Arc<Page>> {
-        page_reclaimer_lock_irqsave().get(paddr);
-        self.phys2page.get(paddr).cloned()
+    pub fn get(&self, paddr: &PhysAddr) -> Option<Arc<Page>> {
+        let page = self.slot(paddr)?.get()?;
+        page.mark_accessed();
+        Some(page)
     }
 
-    pub fn get_unwrap(&mut self, paddr: &PhysAddr) -> Arc<Page> {
-        page_reclaimer_lock_irqsave().get(paddr);
-        self.phys2page
-            .get(paddr)
+    pub fn get_unwrap(&self, paddr: &PhysAddr) -> Arc<Page> {
+        self.get(paddr)
             .unwrap_or_else(|| panic!("Phys Page not found, {:?}", paddr))
-            .clone()
     }
 
-    pub fn insert(&mut self, paddr: PhysAddr, page: &Arc<Page>) {
-        self.phys2page.insert(paddr, page.clone());
+    pub fn insert(&self, paddr: PhysAddr, page: &Arc<Page>) {
+        self.slot(&paddr)
+            .unwrap_or_else(|| panic!("PageManager: {:?} is out of memmap", paddr))
+            .replace(Some(page.clone()));
+    }
+
+    pub fn remove_page(&self, paddr: &PhysAddr) {
+        if let Some(slot) = self.slot(paddr) {
+            slot.replace(None);
+        }
+    }
+}
+
+/// memmap中的一个槽位
+///
+/// 保存由`Arc::into_raw`得到的`Page`指针。由于`Page`按8字节对齐，
+/// 指针的最低位被用作槽位锁：只在复制或替换指针的几条指令内持有，
+/// 保证读者增加引用计数的时候，`Page`不会被并发地释放。
+struct PageSlot(AtomicUsize);
+
+impl PageSlot {
+    const LOCKED: usize = 1;
+
+    fn new() -> Self {
+        Self(AtomicUsize::new(0))
+    }
+
+    #[inline(always)]
+    fn is_empty(&self) -> bool {
+        self.0.load(Ordering::Acquire) & !Self::LOCKED == 0
+    }
+
+    /// 锁住槽位，返回当前保存的指针
+    #[inline(always)]
+    fn lock(&self) -> usize {
+        loop {
+            let val = self.0.load(Ordering::Relaxed);
+            if val & Self::LOCKED == 0
+                && self
+                    .0
+                    .compare_exchange_weak(
+                        val,
+                        val | Self::LOCKED,
+                        Ordering::Acquire,
+                        Ordering::Relaxed,
+                    )
+                    .is_ok()
+            {
+                return val;
+            }
+            spin_loop();
+        }
+    }
+
+    /// 写入新的指针并解锁槽位
+    #[inline(always)]
+    fn unlock(&self, val: usize) {
+        self.0.store(val, Ordering::Release);
+    }
+
+    fn get(&self) -> Option<Arc<Page>> {
+        if self.is_empty() {
+            return None;
+        }
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let ptr = self.lock();
+        let page = if ptr == 0 {
+            None
+        } else {
+            unsafe {
+                Arc::increment_strong_count(ptr as *const Page);
+                Some(Arc::from_raw(ptr as *const Page))
+            }
+        };
+        self.unlock(ptr);
+        drop(irq_guard);
+        page
+    }
+
+    /// 替换槽位中的Page，返回旧的Page
+    fn replace(&self, page: Option<Arc<Page>>) -> Option<Arc<Page>> {
+        let new = page.map(|p| Arc::into_raw(p) as usize).unwrap_or(0);
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let old = self.lock();
+        self.unlock(new);
+        drop(irq_guard);
+        if old == 0 {
+            None
+        } else {
+            Some(unsafe { Arc::from_raw(old as *const Page) })
+        }
     }
+}
 
-    pub fn remove_page(&mut self, paddr: &PhysAddr) {
-        self.phys2page.remove(paddr);
+impl Drop for PageSlot {
+    fn drop(&mut self) {
+        self.replace(None);
     }
 }
 
@@ -147,7 +262,10 @@ fn page_reclaim_thread() -> i32 {
             page_reclaimer_lock_irqsave().shrink_list(PageFrameCount::new(page_to_free));
         } else {
             //TODO 暂时让页面回收线程负责脏页回写任务，后续需要分离
-            page_reclaimer_lock_irqsave().flush_dirty_pages();
+            PageReclaimer::writeback_dirty_pages();
+            // 文件系统缓存在内存中的元数据（例如FAT表）也在这里周期性地写回
+            crate::filesystem::vfs::core::sync_all_filesystems()
+                .unwrap_or_else(|e| error!("filesystem writeback failed: {:?}", e));
             // 休眠5秒
             // log::info!("sleep");
             let _ = nanosleep(PosixTimeSpec::new(5, 0));
@@ -172,40 +290,76 @@ impl PageReclaimer {
         }
     }
 
-    pub fn get(&mut self, paddr: &PhysAddr) -> Option<Arc<Page>> {
-        self.lru.get(paddr).cloned()
-    }
-
     pub fn insert_page(&mut self, paddr: PhysAddr, page: &Arc<Page>) {
         self.lru.put(paddr, page.clone());
     }
 
     /// lru链表缩减
+    ///
+    /// 查找页面时只会给页面设置PG_REFERENCED标志，而不会调整lru链表，
+    /// 因此这里对被访问过的页面给予第二次机会：清除标志并放回链表头部。
+    ///
     /// ## 参数
     ///
     /// - `count`: 需要缩减的页面数量
     pub fn shrink_list(&mut self, count: PageFrameCount) {
-        for _ in 0..count.data() {
+        let mut scanned = 0;
+        let mut freed = 0;
+        while freed < count.data() {
             let (paddr, page) = self.lru.pop_lru().expect("pagecache is empty");
+            scanned += 1;
+            // 最多扫描两轮，避免所有页面都被访问过时陷入死循环
+            if page.test_and_clear_flags(PageFlags::PG_REFERENCED)
+                && scanned <= 2 * (self.lru.len() + 1)
+            {
+                self.lru.put(paddr, page);
+                continue;
+            }
+            freed += 1;
             let page_cache = page.read_irqsave().page_cache().unwrap();
-            for vma in page.read_irqsave().anon_vma() {
+            // 解除页面在所有VMA中的映射，同时把VMA从页面的anon_vma中删去，之后映射计数归零
+            let vmas: Vec<Arc<LockedVMA>> =
+                page.read_irqsave().anon_vma().iter().cloned().collect();
+            for vma in vmas {
                 let address_space = vma.lock_irqsave().address_space().unwrap();
                 let address_space = address_space.upgrade().unwrap();
                 let mut guard = address_space.write();
                 let mapper = &mut guard.user_mapper.utable;
                 let virt = vma.lock_irqsave().page_address(&page).unwrap();
-                unsafe {
-                    mapper.unmap(virt, false).unwrap().flush();
+                // 只解除映射，页帧由下面设置的标志释放。其他加载了这个地址空间的cpu也要刷新TLB，
+                // 否则页帧被释放之后仍然可以通过旧的TLB项访问
+                let mut flusher = address_space.tlb().batch();
+                if let Some((_, _, flush)) = unsafe { mapper.unmap_phys(virt, false) } {
+                    flusher.consume(flush);
                 }
+                drop(flusher);
+                drop(guard);
+                page.write_irqsave().remove_vma(&vma);
             }
             page_cache.remove_page(page.read_irqsave().index().unwrap());
-            page_manager_lock_irqsave().remove_page(&paddr);
-            if page.read_irqsave().flags.contains(PageFlags::PG_DIRTY) {
-                Self::page_writeback(&page, true);
+            if page.flags().contains(PageFlags::PG_DIRTY) {
+                Self::page_writeback(&page, true)
+                    .unwrap_or_else(|e| error!("page writeback failed: {:?}", e));
+            }
+
+            // 与PageCache::evict_page相同：仍被映射的页面在最后一次解除映射时释放，
+            // 否则在最后一个引用（例如管道持有的引用）消失时释放
+            let mut guard = page.write_irqsave();
+            if guard.map_count() > 0 {
+                guard.set_dealloc_when_zero(true);
+            } else {
+                guard.set_free_on_drop();
+                drop(guard);
+                page_manager().remove_page(&paddr);
             }
         }
     }
 
+    /// 将页面从lru链表中移除
+    pub fn remove_page(&mut self, paddr: &PhysAddr) -> Option<Arc<Page>> {
+        self.lru.pop(paddr)
+    }
+
     /// 唤醒页面回收线程
     pub fn wakeup_claim_thread() {
         // log::info!("wakeup_claim_thread");
@@ -219,10 +373,10 @@ impl PageReclaimer {
     /// - `unmap`: 是否取消映射
     ///
     /// ## 返回值
-    /// - VmFaultReason: 页面错误处理信息标志
-    pub fn page_writeback(page: &Arc<Page>, unmap: bool) {
+    /// - Ok(()): 回写成功，或者页面已经超出文件范围而无需回写
+    pub fn page_writeback(page: &Arc<Page>, unmap: bool) -> Result<(), SystemError> {
         if !unmap {
-            page.write_irqsave().remove_flags(PageFlags::PG_DIRTY);
+            page.remove_flags(PageFlags::PG_DIRTY);
         }
 
         for vma in page.read_irqsave().anon_vma() {
@@ -231,10 +385,9 @@ impl PageReclaimer {
             let mut guard = address_space.write();
             let mapper = &mut guard.user_mapper.utable;
             let virt = vma.lock_irqsave().page_address(page).unwrap();
-            if unmap {
-                unsafe {
-                    mapper.unmap(virt, false).unwrap().flush();
-                }
+            let mut flusher = address_space.tlb().batch();
+            let flush = if unmap {
+                unsafe { mapper.unmap_phys(virt, false) }.map(|(_, _, flush)| flush)
             } else {
                 unsafe {
                     // 保护位设为只读
@@ -242,7 +395,10 @@ impl PageReclaimer {
                         virt,
                         mapper.get_entry(virt, 0).unwrap().flags().set_write(false),
                     )
-                };
+                }
+            };
+            if let Some(flush) = flush {
+                flusher.consume(flush);
             }
         }
         let inode = page
@@ -254,32 +410,47 @@ impl PageReclaimer {
             .clone()
             .unwrap()
             .upgrade()
-            .unwrap();
-        inode
-            .write_at(
-                page.read_irqsave().index().unwrap(),
-                MMArch::PAGE_SIZE,
-                unsafe {
-                    core::slice::from_raw_parts(
-                        MMArch::phys_2_virt(page.read_irqsave().phys_addr)
-                            .unwrap()
-                            .data() as *mut u8,
-                        MMArch::PAGE_SIZE,
-                    )
-                },
-                SpinLock::new(FilePrivateData::Unused).lock(),
+            .ok_or(SystemError::EIO)?;
+
+        // 回写不能改变文件长度：只写回文件范围内的部分
+        let offset = page.read_irqsave().index().unwrap() * MMArch::PAGE_SIZE;
+        let file_size = inode.metadata()?.size as usize;
+        let len = core::cmp::min(MMArch::PAGE_SIZE, file_size.saturating_sub(offset));
+        if len == 0 {
+            return Ok(());
+        }
+        let r = inode.write_sync(offset, unsafe {
+            core::slice::from_raw_parts(
+                MMArch::phys_2_virt(page.read_irqsave().phys_addr)
+                    .unwrap()
+                    .data() as *mut u8,
+                len,
             )
-            .unwrap();
+        });
+        if r.is_err() && !unmap {
+            page.add_flags(PageFlags::PG_DIRTY);
+        }
+        return r.map(|_| ());
     }
 
-    /// lru脏页刷新
-    pub fn flush_dirty_pages(&self) {
-        // log::info!("flush_dirty_pages");
-        let iter = self.lru.iter();
-        for (_, page) in iter {
-            if page.read_irqsave().flags().contains(PageFlags::PG_DIRTY) {
-                Self::page_writeback(page, false);
-            }
+    /// 收集lru链表中的脏页
+    ///
+    /// 回写涉及磁盘I/O，不能在持有页面回收器的锁时进行，
+    /// 因此先收集脏页，释放锁之后再逐个调用`page_writeback`。
+    pub fn dirty_pages(&self) -> Vec<Arc<Page>> {
+        self.lru
+            .iter()
+            .filter(|(_, page)| page.flags().contains(PageFlags::PG_DIRTY))
+            .map(|(_, page)| page.clone())
+            .collect()
+    }
+
+    /// 回写页面缓存中的所有脏页
+    pub fn writeback_dirty_pages() {
+        let dirty_pages = page_reclaimer_lock_irqsave().dirty_pages();
+        for page in dirty_pages {
+            PageReclaimer::page_writeback(&page, false)
+                .unwrap_or_else(|e| error!("page writeback failed: {:?}", e));
         }
     }
 }
@@ -302,12 +473,16 @@ bitflags! {
         const PG_PRIVATE = 1 << 15;
         const PG_RECLAIM = 1 << 18;
         const PG_SWAPBACKED = 1 << 19;
+        /// 预读窗口异步部分的第一页，读到该页时触发下一次预读
+        const PG_READAHEAD = 1 << 20;
     }
 }
 
 #[derive(Debug)]
 pub struct Page {
     inner: RwLock<InnerPage>,
+    /// 页面标志，可以不加锁地读取和修改
+    flags: AtomicU64,
 }
 
 impl Page {
@@ -315,6 +490,41 @@ impl Page {
         let inner = InnerPage::new(shared, phys_addr);
         Self {
             inner: RwLock::new(inner),
+            flags: AtomicU64::new(PageFlags::empty().bits()),
+        }
+    }
+
+    #[inline(always)]
+    pub fn flags(&self) -> PageFlags {
+        PageFlags::from_bits_truncate(self.flags.load(Ordering::Acquire))
+    }
+
+    #[inline(always)]
+    pub fn set_flags(&self, flags: PageFlags) {
+        self.flags.store(flags.bits(), Ordering::Release);
+    }
+
+    #[inline(always)]
+    pub fn add_flags(&self, flags: PageFlags) {
+        self.flags.fetch_or(flags.bits(), Ordering::AcqRel);
+    }
+
+    #[inline(always)]
+    pub fn remove_flags(&self, flags: PageFlags) {
+        self.flags.fetch_and(!flags.bits(), Ordering::AcqRel);
+    }
+
+    /// 清除指定的标志，返回清除之前这些标志是否有被设置
+    #[inline(always)]
+    pub fn test_and_clear_flags(&self, flags: PageFlags) -> bool {
+        self.flags.fetch_and(!flags.bits(), Ordering::AcqRel) & flags.bits() != 0
+    }
+
+    /// 标记页面最近被访问过，供页面回收器判断冷热
+    #[inline(always)]
+    pub fn mark_accessed(&self) {
+        if !self.flags().contains(PageFlags::PG_REFERENCED) {
+            self.add_flags(PageFlags::PG_REFERENCED);
         }
     }
 
@@ -327,6 +537,15 @@ impl Page {
     }
 }
 
+impl Drop for Page {
+    fn drop(&mut self) {
+        let inner = self.inner.read_irqsave();
+        if inner.free_on_drop && !inner.free_claimed {
+            unsafe { LockedFrameAllocator.free_one(inner.phys_addr) };
+        }
+    }
+}
+
 #[derive(Debug)]
 /// 物理页面信息
 pub struct InnerPage {
@@ -336,12 +555,14 @@ pub struct InnerPage {
     shared: bool,
     /// 映射计数为0时，是否可回收
     free_when_zero: bool,
+    /// 物理页帧已经被某个调用者认领释放
+    free_claimed: bool,
+    /// 最后一个`Arc<Page>`被释放时，同时释放物理页帧
+    free_on_drop: bool,
     /// 共享页id（如果是共享页）
     shm_id: Option<ShmId>,
     /// 映射到当前page的VMA
     anon_vma: HashSet<Arc<LockedVMA>>,
-    /// 标志
-    flags: PageFlags,
     /// 页所在的物理页帧号
     phys_addr: PhysAddr,
     /// 在pagecache中的偏移
@@ -356,9 +577,10 @@ impl InnerPage {
             map_count: 0,
             shared,
             free_when_zero: dealloc_when_zero,
+            free_claimed: false,
+            free_on_drop: false,
             shm_id: None,
             anon_vma: HashSet::new(),
-            flags: PageFlags::empty(),
             phys_addr,
             index: None,
             page_cache: None,
@@ -382,6 +604,19 @@ impl InnerPage {
         self.map_count == 0 && self.free_when_zero
     }
 
+    /// 将vma从anon_vma中删去，并判断调用者是否应该释放物理页
+    ///
+    /// 删除和判断在同一个写锁内完成，并且只有第一个看到物理页可以回收的调用者会得到`true`，
+    /// 保证多个地址空间同时解除同一个共享页或写时复制页的映射时，页帧只会被释放一次
+    pub fn remove_vma_and_claim_free(&mut self, vma: &LockedVMA) -> bool {
+        self.remove_vma(vma);
+        if self.can_deallocate() && !self.free_claimed {
+            self.free_claimed = true;
+            return true;
+        }
+        return false;
+    }
+
     pub fn shared(&self) -> bool {
         self.shared
     }
@@ -423,6 +658,13 @@ impl InnerPage {
         self.free_when_zero = dealloc_when_zero;
     }
 
+    /// 设置在最后一个`Arc<Page>`被释放时释放物理页帧
+    ///
+    /// 用于已经从所有全局结构中移除、但可能仍被其他人临时引用的页面
+    pub fn set_free_on_drop(&mut self) {
+        self.free_on_drop = true;
+    }
+
     #[inline(always)]
     pub fn anon_vma(&self) -> &HashSet<Arc<LockedVMA>> {
         &self.anon_vma
@@ -433,26 +675,6 @@ impl InnerPage {
         self.map_count
     }
 
-    #[inline(always)]
-    pub fn flags(&self) -> &PageFlags {
-        &self.flags
-    }
-
-    #[inline(always)]
-    pub fn set_flags(&mut self, flags: PageFlags) {
-        self.flags = flags
-    }
-
-    #[inline(always)]
-    pub fn add_flags(&mut self, flags: PageFlags) {
-        self.flags = self.flags.union(flags);
-    }
-
-    #[inline(always)]
-    pub fn remove_flags(&mut self, flags: PageFlags) {
-        self.flags = self.flags.difference(flags);
-    }
-
     #[inline(always)]
     pub fn phys_address(&self) -> PhysAddr {
         self.phys_addr
@@ -615,9 +837,7 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
         copy_on_write: bool,
     ) -> Option<PageTable<Arch>> {
         // 分配新页面作为新的页表
-        let phys = allocator.allocate_one()?;
-        let frame = MMArch::phys_2_virt(phys).unwrap();
-        MMArch::write_bytes(frame, 0, MMArch::PAGE_SIZE);
+        let phys = allocator.allocate_one_zeroed()?;
         let new_table = PageTable::new(self.base, phys, self.level);
         if self.level == 0 {
             for i in 0..Arch::PAGE_ENTRY_NUM {
@@ -632,9 +852,9 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
                             new_table.set_entry(i, entry);
                         } else {
                             let phys = allocator.allocate_one()?;
-                            let mut page_manager_guard = page_manager_lock_irqsave();
+                            let page_manager = page_manager();
                             let old_phys = entry.address().unwrap();
-                            let old_page = page_manager_guard.get_unwrap(&old_phys);
+                            let old_page = page_manager.get_unwrap(&old_phys);
                             let new_page =
                                 Arc::new(Page::new(old_page.read_irqsave().shared(), phys));
                             if let Some(ref page_cache) = old_page.read_irqsave().page_cache() {
@@ -644,7 +864,7 @@ impl<Arch: MemoryManagementArch> PageTable<Arch> {
                                 );
                             }
 
-                            page_manager_guard.insert(phys, &new_page);
+                            page_manager.insert(phys, &new_page);
                             let old_phys = entry.address().unwrap();
                             let frame = MMArch::phys_2_virt(phys).unwrap().data() as *mut u8;
                             frame.copy_from_nonoverlapping(
@@ -1181,20 +1401,13 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
         flags: EntryFlags<Arch>,
     ) -> Option<PageFlush<Arch>> {
         compiler_fence(Ordering::SeqCst);
-        let phys: PhysAddr = self.frame_allocator.allocate_one()?;
+        let phys: PhysAddr = self.frame_allocator.allocate_one_zeroed()?;
         compiler_fence(Ordering::SeqCst);
 
-        unsafe {
-            let vaddr = MMArch::phys_2_virt(phys).unwrap();
-            MMArch::write_bytes(vaddr, 0, MMArch::PAGE_SIZE);
-        }
-
-        let mut page_manager_guard: SpinLockGuard<'static, PageManager> =
-            page_manager_lock_irqsave();
-        if !page_manager_guard.contains(&phys) {
-            page_manager_guard.insert(phys, &Arc::new(Page::new(false, phys)))
+        let page_manager = page_manager();
+        if !page_manager.contains(&phys) {
+            page_manager.insert(phys, &Arc::new(Page::new(false, phys)))
         }
-        drop(page_manager_guard);
         return self.map_phys(virt, phys, flags);
     }
 
@@ -1237,11 +1450,8 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
                     table = next_table;
                     // debug!("Mapping {:?} to next level table...", virt);
                 } else {
-                    // 分配下一级页表
-                    let frame = self.frame_allocator.allocate_one()?;
-
-                    // 清空这个页帧
-                    MMArch::write_bytes(MMArch::phys_2_virt(frame).unwrap(), 0, MMArch::PAGE_SIZE);
+                    // 分配下一级页表，页帧的内容已经被清空
+                    let frame = self.frame_allocator.allocate_one_zeroed()?;
                     // 设置页表项的flags
                     let flags: EntryFlags<Arch> =
                         EntryFlags::new_page_table(virt.kind() == PageTableKind::User);
@@ -1320,10 +1530,8 @@ impl<Arch: MemoryManagementArch, F: FrameAllocator> PageMapper<Arch, F> {
     ) -> Option<PageTable<Arch>> {
         let table = self.get_table(virt, level + 1)?;
         let i = table.index_of(virt)?;
-        let frame = self.frame_allocator.allocate_one()?;
-
-        // 清空这个页帧
-        MMArch::write_bytes(MMArch::phys_2_virt(frame).unwrap(), 0, MMArch::PAGE_SIZE);
+        // 页帧的内容已经被清空
+        let frame = self.frame_allocator.allocate_one_zeroed()?;
 
         // 设置页表项的flags
         let flags: EntryFlags<Arch> =
@@ -1628,6 +1836,12 @@ impl<Arch: MemoryManagementArch> PageFlush<Arch> {
         unsafe { Arch::invalidate_page(self.virt) };
     }
 
+    /// 需要刷新的虚拟地址
+    #[inline]
+    pub fn virt_address(&self) -> VirtAddr {
+        return self.virt;
+    }
+
     /// 忽略掉这个刷新器
     pub unsafe fn ignore(self) {
         mem::forget(self);
@@ -1693,35 +1907,6 @@ impl<Arch: MemoryManagementArch> Drop for PageFlushAll<Arch> {
     }
 }
 
-/// 未在当前CPU上激活的页表的刷新器
-///
-/// 如果页表没有在当前cpu上激活，那么需要发送ipi到其他核心，尝试在其他核心上刷新页表
-///
-/// TODO: 这个方式很暴力，也许把它改成在指定的核心上刷新页表会更好。（可以测试一下开销）
-#[derive(Debug)]
-pub struct InactiveFlusher;
-
-impl InactiveFlusher {
-    pub fn new() -> Self {
-        return Self {};
-    }
-}
-
-impl Flusher<MMArch> for InactiveFlusher {
-    fn consume(&mut self, flush: PageFlush<MMArch>) {
-        unsafe {
-            flush.ignore();
-        }
-    }
-}
-
-impl Drop for InactiveFlusher {
-    fn drop(&mut self) {
-        // 发送刷新页表的IPI
-        send_ipi(IpiKind::FlushTLB, IpiTarget::Other);
-    }
-}
-
 /// # 把一个地址向下对齐到页大小
 pub fn round_down_to_page_size(addr: usize) -> usize {
     addr & !(MMArch::PAGE_SIZE - 1)
@@ -0,0 +1,265 @@
+//! 跨cpu的TLB刷新
+//!
+//! 每个用户地址空间记录自己当前被加载在哪些cpu上。修改页表之后，只需要通知这些cpu刷新TLB，
+//! 而且通知中带有被修改的虚拟地址范围：接收方只刷新这个范围内的页，范围太大时才刷新整个TLB。
+//!
+//! 刷新请求放在接收方的每cpu队列中，然后向接收方发送`IpiKind::FlushTLB`。
+//! 接收方只处理页表与自己当前加载的页表相同的请求：没有加载这个页表的cpu在切换页表时已经刷新了TLB。
+
+use core::{
+    mem,
+    sync::atomic::{compiler_fence, fence, AtomicU64, Ordering},
+};
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    arch::{interrupt::ipi::send_ipi, CurrentIrqArch, MMArch},
+    exception::{
+        ipi::{IpiKind, IpiTarget},
+        InterruptArch,
+    },
+    libs::spinlock::SpinLock,
+    smp::{core::smp_get_processor_id, cpu::ProcessorId},
+};
+
+use super::{
+    page::{Flusher, PageFlush},
+    percpu::PerCpu,
+    ucontext::AddressSpace,
+    MemoryManagementArch, PageTableKind, PhysAddr, VirtAddr,
+};
+
+/// 需要刷新的页数超过这个值时，直接刷新整个TLB
+const TLB_FLUSH_ALL_THRESHOLD: usize = 33;
+/// 每个cpu最多缓存的刷新请求数，超过之后合并为一次完整的刷新
+const TLB_FLUSH_QUEUE_SIZE: usize = 8;
+const CPU_MASK_WORDS: usize = (PerCpu::MAX_CPU_NUM as usize).div_ceil(64);
+
+lazy_static! {
+    static ref TLB_FLUSH_QUEUES: Vec<SpinLock<TlbFlushQueue>> = (0..PerCpu::MAX_CPU_NUM)
+        .map(|_| SpinLock::new(TlbFlushQueue::new()))
+        .collect();
+}
+
+/// 一次刷新请求：刷新页表`table`中[start, end)范围内的页
+#[derive(Debug, Clone, Copy)]
+struct TlbFlushRequest {
+    table: PhysAddr,
+    start: usize,
+    end: usize,
+}
+
+impl TlbFlushRequest {
+    const EMPTY: Self = Self {
+        table: PhysAddr::new(0),
+        start: 0,
+        end: 0,
+    };
+}
+
+/// 等待某个cpu处理的刷新请求
+struct TlbFlushQueue {
+    requests: [TlbFlushRequest; TLB_FLUSH_QUEUE_SIZE],
+    len: usize,
+    /// 请求太多，需要刷新整个TLB
+    flush_all: bool,
+}
+
+impl TlbFlushQueue {
+    fn new() -> Self {
+        Self {
+            requests: [TlbFlushRequest::EMPTY; TLB_FLUSH_QUEUE_SIZE],
+            len: 0,
+            flush_all: false,
+        }
+    }
+
+    fn push(&mut self, req: TlbFlushRequest) {
+        if self.flush_all {
+            return;
+        }
+        if self.len == TLB_FLUSH_QUEUE_SIZE {
+            self.flush_all = true;
+            self.len = 0;
+            return;
+        }
+        self.requests[self.len] = req;
+        self.len += 1;
+    }
+}
+
+/// # 用户地址空间的TLB状态
+///
+/// 记录地址空间的顶级页表，以及加载了这个页表的cpu。可以不持有地址空间的锁访问。
+#[derive(Debug)]
+pub struct AddressSpaceTlb {
+    table: PhysAddr,
+    cpus: [AtomicU64; CPU_MASK_WORDS],
+}
+
+impl AddressSpaceTlb {
+    pub fn new(table: PhysAddr) -> Self {
+        Self {
+            table,
+            cpus: [const { AtomicU64::new(0) }; CPU_MASK_WORDS],
+        }
+    }
+
+    /// 地址空间的顶级页表的物理地址
+    #[inline]
+    pub fn table(&self) -> PhysAddr {
+        self.table
+    }
+
+    #[inline]
+    fn set_cpu(&self, cpu: ProcessorId, active: bool) {
+        let cpu = cpu.data() as usize;
+        let bit = 1u64 << (cpu % 64);
+        if active {
+            self.cpus[cpu / 64].fetch_or(bit, Ordering::SeqCst);
+        } else {
+            self.cpus[cpu / 64].fetch_and(!bit, Ordering::SeqCst);
+        }
+    }
+
+    /// 遍历加载了这个地址空间的cpu
+    fn iter_cpus(&self) -> impl Iterator<Item = ProcessorId> + '_ {
+        self.cpus.iter().enumerate().flat_map(|(word, bits)| {
+            let bits = bits.load(Ordering::SeqCst);
+            (0..64)
+                .filter(move |bit| bits & (1 << bit) != 0)
+                .map(move |bit| ProcessorId::new((word * 64 + bit) as u32))
+        })
+    }
+
+    /// 创建一个批量刷新器
+    pub fn batch(self: &Arc<Self>) -> TlbBatch {
+        TlbBatch {
+            tlb: self.clone(),
+            start: usize::MAX,
+            end: 0,
+        }
+    }
+
+    /// 刷新[start, end)范围内的页在所有加载了这个地址空间的cpu上的TLB
+    pub fn flush_range(&self, start: VirtAddr, end: VirtAddr) {
+        if start >= end {
+            return;
+        }
+        // 关中断，保证检查和刷新期间不会切换页表，也不会迁移到其他cpu
+        let irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+        let this_cpu = smp_get_processor_id();
+        if unsafe { MMArch::table(PageTableKind::User) } == self.table {
+            local_flush_range(start.data(), end.data());
+        }
+
+        let req = TlbFlushRequest {
+            table: self.table,
+            start: start.data(),
+            end: end.data(),
+        };
+        // 调用者对页表项的修改是普通的写操作，可能还在store buffer中。先让它对其他cpu可见，
+        // 再读取cpu掩码，与switch_mm中“先登记再加载页表”配对：
+        // 否则正在切换到这个地址空间的cpu可能缓存旧的页表项，而这里又读不到它的登记位
+        fence(Ordering::SeqCst);
+        for cpu in self.iter_cpus().filter(|cpu| *cpu != this_cpu) {
+            TLB_FLUSH_QUEUES[cpu.data() as usize]
+                .lock_irqsave()
+                .push(req);
+            send_ipi(IpiKind::FlushTLB, IpiTarget::Specified(cpu));
+        }
+        drop(irq_guard);
+    }
+
+    /// 刷新整个地址空间在所有加载了它的cpu上的TLB
+    pub fn flush_all(&self) {
+        self.flush_range(VirtAddr::new(0), VirtAddr::new(usize::MAX));
+    }
+}
+
+/// # 批量刷新一个用户地址空间的TLB
+///
+/// 收集页表修改涉及的页（合并为一个地址范围），drop的时候统一刷新
+#[must_use = "The flusher must be kept alive until the page table changes are done."]
+pub struct TlbBatch {
+    tlb: Arc<AddressSpaceTlb>,
+    start: usize,
+    end: usize,
+}
+
+impl TlbBatch {
+    /// 把一个页加入需要刷新的范围
+    pub fn add(&mut self, virt: VirtAddr) {
+        let page = virt.data() & !(MMArch::PAGE_SIZE - 1);
+        self.start = self.start.min(page);
+        self.end = self.end.max(page + MMArch::PAGE_SIZE);
+    }
+}
+
+impl Flusher<MMArch> for TlbBatch {
+    fn consume(&mut self, flush: PageFlush<MMArch>) {
+        self.add(flush.virt_address());
+        unsafe { flush.ignore() };
+    }
+}
+
+impl Drop for TlbBatch {
+    fn drop(&mut self) {
+        self.tlb
+            .flush_range(VirtAddr::new(self.start), VirtAddr::new(self.end));
+    }
+}
+
+/// 刷新本cpu上[start, end)范围内的TLB
+fn local_flush_range(start: usize, end: usize) {
+    let pages = (end - start).div_ceil(MMArch::PAGE_SIZE);
+    if pages > TLB_FLUSH_ALL_THRESHOLD {
+        unsafe { MMArch::invalidate_all() };
+        return;
+    }
+    for i in 0..pages {
+        unsafe { MMArch::invalidate_page(VirtAddr::new(start + i * MMArch::PAGE_SIZE)) };
+    }
+}
+
+/// ## 处理其他cpu发来的刷新TLB的请求，在`IpiKind::FlushTLB`的中断处理函数中调用
+pub fn handle_flush_tlb_ipi() {
+    let mut queue = TLB_FLUSH_QUEUES[smp_get_processor_id().data() as usize].lock_irqsave();
+    let flush_all = mem::replace(&mut queue.flush_all, false);
+    let len = mem::replace(&mut queue.len, 0);
+    let requests = queue.requests;
+    drop(queue);
+
+    if flush_all {
+        unsafe { MMArch::invalidate_all() };
+        return;
+    }
+    let current = unsafe { MMArch::table(PageTableKind::User) };
+    for req in requests[..len].iter().filter(|req| req.table == current) {
+        local_flush_range(req.start, req.end);
+    }
+}
+
+/// ## 在本cpu上切换到`next`地址空间
+///
+/// 同时更新两个地址空间被加载在哪些cpu上的记录。调用者需要关闭中断
+///
+/// ## 参数
+///
+/// - `prev`: 切换之前的地址空间
+/// - `next`: 要切换到的地址空间
+pub unsafe fn switch_mm(prev: Option<&Arc<AddressSpace>>, next: &Arc<AddressSpace>) {
+    let cpu = smp_get_processor_id();
+    // 先登记再加载页表：其他cpu修改页表时，要么能看到这一位并通知本cpu，要么在本cpu加载页表之前就已经改完
+    next.tlb().set_cpu(cpu, true);
+    compiler_fence(Ordering::SeqCst);
+    MMArch::set_table(PageTableKind::User, next.tlb().table());
+    compiler_fence(Ordering::SeqCst);
+
+    if let Some(prev) = prev {
+        if !Arc::ptr_eq(prev, next) {
+            prev.tlb().set_cpu(cpu, false);
+        }
+    }
+}
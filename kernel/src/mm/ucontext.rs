@@ -26,7 +26,7 @@ use crate::{
         rwlock::RwLock,
         spinlock::{SpinLock, SpinLockGuard},
     },
-    mm::page::page_manager_lock_irqsave,
+    mm::page::page_manager,
     process::ProcessManager,
     syscall::user_access::{UserBufferReader, UserBufferWriter},
 };
@@ -35,8 +35,9 @@ use super::{
     allocator::page_frame::{
         deallocate_page_frames, PageFrameCount, PhysPageFrame, VirtPageFrame, VirtPageFrameIter,
     },
-    page::{EntryFlags, Flusher, InactiveFlusher, Page, PageFlushAll},
+    page::{EntryFlags, Flusher, Page, PageFlushAll},
     syscall::{MadvFlags, MapFlags, MremapFlags, ProtFlags},
+    tlb::AddressSpaceTlb,
     MemoryManagementArch, PageTableKind, VirtAddr, VirtRegion, VmFlags,
 };
 
@@ -60,17 +61,27 @@ static LOCKEDVMA_ID_ALLOCATOR: SpinLock<IdAllocator> =
 #[derive(Debug)]
 pub struct AddressSpace {
     inner: RwLock<InnerAddressSpace>,
+    /// 与`InnerAddressSpace::tlb`相同，切换进程和处理缺页时不需要获取地址空间的锁就能访问
+    tlb: Arc<AddressSpaceTlb>,
 }
 
 impl AddressSpace {
     pub fn new(create_stack: bool) -> Result<Arc<Self>, SystemError> {
         let inner = InnerAddressSpace::new(create_stack)?;
+        let tlb = inner.tlb.clone();
         let result = Self {
             inner: RwLock::new(inner),
+            tlb,
         };
         return Ok(Arc::new(result));
     }
 
+    /// 地址空间的TLB状态
+    #[inline]
+    pub fn tlb(&self) -> &Arc<AddressSpaceTlb> {
+        return &self.tlb;
+    }
+
     /// 从pcb中获取当前进程的地址空间结构体的Arc指针
     pub fn current() -> Result<Arc<AddressSpace>, SystemError> {
         let vm = ProcessManager::current_pcb()
@@ -109,6 +120,8 @@ impl core::ops::DerefMut for AddressSpace {
 #[derive(Debug)]
 pub struct InnerAddressSpace {
     pub user_mapper: UserMapper,
+    /// 加载了这个地址空间的cpu，修改页表之后需要通知它们刷新TLB
+    pub tlb: Arc<AddressSpaceTlb>,
     pub mappings: UserMappings,
     pub mmap_min: VirtAddr,
     /// 用户栈信息结构体
@@ -130,8 +143,11 @@ pub struct InnerAddressSpace {
 
 impl InnerAddressSpace {
     pub fn new(create_stack: bool) -> Result<Self, SystemError> {
+        let user_mapper = MMArch::setup_new_usermapper()?;
+        let tlb = Arc::new(AddressSpaceTlb::new(user_mapper.utable.table().phys()));
         let mut result = Self {
-            user_mapper: MMArch::setup_new_usermapper()?,
+            user_mapper,
+            tlb,
             mappings: UserMappings::new(),
             mmap_min: VirtAddr(DEFAULT_MMAP_MIN_ADDR),
             elf_brk_start: VirtAddr::new(0),
@@ -167,6 +183,8 @@ impl InnerAddressSpace {
                 .user_mapper
                 .clone_from(&mut self.user_mapper, MMArch::PAGE_FAULT_ENABLED)
         };
+        // 写时复制把原来的页表项设置为了只读，其他cpu上可能还缓存着可写的表项
+        self.tlb.flush_all();
 
         // 拷贝用户栈的结构体信息，但是不拷贝用户栈的内容（因为后面VMA的拷贝会拷贝用户栈的内容）
         unsafe {
@@ -188,15 +206,14 @@ impl InnerAddressSpace {
             // debug!("new vma: {:x?}", new_vma);
             let new_vma_guard = new_vma.lock_irqsave();
             let new_mapper = &new_guard.user_mapper.utable;
-            let mut page_manager_guard = page_manager_lock_irqsave();
+            let page_manager = page_manager();
             for page in new_vma_guard.pages().map(|p| p.virt_address()) {
                 if let Some((paddr, _)) = new_mapper.translate(page) {
-                    let page = page_manager_guard.get_unwrap(&paddr);
+                    let page = page_manager.get_unwrap(&paddr);
                     page.write_irqsave().insert_vma(new_vma.clone());
                 }
             }
 
-            drop(page_manager_guard);
             drop(vma_guard);
             drop(new_vma_guard);
         }
@@ -471,7 +488,7 @@ impl InnerAddressSpace {
             active = PageFlushAll::new();
             &mut active as &mut dyn Flusher<MMArch>
         } else {
-            inactive = InactiveFlusher::new();
+            inactive = self.tlb.batch();
             &mut inactive as &mut dyn Flusher<MMArch>
         };
         compiler_fence(Ordering::SeqCst);
@@ -574,7 +591,7 @@ impl InnerAddressSpace {
         page_count: PageFrameCount,
     ) -> Result<(), SystemError> {
         let to_unmap = VirtRegion::new(start_page.virt_address(), page_count.bytes());
-        let mut flusher: PageFlushAll<MMArch> = PageFlushAll::new();
+        let mut flusher = self.tlb.batch();
 
         let regions: Vec<Arc<LockedVMA>> = self.mappings.conflicts(to_unmap).collect::<Vec<_>>();
 
@@ -615,14 +632,8 @@ impl InnerAddressSpace {
         //     start_page,
         //     page_count
         // );
-        let (mut active, mut inactive);
-        let flusher = if self.is_current() {
-            active = PageFlushAll::new();
-            &mut active as &mut dyn Flusher<MMArch>
-        } else {
-            inactive = InactiveFlusher::new();
-            &mut inactive as &mut dyn Flusher<MMArch>
-        };
+        let mut batch = self.tlb.batch();
+        let flusher = &mut batch as &mut dyn Flusher<MMArch>;
 
         let mapper = &mut self.user_mapper.utable;
         let region = VirtRegion::new(start_page.virt_address(), page_count.bytes());
@@ -676,14 +687,8 @@ impl InnerAddressSpace {
         page_count: PageFrameCount,
         behavior: MadvFlags,
     ) -> Result<(), SystemError> {
-        let (mut active, mut inactive);
-        let flusher = if self.is_current() {
-            active = PageFlushAll::new();
-            &mut active as &mut dyn Flusher<MMArch>
-        } else {
-            inactive = InactiveFlusher::new();
-            &mut inactive as &mut dyn Flusher<MMArch>
-        };
+        let mut batch = self.tlb.batch();
+        let flusher = &mut batch as &mut dyn Flusher<MMArch>;
 
         let mapper = &mut self.user_mapper.utable;
 
@@ -730,7 +735,7 @@ impl InnerAddressSpace {
 
     /// 取消用户空间内的所有映射
     pub unsafe fn unmap_all(&mut self) {
-        let mut flusher: PageFlushAll<MMArch> = PageFlushAll::new();
+        let mut flusher = self.tlb.batch();
         for vma in self.mappings.iter_vmas() {
             if vma.mapped() {
                 vma.unmap(&mut self.user_mapper.utable, &mut flusher);
@@ -837,7 +842,6 @@ impl Drop for UserMapper {
             deallocate_page_frames(
                 PhysPageFrame::new(self.utable.table().phys()),
                 PageFrameCount::new(1),
-                &mut page_manager_lock_irqsave(),
             )
         };
     }
@@ -1151,9 +1155,7 @@ impl LockedVMA {
 
         let mut guard = self.lock_irqsave();
 
-        // 获取物理页的anon_vma的守卫
-        let mut page_manager_guard: SpinLockGuard<'_, crate::mm::page::PageManager> =
-            page_manager_lock_irqsave();
+        let page_manager = page_manager();
         for page in guard.region.pages() {
             if mapper.translate(page.virt_address()).is_none() {
                 continue;
@@ -1161,19 +1163,13 @@ impl LockedVMA {
             let (paddr, _, flush) = unsafe { mapper.unmap_phys(page.virt_address(), true) }
                 .expect("Failed to unmap, beacuse of some page is not mapped");
 
-            // 从anon_vma中删除当前VMA
-            let page = page_manager_guard.get_unwrap(&paddr);
-            page.write_irqsave().remove_vma(self);
-
-            // 如果物理页的anon_vma链表长度为0并且不是共享页，则释放物理页.
-            if page.read_irqsave().can_deallocate() {
+            // 从anon_vma中删除当前VMA。如果物理页的anon_vma链表长度为0并且不是共享页，则释放物理页
+            let page = page_manager.get_unwrap(&paddr);
+            let claimed = page.write_irqsave().remove_vma_and_claim_free(self);
+            if claimed {
                 unsafe {
                     drop(page);
-                    deallocate_page_frames(
-                        PhysPageFrame::new(paddr),
-                        PageFrameCount::new(1),
-                        &mut page_manager_guard,
-                    )
+                    deallocate_page_frames(PhysPageFrame::new(paddr), PageFrameCount::new(1))
                 };
             }
 
@@ -1245,12 +1241,12 @@ impl LockedVMA {
         });
 
         // 重新设置before、after这两个VMA里面的物理页的anon_vma
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         if let Some(before) = before.clone() {
             let virt_iter = before.lock_irqsave().region.iter_pages();
             for frame in virt_iter {
                 if let Some((paddr, _)) = utable.translate(frame.virt_address()) {
-                    let page = page_manager_guard.get_unwrap(&paddr);
+                    let page = page_manager.get_unwrap(&paddr);
                     let mut page_guard = page.write_irqsave();
                     page_guard.insert_vma(before.clone());
                     page_guard.remove_vma(self);
@@ -1263,7 +1259,7 @@ impl LockedVMA {
             let virt_iter = after.lock_irqsave().region.iter_pages();
             for frame in virt_iter {
                 if let Some((paddr, _)) = utable.translate(frame.virt_address()) {
-                    let page = page_manager_guard.get_unwrap(&paddr);
+                    let page = page_manager.get_unwrap(&paddr);
                     let mut page_guard = page.write_irqsave();
                     page_guard.insert_vma(after.clone());
                     page_guard.remove_vma(self);
@@ -1571,11 +1567,11 @@ impl VMA {
         ));
 
         // 将VMA加入到anon_vma中
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         cur_phy = phys;
         for _ in 0..count.data() {
             let paddr = cur_phy.phys_address();
-            let page = page_manager_guard.get_unwrap(&paddr);
+            let page = page_manager.get_unwrap(&paddr);
             page.write_irqsave().insert_vma(r.clone());
             cur_phy = cur_phy.next();
         }
@@ -1641,14 +1637,14 @@ impl VMA {
         // debug!("VMA::zeroed: flusher dropped");
 
         // 清空这些内存并将VMA加入到anon_vma中
-        let mut page_manager_guard = page_manager_lock_irqsave();
+        let page_manager = page_manager();
         let virt_iter: VirtPageFrameIter =
             VirtPageFrameIter::new(destination, destination.add(page_count));
         for frame in virt_iter {
             let paddr = mapper.translate(frame.virt_address()).unwrap().0;
 
             // 将VMA加入到anon_vma
-            let page = page_manager_guard.get_unwrap(&paddr);
+            let page = page_manager.get_unwrap(&paddr);
             page.write_irqsave().insert_vma(r.clone());
         }
         // debug!("VMA::zeroed: done");
@@ -2,10 +2,11 @@ use core::{
     any::Any,
     fmt::Debug,
     sync::atomic::{AtomicBool, Ordering},
+    task::Waker,
 };
 
 use alloc::{
-    collections::LinkedList,
+    collections::{LinkedList, VecDeque},
     sync::{Arc, Weak},
     vec::Vec,
 };
@@ -26,7 +27,7 @@ use crate::{
     process::ProcessManager,
     sched::{schedule, SchedMode},
     time::{
-        timer::{next_n_us_timer_jiffies, Timer, WakeUpHelper},
+        timer::{next_n_us_timer_jiffies, Timer},
         PosixTimeSpec,
     },
 };
@@ -40,14 +41,12 @@ pub struct LockedEventPoll(Arc<SpinLock<EventPoll>>);
 /// 它对应一个epfd
 #[derive(Debug)]
 pub struct EventPoll {
-    /// epoll_wait用到的等待队列
-    epoll_wq: WaitQueue,
     /// 维护所有添加进来的socket的红黑树
     ep_items: RBTree<i32, Arc<EPollItem>>,
-    /// 接收就绪的描述符列表
-    ready_list: LinkedList<Arc<EPollItem>>,
-    /// 是否已经关闭
-    shutdown: AtomicBool,
+    /// 就绪队列和epoll_wait用到的等待队列
+    ready: Arc<EPollReady>,
+    /// 向用户空间发送事件时，就绪队列整个换到这里处理。两个队列交替使用，容量得以保留，不需要每次分配内存
+    txlist: VecDeque<Arc<EPollItem>>,
     self_ref: Option<Weak<SpinLock<EventPoll>>>,
 }
 
@@ -57,15 +56,127 @@ impl EventPoll {
     pub const ADD_EPOLLITEM: u32 = 0x7965;
     pub fn new() -> Self {
         Self {
-            epoll_wq: WaitQueue::default(),
             ep_items: RBTree::new(),
-            ready_list: LinkedList::new(),
-            shutdown: AtomicBool::new(false),
+            ready: Arc::new(EPollReady::new()),
+            txlist: VecDeque::new(),
             self_ref: None,
         }
     }
 }
 
+/// ## epoll的就绪队列
+///
+/// 与epoll的其余部分分开加锁：文件状态变化时只需要获取这把锁就能把epitem加入就绪队列并唤醒等待者，
+/// 不会因为epoll的锁被占用而丢失事件。持有这把锁时不会再获取除等待队列以外的其他锁
+#[derive(Debug)]
+pub struct EPollReady {
+    /// 就绪的epitem，每个epitem至多出现一次（由`EPollItem::on_ready`保证）
+    list: SpinLock<VecDeque<Arc<EPollItem>>>,
+    /// epoll_wait用到的等待队列，每个事件只唤醒一个等待者
+    wq: WaitQueue,
+    /// 是否已经关闭
+    shutdown: AtomicBool,
+    /// 有事件或者关闭时调用一次的唤醒器，供不在等待队列上睡眠的内核等待者使用，见`FilePollWaiter::arm`
+    waker: SpinLock<Option<Waker>>,
+}
+
+impl EPollReady {
+    fn new() -> Self {
+        Self {
+            list: SpinLock::new(VecDeque::new()),
+            wq: WaitQueue::default(),
+            shutdown: AtomicBool::new(false),
+            waker: SpinLock::new(None),
+        }
+    }
+
+    /// 调用并清除注册的唤醒器
+    ///
+    /// ### 返回值
+    /// - true: 调用了唤醒器
+    fn wake_waker(&self) -> bool {
+        let waker = self.waker.lock_irqsave().take();
+        match waker {
+            Some(waker) => {
+                waker.wake();
+                return true;
+            }
+            None => return false,
+        }
+    }
+
+    /// 将epitem加入就绪队列，已经在队列中时忽略
+    fn add(&self, epitem: &Arc<EPollItem>) {
+        let mut list = self.list.lock_irqsave();
+        if !epitem.on_ready.swap(true, Ordering::SeqCst) {
+            list.push_back(epitem.clone());
+        }
+    }
+
+    /// 将epitem从就绪队列中删除
+    fn remove(&self, epitem: &Arc<EPollItem>) {
+        let mut list = self.list.lock_irqsave();
+        if epitem.on_ready.swap(false, Ordering::SeqCst) {
+            list.retain(|item| !Arc::ptr_eq(item, epitem));
+        }
+    }
+
+    /// 清空就绪队列
+    fn clear(&self) {
+        let mut list = self.list.lock_irqsave();
+        for epitem in list.iter() {
+            epitem.on_ready.store(false, Ordering::SeqCst);
+        }
+        list.clear();
+    }
+
+    #[inline]
+    fn has_events(&self) -> bool {
+        !self.list.lock_irqsave().is_empty()
+    }
+
+    #[inline]
+    fn is_shutdown(&self) -> bool {
+        self.shutdown.load(Ordering::SeqCst)
+    }
+
+    /// ## 唤醒一个等待者
+    ///
+    /// ### 返回值
+    /// - true: 唤醒了一个进程
+    fn wake_one(&self) -> bool {
+        if self.wake_waker() {
+            return true;
+        }
+        // 等待队列中可能还有已经被定时器或者信号唤醒、尚未离开队列的进程，跳过它们
+        while self.wq.len() != 0 {
+            if self.wq.wakeup(None) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    fn wake_all(&self) {
+        self.wake_waker();
+        self.wq.wakeup_all(None);
+    }
+
+    /// ## 让当前进程在就绪队列上睡眠，直到有epitem就绪、epoll被关闭或者被唤醒
+    ///
+    /// 检查就绪队列和进入睡眠在同一把锁下完成，不会错过唤醒
+    fn sleep(&self) {
+        let list = self.list.lock_irqsave();
+        if !list.is_empty() || self.is_shutdown() {
+            return;
+        }
+        unsafe { self.wq.sleep_without_schedule() };
+        drop(list);
+        schedule(SchedMode::SM_NONE);
+        self.wq.finish_wait();
+    }
+}
+
 impl Default for EventPoll {
     fn default() -> Self {
         Self::new()
@@ -84,11 +195,16 @@ pub struct EPollItem {
     fd: i32,
     /// 对应的文件
     file: Weak<File>,
+    /// 对应的epoll的就绪队列
+    ready: Weak<EPollReady>,
+    /// 是否在就绪队列中，由就绪队列的锁保护
+    on_ready: AtomicBool,
 }
 
 impl EPollItem {
     pub fn new(
         epoll: Weak<SpinLock<EventPoll>>,
+        ready: Weak<EPollReady>,
         events: EPollEvent,
         fd: i32,
         file: Weak<File>,
@@ -98,6 +214,8 @@ impl EPollItem {
             event: RwLock::new(events),
             fd,
             file,
+            ready,
+            on_ready: AtomicBool::new(false),
         }
     }
 
@@ -183,6 +301,10 @@ impl IndexNode for EPollInode {
         todo!()
     }
 
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
     fn as_any_ref(&self) -> &dyn core::any::Any {
         self
     }
@@ -200,7 +322,7 @@ impl IndexNode for EPollInode {
         let mut epoll = self.epoll.0.lock_irqsave();
 
         // 唤醒epoll上面等待的所有进程
-        epoll.shutdown.store(true, Ordering::SeqCst);
+        epoll.ready.shutdown.store(true, Ordering::SeqCst);
         epoll.ep_wake_all();
 
         let fds = epoll.ep_items.keys().cloned().collect::<Vec<_>>();
@@ -361,6 +483,7 @@ impl EventPoll {
                     // 设置epoll
                     let epitem = Arc::new(EPollItem::new(
                         Arc::downgrade(&epoll_data.epoll.0),
+                        Arc::downgrade(&epoll_guard.ready),
                         *epds,
                         fd,
                         Arc::downgrade(&dst_file),
@@ -395,6 +518,8 @@ impl EventPoll {
     }
 
     /// ## epoll_wait的具体实现
+    ///
+    /// 限时等待使用进程自己的睡眠定时器，不需要每次分配定时器
     pub fn do_epoll_wait(
         epfd: i32,
         epoll_event: &mut [EPollEvent],
@@ -402,15 +527,9 @@ impl EventPoll {
         timespec: Option<PosixTimeSpec>,
     ) -> Result<usize, SystemError> {
         let current_pcb = ProcessManager::current_pcb();
-        let fd_table = current_pcb.fd_table();
-        let fd_table_guard = fd_table.read();
 
         // 获取epoll文件
-        let ep_file = fd_table_guard
-            .get_file_by_fd(epfd)
-            .ok_or(SystemError::EBADF)?;
-
-        drop(fd_table_guard);
+        let ep_file = current_pcb.get_file(epfd).ok_or(SystemError::EBADF)?;
 
         // 确保是epoll file
         if !Self::is_epoll_file(&ep_file) {
@@ -424,7 +543,7 @@ impl EventPoll {
         }
         if let Some(epoll_data) = epolldata {
             let epoll = epoll_data.epoll.clone();
-            let epoll_guard = epoll.0.lock_irqsave();
+            let ready = epoll.0.lock_irqsave().ready.clone();
 
             let mut timeout = false;
             if let Some(timespec) = timespec {
@@ -433,81 +552,61 @@ impl EventPoll {
                     timeout = true;
                 }
             }
-            // 判断epoll上有没有就绪事件
-            let mut available = epoll_guard.ep_events_available();
 
-            drop(epoll_guard);
-            loop {
-                if available {
+            let mut timer: Option<Arc<Timer>> = None;
+            let r = loop {
+                if ready.has_events() {
                     // 如果有就绪的事件，则直接返回就绪事件
-                    return Self::ep_send_events(epoll.clone(), epoll_event, max_events);
+                    let res = Self::ep_send_events(epoll.clone(), epoll_event, max_events)?;
+                    if res != 0 || timeout {
+                        break Ok(res);
+                    }
+                    // 就绪队列中的文件都已经没有事件了，继续等待
+                    continue;
                 }
 
-                if epoll.0.lock_irqsave().shutdown.load(Ordering::SeqCst) {
+                if ready.is_shutdown() {
                     // 如果已经关闭
-                    return Err(SystemError::EBADF);
+                    break Err(SystemError::EBADF);
                 }
 
                 // 如果超时
                 if timeout {
-                    return Ok(0);
-                }
-
-                // 自旋等待一段时间
-                available = {
-                    let mut ret = false;
-                    for _ in 0..50 {
-                        if let Ok(guard) = epoll.0.try_lock_irqsave() {
-                            if guard.ep_events_available() {
-                                ret = true;
-                                break;
-                            }
-                        }
-                    }
-                    // 最后再次不使用try_lock尝试
-                    if !ret {
-                        ret = epoll.0.lock_irqsave().ep_events_available();
-                    }
-                    ret
-                };
-
-                if available {
-                    continue;
+                    break Ok(0);
                 }
 
                 // 如果有未处理的信号则返回错误
                 if current_pcb.sig_info_irqsave().sig_pending().signal().bits() != 0 {
-                    return Err(SystemError::EINTR);
+                    break Err(SystemError::EINTR);
                 }
 
-                // 还未等待到事件发生，则睡眠
-                // 注册定时器
-                let mut timer = None;
-                if let Some(timespec) = timespec {
-                    let handle = WakeUpHelper::new(current_pcb.clone());
-                    let jiffies = next_n_us_timer_jiffies(
-                        (timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000) as u64,
-                    );
-                    let inner = Timer::new(handle, jiffies);
-                    inner.activate();
-                    timer = Some(inner);
-                }
-                let guard = epoll.0.lock_irqsave();
-                unsafe { guard.epoll_wq.sleep_without_schedule() };
-                drop(guard);
-                schedule(SchedMode::SM_NONE);
-                // 被唤醒后,检查是否有事件可读
-                available = epoll.0.lock_irqsave().ep_events_available();
-                if let Some(timer) = timer {
-                    if timer.as_ref().timeout() {
-                        // 超时
-                        timeout = true;
-                    } else {
-                        // 未超时，则取消计时器
-                        timer.cancel();
+                // 第一次睡眠之前设置定时器
+                if timer.is_none() {
+                    if let Some(timespec) = timespec {
+                        let sleep_timer = current_pcb.sleep_timer();
+                        sleep_timer.rearm(next_n_us_timer_jiffies(
+                            (timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000) as u64,
+                        ));
+                        timer = Some(sleep_timer);
                     }
                 }
+
+                // 还未等待到事件发生，则睡眠
+                ready.sleep();
+
+                if timer.as_ref().is_some_and(|timer| timer.timeout()) {
+                    timeout = true;
+                }
+            };
+
+            if let Some(timer) = timer {
+                timer.cancel();
             }
+            // 被唤醒之后没有取走事件就离开了（超时、信号），把唤醒转交给下一个等待者
+            if !matches!(r, Ok(res) if res != 0) && ready.has_events() {
+                ready.wake_one();
+            }
+            return r;
         } else {
             panic!("An epoll file does not have the corresponding private information");
         }
@@ -515,6 +614,9 @@ impl EventPoll {
 
     /// ## 将已经准备好的事件拷贝到用户空间
     ///
+    /// 整个就绪队列先换到txlist中，逐个重新poll之后写入用户空间，处理过程中不持有就绪队列的锁，
+    /// 文件可以继续把epitem加入就绪队列。水平触发的epitem重新加入就绪队列，下一次epoll_wait时再次检查
+    ///
     /// ### 参数
     /// - epoll: 对应的epoll
     /// - user_event: 用户空间传入的epoll_event地址，因为内存对其问题，所以这里需要直接操作地址
@@ -525,16 +627,20 @@ impl EventPoll {
         max_events: i32,
     ) -> Result<usize, SystemError> {
         let mut ep_guard = epoll.0.lock_irqsave();
+        let ep = &mut *ep_guard;
+        let ready = &ep.ready;
+        let txlist = &mut ep.txlist;
         let mut res: usize = 0;
 
-        // 在水平触发模式下，需要将epitem再次加入队列，在下次循环再次判断是否还有事件
-        // （所以边缘触发的效率会高于水平触发，但是水平触发某些情况下能够使得更迅速地向用户反馈）
-        let mut push_back = Vec::new();
-        while let Some(epitem) = ep_guard.ready_list.pop_front() {
-            if res >= max_events as usize {
-                push_back.push(epitem);
+        core::mem::swap(&mut *ready.list.lock_irqsave(), txlist);
+
+        while res < max_events as usize {
+            let Some(epitem) = txlist.pop_front() else {
                 break;
-            }
+            };
+            // 先离开就绪队列再poll，之后到来的事件会把epitem重新加入就绪队列，不会丢失
+            epitem.on_ready.store(false, Ordering::SeqCst);
+
             let ep_events = EPollEventType::from_bits_truncate(epitem.event.read().events);
 
             // 再次poll获取事件(为了防止水平触发一直加入队列)
@@ -549,42 +655,32 @@ impl EventPoll {
                 data: epitem.event.read().data,
             };
 
-            // 这里是需要判断下一个写入的位置是否为空指针
-
-            // TODO:这里有可能会出现事件丢失的情况
-            // 如果用户传入的数组长度小于传入的max_event，到这里时如果已经到数组最大长度，但是未到max_event
-            // 会出现的问题是我们会把这个数据写入到后面的内存中，用户无法在传入的数组中拿到事件，而且写脏数据到了后面一片内存，导致事件丢失
-            // 出现这个问题的几率比较小，首先是因为用户的使用不规范,后因为前面地址校验是按照max_event来校验的，只会在两块内存连着分配时出现，但是也是需要考虑的
-
-            // 以下的写法判断并无意义，只是记一下错误处理
-            // offset += core::mem::size_of::<EPollEvent>();
-            // if offset >= max_offset {
-            //     // 当前指向的地址已为空，则把epitem放回队列
-            //     ep_guard.ready_list.push_back(epitem.clone());
-            //     if res == 0 {
-            //         // 一个都未写入成功，表明用户传进的地址就是有问题的
-            //         return Err(SystemError::EFAULT);
-            //     }
-            // }
-
             // 拷贝到用户空间
             user_event[res] = event;
             // 记数加一
             res += 1;
 
-            // crate::debug!("ep send {event:?}");
-
             if ep_events.contains(EPollEventType::EPOLLONESHOT) {
                 let mut event_writer = epitem.event.write();
                 let new_event = event_writer.events & EPollEventType::EP_PRIVATE_BITS.bits;
                 event_writer.set_events(new_event);
             } else if !ep_events.contains(EPollEventType::EPOLLET) {
-                push_back.push(epitem);
+                // 在水平触发模式下，需要将epitem再次加入队列，在下次循环再次判断是否还有事件
+                ready.add(&epitem);
+            }
+        }
+
+        // 超过max_events没有处理的epitem放回就绪队列的开头，它们仍然标记为在就绪队列中
+        if !txlist.is_empty() {
+            let mut list = ready.list.lock_irqsave();
+            while let Some(epitem) = txlist.pop_back() {
+                list.push_front(epitem);
             }
         }
 
-        for item in push_back {
-            ep_guard.ep_add_ready(item);
+        // 还有就绪的epitem，唤醒下一个等待者
+        if ready.has_events() {
+            ready.wake_one();
         }
 
         Ok(res)
@@ -647,9 +743,7 @@ impl EventPoll {
 
         let epitem = epoll.ep_items.remove(&fd).unwrap();
 
-        let _ = epoll
-            .ready_list
-            .extract_if(|item| Arc::ptr_eq(item, &epitem));
+        epoll.ready.remove(&epitem);
 
         Ok(())
     }
@@ -686,85 +780,166 @@ impl EventPoll {
 
     /// ### 判断epoll是否有就绪item
     pub fn ep_events_available(&self) -> bool {
-        !self.ready_list.is_empty()
+        self.ready.has_events()
     }
 
     /// ### 将epitem加入到就绪队列，如果为重复添加则忽略
     pub fn ep_add_ready(&mut self, epitem: Arc<EPollItem>) {
-        let ret = self.ready_list.iter().find(|epi| Arc::ptr_eq(epi, &epitem));
-
-        if ret.is_none() {
-            self.ready_list.push_back(epitem);
-        }
+        self.ready.add(&epitem);
     }
 
     /// ### 判断该epoll上是否有进程在等待
     pub fn ep_has_waiter(&self) -> bool {
-        self.epoll_wq.len() != 0
+        self.ready.wq.len() != 0
     }
 
     /// ### 唤醒所有在epoll上等待的进程
     pub fn ep_wake_all(&self) {
-        self.epoll_wq.wakeup_all(None);
+        self.ready.wake_all();
     }
 
     /// ### 唤醒所有在epoll上等待的首个进程
     pub fn ep_wake_one(&self) {
-        self.epoll_wq.wakeup(None);
+        self.ready.wake_one();
     }
 
     /// ### epoll的回调，支持epoll的文件有事件到来时直接调用该方法即可
+    ///
+    /// 把所有关心该事件的epitem加入各自epoll的就绪队列，每个epoll只唤醒一个等待者。
+    /// 只获取就绪队列的锁，不需要获取epoll本身的锁，因此不会因为锁竞争丢失事件。
+    /// 设置了EPOLLEXCLUSIVE的epitem中只要有一个唤醒了进程，其余的就不再唤醒
     pub fn wakeup_epoll(
         epitems: &SpinLock<LinkedList<Arc<EPollItem>>>,
         pollflags: Option<EPollEventType>,
     ) -> Result<(), SystemError> {
-        let mut epitems_guard = epitems.try_lock_irqsave()?;
-        // 一次只取一个，因为一次也只有一个进程能拿到对应文件的🔓
-        if let Some(epitem) = epitems_guard.pop_front() {
-            let pollflags = pollflags.unwrap_or({
-                if let Some(file) = epitem.file.upgrade() {
-                    EPollEventType::from_bits_truncate(file.poll()? as u32)
-                } else {
-                    EPollEventType::empty()
-                }
-            });
+        let epitems_guard = epitems.lock_irqsave();
+        let pollflags = match pollflags {
+            Some(pollflags) => pollflags,
+            None => match epitems_guard
+                .front()
+                .and_then(|epitem| epitem.file.upgrade())
+            {
+                Some(file) => EPollEventType::from_bits_truncate(file.poll()? as u32),
+                None => EPollEventType::empty(),
+            },
+        };
+
+        let mut exclusive_woken = false;
+        for epitem in epitems_guard.iter() {
+            let ep_events = EPollEventType::from_bits_truncate(epitem.event.read().events());
+
+            // 检查事件合理性以及是否有感兴趣的事件
+            if ep_events
+                .difference(EPollEventType::EP_PRIVATE_BITS)
+                .is_empty()
+                || (!pollflags.is_empty() && !pollflags.intersects(ep_events))
+            {
+                continue;
+            }
 
-            if let Some(epoll) = epitem.epoll().upgrade() {
-                let mut epoll_guard = epoll.try_lock()?;
-                let binding = epitem.clone();
-                let event_guard = binding.event().read();
-                let ep_events = EPollEventType::from_bits_truncate(event_guard.events());
+            // 避免惊群
+            let exclusive = ep_events.contains(EPollEventType::EPOLLEXCLUSIVE)
+                && !pollflags.contains(EPollEventType::POLLFREE);
+            if exclusive && exclusive_woken {
+                continue;
+            }
 
-                // 检查事件合理性以及是否有感兴趣的事件
-                if !(ep_events
-                    .difference(EPollEventType::EP_PRIVATE_BITS)
-                    .is_empty()
-                    || pollflags.difference(ep_events).is_empty())
-                {
-                    // TODO: 未处理pm相关
-
-                    // 首先将就绪的epitem加入等待队列
-                    epoll_guard.ep_add_ready(epitem.clone());
-
-                    if epoll_guard.ep_has_waiter() {
-                        if ep_events.contains(EPollEventType::EPOLLEXCLUSIVE)
-                            && !pollflags.contains(EPollEventType::POLLFREE)
-                        {
-                            // 避免惊群
-                            epoll_guard.ep_wake_one();
-                        } else {
-                            epoll_guard.ep_wake_all();
-                        }
-                    }
+            // TODO: 未处理pm相关
+            if let Some(ready) = epitem.ready.upgrade() {
+                ready.add(epitem);
+                if ready.wake_one() && exclusive {
+                    exclusive_woken = true;
                 }
-
-                epitems_guard.push_back(epitem);
             }
         }
         Ok(())
     }
 }
 
+/// ## 在内核中等待单个文件就绪
+///
+/// 用一个不对应epoll文件描述符的内部epoll对象监听文件，供io_uring工作线程等内核中的异步机制使用。
+/// 等待者不在文件上睡眠，而是通过`arm`注册唤醒器，在文件就绪时得到通知
+#[derive(Debug)]
+pub struct FilePollWaiter {
+    epoll: LockedEventPoll,
+    /// 内部epoll的就绪队列
+    ready: Arc<EPollReady>,
+    file: Arc<File>,
+}
+
+impl FilePollWaiter {
+    /// 内部epoll中监听项使用的描述符编号
+    const FD: i32 = -1;
+
+    /// ## 开始监听文件
+    ///
+    /// ## 参数
+    /// - `events`：感兴趣的事件，需要EPOLLERR、EPOLLHUP时要显式指定
+    ///
+    /// ## 返回值
+    /// - `Err(SystemError::ENOSYS)`：文件不支持poll
+    pub fn new(file: Arc<File>, events: EPollEventType) -> Result<Self, SystemError> {
+        let epoll = LockedEventPoll(Arc::new(SpinLock::new(EventPoll::new())));
+        let ready = {
+            let mut epoll_guard = epoll.0.lock_irqsave();
+            epoll_guard.self_ref = Some(Arc::downgrade(&epoll.0));
+            epoll_guard.ready.clone()
+        };
+        let epitem = Arc::new(EPollItem::new(
+            Arc::downgrade(&epoll.0),
+            Arc::downgrade(&ready),
+            EPollEvent {
+                events: events.bits(),
+                data: 0,
+            },
+            Self::FD,
+            Arc::downgrade(&file),
+        ));
+        EventPoll::ep_insert(&mut epoll.0.lock_irqsave(), file.clone(), epitem)?;
+        return Ok(Self { epoll, ready, file });
+    }
+
+    /// 文件当前已经就绪的感兴趣的事件
+    pub fn poll(&self) -> EPollEventType {
+        let epitem = self.epoll.0.lock_irqsave().ep_items.get(&Self::FD).cloned();
+        return epitem
+            .map(|epitem| epitem.ep_item_poll())
+            .unwrap_or(EPollEventType::empty());
+    }
+
+    /// ## 注册文件就绪时的唤醒器
+    ///
+    /// 文件上发生感兴趣的事件或者等待被`cancel`取消时，`waker`被调用一次。
+    /// 注册之前文件可能已经就绪，调用者注册之后需要再用`poll`检查一次
+    pub fn arm(&self, waker: Waker) {
+        *self.ready.waker.lock_irqsave() = Some(waker);
+        self.ready.clear();
+        if self.ready.is_shutdown() {
+            self.ready.wake_waker();
+        }
+    }
+
+    /// 等待是否已经被`cancel`取消
+    #[inline]
+    pub fn is_cancelled(&self) -> bool {
+        self.ready.is_shutdown()
+    }
+
+    /// 取消等待：调用注册的唤醒器，之后`is_cancelled`返回`true`
+    pub fn cancel(&self) {
+        self.ready.shutdown.store(true, Ordering::SeqCst);
+        self.ready.wake_all();
+    }
+}
+
+impl Drop for FilePollWaiter {
+    fn drop(&mut self) {
+        let mut epoll_guard = self.epoll.0.lock_irqsave();
+        let _ = EventPoll::ep_remove(&mut epoll_guard, Self::FD, Some(self.file.clone()));
+    }
+}
+
 /// 与C兼容的Epoll事件结构体
 #[derive(Copy, Clone, Default)]
 #[repr(packed)]
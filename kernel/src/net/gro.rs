@@ -0,0 +1,158 @@
+//! # 收包方向的分段合并(GRO)
+//!
+//! 同一个TCP流中连续到达、序号相接的数据段在交给smoltcp之前合并成一个大的数据帧，
+//! 减少协议栈逐个数据段查找socket、更新接收窗口和回复ACK的开销。
+//!
+//! 合并后TCP首部中的校验和不再正确，因此只有收包时不需要smoltcp校验IP/TCP校验和的网卡才能使用GRO，见`gro_supported`。
+
+use alloc::vec::Vec;
+use smoltcp::{
+    phy::{DeviceCapabilities, Medium},
+    wire,
+};
+
+/// 以太网首部的长度
+const ETHERNET_HEADER_LEN: usize = 14;
+/// 合并后的IP数据包的最大长度
+const GRO_MAX_SIZE: usize = u16::MAX as usize;
+
+/// 网卡收到的数据帧是否可以合并
+///
+/// 需要软件校验校验和的网卡不合并：逐段校验再重新计算合并后的校验和，比smoltcp直接校验多出两遍数据访问
+pub fn gro_supported(caps: &DeviceCapabilities) -> bool {
+    return caps.medium == Medium::Ethernet && !caps.checksum.ipv4.rx() && !caps.checksum.tcp.rx();
+}
+
+/// 可以参与合并的TCP数据段
+struct GroSegment {
+    ethertype: wire::EthernetProtocol,
+    /// TCP首部在以太网帧中的偏移
+    tcp_offset: usize,
+    tcp_header_len: usize,
+    payload_len: usize,
+    seq: wire::TcpSeqNumber,
+    psh: bool,
+}
+
+impl GroSegment {
+    /// 解析以太网帧。只有不带IP选项、没有分片、只带有ACK/PSH标志并且携带数据的TCP数据段可以合并
+    fn parse(frame: &[u8]) -> Option<Self> {
+        let eth = wire::EthernetFrame::new_checked(frame).ok()?;
+        let ethertype = eth.ethertype();
+        let (ip_header_len, ip_payload) = match ethertype {
+            wire::EthernetProtocol::Ipv4 => {
+                let packet = wire::Ipv4Packet::new_checked(eth.payload()).ok()?;
+                if packet.header_len() as usize != wire::IPV4_HEADER_LEN
+                    || packet.more_frags()
+                    || packet.frag_offset() != 0
+                    || packet.next_header() != wire::IpProtocol::Tcp
+                {
+                    return None;
+                }
+                (wire::IPV4_HEADER_LEN, packet.payload())
+            }
+            wire::EthernetProtocol::Ipv6 => {
+                let packet = wire::Ipv6Packet::new_checked(eth.payload()).ok()?;
+                if packet.next_header() != wire::IpProtocol::Tcp {
+                    return None;
+                }
+                (wire::IPV6_HEADER_LEN, packet.payload())
+            }
+            _ => return None,
+        };
+
+        let tcp = wire::TcpPacket::new_checked(ip_payload).ok()?;
+        if !tcp.ack() || tcp.syn() || tcp.fin() || tcp.rst() || tcp.urg() || tcp.ece() || tcp.cwr()
+        {
+            return None;
+        }
+        let tcp_header_len = tcp.header_len() as usize;
+        let payload_len = ip_payload.len() - tcp_header_len;
+        if payload_len == 0 {
+            return None;
+        }
+
+        return Some(Self {
+            ethertype,
+            tcp_offset: ETHERNET_HEADER_LEN + ip_header_len,
+            tcp_header_len,
+            payload_len,
+            seq: tcp.seq_number(),
+            psh: tcp.psh(),
+        });
+    }
+
+    /// 数据段在以太网帧中结束的位置（不包括以太网帧的填充）
+    fn end(&self) -> usize {
+        self.tcp_offset + self.tcp_header_len + self.payload_len
+    }
+}
+
+/// 两个数据段是否属于同一个流，并且首部中除了长度、IP标识、校验和、序号、窗口和PSH以外的字段都相同
+fn same_headers(last: &[u8], frame: &[u8], seg: &GroSegment) -> bool {
+    let ip = ETHERNET_HEADER_LEN;
+    let tcp = seg.tcp_offset;
+    let same = |range: core::ops::Range<usize>| last[range.clone()] == frame[range];
+
+    if !same(0..ETHERNET_HEADER_LEN) {
+        return false;
+    }
+    let ip_same = match seg.ethertype {
+        // 版本、首部长度、服务类型；分片标志、TTL、协议；源地址和目的地址
+        wire::EthernetProtocol::Ipv4 => {
+            same(ip..ip + 2) && same(ip + 6..ip + 10) && same(ip + 12..tcp)
+        }
+        // 版本、流量类别、流标签；下一个首部、跳数限制、源地址和目的地址
+        _ => same(ip..ip + 4) && same(ip + 6..tcp),
+    };
+    // 端口号；确认号；首部长度；紧急指针和选项
+    return ip_same
+        && same(tcp..tcp + 4)
+        && same(tcp + 8..tcp + 13)
+        && same(tcp + 18..tcp + seg.tcp_header_len);
+}
+
+/// ## 尝试把以太网帧`frame`中的TCP数据合并到上一个数据帧`last`的末尾
+///
+/// ## 返回值
+/// 是否合并成功。合并失败时`last`不会被修改
+pub fn gro_merge(last: &mut Vec<u8>, frame: &[u8]) -> bool {
+    let (Some(prev), Some(next)) = (GroSegment::parse(last), GroSegment::parse(frame)) else {
+        return false;
+    };
+    if prev.psh
+        || prev.ethertype != next.ethertype
+        || prev.tcp_offset != next.tcp_offset
+        || prev.tcp_header_len != next.tcp_header_len
+        || prev.seq + prev.payload_len != next.seq
+    {
+        return false;
+    }
+    let ip_len = prev.end() - ETHERNET_HEADER_LEN + next.payload_len;
+    if ip_len > GRO_MAX_SIZE || !same_headers(last, frame, &prev) {
+        return false;
+    }
+
+    last.truncate(prev.end());
+    last.extend_from_slice(&frame[next.tcp_offset + next.tcp_header_len..next.end()]);
+
+    let (ip_header, tcp_segment) =
+        last[ETHERNET_HEADER_LEN..].split_at_mut(prev.tcp_offset - ETHERNET_HEADER_LEN);
+    match prev.ethertype {
+        wire::EthernetProtocol::Ipv4 => {
+            let mut packet = wire::Ipv4Packet::new_unchecked(ip_header);
+            packet.set_total_len(ip_len as u16);
+            packet.fill_checksum();
+        }
+        _ => {
+            let mut packet = wire::Ipv6Packet::new_unchecked(ip_header);
+            packet.set_payload_len((ip_len - wire::IPV6_HEADER_LEN) as u16);
+        }
+    }
+    let next_tcp = wire::TcpPacket::new_unchecked(&frame[next.tcp_offset..]);
+    let mut tcp = wire::TcpPacket::new_unchecked(tcp_segment);
+    tcp.set_window_len(next_tcp.window_len());
+    tcp.set_psh(next.psh);
+
+    return true;
+}
@@ -11,6 +11,7 @@ use smoltcp::wire::IpEndpoint;
 use self::socket::SocketInode;
 
 pub mod event_poll;
+pub mod gro;
 pub mod net_core;
 pub mod socket;
 pub mod syscall;
@@ -1,43 +1,391 @@
-use alloc::{boxed::Box, collections::BTreeMap, sync::Arc};
-use log::{debug, info, warn};
-use smoltcp::{socket::dhcpv4, wire};
+//! 网络协议栈的处理上下文
+//!
+//! smoltcp的轮询循环只在这里运行：网卡中断只触发`SoftirqNumber::NetRx`软中断，
+//! 系统调用在修改了socket（发送数据、连接、关闭）之后调用`net_kick`标记socket所在的分片，二者都不会在系统调用中反复轮询网卡。
+//!
+//! 每个socket都向smoltcp注册了唤醒器，smoltcp在socket的状态发生变化时调用它，把socket加入所在分片的待通知列表。
+//! 轮询结束后只向这些socket的等待队列和epoll发布事件，不需要遍历所有的socket。
+//! smoltcp的唤醒器只会被调用一次，发布事件时重新注册。
+//!
+//! TCP的重传等定时任务由定时器驱动：每次轮询后按照`poll_delay`重新设置定时器。
+//!
+//! NET_RX软中断只处理当前cpu上的socket分片和被`net_kick`标记的分片，属于其他分片的数据帧交给分片所在的cpu处理，
+//! 见`socket::shard`。定时器处理所有的分片。
+
+use alloc::{boxed::Box, sync::Arc, task::Wake, vec::Vec};
+use core::{
+    sync::atomic::{AtomicBool, AtomicU32, Ordering},
+    task::Waker,
+};
+use log::{debug, info};
+use smoltcp::{
+    iface::{SocketHandle, SocketSet},
+    socket::{dhcpv4, raw, tcp, udp, AnySocket},
+    wire,
+};
 use system_error::SystemError;
 
 use crate::{
-    driver::net::{NetDevice, Operstate},
-    libs::rwlock::RwLockReadGuard,
+    driver::net::Operstate,
+    exception::softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
+    libs::spinlock::SpinLock,
     net::{socket::SocketPollMethod, NET_DEVICES},
-    time::timer::{next_n_ms_timer_jiffies, Timer, TimerFunction},
+    time::{
+        timer::{next_n_us_timer_jiffies, Timer, TimerFunction},
+        Instant,
+    },
 };
 
 use super::{
     event_poll::{EPollEventType, EventPoll},
-    socket::{handle::GlobalSocketHandle, inet::TcpSocket, HANDLE_MAP, SOCKET_SET},
+    socket::{
+        handle::GlobalSocketHandle,
+        inet::TcpSocket,
+        shard::{FourTuple, PollScope, SocketShard, SOCKET_DEMUX, SOCKET_SHARDS, SOCKET_SHARD_NUM},
+    },
 };
 
-/// The network poll function, which will be called by timer.
+lazy_static! {
+    /// 驱动TCP定时任务的定时器
+    static ref NET_POLL_TIMER: SpinLock<Option<Arc<Timer>>> = SpinLock::new(None);
+}
+
+/// 需要发布事件的socket的类型
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SocketKind {
+    Raw,
+    Udp,
+    Tcp,
+}
+
+/// 可以注册唤醒器的smoltcp socket
+pub trait WatchedSocket: AnySocket<'static> {
+    const KIND: SocketKind;
+
+    fn register_waker(&mut self, waker: &Waker);
+}
+
+impl WatchedSocket for raw::Socket<'static> {
+    const KIND: SocketKind = SocketKind::Raw;
+
+    fn register_waker(&mut self, waker: &Waker) {
+        self.register_recv_waker(waker);
+        self.register_send_waker(waker);
+    }
+}
+
+impl WatchedSocket for udp::Socket<'static> {
+    const KIND: SocketKind = SocketKind::Udp;
+
+    fn register_waker(&mut self, waker: &Waker) {
+        self.register_recv_waker(waker);
+        self.register_send_waker(waker);
+    }
+}
+
+impl WatchedSocket for tcp::Socket<'static> {
+    const KIND: SocketKind = SocketKind::Tcp;
+
+    fn register_waker(&mut self, waker: &Waker) {
+        self.register_recv_waker(waker);
+        self.register_send_waker(waker);
+    }
+}
+
+/// socket的唤醒器，被调用时把socket加入待通知的列表
+#[derive(Debug)]
+struct SocketWaker {
+    shard: usize,
+    handle: SocketHandle,
+    kind: SocketKind,
+    /// 收、发两个方向共用一个唤醒器，只入队一次
+    queued: AtomicBool,
+}
+
+impl SocketWaker {
+    fn new_waker(shard: usize, handle: SocketHandle, kind: SocketKind) -> Waker {
+        return Waker::from(Arc::new(Self {
+            shard,
+            handle,
+            kind,
+            queued: AtomicBool::new(false),
+        }));
+    }
+}
+
+impl Wake for SocketWaker {
+    fn wake(self: Arc<Self>) {
+        self.wake_by_ref();
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        if !self.queued.swap(true, Ordering::SeqCst) {
+            SocketShard::get(self.shard)
+                .pending
+                .lock_irqsave()
+                .push((self.handle, self.kind));
+        }
+    }
+}
+
+fn register_waker<T: WatchedSocket>(
+    shard: &SocketShard,
+    sockets: &mut SocketSet<'static>,
+    handle: SocketHandle,
+) {
+    sockets
+        .get_mut::<T>(handle)
+        .register_waker(&SocketWaker::new_waker(shard.id(), handle, T::KIND));
+}
+
+/// ## 把socket加入分片的SocketSet，并注册唤醒器
 ///
-/// The main purpose of this function is to poll all network interfaces.
+/// `sockets`必须是`shard.sockets`的锁守卫
+pub fn add_socket<T: WatchedSocket>(
+    shard: &SocketShard,
+    sockets: &mut SocketSet<'static>,
+    socket: T,
+) -> GlobalSocketHandle {
+    let handle = sockets.add(socket);
+    register_waker::<T>(shard, sockets, handle);
+    return GlobalSocketHandle::new_smoltcp_handle(shard.id(), handle);
+}
+
+/// ## 把socket从所在分片的SocketSet中移除
+///
+/// 同时丢弃这个socket还没有发布的事件，避免之后用被复用的句柄访问其他socket
+pub fn remove_socket(
+    sockets: &mut SocketSet<'static>,
+    handle: GlobalSocketHandle,
+) -> smoltcp::socket::Socket<'static> {
+    let smoltcp_handle = handle.smoltcp_handle().unwrap();
+    let socket = sockets.remove(smoltcp_handle);
+    SocketShard::of(handle)
+        .pending
+        .lock_irqsave()
+        .retain(|(h, _)| *h != smoltcp_handle);
+    return socket;
+}
+
+/// 网络收包软中断
+#[derive(Debug)]
+struct NetRxSoftirq;
+
+/// 系统调用通过`net_kick`请求处理的分片的掩码，由下一次NET_RX软中断清除
+static NET_KICKED_SHARDS: AtomicU32 = AtomicU32::new(0);
+const _: () = assert!(SOCKET_SHARD_NUM <= u32::BITS as usize);
+
+impl SoftirqVec for NetRxSoftirq {
+    fn run(&self) {
+        let kicked = NET_KICKED_SHARDS.swap(0, Ordering::AcqRel);
+        let scope = if kicked != 0 {
+            PollScope::Kicked(kicked)
+        } else {
+            PollScope::Local
+        };
+        net_rx_action(scope);
+    }
+}
+
+/// 定时器到期时处理TCP的重传、延迟确认等定时任务
 #[derive(Debug)]
-#[allow(dead_code)]
-struct NetWorkPollFunc;
+struct NetPollTimerFunc;
 
-impl TimerFunction for NetWorkPollFunc {
+impl TimerFunction for NetPollTimerFunc {
     fn run(&mut self) -> Result<(), SystemError> {
-        poll_ifaces_try_lock(10).ok();
-        let next_time = next_n_ms_timer_jiffies(10);
-        let timer = Timer::new(Box::new(NetWorkPollFunc), next_time);
-        timer.activate();
+        net_rx_action(PollScope::All);
         return Ok(());
     }
 }
 
+/// ## 在中断上下文中请求处理网卡收到的数据包，由网卡的中断处理函数调用
+#[inline]
+pub fn net_raise_rx() {
+    softirq_vectors().raise_softirq(SoftirqNumber::NetRx);
+}
+
+/// ## 请求处理socket上待发送的数据和状态变化
+///
+/// 系统调用在向socket写入数据或发起连接之后调用。这里只标记socket所在的分片和NET_RX软中断，
+/// 实际的处理在当前CPU下一次退出中断时进行，不会在系统调用中轮询网卡
+///
+/// ## 参数
+/// - `shard`：socket所在的分片
+pub fn net_kick(shard: &SocketShard) {
+    NET_KICKED_SHARDS.fetch_or(1 << shard.id(), Ordering::AcqRel);
+    softirq_vectors().raise_softirq(SoftirqNumber::NetRx);
+}
+
+/// 轮询所有的网卡，然后逐个分片向状态发生变化的socket发布事件
+fn net_rx_action(scope: PollScope) {
+    let devices = NET_DEVICES.read_irqsave();
+    for iface in devices.values() {
+        iface.poll(scope).ok();
+    }
+
+    let mut delay: Option<smoltcp::time::Duration> = None;
+    let shards = SOCKET_SHARDS.iter().filter(|shard| scope.includes(shard));
+    for shard in shards {
+        // 轮询网卡时没有处理过、也没有待发布事件的分片，定时任务没有变化，不需要加锁。
+        // 定时器到期时仍然要重新计算所有分片的定时任务
+        if !shard.take_polled()
+            && scope != PollScope::All
+            && shard.pending.lock_irqsave().is_empty()
+        {
+            continue;
+        }
+        let mut sockets = shard.sockets.lock_irqsave();
+        let timestamp: smoltcp::time::Instant = Instant::now().into();
+        for iface in devices.values() {
+            if let Some(d) = iface.inner_iface().lock().poll_delay(timestamp, &sockets) {
+                delay = Some(delay.map_or(d, |x| x.min(d)));
+            }
+        }
+
+        let pending = core::mem::take(&mut *shard.pending.lock_irqsave());
+        publish_events(shard, &mut sockets, pending);
+        shard.reap_tcp_orphans(&mut sockets);
+    }
+    drop(devices);
+
+    if let Some(delay) = delay {
+        schedule_poll_timer(delay);
+    }
+}
+
+/// ## 把已连接的TCP socket迁移到分片`target`
+///
+/// 监听socket接受的连接最初位于监听socket的分片中，accept时迁移到新的分片，
+/// 使同一个监听端口上的连接分散到各个分片和cpu上。调用时不能持有任何分片的锁
+///
+/// ## 参数
+/// - `handle`：socket当前的句柄
+/// - `connection`：连接的四元组
+/// - `target`：目标分片
+///
+/// ## 返回值
+/// socket在目标分片中的句柄
+pub fn migrate_tcp_socket(
+    handle: GlobalSocketHandle,
+    connection: FourTuple,
+    target: &'static SocketShard,
+) -> GlobalSocketHandle {
+    let source = SocketShard::of(handle);
+    if source.id() == target.id() {
+        return handle;
+    }
+
+    // 按照分片的下标顺序加锁，避免两个方向的迁移互相等待
+    let (mut src, mut dst) = if source.id() < target.id() {
+        let src = source.sockets.lock_irqsave();
+        (src, target.sockets.lock_irqsave())
+    } else {
+        let dst = target.sockets.lock_irqsave();
+        (source.sockets.lock_irqsave(), dst)
+    };
+
+    let smoltcp::socket::Socket::Tcp(socket) = remove_socket(&mut src, handle) else {
+        panic!("migrate_tcp_socket: {:?} is not a tcp socket", handle);
+    };
+    let new_handle = add_socket(target, &mut dst, socket);
+    if let Some(item) = source.handles.write_irqsave().remove(&handle) {
+        target.handles.write_irqsave().insert(new_handle, item);
+    }
+    SOCKET_DEMUX.migrate(connection, target.id());
+    drop(src);
+    drop(dst);
+
+    // 迁移之前发生的状态变化已经随着待通知列表一起丢弃，在新的分片中重新发布一次
+    target
+        .pending
+        .lock_irqsave()
+        .push((new_handle.smoltcp_handle().unwrap(), SocketKind::Tcp));
+    net_kick(target);
+    return new_handle;
+}
+
+/// 在`delay`之后再次轮询网卡。已经有更早到期的定时器时不做任何事
+fn schedule_poll_timer(delay: smoltcp::time::Duration) {
+    let expire_jiffies = next_n_us_timer_jiffies(delay.total_micros()) + 1;
+    let mut guard = NET_POLL_TIMER.lock_irqsave();
+    if let Some(timer) = guard.as_ref() {
+        if !timer.timeout() && timer.inner().expire_jiffies <= expire_jiffies {
+            return;
+        }
+        timer.cancel();
+    }
+    let timer = Timer::new(Box::new(NetPollTimerFunc), expire_jiffies);
+    timer.activate();
+    *guard = Some(timer);
+}
+
+/// ### 向分片中状态发生变化的socket发布事件，并重新注册它们的唤醒器
+fn publish_events(
+    shard: &SocketShard,
+    sockets: &mut SocketSet<'static>,
+    pending: Vec<(SocketHandle, SocketKind)>,
+) {
+    if pending.is_empty() {
+        return;
+    }
+    let handle_guard = shard.handles.read_irqsave();
+    for (handle, kind) in pending {
+        let item = handle_guard.get(&GlobalSocketHandle::new_smoltcp_handle(shard.id(), handle));
+        let posix_item = item.and_then(|item| item.posix_item());
+
+        let events = match kind {
+            SocketKind::Raw => {
+                register_waker::<raw::Socket>(shard, sockets, handle);
+                item.map(|item| {
+                    let socket = sockets.get::<raw::Socket>(handle);
+                    SocketPollMethod::raw_poll(socket, item.shutdown_type()).bits() as u64
+                })
+            }
+            SocketKind::Udp => {
+                register_waker::<udp::Socket>(shard, sockets, handle);
+                item.map(|item| {
+                    let socket = sockets.get::<udp::Socket>(handle);
+                    SocketPollMethod::udp_poll(socket, item.shutdown_type()).bits() as u64
+                })
+            }
+            SocketKind::Tcp => {
+                register_waker::<tcp::Socket>(shard, sockets, handle);
+                item.map(|item| {
+                    let socket = sockets.get::<tcp::Socket>(handle);
+                    let mut events = SocketPollMethod::tcp_poll(
+                        socket,
+                        item.shutdown_type(),
+                        item.is_posix_listen,
+                    )
+                    .bits() as u64;
+                    if socket.is_active() {
+                        events |= TcpSocket::CAN_ACCPET;
+                    }
+                    if socket.state() == tcp::State::Established {
+                        events |= TcpSocket::CAN_CONNECT;
+                    }
+                    if socket.state() == tcp::State::CloseWait {
+                        events |= EPollEventType::EPOLLHUP.bits() as u64;
+                    }
+                    events
+                })
+            }
+        };
+
+        if let (Some(posix_item), Some(events)) = (posix_item, events) {
+            posix_item.wakeup_any(events);
+            EventPoll::wakeup_epoll(
+                &posix_item.epitems,
+                Some(EPollEventType::from_bits_truncate(events as u32)),
+            )
+            .ok();
+        }
+    }
+}
+
 pub fn net_init() -> Result<(), SystemError> {
+    softirq_vectors().register_softirq(SoftirqNumber::NetRx, Arc::new(NetRxSoftirq))?;
     dhcp_query()?;
-    // Init poll timer function
-    // let next_time = next_n_ms_timer_jiffies(5);
-    // let timer = Timer::new(Box::new(NetWorkPollFunc), next_time);
-    // timer.activate();
     return Ok(());
 }
 
@@ -59,13 +407,15 @@ fn dhcp_query() -> Result<(), SystemError> {
     // IMPORTANT: This should be removed in production.
     dhcp_socket.set_max_lease_duration(Some(smoltcp::time::Duration::from_secs(10)));
 
-    let dhcp_handle = SOCKET_SET.lock_irqsave().add(dhcp_socket);
+    // DHCP的数据包不会匹配到任何socket，由默认分片处理
+    let shard = SocketShard::default_shard();
+    let dhcp_handle = shard.sockets.lock_irqsave().add(dhcp_socket);
 
     const DHCP_TRY_ROUND: u8 = 10;
     for i in 0..DHCP_TRY_ROUND {
         debug!("DHCP try round: {}", i);
-        net_face.poll(&mut SOCKET_SET.lock_irqsave()).ok();
-        let mut binding = SOCKET_SET.lock_irqsave();
+        net_face.poll(PollScope::All).ok();
+        let mut binding = shard.sockets.lock_irqsave();
         let event = binding.get_mut::<dhcpv4::Socket>(dhcp_handle).poll();
 
         match event {
@@ -122,125 +472,3 @@ fn dhcp_query() -> Result<(), SystemError> {
 
     return Err(SystemError::ETIMEDOUT);
 }
-
-pub fn poll_ifaces() {
-    let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDevice>>> = NET_DEVICES.read_irqsave();
-    if guard.len() == 0 {
-        warn!("poll_ifaces: No net driver found!");
-        return;
-    }
-    let mut sockets = SOCKET_SET.lock_irqsave();
-    for (_, iface) in guard.iter() {
-        iface.poll(&mut sockets).ok();
-    }
-    let _ = send_event(&sockets);
-}
-
-/// 对ifaces进行轮询，最多对SOCKET_SET尝试times次加锁。
-///
-/// @return 轮询成功，返回Ok(())
-/// @return 加锁超时，返回SystemError::EAGAIN_OR_EWOULDBLOCK
-/// @return 没有网卡，返回SystemError::ENODEV
-pub fn poll_ifaces_try_lock(times: u16) -> Result<(), SystemError> {
-    let mut i = 0;
-    while i < times {
-        let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDevice>>> =
-            NET_DEVICES.read_irqsave();
-        if guard.len() == 0 {
-            warn!("poll_ifaces: No net driver found!");
-            // 没有网卡，返回错误
-            return Err(SystemError::ENODEV);
-        }
-        let sockets = SOCKET_SET.try_lock_irqsave();
-        // 加锁失败，继续尝试
-        if sockets.is_err() {
-            i += 1;
-            continue;
-        }
-
-        let mut sockets = sockets.unwrap();
-        for (_, iface) in guard.iter() {
-            iface.poll(&mut sockets).ok();
-        }
-        send_event(&sockets)?;
-        return Ok(());
-    }
-    // 尝试次数用完，返回错误
-    return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
-}
-
-/// 对ifaces进行轮询，最多对SOCKET_SET尝试一次加锁。
-///
-/// @return 轮询成功，返回Ok(())
-/// @return 加锁超时，返回SystemError::EAGAIN_OR_EWOULDBLOCK
-/// @return 没有网卡，返回SystemError::ENODEV
-pub fn poll_ifaces_try_lock_onetime() -> Result<(), SystemError> {
-    let guard: RwLockReadGuard<BTreeMap<usize, Arc<dyn NetDevice>>> = NET_DEVICES.read_irqsave();
-    if guard.len() == 0 {
-        warn!("poll_ifaces: No net driver found!");
-        // 没有网卡，返回错误
-        return Err(SystemError::ENODEV);
-    }
-    let mut sockets = SOCKET_SET.try_lock_irqsave()?;
-    for (_, iface) in guard.iter() {
-        iface.poll(&mut sockets).ok();
-    }
-    send_event(&sockets)?;
-    return Ok(());
-}
-
-/// ### 处理轮询后的事件
-fn send_event(sockets: &smoltcp::iface::SocketSet) -> Result<(), SystemError> {
-    for (handle, socket_type) in sockets.iter() {
-        let handle_guard = HANDLE_MAP.read_irqsave();
-        let global_handle = GlobalSocketHandle::new_smoltcp_handle(handle);
-        let item: Option<&super::socket::SocketHandleItem> = handle_guard.get(&global_handle);
-        if item.is_none() {
-            continue;
-        }
-
-        let handle_item = item.unwrap();
-        let posix_item = handle_item.posix_item();
-        if posix_item.is_none() {
-            continue;
-        }
-        let posix_item = posix_item.unwrap();
-
-        // 获取socket上的事件
-        let mut events = SocketPollMethod::poll(socket_type, handle_item).bits() as u64;
-
-        // 分发到相应类型socket处理
-        match socket_type {
-            smoltcp::socket::Socket::Raw(_) | smoltcp::socket::Socket::Udp(_) => {
-                posix_item.wakeup_any(events);
-            }
-            smoltcp::socket::Socket::Icmp(_) => unimplemented!("Icmp socket hasn't unimplemented"),
-            smoltcp::socket::Socket::Tcp(inner_socket) => {
-                if inner_socket.is_active() {
-                    events |= TcpSocket::CAN_ACCPET;
-                }
-                if inner_socket.state() == smoltcp::socket::tcp::State::Established {
-                    events |= TcpSocket::CAN_CONNECT;
-                }
-                if inner_socket.state() == smoltcp::socket::tcp::State::CloseWait {
-                    events |= EPollEventType::EPOLLHUP.bits() as u64;
-                }
-
-                posix_item.wakeup_any(events);
-            }
-            smoltcp::socket::Socket::Dhcpv4(_) => {}
-            smoltcp::socket::Socket::Dns(_) => unimplemented!("Dns socket hasn't unimplemented"),
-        }
-        EventPoll::wakeup_epoll(
-            &posix_item.epitems,
-            Some(EPollEventType::from_bits_truncate(events as u32)),
-        )?;
-        drop(handle_guard);
-        // crate::debug!(
-        //     "{} send_event {:?}",
-        //     handle,
-        //     EPollEventType::from_bits_truncate(events as u32)
-        // );
-    }
-    Ok(())
-}
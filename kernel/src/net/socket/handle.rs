@@ -3,6 +3,8 @@ use smoltcp::iface::SocketHandle;
 
 use crate::libs::spinlock::SpinLock;
 
+use super::shard::SOCKET_SHARD_NUM;
+
 int_like!(KernelHandle, usize);
 
 /// # socket的句柄管理组件
@@ -10,7 +12,8 @@ int_like!(KernelHandle, usize);
 /// 比如，在socket被关闭时，自动释放socket的资源，通知系统的其他组件。
 #[derive(Debug, Hash, Eq, PartialEq, Clone, Copy)]
 pub enum GlobalSocketHandle {
-    Smoltcp(SocketHandle),
+    /// smoltcp的socket：(所在的socket表分片, 分片内的SocketHandle)
+    Smoltcp(usize, SocketHandle),
     Kernel(KernelHandle),
 }
 
@@ -18,8 +21,8 @@ static KERNEL_HANDLE_IDA: SpinLock<IdAllocator> =
     SpinLock::new(IdAllocator::new(0, usize::MAX).unwrap());
 
 impl GlobalSocketHandle {
-    pub fn new_smoltcp_handle(handle: SocketHandle) -> Self {
-        return Self::Smoltcp(handle);
+    pub fn new_smoltcp_handle(shard: usize, handle: SocketHandle) -> Self {
+        return Self::Smoltcp(shard, handle);
     }
 
     pub fn new_kernel_handle() -> Self {
@@ -27,12 +30,20 @@ impl GlobalSocketHandle {
     }
 
     pub fn smoltcp_handle(&self) -> Option<SocketHandle> {
-        if let Self::Smoltcp(sh) = *self {
+        if let Self::Smoltcp(_, sh) = *self {
             return Some(sh);
         }
         None
     }
 
+    /// socket所在的socket表分片，内核socket按照句柄散列到各个分片
+    pub fn shard(&self) -> usize {
+        match *self {
+            Self::Smoltcp(shard, _) => shard,
+            Self::Kernel(kh) => kh.data() % SOCKET_SHARD_NUM,
+        }
+    }
+
     pub fn kernel_handle(&self) -> Option<KernelHandle> {
         if let Self::Kernel(kh) = *self {
             return Some(kh);
@@ -10,14 +10,17 @@ use crate::{
     driver::net::NetDevice,
     libs::rwlock::RwLock,
     net::{
-        event_poll::EPollEventType, net_core::poll_ifaces, Endpoint, Protocol, ShutdownType,
-        NET_DEVICES,
+        event_poll::EPollEventType,
+        net_core::{add_socket, migrate_tcp_socket, net_kick, remove_socket},
+        Endpoint, Protocol, ShutdownType, NET_DEVICES,
     },
 };
 
 use super::{
-    handle::GlobalSocketHandle, PosixSocketHandleItem, Socket, SocketHandleItem, SocketMetadata,
-    SocketOptions, SocketPollMethod, SocketType, HANDLE_MAP, PORT_MANAGER, SOCKET_SET,
+    handle::GlobalSocketHandle,
+    shard::{FourTuple, SocketShard, SOCKET_DEMUX},
+    PosixSocketHandleItem, Socket, SocketHandleItem, SocketMetadata, SocketOptions,
+    SocketPollMethod, SocketType, PORT_MANAGER,
 };
 
 /// @brief 表示原始的socket。原始套接字绕过传输层协议（如 TCP 或 UDP）并提供对网络层协议（如 IP）的直接访问。
@@ -66,8 +69,9 @@ impl RawSocket {
             tx_buffer,
         );
 
-        // 把socket添加到socket集合中，并得到socket的句柄
-        let handle = GlobalSocketHandle::new_smoltcp_handle(SOCKET_SET.lock_irqsave().add(socket));
+        // 把socket添加到默认分片中，并得到socket的句柄。没有匹配到TCP/UDP socket的数据包都由默认分片处理
+        let shard = SocketShard::default_shard();
+        let handle = add_socket(shard, &mut shard.sockets.lock_irqsave(), socket);
 
         let metadata = SocketMetadata::new(
             SocketType::Raw,
@@ -94,21 +98,19 @@ impl Socket for RawSocket {
     }
 
     fn close(&mut self) {
-        let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+        let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
         if let smoltcp::socket::Socket::Udp(mut sock) =
-            socket_set_guard.remove(self.handle.smoltcp_handle().unwrap())
+            remove_socket(&mut socket_set_guard, self.handle)
         {
             sock.close();
         }
         drop(socket_set_guard);
-        poll_ifaces();
     }
 
     fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
-        poll_ifaces();
         loop {
             // 如何优化这里？
-            let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+            let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
             let socket =
                 socket_set_guard.get_mut::<raw::Socket>(self.handle.smoltcp_handle().unwrap());
 
@@ -130,19 +132,21 @@ impl Socket for RawSocket {
                     }
                 }
             }
-            drop(socket_set_guard);
-            self.posix_item.sleep(EPollEventType::EPOLLIN.bits() as u64);
+            self.posix_item
+                .sleep_unlock(EPollEventType::EPOLLIN.bits() as u64, socket_set_guard);
         }
     }
 
     fn write(&self, buf: &[u8], to: Option<Endpoint>) -> Result<usize, SystemError> {
         // 如果用户发送的数据包，包含IP头，则直接发送
         if self.header_included {
-            let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+            let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
             let socket =
                 socket_set_guard.get_mut::<raw::Socket>(self.handle.smoltcp_handle().unwrap());
             match socket.send_slice(buf) {
                 Ok(_) => {
+                    drop(socket_set_guard);
+                    net_kick(SocketShard::of(self.handle));
                     return Ok(buf.len());
                 }
                 Err(raw::SendError::BufferFull) => {
@@ -153,7 +157,7 @@ impl Socket for RawSocket {
             // 如果用户发送的数据包，不包含IP头，则需要自己构造IP头
 
             if let Some(Endpoint::Ip(Some(endpoint))) = to {
-                let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+                let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
                 let socket: &mut raw::Socket =
                     socket_set_guard.get_mut::<raw::Socket>(self.handle.smoltcp_handle().unwrap());
 
@@ -196,9 +200,8 @@ impl Socket for RawSocket {
                     // 发送数据包
                     socket.send_slice(&buffer).unwrap();
 
-                    iface.poll(&mut socket_set_guard).ok();
-
                     drop(socket_set_guard);
+                    net_kick(SocketShard::of(self.handle));
                     return Ok(len);
                 } else {
                     warn!("Unsupport Ip protocol type!");
@@ -271,9 +274,10 @@ impl UdpSocket {
         );
         let socket = udp::Socket::new(rx_buffer, tx_buffer);
 
-        // 把socket添加到socket集合中，并得到socket的句柄
+        // 把socket添加到socket集合的一个分片中，并得到socket的句柄
+        let shard = SocketShard::alloc();
         let handle: GlobalSocketHandle =
-            GlobalSocketHandle::new_smoltcp_handle(SOCKET_SET.lock_irqsave().add(socket));
+            add_socket(shard, &mut shard.sockets.lock_irqsave(), socket);
 
         let metadata = SocketMetadata::new(
             SocketType::Udp,
@@ -309,7 +313,10 @@ impl UdpSocket {
             };
 
             match bind_res {
-                Ok(()) => return Ok(()),
+                Ok(()) => {
+                    SOCKET_DEMUX.bind_port(wire::IpProtocol::Udp, ip.port, self.handle.shard());
+                    return Ok(());
+                }
                 Err(_) => return Err(SystemError::EINVAL),
             }
         } else {
@@ -324,22 +331,23 @@ impl Socket for UdpSocket {
     }
 
     fn close(&mut self) {
-        let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+        let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
         if let smoltcp::socket::Socket::Udp(mut sock) =
-            socket_set_guard.remove(self.handle.smoltcp_handle().unwrap())
+            remove_socket(&mut socket_set_guard, self.handle)
         {
+            let port = sock.endpoint().port;
+            if port != 0 {
+                SOCKET_DEMUX.unbind_port(wire::IpProtocol::Udp, port);
+            }
             sock.close();
         }
         drop(socket_set_guard);
-        poll_ifaces();
     }
 
     /// @brief 在read函数执行之前，请先bind到本地的指定端口
     fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
         loop {
-            // debug!("Wait22 to Read");
-            poll_ifaces();
-            let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+            let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
             let socket =
                 socket_set_guard.get_mut::<udp::Socket>(self.handle.smoltcp_handle().unwrap());
 
@@ -347,16 +355,14 @@ impl Socket for UdpSocket {
 
             if socket.can_recv() {
                 if let Ok((size, metadata)) = socket.recv_slice(buf) {
-                    drop(socket_set_guard);
-                    poll_ifaces();
                     return (Ok(size), Endpoint::Ip(Some(metadata.endpoint)));
                 }
             } else {
                 // 如果socket没有连接，则忙等
                 // return (Err(SystemError::ENOTCONN), Endpoint::Ip(None));
             }
-            drop(socket_set_guard);
-            self.posix_item.sleep(EPollEventType::EPOLLIN.bits() as u64);
+            self.posix_item
+                .sleep_unlock(EPollEventType::EPOLLIN.bits() as u64, socket_set_guard);
         }
     }
 
@@ -373,7 +379,7 @@ impl Socket for UdpSocket {
         };
         // debug!("udp write: remote = {:?}", remote_endpoint);
 
-        let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+        let mut socket_set_guard = SocketShard::of(self.handle).sockets.lock_irqsave();
         let socket = socket_set_guard.get_mut::<udp::Socket>(self.handle.smoltcp_handle().unwrap());
         // debug!("is open()={}", socket.is_open());
         // debug!("socket endpoint={:?}", socket.endpoint());
@@ -383,7 +389,7 @@ impl Socket for UdpSocket {
                 Ok(()) => {
                     // debug!("udp write: send ok");
                     drop(socket_set_guard);
-                    poll_ifaces();
+                    net_kick(SocketShard::of(self.handle));
                     return Ok(buf.len());
                 }
                 Err(_) => {
@@ -398,19 +404,20 @@ impl Socket for UdpSocket {
     }
 
     fn bind(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
-        let mut sockets = SOCKET_SET.lock_irqsave();
+        let mut sockets = SocketShard::of(self.handle).sockets.lock_irqsave();
         let socket = sockets.get_mut::<udp::Socket>(self.handle.smoltcp_handle().unwrap());
         // debug!("UDP Bind to {:?}", endpoint);
         return self.do_bind(socket, endpoint);
     }
 
     fn poll(&self) -> EPollEventType {
-        let sockets = SOCKET_SET.lock_irqsave();
+        let sockets = SocketShard::of(self.handle).sockets.lock_irqsave();
         let socket = sockets.get::<udp::Socket>(self.handle.smoltcp_handle().unwrap());
 
         return SocketPollMethod::udp_poll(
             socket,
-            HANDLE_MAP
+            SocketShard::of(self.handle)
+                .handles
                 .read_irqsave()
                 .get(&self.socket_handle())
                 .unwrap()
@@ -446,7 +453,7 @@ impl Socket for UdpSocket {
     }
 
     fn endpoint(&self) -> Option<Endpoint> {
-        let sockets = SOCKET_SET.lock_irqsave();
+        let sockets = SocketShard::of(self.handle).sockets.lock_irqsave();
         let socket = sockets.get::<udp::Socket>(self.handle.smoltcp_handle().unwrap());
         let listen_endpoint = socket.endpoint();
 
@@ -488,8 +495,11 @@ impl Socket for UdpSocket {
 /// https://man7.org/linux/man-pages/man7/tcp.7.html
 #[derive(Debug, Clone)]
 pub struct TcpSocket {
+    /// 所有的handle都在同一个socket分片中
     handles: Vec<GlobalSocketHandle>,
     local_endpoint: Option<wire::IpEndpoint>, // save local endpoint for bind()
+    /// 已连接的socket的四元组，用于把收到的数据包分发到socket所在的分片
+    connection: Option<FourTuple>,
     is_listening: bool,
     metadata: SocketMetadata,
     posix_item: Arc<PosixSocketHandleItem>,
@@ -513,9 +523,12 @@ impl TcpSocket {
     ///
     /// @return 返回创建的tcp的socket
     pub fn new(options: SocketOptions) -> Self {
-        // 创建handles数组并把socket添加到socket集合中，并得到socket的句柄
-        let handles: Vec<GlobalSocketHandle> = vec![GlobalSocketHandle::new_smoltcp_handle(
-            SOCKET_SET.lock_irqsave().add(Self::create_new_socket()),
+        // 创建handles数组并把socket添加到socket集合的一个分片中，并得到socket的句柄
+        let shard = SocketShard::alloc();
+        let handles: Vec<GlobalSocketHandle> = vec![add_socket(
+            shard,
+            &mut shard.sockets.lock_irqsave(),
+            Self::create_new_socket(),
         )];
 
         let metadata = SocketMetadata::new(
@@ -531,6 +544,7 @@ impl TcpSocket {
         return Self {
             handles,
             local_endpoint: None,
+            connection: None,
             is_listening: false,
             metadata,
             posix_item,
@@ -571,9 +585,15 @@ impl TcpSocket {
         tcp::Socket::new(rx_buffer, tx_buffer)
     }
 
+    /// socket所在的分片
+    #[inline]
+    fn shard(&self) -> &'static SocketShard {
+        SocketShard::of(self.socket_handle())
+    }
+
     /// listening状态的posix socket是需要特殊处理的
     fn tcp_poll_listening(&self) -> EPollEventType {
-        let socketset_guard = SOCKET_SET.lock_irqsave();
+        let socketset_guard = self.shard().sockets.lock_irqsave();
 
         let can_accept = self.handles.iter().any(|h| {
             if let Some(sh) = h.smoltcp_handle() {
@@ -598,25 +618,43 @@ impl Socket for TcpSocket {
     }
 
     fn close(&mut self) {
+        let mut connection = self.connection.take();
         for handle in self.handles.iter() {
-            {
-                let mut socket_set_guard = SOCKET_SET.lock_irqsave();
-                let smoltcp_handle = handle.smoltcp_handle().unwrap();
-                socket_set_guard
-                    .get_mut::<smoltcp::socket::tcp::Socket>(smoltcp_handle)
-                    .close();
-                drop(socket_set_guard);
+            let shard = SocketShard::of(*handle);
+            let mut socket_set_guard = shard.sockets.lock_irqsave();
+            let smoltcp_handle = handle.smoltcp_handle().unwrap();
+            let socket = socket_set_guard.get_mut::<smoltcp::socket::tcp::Socket>(smoltcp_handle);
+            socket.close();
+            if socket.state() == smoltcp::socket::tcp::State::Closed {
+                // 监听中或者还没有建立连接的socket不需要发送FIN
+                remove_socket(&mut socket_set_guard, *handle);
+                continue;
+            }
+            // 剩余的数据和FIN由NET_RX软中断发送，连接结束之后再移除socket并删除分发表中的记录，
+            // 见SocketShard::reap_tcp_orphans
+            let orphan_connection = if *handle == self.socket_handle() {
+                connection.take()
+            } else {
+                None
+            };
+            shard.add_tcp_orphan(smoltcp_handle, orphan_connection);
+            drop(socket_set_guard);
+            net_kick(shard);
+        }
+        if let Some(connection) = connection {
+            SOCKET_DEMUX.disconnect(&connection);
+        }
+        if self.is_listening {
+            if let Some(local_endpoint) = self.local_endpoint {
+                SOCKET_DEMUX.unbind_port(wire::IpProtocol::Tcp, local_endpoint.port);
             }
-            poll_ifaces();
-            SOCKET_SET
-                .lock_irqsave()
-                .remove(handle.smoltcp_handle().unwrap());
-            // debug!("[Socket] [TCP] Close: {:?}", handle);
         }
     }
 
     fn read(&self, buf: &mut [u8]) -> (Result<usize, SystemError>, Endpoint) {
-        if HANDLE_MAP
+        if self
+            .shard()
+            .handles
             .read_irqsave()
             .get(&self.socket_handle())
             .unwrap()
@@ -628,8 +666,7 @@ impl Socket for TcpSocket {
         // debug!("tcp socket: read, buf len={}", buf.len());
         // debug!("tcp socket:read, socket'len={}",self.handle.len());
         loop {
-            poll_ifaces();
-            let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+            let mut socket_set_guard = self.shard().sockets.lock_irqsave();
 
             let socket = socket_set_guard
                 .get_mut::<tcp::Socket>(self.handles.first().unwrap().smoltcp_handle().unwrap());
@@ -641,6 +678,8 @@ impl Socket for TcpSocket {
             }
 
             if socket.may_recv() {
+                // 接收窗口较小时，读取之后需要尽快通告新的窗口
+                let window_low = socket.recv_queue() * 2 >= socket.recv_capacity();
                 match socket.recv_slice(buf) {
                     Ok(size) => {
                         if size > 0 {
@@ -651,7 +690,9 @@ impl Socket for TcpSocket {
                             };
 
                             drop(socket_set_guard);
-                            poll_ifaces();
+                            if window_low {
+                                net_kick(self.shard());
+                            }
                             return (Ok(size), Endpoint::Ip(Some(endpoint)));
                         }
                     }
@@ -661,7 +702,8 @@ impl Socket for TcpSocket {
                     }
                     Err(tcp::RecvError::Finished) => {
                         // 对端写端已关闭，我们应该关闭读端
-                        HANDLE_MAP
+                        self.shard()
+                            .handles
                             .write_irqsave()
                             .get_mut(&self.socket_handle())
                             .unwrap()
@@ -673,14 +715,17 @@ impl Socket for TcpSocket {
             } else {
                 return (Err(SystemError::ENOTCONN), Endpoint::Ip(None));
             }
-            drop(socket_set_guard);
-            self.posix_item
-                .sleep((EPollEventType::EPOLLIN | EPollEventType::EPOLLHUP).bits() as u64);
+            self.posix_item.sleep_unlock(
+                (EPollEventType::EPOLLIN | EPollEventType::EPOLLHUP).bits() as u64,
+                socket_set_guard,
+            );
         }
     }
 
     fn write(&self, buf: &[u8], _to: Option<Endpoint>) -> Result<usize, SystemError> {
-        if HANDLE_MAP
+        if self
+            .shard()
+            .handles
             .read_irqsave()
             .get(&self.socket_handle())
             .unwrap()
@@ -691,7 +736,7 @@ impl Socket for TcpSocket {
         }
         // debug!("tcp socket:write, socket'len={}",self.handle.len());
 
-        let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+        let mut socket_set_guard = self.shard().sockets.lock_irqsave();
 
         let socket = socket_set_guard
             .get_mut::<tcp::Socket>(self.handles.first().unwrap().smoltcp_handle().unwrap());
@@ -701,7 +746,7 @@ impl Socket for TcpSocket {
                 match socket.send_slice(buf) {
                     Ok(size) => {
                         drop(socket_set_guard);
-                        poll_ifaces();
+                        net_kick(self.shard());
                         return Ok(size);
                     }
                     Err(e) => {
@@ -726,12 +771,12 @@ impl Socket for TcpSocket {
 
         assert!(self.handles.len() == 1);
 
-        let mut socket_set_guard = SOCKET_SET.lock_irqsave();
+        let mut socket_set_guard = self.shard().sockets.lock_irqsave();
         // debug!("tcp socket:poll, socket'len={}",self.handle.len());
 
         let socket = socket_set_guard
             .get_mut::<tcp::Socket>(self.handles.first().unwrap().smoltcp_handle().unwrap());
-        let handle_map_guard = HANDLE_MAP.read_irqsave();
+        let handle_map_guard = self.shard().handles.read_irqsave();
         let handle_item = handle_map_guard.get(&self.socket_handle()).unwrap();
         let shutdown_type = handle_item.shutdown_type();
         let is_posix_listen = handle_item.is_posix_listen;
@@ -741,7 +786,7 @@ impl Socket for TcpSocket {
     }
 
     fn connect(&mut self, endpoint: Endpoint) -> Result<(), SystemError> {
-        let mut sockets = SOCKET_SET.lock_irqsave();
+        let mut sockets = self.shard().sockets.lock_irqsave();
         // debug!("tcp socket:connect, socket'len={}", self.handles.len());
 
         let socket =
@@ -759,14 +804,21 @@ impl Socket for TcpSocket {
 
             match socket.connect(inner_iface.context(), ip, temp_port) {
                 Ok(()) => {
+                    // 在发出SYN之前登记四元组，对端的回复才能分发到这个分片
+                    if let Some(local) = socket.local_endpoint() {
+                        let connection = FourTuple::new(wire::IpProtocol::Tcp, local, ip);
+                        SOCKET_DEMUX.connect(connection, self.shard().id());
+                        self.connection = Some(connection);
+                    }
                     // avoid deadlock
                     drop(inner_iface);
                     drop(iface);
                     drop(sockets);
+                    // 发出SYN
+                    net_kick(self.shard());
                     loop {
-                        poll_ifaces();
-                        let mut sockets = SOCKET_SET.lock_irqsave();
-                        let socket = sockets.get_mut::<tcp::Socket>(
+                        let sockets = self.shard().sockets.lock_irqsave();
+                        let socket = sockets.get::<tcp::Socket>(
                             self.handles.first().unwrap().smoltcp_handle().unwrap(),
                         );
 
@@ -775,8 +827,7 @@ impl Socket for TcpSocket {
                                 return Ok(());
                             }
                             tcp::State::SynSent => {
-                                drop(sockets);
-                                self.posix_item.sleep(Self::CAN_CONNECT);
+                                self.posix_item.sleep_unlock(Self::CAN_CONNECT, sockets);
                             }
                             _ => {
                                 return Err(SystemError::ECONNREFUSED);
@@ -811,20 +862,21 @@ impl Socket for TcpSocket {
         // );
 
         let local_endpoint = self.local_endpoint.ok_or(SystemError::EINVAL)?;
-        let mut sockets = SOCKET_SET.lock_irqsave();
+        let shard = self.shard();
+        let mut sockets = shard.sockets.lock_irqsave();
         // 获取handle的数量
         let handlen = self.handles.len();
         let backlog = handlen.max(backlog);
 
         // 添加剩余需要构建的socket
         // debug!("tcp socket:before listen, socket'len={}", self.handle_list.len());
-        let mut handle_guard = HANDLE_MAP.write_irqsave();
+        let mut handle_guard = shard.handles.write_irqsave();
         let socket_handle_item_0 = handle_guard.get_mut(&self.socket_handle()).unwrap();
         socket_handle_item_0.is_posix_listen = true;
 
         self.handles.extend((handlen..backlog).map(|_| {
             let socket = Self::create_new_socket();
-            let handle = GlobalSocketHandle::new_smoltcp_handle(sockets.add(socket));
+            let handle = add_socket(shard, &mut sockets, socket);
             let mut handle_item = SocketHandleItem::new(Arc::downgrade(&self.posix_item));
             handle_item.is_posix_listen = true;
             handle_guard.insert(handle, handle_item);
@@ -846,6 +898,8 @@ impl Socket for TcpSocket {
             }
             // debug!("Tcp Socket  before listen, open={}", socket.is_open());
         }
+        // 发往监听端口的新连接都在这个分片中处理
+        SOCKET_DEMUX.bind_port(wire::IpProtocol::Tcp, local_endpoint.port, shard.id());
 
         return Ok(());
     }
@@ -870,7 +924,8 @@ impl Socket for TcpSocket {
 
     fn shutdown(&mut self, shutdown_type: super::ShutdownType) -> Result<(), SystemError> {
         // TODO：目前只是在表层判断，对端不知晓，后续需使用tcp实现
-        HANDLE_MAP
+        self.shard()
+            .handles
             .write_irqsave()
             .get_mut(&self.socket_handle())
             .unwrap()
@@ -884,11 +939,10 @@ impl Socket for TcpSocket {
         }
         let endpoint = self.local_endpoint.ok_or(SystemError::EINVAL)?;
         loop {
-            // debug!("tcp accept: poll_ifaces()");
-            poll_ifaces();
             // debug!("tcp socket:accept, socket'len={}", self.handle_list.len());
 
-            let mut sockset = SOCKET_SET.lock_irqsave();
+            let shard = self.shard();
+            let mut sockset = shard.sockets.lock_irqsave();
             // Get the corresponding activated handler
             let global_handle_index = self.handles.iter().position(|handle| {
                 let con_smol_sock = sockset.get::<tcp::Socket>(handle.smoltcp_handle().unwrap());
@@ -904,10 +958,17 @@ impl Socket for TcpSocket {
                 let remote_ep = con_smol_sock
                     .remote_endpoint()
                     .ok_or(SystemError::ENOTCONN)?;
+                // 已连接的socket先按照四元组分发到监听socket的分片，返回之前再迁移到新选择的分片
+                let connection = con_smol_sock
+                    .local_endpoint()
+                    .map(|local| FourTuple::new(wire::IpProtocol::Tcp, local, remote_ep));
+                if let Some(connection) = connection {
+                    SOCKET_DEMUX.connect(connection, shard.id());
+                }
 
                 let tcp_socket = Self::create_new_socket();
 
-                let new_handle = GlobalSocketHandle::new_smoltcp_handle(sockset.add(tcp_socket));
+                let new_handle = add_socket(shard, &mut sockset, tcp_socket);
 
                 // let handle in TcpSock be the new empty handle, and return the old connected handle
                 let old_handle = core::mem::replace(&mut self.handles[handle_index], new_handle);
@@ -920,16 +981,17 @@ impl Socket for TcpSocket {
                     self.metadata.options,
                 );
 
-                let sock_ret = Box::new(TcpSocket {
+                let mut sock_ret = Box::new(TcpSocket {
                     handles: vec![old_handle],
                     local_endpoint: self.local_endpoint,
+                    connection,
                     is_listening: false,
                     metadata,
                     posix_item: Arc::new(PosixSocketHandleItem::new(None)),
                 });
 
                 {
-                    let mut handle_guard = HANDLE_MAP.write_irqsave();
+                    let mut handle_guard = shard.handles.write_irqsave();
                     // 先删除原来的
                     let item = handle_guard.remove(&old_handle).unwrap();
                     item.reset_shutdown_type();
@@ -951,15 +1013,20 @@ impl Socket for TcpSocket {
 
                     drop(handle_guard);
                 }
+                drop(sockset);
+
+                // 同一个监听端口上的连接分散到各个分片上
+                if let Some(connection) = connection {
+                    sock_ret.handles[0] =
+                        migrate_tcp_socket(old_handle, connection, SocketShard::alloc());
+                }
 
                 return Ok((sock_ret, Endpoint::Ip(Some(remote_ep))));
             }
 
-            drop(sockset);
-
             // debug!("[TCP] [Accept] sleeping socket with handle: {:?}", self.handles.first().unwrap().smoltcp_handle().unwrap());
-            self.posix_item.sleep(Self::CAN_ACCPET);
-            // debug!("tcp socket:after sleep, handle_guard'len={}",HANDLE_MAP.write_irqsave().len());
+            self.posix_item.sleep_unlock(Self::CAN_ACCPET, sockset);
+            // debug!("tcp socket:after sleep, handle_guard'len={}",shard.handles.write_irqsave().len());
         }
     }
 
@@ -967,7 +1034,7 @@ impl Socket for TcpSocket {
         let mut result: Option<Endpoint> = self.local_endpoint.map(|x| Endpoint::Ip(Some(x)));
 
         if result.is_none() {
-            let sockets = SOCKET_SET.lock_irqsave();
+            let sockets = self.shard().sockets.lock_irqsave();
             // debug!("tcp socket:endpoint, socket'len={}",self.handle.len());
 
             let socket =
@@ -980,7 +1047,7 @@ impl Socket for TcpSocket {
     }
 
     fn peer_endpoint(&self) -> Option<Endpoint> {
-        let sockets = SOCKET_SET.lock_irqsave();
+        let sockets = self.shard().sockets.lock_irqsave();
         // debug!("tcp socket:peer_endpoint, socket'len={}",self.handle.len());
 
         let socket =
@@ -33,6 +33,7 @@ use crate::{
 use self::{
     handle::GlobalSocketHandle,
     inet::{RawSocket, TcpSocket, UdpSocket},
+    shard::SocketShard,
     unix::{SeqpacketSocket, StreamSocket},
 };
 
@@ -43,15 +44,10 @@ use super::{
 
 pub mod handle;
 pub mod inet;
+pub mod shard;
 pub mod unix;
 
 lazy_static! {
-    /// 所有socket的集合
-    /// TODO: 优化这里，自己实现SocketSet！！！现在这样的话，不管全局有多少个网卡，每个时间点都只会有1个进程能够访问socket
-    pub static ref SOCKET_SET: SpinLock<SocketSet<'static >> = SpinLock::new(SocketSet::new(vec![]));
-    /// SocketHandle表，每个SocketHandle对应一个SocketHandleItem，
-    /// 注意！：在网卡中断中需要拿到这张表的🔓，在获取读锁时应该确保关中断避免死锁
-    pub static ref HANDLE_MAP: RwLock<HashMap<GlobalSocketHandle, SocketHandleItem>> = RwLock::new(HashMap::new());
     /// 端口管理器
     pub static ref PORT_MANAGER: PortManager = PortManager::new();
 }
@@ -88,7 +84,8 @@ pub(super) fn new_socket(
     };
 
     let handle_item = SocketHandleItem::new(Arc::downgrade(&socket.posix_item()));
-    HANDLE_MAP
+    SocketShard::of(socket.socket_handle())
+        .handles
         .write_irqsave()
         .insert(socket.socket_handle(), handle_item);
     Ok(socket)
@@ -314,7 +311,8 @@ impl SocketInode {
 
             socket.clear_epoll()?;
 
-            HANDLE_MAP
+            SocketShard::of(socket.socket_handle())
+                .handles
                 .write_irqsave()
                 .remove(&socket.socket_handle())
                 .unwrap();
@@ -378,6 +376,10 @@ impl IndexNode for SocketInode {
         todo!()
     }
 
+    fn sync_fs(&self) -> Result<(), SystemError> {
+        return Ok(());
+    }
+
     fn as_any_ref(&self) -> &dyn Any {
         self
     }
@@ -426,6 +428,14 @@ impl PosixSocketHandleItem {
         schedule(SchedMode::SM_NONE);
     }
 
+    /// ## 释放socket所在分片的锁，并在socket的等待队列上睡眠
+    ///
+    /// socket的事件是在持有所在分片的锁时发布的，先加入等待队列再释放锁，不会错过检查socket之后发生的事件
+    pub fn sleep_unlock(&self, events: u64, socket_set_guard: SpinLockGuard<SocketSet<'static>>) {
+        self.wait_queue
+            .sleep_unlock_spinlock(events, socket_set_guard);
+    }
+
     pub fn add_epoll(&self, epitem: Arc<EPollItem>) {
         self.epitems.lock_irqsave().push_back(epitem)
     }
@@ -0,0 +1,658 @@
+//! # socket表的分片
+//!
+//! 所有的smoltcp socket被分散到`SOCKET_SHARD_NUM`个分片中，每个分片有自己的锁、smoltcp的`SocketSet`和SocketHandle表，
+//! 不同分片上的socket的系统调用和收包处理可以并行进行。
+//!
+//! smoltcp的`Interface::poll`会把收到的、没有匹配到socket的数据包当作无人监听（回复RST或者端口不可达），
+//! 因此轮询网卡时先把收到的数据帧按照四元组分发到各个分片的队列中，再逐个分片调用`Interface::poll`。
+//! 没有匹配到任何socket的数据帧（ARP、ICMP、DHCP等）交给默认分片处理，原始socket和DHCP socket也放在默认分片中。
+//!
+//! 每个分片有一个所在的cpu（见`SocketShard::cpu`）。在NET_RX软中断中，其他cpu从网卡取出的、属于这个分片的数据帧
+//! 被放进分片的积压队列，再在分片所在的cpu上调度NET_RX软中断，由它把数据帧交给smoltcp并向socket发布事件。
+//! 同一个流的数据包总是在同一个cpu上处理，不同分片的收包处理分散到各个cpu上。
+//! 监听socket接受的连接在accept时被迁移到新选择的分片（见`net_core::migrate_tcp_socket`），
+//! 因此同一个监听端口上的不同连接也会分散到各个分片上。
+//!
+//! 轮询网卡时只会对收到了数据帧、或者有待发送数据（见`net_core::net_kick`）的分片加锁。
+
+use core::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
+use alloc::{collections::VecDeque, vec::Vec};
+use hashbrown::HashMap;
+use smoltcp::{
+    iface::{Interface, SocketHandle, SocketSet},
+    phy::{self, RxToken, TxToken},
+    socket::tcp,
+    wire,
+};
+
+use crate::{
+    exception::softirq::{softirq_vectors, SoftirqNumber},
+    libs::{rwlock::RwLock, spinlock::SpinLock},
+    net::{
+        gro::{gro_merge, gro_supported},
+        net_core::{remove_socket, SocketKind},
+    },
+    smp::{
+        core::smp_get_processor_id,
+        cpu::{smp_cpu_manager, ProcessorId},
+    },
+    time::{Duration, Instant},
+};
+
+use super::{handle::GlobalSocketHandle, SocketHandleItem};
+
+/// socket表的分片数
+pub const SOCKET_SHARD_NUM: usize = 16;
+/// 默认分片的下标
+const DEFAULT_SHARD: usize = 0;
+/// 一轮轮询中最多从网卡取出的数据帧数
+pub const NET_RX_BUDGET: usize = 64;
+/// 一次轮询网卡最多进行的轮数，避免环回设备上的数据包互相触发导致无法退出
+const NET_POLL_MAX_ROUNDS: usize = 16;
+/// 一个分片的积压队列中最多存放的数据帧数，超出的数据帧被丢弃
+const NET_BACKLOG_MAX: usize = NET_RX_BUDGET * NET_POLL_MAX_ROUNDS;
+/// 已经关闭的TCP socket等待对端确认FIN的最长时间，与Linux的tcp_fin_timeout相同
+const TCP_ORPHAN_TIMEOUT: Duration = Duration::from_secs(60);
+
+lazy_static! {
+    /// 所有socket的集合，按分片存放
+    pub static ref SOCKET_SHARDS: Vec<SocketShard> = (0..SOCKET_SHARD_NUM).map(SocketShard::new).collect();
+    /// 根据四元组查找数据包所属的分片
+    pub static ref SOCKET_DEMUX: SocketDemux = SocketDemux::new();
+}
+
+/// socket表的一个分片
+pub struct SocketShard {
+    id: usize,
+    /// 这个分片中的smoltcp socket
+    pub sockets: SpinLock<SocketSet<'static>>,
+    /// SocketHandle表，每个SocketHandle对应一个SocketHandleItem，
+    /// 注意！：在软中断中需要拿到这张表的🔓，在获取锁时应该确保关中断避免死锁
+    pub handles: RwLock<HashMap<GlobalSocketHandle, SocketHandleItem>>,
+    /// 状态发生了变化、等待发布事件的socket
+    pub pending: SpinLock<Vec<(SocketHandle, SocketKind)>>,
+    /// 其他cpu收到的、等待分片所在的cpu处理的数据帧，按照网卡的id存放。
+    /// 同时记录其中最早的数据帧是在哪一代分发表下分发的
+    backlog: SpinLock<HashMap<usize, (usize, VecDeque<Vec<u8>>)>>,
+    /// 分片在轮询网卡时被处理过，需要重新计算定时任务并发布事件
+    polled: AtomicBool,
+    /// 已经被关闭、还在发送剩余数据和FIN的TCP socket
+    orphans: SpinLock<Vec<TcpOrphan>>,
+}
+
+/// 已经被用户关闭、但连接还没有结束的TCP socket
+#[derive(Debug)]
+struct TcpOrphan {
+    handle: SocketHandle,
+    connection: Option<FourTuple>,
+    deadline: Instant,
+}
+
+impl SocketShard {
+    fn new(id: usize) -> Self {
+        Self {
+            id,
+            sockets: SpinLock::new(SocketSet::new(vec![])),
+            handles: RwLock::new(HashMap::new()),
+            pending: SpinLock::new(Vec::new()),
+            backlog: SpinLock::new(HashMap::new()),
+            polled: AtomicBool::new(false),
+            orphans: SpinLock::new(Vec::new()),
+        }
+    }
+
+    #[inline]
+    pub fn id(&self) -> usize {
+        self.id
+    }
+
+    /// 获取socket所在的分片
+    #[inline]
+    pub fn of(handle: GlobalSocketHandle) -> &'static SocketShard {
+        &SOCKET_SHARDS[handle.shard()]
+    }
+
+    /// 获取第`id`个分片
+    #[inline]
+    pub fn get(id: usize) -> &'static SocketShard {
+        &SOCKET_SHARDS[id]
+    }
+
+    /// 默认分片，存放原始socket、DHCP socket，以及处理没有匹配到socket的数据帧
+    #[inline]
+    pub fn default_shard() -> &'static SocketShard {
+        &SOCKET_SHARDS[DEFAULT_SHARD]
+    }
+
+    /// ## 登记一个已经关闭、还需要发送剩余数据和FIN的TCP socket
+    ///
+    /// socket由NET_RX软中断发出FIN，连接结束或者超时之后再从分片中移除，
+    /// 在此之前仍然按照`connection`把对端的确认分发到这个分片
+    pub fn add_tcp_orphan(&self, handle: SocketHandle, connection: Option<FourTuple>) {
+        self.orphans.lock_irqsave().push(TcpOrphan {
+            handle,
+            connection,
+            deadline: Instant::now() + TCP_ORPHAN_TIMEOUT,
+        });
+    }
+
+    /// ## 移除连接已经结束或者超时的孤儿socket
+    ///
+    /// 调用者需要持有分片的`sockets`锁
+    pub fn reap_tcp_orphans(&self, sockets: &mut SocketSet<'static>) {
+        let mut orphans = self.orphans.lock_irqsave();
+        if orphans.is_empty() {
+            return;
+        }
+        let now = Instant::now();
+        orphans.retain(|orphan| {
+            let state = sockets.get::<tcp::Socket>(orphan.handle).state();
+            if !matches!(state, tcp::State::Closed | tcp::State::TimeWait) && now < orphan.deadline
+            {
+                return true;
+            }
+            remove_socket(
+                sockets,
+                GlobalSocketHandle::new_smoltcp_handle(self.id, orphan.handle),
+            );
+            if let Some(connection) = &orphan.connection {
+                SOCKET_DEMUX.disconnect(connection);
+            }
+            return false;
+        });
+    }
+
+    /// 处理这个分片收到的数据帧、向分片中的socket发布事件的cpu
+    pub fn cpu(&self) -> ProcessorId {
+        let cpus = smp_cpu_manager().present_cpus_count().max(1) as usize;
+        ProcessorId::new((self.id % cpus) as u32)
+    }
+
+    /// 分片是否由当前cpu处理
+    #[inline]
+    pub fn is_local(&self) -> bool {
+        self.cpu() == smp_get_processor_id()
+    }
+
+    /// 把当前cpu从网卡`nic_id`收到的数据帧放进积压队列，并在分片所在的cpu上调度NET_RX软中断
+    ///
+    /// `generation`是分发这些数据帧时分发表的版本号
+    fn steer(&self, nic_id: usize, frames: &mut VecDeque<Vec<u8>>, generation: usize) {
+        if frames.is_empty() {
+            return;
+        }
+        let mut backlog = self.backlog.lock_irqsave();
+        let (queue_generation, queue) = backlog
+            .entry(nic_id)
+            .or_insert((generation, VecDeque::new()));
+        if queue.is_empty() {
+            *queue_generation = generation;
+        }
+        // 积压队列满时丢弃新的数据帧，由对端重传
+        frames.truncate(NET_BACKLOG_MAX.saturating_sub(queue.len()));
+        queue.append(frames);
+        drop(backlog);
+
+        softirq_vectors().raise_softirq_on(self.cpu(), SoftirqNumber::NetRx);
+    }
+
+    /// 取出其他cpu从网卡`nic_id`收到的数据帧，放在`frames`的前面
+    ///
+    /// ## 返回值
+    /// 取出的数据帧中最早的一个是在哪一代分发表下分发的，没有取出数据帧时返回`generation`
+    fn take_backlog(
+        &self,
+        nic_id: usize,
+        frames: &mut VecDeque<Vec<u8>>,
+        generation: usize,
+    ) -> usize {
+        let mut backlog = self.backlog.lock_irqsave();
+        match backlog.get_mut(&nic_id) {
+            Some((queue_generation, queue)) if !queue.is_empty() => {
+                queue.append(frames);
+                core::mem::swap(queue, frames);
+                return *queue_generation;
+            }
+            _ => return generation,
+        }
+    }
+
+    /// 把分发之后因为socket迁移而不再属于这个分片的数据帧重新分发到它们现在所在的分片
+    ///
+    /// 调用时必须持有这个分片的`sockets`锁，保证检查之后不会再有socket迁出
+    fn resteer(&self, nic_id: usize, frames: &mut VecDeque<Vec<u8>>) {
+        let generation = SOCKET_DEMUX.generation();
+        for frame in core::mem::take(frames) {
+            let id = SOCKET_DEMUX.shard_of_frame(&frame);
+            if id == self.id {
+                frames.push_back(frame);
+            } else {
+                SOCKET_SHARDS[id].steer(nic_id, &mut VecDeque::from([frame]), generation);
+            }
+        }
+    }
+
+    /// 取出并清除分片被轮询过的标志
+    #[inline]
+    pub fn take_polled(&self) -> bool {
+        self.polled.swap(false, Ordering::AcqRel)
+    }
+
+    /// 为新的TCP/UDP socket选择分片（轮转分配）
+    pub fn alloc() -> &'static SocketShard {
+        static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+        let id = NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % SOCKET_SHARD_NUM;
+        &SOCKET_SHARDS[id]
+    }
+}
+
+/// 传输层连接的四元组
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct FourTuple {
+    /// IP层的协议号
+    pub protocol: u8,
+    pub local: wire::IpEndpoint,
+    pub remote: wire::IpEndpoint,
+}
+
+impl FourTuple {
+    pub fn new(
+        protocol: wire::IpProtocol,
+        local: wire::IpEndpoint,
+        remote: wire::IpEndpoint,
+    ) -> Self {
+        Self {
+            protocol: protocol.into(),
+            local,
+            remote,
+        }
+    }
+}
+
+/// # 数据包到socket分片的分发表
+///
+/// 先按照四元组查找已连接的socket，找不到时再按照本地端口查找绑定或者监听了这个端口的socket
+pub struct SocketDemux {
+    /// 已连接的socket：四元组 -> 分片
+    connected: RwLock<HashMap<FourTuple, usize>>,
+    /// 绑定了本地端口的socket：(协议号, 端口) -> 分片
+    bound: RwLock<HashMap<(u8, u16), usize>>,
+    /// 版本号，每次有socket迁移到其他分片时加一。
+    /// 在旧版本下分发的数据帧，处理之前需要重新分发
+    generation: AtomicUsize,
+}
+
+impl SocketDemux {
+    fn new() -> Self {
+        Self {
+            connected: RwLock::new(HashMap::new()),
+            bound: RwLock::new(HashMap::new()),
+            generation: AtomicUsize::new(0),
+        }
+    }
+
+    #[inline]
+    pub fn generation(&self) -> usize {
+        self.generation.load(Ordering::Acquire)
+    }
+
+    /// 记录已连接的socket迁移到了分片`shard`
+    ///
+    /// 调用时必须同时持有原来的分片和新分片的`sockets`锁
+    pub fn migrate(&self, tuple: FourTuple, shard: usize) {
+        self.connect(tuple, shard);
+        self.generation.fetch_add(1, Ordering::AcqRel);
+    }
+
+    /// 记录已连接的socket所在的分片
+    pub fn connect(&self, tuple: FourTuple, shard: usize) {
+        self.connected.write_irqsave().insert(tuple, shard);
+    }
+
+    pub fn disconnect(&self, tuple: &FourTuple) {
+        self.connected.write_irqsave().remove(tuple);
+    }
+
+    /// 记录绑定了本地端口的socket所在的分片
+    pub fn bind_port(&self, protocol: wire::IpProtocol, port: u16, shard: usize) {
+        self.bound
+            .write_irqsave()
+            .insert((protocol.into(), port), shard);
+    }
+
+    pub fn unbind_port(&self, protocol: wire::IpProtocol, port: u16) {
+        self.bound.write_irqsave().remove(&(protocol.into(), port));
+    }
+
+    /// 查找四元组对应的分片
+    pub fn lookup(&self, tuple: &FourTuple) -> Option<usize> {
+        if let Some(shard) = self.connected.read_irqsave().get(tuple) {
+            return Some(*shard);
+        }
+        self.bound
+            .read_irqsave()
+            .get(&(tuple.protocol, tuple.local.port))
+            .copied()
+    }
+
+    /// 查找以太网帧应当交给哪个分片处理
+    fn shard_of_frame(&self, frame: &[u8]) -> usize {
+        Self::frame_tuple(frame)
+            .and_then(|tuple| self.lookup(&tuple))
+            .unwrap_or(DEFAULT_SHARD)
+    }
+
+    /// 解析以太网帧中TCP/UDP数据包的四元组，本地端点是数据包的目的端点
+    fn frame_tuple(frame: &[u8]) -> Option<FourTuple> {
+        let frame = wire::EthernetFrame::new_checked(frame).ok()?;
+        match frame.ethertype() {
+            wire::EthernetProtocol::Ipv4 => {
+                let packet = wire::Ipv4Packet::new_checked(frame.payload()).ok()?;
+                // 只有第一个分片带有端口号，分片的数据包交给默认分片
+                if packet.more_frags() || packet.frag_offset() != 0 {
+                    return None;
+                }
+                Self::transport_tuple(
+                    packet.next_header(),
+                    wire::IpAddress::Ipv4(packet.src_addr()),
+                    wire::IpAddress::Ipv4(packet.dst_addr()),
+                    packet.payload(),
+                )
+            }
+            wire::EthernetProtocol::Ipv6 => {
+                let packet = wire::Ipv6Packet::new_checked(frame.payload()).ok()?;
+                Self::transport_tuple(
+                    packet.next_header(),
+                    wire::IpAddress::Ipv6(packet.src_addr()),
+                    wire::IpAddress::Ipv6(packet.dst_addr()),
+                    packet.payload(),
+                )
+            }
+            _ => None,
+        }
+    }
+
+    fn transport_tuple(
+        protocol: wire::IpProtocol,
+        src_addr: wire::IpAddress,
+        dst_addr: wire::IpAddress,
+        payload: &[u8],
+    ) -> Option<FourTuple> {
+        let (src_port, dst_port) = match protocol {
+            wire::IpProtocol::Tcp => {
+                let packet = wire::TcpPacket::new_checked(payload).ok()?;
+                (packet.src_port(), packet.dst_port())
+            }
+            wire::IpProtocol::Udp => {
+                let packet = wire::UdpPacket::new_checked(payload).ok()?;
+                (packet.src_port(), packet.dst_port())
+            }
+            _ => return None,
+        };
+        Some(FourTuple::new(
+            protocol,
+            wire::IpEndpoint::new(dst_addr, dst_port),
+            wire::IpEndpoint::new(src_addr, src_port),
+        ))
+    }
+}
+
+/// 轮询网卡时处理哪些分片
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PollScope {
+    /// 只处理当前cpu上的分片收到的数据帧，其他分片收到的数据帧交给分片所在的cpu。在NET_RX软中断中使用
+    Local,
+    /// 在`Local`的基础上，还处理掩码中的分片上待发送的数据。
+    /// 在系统调用通过`net_kick`请求之后的NET_RX软中断中使用
+    Kicked(u32),
+    /// 处理所有分片上待发送的数据和定时任务。在定时器中使用
+    All,
+}
+
+impl PollScope {
+    /// 是否处理分片`shard`
+    pub fn includes(&self, shard: &SocketShard) -> bool {
+        return shard.is_local() || self.services(shard);
+    }
+
+    /// 分片上即使没有收到数据帧，是否也需要轮询（处理待发送的数据和定时任务）
+    pub fn services(&self, shard: &SocketShard) -> bool {
+        match self {
+            PollScope::Local => false,
+            PollScope::Kicked(mask) => mask & (1 << shard.id()) != 0,
+            PollScope::All => true,
+        }
+    }
+}
+
+/// ## 轮询网卡，并按照分片处理收到的数据帧
+///
+/// 先在网卡接口的锁内把数据帧取出并分发到各个分片的队列，然后逐个分片持有分片的锁调用`Interface::poll`。
+/// 加锁的顺序与系统调用相同：先分片，后网卡接口。同一时刻只持有一个分片的锁。
+/// 网卡支持GRO时，同一个TCP流中序号相接的数据段在分发时就合并成一个数据帧，见`net::gro`。
+/// 不在当前cpu上的分片收到的数据帧总是交给分片所在的cpu处理。
+///
+/// ## 参数
+/// - `nic_id`：网卡的id
+/// - `iface`：网卡的smoltcp接口
+/// - `device`：网卡的smoltcp设备，只能在持有`iface`的锁时访问
+/// - `scope`：要处理的分片
+///
+/// ## 返回值
+/// 是否有socket的状态可能发生了变化
+pub fn poll_iface<D>(
+    nic_id: usize,
+    iface: &SpinLock<Interface>,
+    device: &mut D,
+    scope: PollScope,
+) -> bool
+where
+    D: ShardedDevice + ?Sized,
+{
+    return poll_iface_budget(
+        nic_id,
+        iface,
+        device,
+        NET_RX_BUDGET * NET_POLL_MAX_ROUNDS,
+        scope,
+    );
+}
+
+/// ## 轮询网卡，最多从网卡取出`budget`个数据帧
+///
+/// 与`poll_iface`相同，供NAPI按照预算轮询网卡使用。预算用完后仍然会继续处理socket上待发送的数据
+pub fn poll_iface_budget<D>(
+    nic_id: usize,
+    iface: &SpinLock<Interface>,
+    device: &mut D,
+    budget: usize,
+    scope: PollScope,
+) -> bool
+where
+    D: ShardedDevice + ?Sized,
+{
+    let mut budget = budget;
+    let gro = gro_supported(&device.capabilities());
+    let mut queues: Vec<VecDeque<Vec<u8>>> =
+        (0..SOCKET_SHARD_NUM).map(|_| VecDeque::new()).collect();
+    let mut changed = false;
+
+    for round in 0..NET_POLL_MAX_ROUNDS {
+        let (received, generation) = {
+            let _guard = iface.lock_irqsave();
+            let generation = SOCKET_DEMUX.generation();
+            let timestamp: smoltcp::time::Instant = Instant::now().into();
+            let mut received = 0;
+            while received < NET_RX_BUDGET.min(budget) {
+                let got = device.receive_frame(timestamp, |frame| {
+                    let queue = &mut queues[SOCKET_DEMUX.shard_of_frame(frame.as_slice())];
+                    // 与分片中上一个数据帧属于同一个TCP流并且序号相接时，合并成一个数据帧
+                    if gro
+                        && queue
+                            .back_mut()
+                            .is_some_and(|last| gro_merge(last, frame.as_slice()))
+                    {
+                        return;
+                    }
+                    queue.push_back(frame.into_vec());
+                });
+                if !got {
+                    break;
+                }
+                received += 1;
+            }
+            budget -= received;
+            (received, generation)
+        };
+
+        let mut progress = false;
+        for (shard, queue) in SOCKET_SHARDS.iter().zip(queues.iter_mut()) {
+            let mut frames_generation = generation;
+            if shard.is_local() {
+                frames_generation = shard.take_backlog(nic_id, queue, generation);
+            } else {
+                shard.steer(nic_id, queue, generation);
+            }
+            // 待发送的数据在第一轮就会全部交给网卡，之后的轮次只处理收到了数据帧的分片
+            if queue.is_empty() && !(round == 0 && scope.services(shard)) {
+                continue;
+            }
+
+            let mut sockets = shard.sockets.lock_irqsave();
+            if SOCKET_DEMUX.generation() != frames_generation {
+                shard.resteer(nic_id, queue);
+            }
+            shard.polled.store(true, Ordering::Release);
+            let mut guard = iface.lock_irqsave();
+            let timestamp: smoltcp::time::Instant = Instant::now().into();
+            let mut shard_device = ShardDevice {
+                inner: &mut *device,
+                rx_queue: queue,
+            };
+            progress |= guard.poll(timestamp, &mut shard_device, &mut sockets);
+        }
+        changed |= progress;
+
+        // 环回设备上新发出的数据帧要在下一轮收取
+        if received == 0 && !progress {
+            break;
+        }
+    }
+
+    return changed;
+}
+
+/// 分发时从网卡取出的数据帧
+pub enum RxFrame<'a> {
+    /// 数据帧位于网卡的接收缓冲区中，`f`返回之后缓冲区就会归还给网卡
+    Borrowed(&'a mut [u8]),
+    /// 数据帧存放在单独分配的缓冲区中，所有权可以直接交出
+    Owned(Vec<u8>),
+}
+
+impl RxFrame<'_> {
+    #[inline]
+    pub fn as_slice(&self) -> &[u8] {
+        match self {
+            RxFrame::Borrowed(frame) => frame,
+            RxFrame::Owned(frame) => frame,
+        }
+    }
+
+    /// 取得数据帧的所有权，只有数据帧位于网卡的接收缓冲区中时才需要复制
+    #[inline]
+    pub fn into_vec(self) -> Vec<u8> {
+        match self {
+            RxFrame::Borrowed(frame) => frame.to_vec(),
+            RxFrame::Owned(frame) => frame,
+        }
+    }
+}
+
+/// 按分片轮询的网卡设备
+///
+/// 分发数据帧时需要把数据帧从网卡中取出，暂存在分片的队列中。
+/// 默认实现借出网卡接收缓冲区中的数据帧，需要暂存时再复制，适用于接收缓冲区属于接收环的网卡。
+/// 数据帧本来就存放在单独分配的缓冲区中的网卡应当重写`receive_frame`，直接交出缓冲区
+pub trait ShardedDevice: phy::Device {
+    /// 取出一个数据帧交给`f`处理
+    ///
+    /// ## 返回值
+    /// 网卡上没有数据帧时返回`false`
+    fn receive_frame<F>(&mut self, timestamp: smoltcp::time::Instant, f: F) -> bool
+    where
+        F: FnOnce(RxFrame),
+    {
+        let Some((rx, _tx)) = self.receive(timestamp) else {
+            return false;
+        };
+        rx.consume(|frame| f(RxFrame::Borrowed(frame)));
+        return true;
+    }
+}
+
+/// 在一个分片上轮询时使用的smoltcp设备：只收取分发给这个分片的数据帧，发送时直接使用网卡
+struct ShardDevice<'d, D: phy::Device + ?Sized> {
+    inner: &'d mut D,
+    rx_queue: &'d mut VecDeque<Vec<u8>>,
+}
+
+impl<'d, D: phy::Device + ?Sized> phy::Device for ShardDevice<'d, D> {
+    type RxToken<'a>
+        = FrameRxToken
+    where
+        Self: 'a;
+    type TxToken<'a>
+        = ShardTxToken<D::TxToken<'a>>
+    where
+        Self: 'a;
+
+    fn receive(
+        &mut self,
+        timestamp: smoltcp::time::Instant,
+    ) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
+        let buffer = self.rx_queue.pop_front()?;
+        let tx = ShardTxToken(self.inner.transmit(timestamp));
+        return Some((FrameRxToken { buffer }, tx));
+    }
+
+    fn transmit(&mut self, timestamp: smoltcp::time::Instant) -> Option<Self::TxToken<'_>> {
+        self.inner
+            .transmit(timestamp)
+            .map(|tx| ShardTxToken(Some(tx)))
+    }
+
+    fn capabilities(&self) -> phy::DeviceCapabilities {
+        self.inner.capabilities()
+    }
+}
+
+/// 已经从网卡中取出的数据帧
+struct FrameRxToken {
+    buffer: Vec<u8>,
+}
+
+impl RxToken for FrameRxToken {
+    fn consume<R, F>(mut self, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        f(self.buffer.as_mut_slice())
+    }
+}
+
+/// 网卡的发送令牌。收到数据帧时网卡的发送队列可能已满，这时回复的数据包被丢弃
+struct ShardTxToken<T: TxToken>(Option<T>);
+
+impl<T: TxToken> TxToken for ShardTxToken<T> {
+    fn consume<R, F>(self, len: usize, f: F) -> R
+    where
+        F: FnOnce(&mut [u8]) -> R,
+    {
+        match self.0 {
+            Some(tx) => tx.consume(len, f),
+            None => f(vec![0; len].as_mut_slice()),
+        }
+    }
+}
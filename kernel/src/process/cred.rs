@@ -12,6 +12,10 @@ int_like!(Kgid, AtomicKgid, usize, AtomicUsize);
 bitflags! {
     pub struct CAPFlags:u64{
         const CAP_EMPTY_SET = 0;
+        /// 绕过发送信号时的权限检查
+        const CAP_KILL = 1 << 5;
+        /// 提高资源限制的硬限制
+        const CAP_SYS_RESOURCE = 1 << 24;
         const CAP_FULL_SET = (1 << 41) - 1;
     }
 }
@@ -75,6 +79,23 @@ impl Cred {
         }
     }
 
+    /// 是否拥有`cap`中的所有权限
+    pub fn has_capability(&self, cap: CAPFlags) -> bool {
+        return self.cap_effective.contains(cap);
+    }
+
+    /// ## 持有当前凭证的进程能否作用于持有`target`凭证的进程
+    ///
+    /// 与发送信号的检查相同：当前进程的实际uid或有效uid等于目标进程的实际uid或保存的uid，
+    /// 或者拥有CAP_KILL
+    pub fn can_act_on(&self, target: &Cred) -> bool {
+        return self.euid == target.suid
+            || self.euid == target.uid
+            || self.uid == target.suid
+            || self.uid == target.uid
+            || self.has_capability(CAPFlags::CAP_KILL);
+    }
+
     #[allow(dead_code)]
     /// Compare two credentials with respect to filesystem access.
     pub fn fscmp(&self, other: Cred) -> CredFsCmp {
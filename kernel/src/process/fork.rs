@@ -12,7 +12,6 @@ use crate::{
     mm::VirtAddr,
     process::ProcessFlags,
     sched::{sched_cgroup_fork, sched_fork},
-    smp::core::smp_get_processor_id,
     syscall::user_access::UserBufferWriter,
 };
 
@@ -194,8 +193,6 @@ impl ProcessManager {
             )
         });
 
-        pcb.sched_info().set_on_cpu(Some(smp_get_processor_id()));
-
         ProcessManager::wakeup(&pcb).unwrap_or_else(|e| {
             panic!(
                 "fork: Failed to wakeup new process, pid: [{:?}]. Error: {:?}",
@@ -16,8 +16,10 @@ use system_error::SystemError;
 use crate::{
     arch::CurrentIrqArch,
     exception::{irqdesc::IrqAction, InterruptArch},
+    filesystem::vfs::file::FileDescriptorVec,
     init::initial_kthread::initial_kernel_thread,
-    libs::{once::Once, spinlock::SpinLock},
+    libs::{once::Once, rwlock::RwLock, spinlock::SpinLock},
+    mm::{tlb::switch_mm, ucontext::AddressSpace},
     process::{ProcessManager, ProcessState},
     sched::{schedule, SchedMode},
 };
@@ -445,6 +447,60 @@ impl KernelThreadMechanism {
             .contains(KernelThreadFlags::SHOULD_STOP);
     }
 
+    /// ## 让当前内核线程临时使用一个用户进程的地址空间和文件描述符表
+    ///
+    /// 之后访问用户缓冲区、按文件描述符查找文件都以该进程的身份进行，供代替用户进程执行系统调用的工作线程使用。
+    ///
+    /// ## 返回值
+    ///
+    /// 守卫，drop时切换回内核线程原来的地址空间和文件描述符表
+    ///
+    /// ## Panic
+    ///
+    /// 如果当前进程不是内核线程，会panic
+    pub fn use_user_context(
+        vm: Arc<AddressSpace>,
+        fd_table: Arc<RwLock<FileDescriptorVec>>,
+    ) -> KernelThreadUserContext {
+        let pcb = ProcessManager::current_pcb();
+        assert!(
+            pcb.flags().contains(ProcessFlags::KTHREAD),
+            "use_user_context: current process is not a kthread, pid: {:?}",
+            pcb.pid()
+        );
+        let (old_vm, old_fd_table) =
+            unsafe { Self::switch_user_context(&pcb, Some(vm), Some(fd_table)) };
+        return KernelThreadUserContext {
+            old_vm,
+            old_fd_table,
+        };
+    }
+
+    /// 替换pcb中的地址空间和文件描述符表并加载新的页表，返回原来的地址空间和文件描述符表
+    unsafe fn switch_user_context(
+        pcb: &Arc<ProcessControlBlock>,
+        vm: Option<Arc<AddressSpace>>,
+        fd_table: Option<Arc<RwLock<FileDescriptorVec>>>,
+    ) -> (
+        Option<Arc<AddressSpace>>,
+        Option<Arc<RwLock<FileDescriptorVec>>>,
+    ) {
+        // 关中断，避免在替换地址空间之后、加载页表之前被调度
+        let irq_guard = CurrentIrqArch::save_and_disable_irq();
+        let mut basic = pcb.basic_mut();
+        let old_vm = basic.user_vm();
+        let old_fd_table = basic.fd_table();
+        basic.set_user_vm(vm.clone());
+        basic.set_fd_table(fd_table);
+        drop(basic);
+        switch_mm(
+            old_vm.as_ref(),
+            vm.as_ref().expect("kthread must have an address space"),
+        );
+        drop(irq_guard);
+        return (old_vm, old_fd_table);
+    }
+
     /// A daemon thread which creates other kernel threads
     #[inline(never)]
     fn kthread_daemon() -> i32 {
@@ -485,6 +541,26 @@ impl KernelThreadMechanism {
     }
 }
 
+/// 内核线程临时使用用户进程上下文的守卫，见`KernelThreadMechanism::use_user_context`
+#[derive(Debug)]
+pub struct KernelThreadUserContext {
+    old_vm: Option<Arc<AddressSpace>>,
+    old_fd_table: Option<Arc<RwLock<FileDescriptorVec>>>,
+}
+
+impl Drop for KernelThreadUserContext {
+    fn drop(&mut self) {
+        let pcb = ProcessManager::current_pcb();
+        unsafe {
+            KernelThreadMechanism::switch_user_context(
+                &pcb,
+                self.old_vm.take(),
+                self.old_fd_table.take(),
+            )
+        };
+    }
+}
+
 /// 内核线程启动的第二阶段
 ///
 /// 该函数只能被`kernel_thread_bootstrap_stage1`调用（jmp到该函数）
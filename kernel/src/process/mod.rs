@@ -29,7 +29,10 @@ use crate::{
     exception::InterruptArch,
     filesystem::{
         procfs::procfs_unregister_pid,
-        vfs::{file::FileDescriptorVec, FileType},
+        vfs::{
+            file::{FdChunks, File, FileDescriptorVec},
+            FileType,
+        },
     },
     ipc::signal_types::{SigInfo, SigPending, SignalStruct},
     libs::{
@@ -37,7 +40,7 @@ use crate::{
         casting::DowncastArc,
         futex::{
             constant::{FutexFlag, FUTEX_BITSET_MATCH_ANY},
-            futex::{Futex, RobustListHead},
+            futex::{Futex, FutexPiTaskState, RobustListHead},
         },
         lock_free_flags::LockFreeFlags,
         rwlock::{RwLock, RwLockReadGuard, RwLockWriteGuard},
@@ -53,8 +56,8 @@ use crate::{
     net::socket::SocketInode,
     sched::completion::Completion,
     sched::{
-        cpu_rq, fair::FairSchedEntity, prio::MAX_PRIO, DequeueFlag, EnqueueFlag, OnRq, SchedMode,
-        WakeupFlags, __schedule,
+        balance::select_task_rq, cpu_rq, fair::FairSchedEntity, prio::MAX_PRIO, DequeueFlag,
+        EnqueueFlag, OnRq, SchedMode, WakeupFlags, __schedule,
     },
     smp::{
         core::smp_get_processor_id,
@@ -62,6 +65,7 @@ use crate::{
         kick_cpu,
     },
     syscall::{user_access::clear_user, Syscall},
+    time::timer::{SleepTimerHelper, Timer},
 };
 use timer::AlarmTimer;
 
@@ -238,17 +242,23 @@ impl ProcessManager {
                 // avoid deadlock
                 drop(writer);
 
-                let rq =
-                    cpu_rq(pcb.sched_info().on_cpu().unwrap_or(current_cpu_id()).data() as usize);
+                let prev_cpu = pcb.sched_info().on_cpu().unwrap_or(current_cpu_id());
+                // 选择唤醒后运行的cpu，可能会把任务迁移到更空闲的cpu上
+                let cpu = select_task_rq(pcb, prev_cpu);
+                let (mut enqueue_flags, wake_flags) = if cpu != prev_cpu {
+                    (EnqueueFlag::ENQUEUE_MIGRATED, WakeupFlags::WF_MIGRATED)
+                } else {
+                    (EnqueueFlag::empty(), WakeupFlags::empty())
+                };
+                enqueue_flags |= EnqueueFlag::ENQUEUE_WAKEUP | EnqueueFlag::ENQUEUE_NOCLOCK;
+
+                let rq = cpu_rq(cpu.data() as usize);
 
                 let (rq, _guard) = rq.self_lock();
                 rq.update_rq_clock();
-                rq.activate_task(
-                    pcb,
-                    EnqueueFlag::ENQUEUE_WAKEUP | EnqueueFlag::ENQUEUE_NOCLOCK,
-                );
+                rq.activate_task(pcb, enqueue_flags);
 
-                rq.check_preempt_currnet(pcb, WakeupFlags::empty());
+                rq.check_preempt_currnet(pcb, wake_flags);
 
                 // sched_enqueue(pcb.clone(), true);
                 return Ok(());
@@ -415,6 +425,7 @@ impl ProcessManager {
         }
 
         RobustListHead::exit_robust_list(pcb.clone());
+        Futex::exit_pi_state_list(&pcb);
 
         // 如果是vfork出来的进程，则需要处理completion
         if thread.vfork_done.is_some() {
@@ -657,9 +668,15 @@ pub struct ProcessControlBlock {
     ///闹钟定时器
     alarm_timer: SpinLock<Option<AlarmTimer>>,
 
+    /// 进程在内核中限时睡眠时使用的定时器，第一次使用时创建，之后反复使用
+    sleep_timer: SpinLock<Option<Arc<Timer>>>,
+
     /// 进程的robust lock列表
     robust_list: RwLock<Option<RobustListHead>>,
 
+    /// 进程持有和正在等待的优先级继承futex
+    futex_pi: SpinLock<FutexPiTaskState>,
+
     /// 进程作为主体的凭证集
     cred: SpinLock<Cred>,
 }
@@ -743,7 +760,9 @@ impl ProcessControlBlock {
             wait_queue: WaitQueue::default(),
             thread: RwLock::new(ThreadInfo::new()),
             alarm_timer: SpinLock::new(None),
+            sleep_timer: SpinLock::new(None),
             robust_list: RwLock::new(None),
+            futex_pi: SpinLock::new(FutexPiTaskState::default()),
             cred: SpinLock::new(cred),
         };
 
@@ -897,6 +916,19 @@ impl ProcessControlBlock {
         return self.basic.read().fd_table().unwrap();
     }
 
+    /// ## 根据文件描述符序号获取文件
+    ///
+    /// 不需要获取文件描述符表的锁，用于read、write等频繁调用的系统调用
+    #[inline(always)]
+    pub fn get_file(&self, fd: i32) -> Option<Arc<File>> {
+        return self
+            .basic
+            .read()
+            .fd_chunks
+            .as_ref()
+            .and_then(|chunks| chunks.get_file(fd));
+    }
+
     #[inline(always)]
     pub fn cred(&self) -> Cred {
         self.cred.lock().clone()
@@ -912,11 +944,7 @@ impl ProcessControlBlock {
     ///
     /// Option(&mut Box<dyn Socket>) socket对象的可变引用. 如果文件描述符不是socket，那么返回None
     pub fn get_socket(&self, fd: i32) -> Option<Arc<SocketInode>> {
-        let binding = ProcessManager::current_pcb().fd_table();
-        let fd_table_guard = binding.read();
-
-        let f = fd_table_guard.get_file_by_fd(fd)?;
-        drop(fd_table_guard);
+        let f = ProcessManager::current_pcb().get_file(fd)?;
 
         if f.file_type() != FileType::Socket {
             return None;
@@ -1019,9 +1047,25 @@ impl ProcessControlBlock {
         *self.robust_list.write_irqsave() = new_robust_list;
     }
 
+    #[inline(always)]
+    pub fn futex_pi_irqsave(&self) -> SpinLockGuard<FutexPiTaskState> {
+        return self.futex_pi.lock_irqsave();
+    }
+
     pub fn alarm_timer_irqsave(&self) -> SpinLockGuard<Option<AlarmTimer>> {
         return self.alarm_timer.lock_irqsave();
     }
+
+    /// ## 获取进程的睡眠定时器
+    ///
+    /// 用`Timer::rearm`设置到期时间，到期时唤醒进程。同一时刻只能用于一次睡眠，不需要时应当取消
+    pub fn sleep_timer(self: &Arc<Self>) -> Arc<Timer> {
+        return self
+            .sleep_timer
+            .lock_irqsave()
+            .get_or_insert_with(|| Timer::new(SleepTimerHelper::new(Arc::downgrade(self)), 0))
+            .clone();
+    }
 }
 
 impl Drop for ProcessControlBlock {
@@ -1090,6 +1134,9 @@ pub struct ProcessBasicInfo {
 
     /// 文件描述符表
     fd_table: Option<Arc<RwLock<FileDescriptorVec>>>,
+
+    /// 文件描述符表的槽位，与`fd_table`一同设置，查找文件时不需要获取文件描述符表的锁
+    fd_chunks: Option<Arc<FdChunks>>,
 }
 
 impl ProcessBasicInfo {
@@ -1102,7 +1149,9 @@ impl ProcessBasicInfo {
         cwd: String,
         user_vm: Option<Arc<AddressSpace>>,
     ) -> RwLock<Self> {
-        let fd_table = Arc::new(RwLock::new(FileDescriptorVec::new()));
+        let fd_table = FileDescriptorVec::new();
+        let fd_chunks = fd_table.chunks();
+        let fd_table = Arc::new(RwLock::new(fd_table));
         return RwLock::new(Self {
             pgid,
             ppid,
@@ -1111,6 +1160,7 @@ impl ProcessBasicInfo {
             cwd,
             user_vm,
             fd_table: Some(fd_table),
+            fd_chunks: Some(fd_chunks),
         });
     }
 
@@ -1154,6 +1204,7 @@ impl ProcessBasicInfo {
     }
 
     pub fn set_fd_table(&mut self, fd_table: Option<Arc<RwLock<FileDescriptorVec>>>) {
+        self.fd_chunks = fd_table.as_ref().map(|fd_table| fd_table.read().chunks());
         self.fd_table = fd_table;
     }
 }
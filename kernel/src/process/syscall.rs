@@ -6,7 +6,7 @@ use system_error::SystemError;
 
 use super::{
     abi::WaitOption,
-    cred::{Kgid, Kuid},
+    cred::{CAPFlags, Kgid, Kuid},
     exit::kernel_wait4,
     fork::{CloneFlags, KernelCloneArgs},
     resource::{RLimit64, RLimitID, RUsage, RUsageWho},
@@ -14,15 +14,14 @@ use super::{
 };
 use crate::{
     arch::{interrupt::TrapFrame, MMArch},
-    filesystem::{
-        procfs::procfs_register_pid,
-        vfs::{file::FileDescriptorVec, MAX_PATHLEN},
-    },
+    filesystem::{procfs::procfs_register_pid, vfs::MAX_PATHLEN},
     mm::{ucontext::UserStack, verify_area, MemoryManagementArch, VirtAddr},
     process::ProcessControlBlock,
     sched::completion::Completion,
     syscall::{
-        user_access::{check_and_clone_cstr, check_and_clone_cstr_array, UserBufferWriter},
+        user_access::{
+            check_and_clone_cstr, check_and_clone_cstr_array, UserBufferReader, UserBufferWriter,
+        },
         Syscall,
     },
 };
@@ -420,7 +419,7 @@ impl Syscall {
 
     /// # 设置资源限制
     ///
-    /// TODO: 目前暂时不支持设置资源限制，只提供读取默认值的功能
+    /// 目前只支持设置RLIMIT_NOFILE，其他资源只提供读取默认值的功能
     ///
     /// ## 参数
     ///
@@ -435,13 +434,19 @@ impl Syscall {
     /// - 如果old_limit不为NULL，则返回旧的资源限制到old_limit
     ///
     pub fn prlimit64(
-        _pid: Pid,
+        pid: Pid,
         resource: usize,
-        _new_limit: *const RLimit64,
+        new_limit: *const RLimit64,
         old_limit: *mut RLimit64,
     ) -> Result<usize, SystemError> {
         let resource = RLimitID::try_from(resource)?;
         let mut writer = None;
+        let mut new = None;
+
+        if !new_limit.is_null() {
+            let reader = UserBufferReader::new(new_limit, core::mem::size_of::<RLimit64>(), true)?;
+            new = Some(*reader.read_one_from_user::<RLimit64>(0)?);
+        }
 
         if !old_limit.is_null() {
             writer = Some(UserBufferWriter::new(
@@ -454,7 +459,7 @@ impl Syscall {
         match resource {
             RLimitID::Stack => {
                 if let Some(mut writer) = writer {
-                    let mut rlimit = writer.buffer::<RLimit64>(0).unwrap()[0];
+                    let rlimit = &mut writer.buffer::<RLimit64>(0).unwrap()[0];
                     rlimit.rlim_cur = UserStack::DEFAULT_USER_STACK_SIZE as u64;
                     rlimit.rlim_max = UserStack::DEFAULT_USER_STACK_SIZE as u64;
                 }
@@ -462,17 +467,36 @@ impl Syscall {
             }
 
             RLimitID::Nofile => {
+                // RLIMIT_NOFILE保存在文件描述符表中，共享文件描述符表的线程使用同一个限制
+                let current = ProcessManager::current_pcb();
+                let cred = current.cred();
+                let pcb = if pid.data() == 0 {
+                    current.clone()
+                } else {
+                    ProcessManager::find(pid).ok_or(SystemError::ESRCH)?
+                };
+                // 访问其他进程的资源限制，需要有向它发送信号的权限
+                if !Arc::ptr_eq(&pcb, &current) && !cred.can_act_on(&pcb.cred()) {
+                    return Err(SystemError::EPERM);
+                }
+                let fd_table = pcb.fd_table();
+                let mut fd_table_guard = fd_table.write();
+                let old = fd_table_guard.rlimit_nofile();
+                if let Some(new) = new {
+                    fd_table_guard
+                        .set_rlimit_nofile(new, cred.has_capability(CAPFlags::CAP_SYS_RESOURCE))?;
+                }
+                drop(fd_table_guard);
+
                 if let Some(mut writer) = writer {
-                    let mut rlimit = writer.buffer::<RLimit64>(0).unwrap()[0];
-                    rlimit.rlim_cur = FileDescriptorVec::PROCESS_MAX_FD as u64;
-                    rlimit.rlim_max = FileDescriptorVec::PROCESS_MAX_FD as u64;
+                    writer.copy_one_to_user(&old, 0)?;
                 }
                 return Ok(0);
             }
 
             RLimitID::As | RLimitID::Rss => {
                 if let Some(mut writer) = writer {
-                    let mut rlimit = writer.buffer::<RLimit64>(0).unwrap()[0];
+                    let rlimit = &mut writer.buffer::<RLimit64>(0).unwrap()[0];
                     rlimit.rlim_cur = MMArch::USER_END_VADDR.data() as u64;
                     rlimit.rlim_max = MMArch::USER_END_VADDR.data() as u64;
                 }
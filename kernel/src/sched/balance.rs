@@ -0,0 +1,256 @@
+//! CFS的负载均衡
+//!
+//! - 任务被创建和唤醒时，通过`select_task_rq_fork`/`select_task_rq`为它选择运行的cpu
+//! - 时钟中断中周期性地检查各个cpu的负载，从最繁忙的cpu拉取任务
+//! - cpu即将进入idle时，立即尝试从最繁忙的cpu拉取一个任务
+//!
+//! 只会迁移在运行队列中排队、但没有在运行的任务。
+//!
+//! 参考：https://code.dragonos.org.cn/xref/linux-6.6.21/kernel/sched/fair.c
+
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::{
+    process::{ProcessControlBlock, ProcessFlags},
+    smp::{
+        core::smp_get_processor_id,
+        cpu::{smp_cpu_manager, ProcessorId},
+    },
+    time::{clocksource::HZ, timer::clock},
+};
+
+use super::{
+    cpu_rq, set_task_cpu, CpuRunQueue, DequeueFlag, EnqueueFlag, OnRq, SchedPolicy, WakeupFlags,
+};
+
+/// cpu空闲时周期性负载均衡的间隔（jiffies）
+const BALANCE_INTERVAL_IDLE: u64 = 1;
+/// cpu繁忙时周期性负载均衡的间隔（jiffies）
+const BALANCE_INTERVAL_BUSY: u64 = HZ / 16;
+/// 负载之比超过这个百分比时，才认为两个cpu之间的负载不均衡
+const IMBALANCE_PCT: u64 = 117;
+/// 一次负载均衡最多迁移的任务数
+const MAX_MIGRATE_TASKS: usize = 32;
+
+/// 用于比较cpu繁忙程度的键：先比较运行的任务数，再比较负载
+#[inline]
+fn rq_key(rq: &CpuRunQueue) -> (usize, u64) {
+    (rq.nr_running, rq.cfs.runnable_load())
+}
+
+/// 遍历所有已经开始调度的cpu的运行队列
+fn active_rqs() -> impl Iterator<Item = Arc<CpuRunQueue>> {
+    smp_cpu_manager()
+        .present_cpus()
+        .iter_cpu()
+        .map(|cpu| cpu_rq(cpu.data() as usize))
+        .filter(|rq| rq.is_active())
+}
+
+/// 找出最空闲的cpu，相同时优先选择`prefer`
+fn find_idlest_cpu(prefer: usize) -> usize {
+    let mut idlest = prefer;
+    let mut idlest_key = rq_key(&cpu_rq(prefer));
+    for rq in active_rqs() {
+        let key = rq_key(&rq);
+        if key < idlest_key {
+            idlest = rq.cpu;
+            idlest_key = key;
+        }
+    }
+    return idlest;
+}
+
+/// 找出最繁忙的、有任务可以被迁移走的cpu
+fn find_busiest_rq(this_cpu: usize) -> Option<Arc<CpuRunQueue>> {
+    let mut busiest: Option<(Arc<CpuRunQueue>, (usize, u64))> = None;
+    for rq in active_rqs() {
+        // 除了正在运行的任务之外，至少还要有一个排队的任务
+        if rq.cpu == this_cpu || rq.nr_running < 2 {
+            continue;
+        }
+        let key = rq_key(&rq);
+        if busiest.as_ref().map_or(true, |(_, k)| key.1 > k.1) {
+            busiest = Some((rq, key));
+        }
+    }
+    return busiest.map(|(rq, _)| rq);
+}
+
+/// 判断从`src`迁移任务到`dst`是否能改善负载均衡
+#[inline]
+fn imbalanced(src: (usize, u64), dst: (usize, u64)) -> bool {
+    if dst.0 == 0 {
+        return src.0 > 0;
+    }
+    return src.0 > dst.0 + 1 || src.1 * 100 > dst.1 * IMBALANCE_PCT;
+}
+
+/// ## 为新创建的任务选择运行的cpu
+///
+/// 新任务没有缓存亲和性，直接选择最空闲的cpu，相同时留在当前cpu
+pub fn select_task_rq_fork() -> ProcessorId {
+    let this_cpu = smp_get_processor_id().data() as usize;
+    return ProcessorId::new(find_idlest_cpu(this_cpu) as u32);
+}
+
+/// ## 为被唤醒的任务选择运行的cpu
+///
+/// 原来的cpu空闲时留在原来的cpu上，以利用缓存中的数据；否则在负载差距足够大时迁移到最空闲的cpu上。
+///
+/// 返回的cpu与`prev_cpu`不同时，已经通过`set_task_cpu`把任务设置到了新的cpu上
+///
+/// ## 参数
+///
+/// - `pcb`: 被唤醒的任务，调用者已经把它的状态设置为Runnable，但还没有入队
+/// - `prev_cpu`: 任务上一次运行的cpu
+pub fn select_task_rq(pcb: &Arc<ProcessControlBlock>, prev_cpu: ProcessorId) -> ProcessorId {
+    if pcb.sched_info().policy() != SchedPolicy::CFS {
+        return prev_cpu;
+    }
+
+    let prev_rq = cpu_rq(prev_cpu.data() as usize);
+    if prev_rq.nr_running == 0 {
+        return prev_cpu;
+    }
+
+    let target = find_idlest_cpu(prev_rq.cpu);
+    if target == prev_rq.cpu || !imbalanced(rq_key(&prev_rq), rq_key(&cpu_rq(target))) {
+        return prev_cpu;
+    }
+
+    // 任务可能刚刚把自己标记为睡眠，还没有从原来的cpu上切换出去，此时不能迁移。
+    // 原来的cpu在切换进程的过程中一直持有rq的锁，因此拿到锁后任务不是current就说明已经切换完成
+    let (prev_rq, guard) = prev_rq.self_lock();
+    if guard.is_none() || Arc::ptr_eq(&prev_rq.current(), pcb) {
+        // 本cpu已经持有了原来的rq的锁，不能在释放它之前再去获取目标rq的锁
+        return prev_cpu;
+    }
+    let target = ProcessorId::new(target as u32);
+    set_task_cpu(pcb, target);
+    drop(guard);
+
+    return target;
+}
+
+/// 判断任务能否从`src`迁移走
+fn can_migrate_task(src: &CpuRunQueue, pcb: &Arc<ProcessControlBlock>) -> bool {
+    if pcb.sched_info().policy() != SchedPolicy::CFS
+        || pcb.flags().contains(ProcessFlags::EXITING)
+        || Arc::ptr_eq(&src.current(), pcb)
+    {
+        return false;
+    }
+    if let Some(curr) = src.cfs.current() {
+        if Arc::ptr_eq(&curr, &pcb.sched_info().sched_entity()) {
+            return false;
+        }
+    }
+    return *pcb.sched_info().on_rq.lock_irqsave() == OnRq::Queued;
+}
+
+/// 把一个排队中的任务从`src`迁移到`dst`，调用者需要持有两个rq的锁，并已经更新了两个rq的时钟
+fn move_queued_task(src: &mut CpuRunQueue, dst: &mut CpuRunQueue, pcb: &Arc<ProcessControlBlock>) {
+    src.deactivate_task(pcb.clone(), DequeueFlag::DEQUEUE_NOCLOCK);
+    set_task_cpu(pcb, ProcessorId::new(dst.cpu as u32));
+    dst.activate_task(pcb, EnqueueFlag::ENQUEUE_NOCLOCK);
+    dst.check_preempt_currnet(pcb, WakeupFlags::WF_MIGRATED);
+}
+
+/// ## 从最繁忙的cpu向`this`拉取任务
+///
+/// ## 参数
+///
+/// - `this`: 本cpu的rq，调用者需要持有它的锁
+/// - `max_tasks`: 最多迁移的任务数
+///
+/// ## 返回值
+///
+/// 迁移的任务数
+fn load_balance(this: &mut CpuRunQueue, max_tasks: usize) -> usize {
+    let busiest_rq = match find_busiest_rq(this.cpu) {
+        Some(rq) => rq,
+        None => return 0,
+    };
+
+    let this_key = rq_key(this);
+    if !imbalanced(rq_key(&busiest_rq), this_key) {
+        return 0;
+    }
+
+    // 本cpu已经持有自己的rq的锁，只尝试获取对方的锁，获取不到就等下一次均衡
+    let (busiest, _guard) = match busiest_rq.try_self_lock() {
+        Some(r) => r,
+        None => return 0,
+    };
+
+    // 拿到锁之后重新检查
+    let busiest_key = rq_key(busiest);
+    if busiest_key.0 < 2 || !imbalanced(busiest_key, this_key) {
+        return 0;
+    }
+    // 需要迁移的负载量：把两者的负载拉平
+    let mut imbalance = busiest_key.1.saturating_sub(this_key.1) / 2;
+
+    busiest.update_rq_clock();
+    this.update_rq_clock();
+
+    // 最近入队的任务在链表末尾，它们的缓存最冷，优先迁移
+    let src: &CpuRunQueue = busiest;
+    let candidates: Vec<Arc<ProcessControlBlock>> = src
+        .cfs_tasks
+        .iter()
+        .rev()
+        .map(|se| se.pcb())
+        .filter(|pcb| can_migrate_task(src, pcb))
+        .take(max_tasks.min(MAX_MIGRATE_TASKS))
+        .collect();
+
+    let mut moved = 0;
+    for pcb in candidates.iter() {
+        if busiest.nr_running <= 1 || imbalance == 0 {
+            break;
+        }
+        let load = pcb.sched_info().sched_entity().task_load();
+        // 任务的负载不小于两者的负载差时，迁移它只会让不均衡反过来
+        if load >= imbalance * 2 {
+            continue;
+        }
+        move_queued_task(busiest, this, pcb);
+        imbalance = imbalance.saturating_sub(load);
+        moved += 1;
+    }
+
+    return moved;
+}
+
+/// ## 周期性负载均衡，在时钟中断中调用
+///
+/// cpu空闲时每个tick都检查一次，繁忙时间隔`BALANCE_INTERVAL_BUSY`个tick检查一次
+pub fn trigger_load_balance(cpu: usize) {
+    let rq = cpu_rq(cpu);
+    if !rq.is_active() || clock() < rq.next_balance {
+        return;
+    }
+
+    let (rq, _guard) = rq.self_lock();
+    let idle = rq.nr_running == 0;
+    rq.next_balance = clock()
+        + if idle {
+            BALANCE_INTERVAL_IDLE
+        } else {
+            BALANCE_INTERVAL_BUSY
+        };
+
+    load_balance(rq, usize::MAX);
+}
+
+/// ## cpu即将进入idle时调用，尝试从最繁忙的cpu拉取一个任务
+///
+/// 调用者需要持有`this`的锁
+pub fn newidle_balance(this: &mut CpuRunQueue) {
+    if !this.is_active() {
+        return;
+    }
+    load_balance(this, 1);
+}
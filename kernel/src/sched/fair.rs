@@ -9,8 +9,7 @@ use crate::libs::spinlock::SpinLock;
 use crate::process::ProcessControlBlock;
 use crate::process::ProcessFlags;
 use crate::sched::clock::ClockUpdataFlag;
-use crate::sched::{cpu_rq, SchedFeature, SCHED_FEATURES};
-use crate::smp::core::smp_get_processor_id;
+use crate::sched::{SchedFeature, SCHED_FEATURES};
 use crate::time::jiffies::TICK_NESC;
 use crate::time::timer::clock;
 use crate::time::NSEC_PER_MSEC;
@@ -138,6 +137,14 @@ impl FairSchedEntity {
         self.cfs_rq = cfs;
     }
 
+    /// ## 调度实体的负载，负载均衡时用来估计迁移的负载量
+    ///
+    /// 取PELT负载均值与权重中的较大者，刚开始运行的任务还没有积累负载均值
+    #[inline]
+    pub fn task_load(&self) -> u64 {
+        (self.avg.load_avg as u64).max(LoadWeight::scale_load_down(self.load.weight))
+    }
+
     pub fn parent(&self) -> Option<Arc<FairSchedEntity>> {
         self.parent.upgrade()
     }
@@ -150,6 +157,16 @@ impl FairSchedEntity {
         }
     }
 
+    /// 任务的优先级是否通过优先级继承被提升了，即任务持有更高优先级的任务正在等待的PI锁
+    pub fn is_pi_boosted(&self) -> bool {
+        if !self.is_task() {
+            return false;
+        }
+        let pcb = self.pcb();
+        let prio_data = pcb.sched_info().prio_data.read_irqsave();
+        return prio_data.prio < prio_data.normal_prio;
+    }
+
     /// 判断是否是进程持有的调度实体
     #[inline]
     pub fn is_task(&self) -> bool {
@@ -416,6 +433,14 @@ impl CfsRunQueue {
         self.rq = rq;
     }
 
+    /// ## 队列的负载，用于负载均衡
+    ///
+    /// 取PELT负载均值与队列中调度实体的权重之和中的较大者
+    #[inline]
+    pub fn runnable_load(&self) -> u64 {
+        (self.avg.load_avg as u64).max(LoadWeight::scale_load_down(self.load.weight))
+    }
+
     #[inline]
     #[allow(clippy::mut_from_ref)]
     pub fn force_mut(&self) -> &mut Self {
@@ -1000,6 +1025,11 @@ impl CfsRunQueue {
 
         se.force_mut().on_rq = OnRq::Queued;
 
+        // 被提升了优先级的任务在睡眠期间失去了next buddy，重新入队时恢复。正在运行的任务由put_prev_entity处理
+        if !is_curr && se.is_pi_boosted() {
+            self.next = Arc::downgrade(se);
+        }
+
         if self.nr_running == 1 {
             // 只有上面加入的
             // TODO: throttle
@@ -1058,6 +1088,11 @@ impl CfsRunQueue {
 
         if prev.on_rq() {
             self.inner_enqueue_entity(&prev);
+
+            // set_next_entity选中它时清除了next buddy，优先级仍被提升时重新设置，见CompletelyFairScheduler::prio_changed
+            if prev.is_pi_boosted() {
+                self.next = Arc::downgrade(&prev);
+            }
         }
 
         self.set_current(Weak::default());
@@ -1075,6 +1110,8 @@ impl CfsRunQueue {
 
         self.set_current(Arc::downgrade(se));
 
+        // 从被选中时开始计算运行时间，排队等待的时间以及迁移前在其他cpu上的时钟都不计入
+        se.force_mut().exec_start = self.rq().clock_task();
         se.force_mut().prev_sum_exec_runtime = se.sum_exec_runtime;
     }
 
@@ -1346,11 +1383,15 @@ impl CfsRunQueue {
 
     /// pick下一个运行的task
     pub fn pick_next_entity(&self) -> Option<Arc<FairSchedEntity>> {
-        if SCHED_FEATURES.contains(SchedFeature::NEXT_BUDDY)
-            && self.next().is_some()
-            && self.entity_eligible(&self.next().unwrap())
-        {
-            return self.next();
+        if let Some(next) = self.next() {
+            // 优先级被继承提升的任务不受公平性限制，尽快运行以释放高优先级任务等待的锁，见prio_changed
+            if next.on_rq == OnRq::Queued
+                && (next.is_pi_boosted()
+                    || (SCHED_FEATURES.contains(SchedFeature::NEXT_BUDDY)
+                        && self.entity_eligible(&next)))
+            {
+                return Some(next);
+            }
         }
         self.entities.get_first().map(|val| val.1.clone())
     }
@@ -1381,6 +1422,43 @@ impl Default for CfsRunQueue {
 pub struct CompletelyFairScheduler;
 
 impl CompletelyFairScheduler {
+    /// ## 任务的有效优先级改变之后检查是否需要重新调度
+    ///
+    /// 参考Linux的prio_changed_fair：正在运行的任务优先级降低时让出cpu，其他任务优先级提高时尝试抢占当前任务。
+    ///
+    /// CFS的任务目前都没有按照nice值设置负载权重（权重均为0，vruntime按相同的速度增长），
+    /// 因此不能像Linux那样通过reweight_entity体现优先级继承。被提升了优先级的任务被设为所在队列的next buddy，
+    /// 在`pick_next_entity`中优先于其他任务被选中。set_next_entity每次选中任务时都会清除buddy，
+    /// 因此任务在被抢占（`put_prev_entity`）或者重新入队（`enqueue_entity`）时，只要优先级仍被提升就重新设置，
+    /// 直到优先级恢复为止。这里只需要处理正在队列中等待的任务
+    pub fn prio_changed(rq: &mut CpuRunQueue, pcb: &Arc<ProcessControlBlock>, old_prio: i32) {
+        if *pcb.sched_info().on_rq.lock_irqsave() != OnRq::Queued || rq.nr_running <= 1 {
+            return;
+        }
+
+        let prio = pcb.sched_info().prio_data.read_irqsave().prio;
+        if Arc::ptr_eq(&rq.current(), pcb) {
+            if prio > old_prio {
+                rq.resched_current();
+            }
+            return;
+        }
+
+        let mut se = pcb.sched_info().sched_entity();
+        if prio < old_prio {
+            FairSchedEntity::for_each_in_group(&mut se, |se| {
+                if !se.on_rq() {
+                    return (false, true);
+                }
+                se.cfs_rq().force_mut().next = Arc::downgrade(&se);
+                return (true, true);
+            });
+        } else {
+            se.cfs_rq().force_mut().clear_buddies(&se);
+        }
+        rq.check_preempt_currnet(pcb, WakeupFlags::empty());
+    }
+
     /// 寻找到最近公共组长
     fn find_matching_se(se: &mut Arc<FairSchedEntity>, pse: &mut Arc<FairSchedEntity>) {
         let mut se_depth = se.depth;
@@ -1687,8 +1765,9 @@ impl Scheduler for CompletelyFairScheduler {
     }
 
     fn task_fork(pcb: Arc<ProcessControlBlock>) {
-        let rq = cpu_rq(smp_get_processor_id().data() as usize);
         let se = pcb.sched_info().sched_entity();
+        // 新任务所在的cpu已经由sched_cgroup_fork选好
+        let rq = se.cfs_rq().rq();
 
         let (rq, _guard) = rq.self_lock();
 
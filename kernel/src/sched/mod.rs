@@ -1,3 +1,4 @@
+pub mod balance;
 pub mod clock;
 pub mod completion;
 pub mod cputime;
@@ -9,7 +10,7 @@ pub mod syscall;
 
 use core::{
     intrinsics::{likely, unlikely},
-    sync::atomic::{compiler_fence, fence, AtomicUsize, Ordering},
+    sync::atomic::{compiler_fence, fence, AtomicBool, AtomicUsize, Ordering},
 };
 
 use alloc::{
@@ -290,6 +291,8 @@ pub struct CpuRunQueue {
     lock_on_who: AtomicUsize,
 
     cpu: usize,
+    /// 该cpu已经开始调度，可以参与负载均衡
+    active: AtomicBool,
     clock_task: u64,
     clock: u64,
     prev_irq_time: u64,
@@ -334,6 +337,7 @@ impl CpuRunQueue {
             lock: SpinLock::new(()),
             lock_on_who: AtomicUsize::new(usize::MAX),
             cpu,
+            active: AtomicBool::new(false),
             clock_task: 0,
             clock: 0,
             prev_irq_time: 0,
@@ -386,6 +390,23 @@ impl CpuRunQueue {
         }
     }
 
+    /// 尝试获取rq的锁，获取失败时返回None
+    ///
+    /// 用于在持有本cpu的rq的锁时获取另一个cpu的rq的锁（如负载均衡），不会因为两个cpu互相等待而死锁
+    pub fn try_self_lock(&self) -> Option<(&mut Self, SpinLockGuard<()>)> {
+        let guard = self.lock.try_lock_irqsave().ok()?;
+        self.lock_on_who
+            .store(smp_get_processor_id().data() as usize, Ordering::SeqCst);
+        Some((
+            unsafe {
+                (self as *const Self as usize as *mut Self)
+                    .as_mut()
+                    .unwrap()
+            },
+            guard,
+        ))
+    }
+
     fn lock(&self) -> SpinLockGuard<()> {
         let guard = self.lock.lock_irqsave();
 
@@ -453,10 +474,6 @@ impl CpuRunQueue {
             flags |= EnqueueFlag::ENQUEUE_MIGRATED;
         }
 
-        if flags.contains(EnqueueFlag::ENQUEUE_MIGRATED) {
-            todo!()
-        }
-
         self.enqueue_task(pcb.clone(), flags);
 
         *pcb.sched_info().on_rq.lock_irqsave() = OnRq::Queued;
@@ -498,6 +515,16 @@ impl CpuRunQueue {
         self.dequeue_task(pcb, flags);
     }
 
+    #[inline]
+    pub fn cpu(&self) -> usize {
+        self.cpu
+    }
+
+    #[inline]
+    pub fn is_active(&self) -> bool {
+        self.active.load(Ordering::Relaxed)
+    }
+
     #[inline]
     pub fn cfs_rq(&self) -> Arc<CfsRunQueue> {
         self.cfs.clone()
@@ -812,7 +839,8 @@ pub fn scheduler_tick() {
     rq.calculate_global_load_tick();
 
     drop(guard);
-    // TODO:处理负载均衡
+
+    balance::trigger_load_balance(cpu_idx);
 }
 
 /// ## 执行调度
@@ -883,6 +911,11 @@ pub fn __schedule(sched_mod: SchedMode) {
         );
     }
 
+    if rq.nr_running == 0 {
+        // 即将进入idle，先尝试从其他cpu拉取任务
+        balance::newidle_balance(rq);
+    }
+
     let next = rq.pick_next_task(prev.clone());
 
     // kBUG!(
@@ -957,8 +990,43 @@ pub fn sched_fork(pcb: &Arc<ProcessControlBlock>) -> Result<(), SystemError> {
     Ok(())
 }
 
+/// ## 设置任务的有效优先级，用于优先级继承
+///
+/// 只修改`prio`，`normal_prio`和`static_prio`保持不变。任务的优先级恢复时，以`normal_prio`调用即可。
+/// CFS任务的优先级提升如何影响调度见`CompletelyFairScheduler::prio_changed`
+///
+/// ## 返回值
+/// - 有效优先级是否发生了变化
+pub fn rt_mutex_setprio(pcb: &Arc<ProcessControlBlock>, prio: i32) -> bool {
+    let _irq_guard = unsafe { CurrentIrqArch::save_and_disable_irq() };
+    loop {
+        let cpu = pcb.sched_info().on_cpu().unwrap_or(smp_get_processor_id());
+        let rq = cpu_rq(cpu.data() as usize);
+        let (rq, _guard) = rq.self_lock();
+        // 加锁之前任务可能被迁移到了其他cpu上
+        if pcb
+            .sched_info()
+            .on_cpu()
+            .is_some_and(|on_cpu| on_cpu != cpu)
+        {
+            continue;
+        }
+
+        let old_prio =
+            core::mem::replace(&mut pcb.sched_info().prio_data.write_irqsave().prio, prio);
+        if old_prio == prio {
+            return false;
+        }
+        if pcb.sched_info().policy() == SchedPolicy::CFS {
+            CompletelyFairScheduler::prio_changed(rq, pcb, old_prio);
+        }
+        return true;
+    }
+}
+
 pub fn sched_cgroup_fork(pcb: &Arc<ProcessControlBlock>) {
-    __set_task_cpu(pcb, smp_get_processor_id());
+    // 新任务还没有运行过，可以直接放到最空闲的cpu上
+    set_task_cpu(pcb, balance::select_task_rq_fork());
     match pcb.sched_info().policy() {
         SchedPolicy::RT => todo!(),
         SchedPolicy::FIFO => todo!(),
@@ -967,6 +1035,12 @@ pub fn sched_cgroup_fork(pcb: &Arc<ProcessControlBlock>) {
     }
 }
 
+/// 设置任务所在的cpu。调用者需要保证任务不在任何运行队列上，也没有在运行
+pub fn set_task_cpu(pcb: &Arc<ProcessControlBlock>, cpu: ProcessorId) {
+    __set_task_cpu(pcb, cpu);
+    pcb.sched_info().set_on_cpu(Some(cpu));
+}
+
 fn __set_task_cpu(pcb: &Arc<ProcessControlBlock>, cpu: ProcessorId) {
     // TODO: Fixme There is not implement group sched;
     let se = pcb.sched_info().sched_entity();
@@ -974,6 +1048,13 @@ fn __set_task_cpu(pcb: &Arc<ProcessControlBlock>, cpu: ProcessorId) {
     se.force_mut().set_cfs(Arc::downgrade(&rq.cfs));
 }
 
+/// 当前cpu开始调度，此后负载均衡会把任务迁移到这个cpu上
+pub fn sched_cpu_activate() {
+    cpu_rq(smp_get_processor_id().data() as usize)
+        .active
+        .store(true, Ordering::SeqCst);
+}
+
 #[inline(never)]
 pub fn sched_init() {
     // 初始化percpu变量
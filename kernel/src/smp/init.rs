@@ -4,7 +4,7 @@ use crate::{
     arch::{syscall::arch_syscall_init, CurrentIrqArch, CurrentSchedArch},
     exception::InterruptArch,
     process::ProcessManager,
-    sched::SchedArch,
+    sched::{sched_cpu_activate, SchedArch},
     smp::{core::smp_get_processor_id, cpu::smp_cpu_manager},
 };
 
@@ -17,6 +17,7 @@ pub fn smp_ap_start_stage2() -> ! {
     do_ap_start_stage2();
 
     CurrentSchedArch::initial_setup_sched_local();
+    sched_cpu_activate();
 
     CurrentSchedArch::enable_sched_local();
     ProcessManager::arch_idle_func();
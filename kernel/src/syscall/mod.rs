@@ -6,9 +6,15 @@ use core::{
 
 use crate::{
     arch::{ipc::signal::SigSet, syscall::nr::*},
-    filesystem::vfs::syscall::{PosixStatfs, PosixStatx},
+    filesystem::{
+        io_uring::IoUringParams,
+        vfs::syscall::{PosixStatfs, PosixStatx},
+    },
     ipc::shm::{ShmCtlCmd, ShmFlags, ShmId, ShmKey},
-    libs::{futex::constant::FutexFlag, rand::GRandFlags},
+    libs::{
+        futex::{constant::FutexFlag, futex::FutexWaitv},
+        rand::GRandFlags,
+    },
     mm::{page::PAGE_4K_SIZE, syscall::MremapFlags},
     net::syscall::MsgHdr,
     process::{
@@ -27,7 +33,7 @@ use system_error::SystemError;
 use crate::{
     arch::{cpu::cpu_reset, interrupt::TrapFrame, MMArch},
     filesystem::vfs::{
-        fcntl::{AtFlags, FcntlCommand},
+        fcntl::{AtFlags, FadviseAdvice, FcntlCommand},
         file::FileMode,
         syscall::{ModeType, PosixKstat, UtimensFlags},
         MAX_PATHLEN,
@@ -708,7 +714,7 @@ impl Syscall {
                 let val3 = args[5] as u32;
 
                 let mut timespec = None;
-                if utime != 0 && operation.contains(FutexFlag::FLAGS_HAS_TIMEOUT) {
+                if utime != 0 && Self::futex_has_timeout(operation) {
                     let reader = UserBufferReader::new(
                         utime as *const PosixTimeSpec,
                         core::mem::size_of::<PosixTimeSpec>(),
@@ -721,6 +727,14 @@ impl Syscall {
                 Self::do_futex(uaddr, operation, val, timespec, uaddr2, utime as u32, val3)
             }
 
+            SYS_FUTEX_WAITV => Self::futex_waitv(
+                args[0] as *const FutexWaitv,
+                args[1] as u32,
+                args[2] as u32,
+                args[3] as *const PosixTimeSpec,
+                args[4] as i32,
+            ),
+
             SYS_SET_ROBUST_LIST => {
                 let head = args[0];
                 let head_uaddr = VirtAddr::new(head);
@@ -987,10 +1001,10 @@ impl Syscall {
                 Ok(0)
             }
 
-            SYS_FSYNC => {
-                warn!("SYS_FSYNC has not yet been implemented");
-                Ok(0)
-            }
+            // 目前没有单独回写元数据的路径，fdatasync与fsync行为相同
+            SYS_FSYNC | SYS_FDATASYNC => Self::fsync(args[0] as i32),
+            SYS_SYNC => Self::sync(),
+            SYS_SYNCFS => Self::syncfs(args[0] as i32),
 
             SYS_RSEQ => {
                 warn!("SYS_RSEQ has not yet been implemented");
@@ -1043,11 +1057,44 @@ impl Syscall {
             }
 
             SYS_FADVISE64 => {
-                // todo: 这个系统调用还没有实现
+                let fd = args[0] as i32;
+                let offset = args[1] as i64;
+                let len = args[2] as i64;
+                let advice = <FadviseAdvice as FromPrimitive>::from_u32(args[3] as u32);
+                match advice {
+                    Some(advice) if offset >= 0 && len >= 0 => {
+                        Self::fadvise64(fd, offset as usize, len as usize, advice)
+                    }
+                    _ => Err(SystemError::EINVAL),
+                }
+            }
 
-                Err(SystemError::ENOSYS)
+            SYS_SENDFILE => {
+                Self::sendfile(args[0] as i32, args[1] as i32, args[2] as *mut i64, args[3])
             }
 
+            SYS_SPLICE => Self::splice(
+                args[0] as i32,
+                args[1] as *mut i64,
+                args[2] as i32,
+                args[3] as *mut i64,
+                args[4],
+                args[5] as u32,
+            ),
+
+            SYS_TEE => Self::tee(args[0] as i32, args[1] as i32, args[2], args[3] as u32),
+
+            SYS_VMSPLICE => Self::vmsplice(args[0] as i32, args[1], args[2], args[3] as u32),
+
+            SYS_COPY_FILE_RANGE => Self::copy_file_range(
+                args[0] as i32,
+                args[1] as *mut i64,
+                args[2] as i32,
+                args[3] as *mut i64,
+                args[4],
+                args[5] as u32,
+            ),
+
             SYS_MOUNT => {
                 let source = args[0] as *const u8;
                 let target = args[1] as *const u8;
@@ -1145,6 +1192,20 @@ impl Syscall {
                 let flags = args[1] as u32;
                 Self::sys_eventfd(initval, flags)
             }
+            SYS_IO_URING_SETUP => {
+                Self::io_uring_setup(args[0] as u32, args[1] as *mut IoUringParams)
+            }
+            SYS_IO_URING_ENTER => Self::io_uring_enter(
+                args[0] as i32,
+                args[1] as u32,
+                args[2] as u32,
+                args[3] as u32,
+                args[4],
+                args[5],
+            ),
+            SYS_IO_URING_REGISTER => {
+                Self::io_uring_register(args[0] as i32, args[1] as u32, args[2], args[3] as u32)
+            }
             _ => panic!("Unsupported syscall ID: {}", syscall_num),
         };
 
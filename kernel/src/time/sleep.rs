@@ -12,6 +12,7 @@ use crate::{
 };
 
 use super::{
+    jiffies::NSEC_PER_JIFFY,
     timer::{next_n_us_timer_jiffies, Timer, WakeUpHelper},
     PosixTimeSpec, TimeArch,
 };
@@ -39,18 +40,25 @@ pub fn nanosleep(sleep_time: PosixTimeSpec) -> Result<PosixTimeSpec, SystemError
         });
     }
 
-    let total_sleep_time_us: u64 =
-        sleep_time.tv_sec as u64 * 1000000 + sleep_time.tv_nsec as u64 / 1000;
+    let total_sleep_time_ns: u64 =
+        sleep_time.tv_sec as u64 * 1000000000 + sleep_time.tv_nsec as u64;
+    let total_sleep_time_us: u64 = total_sleep_time_ns / 1000;
     // 创建定时器
     let handler: Box<WakeUpHelper> = WakeUpHelper::new(ProcessManager::current_pcb());
     let timer: Arc<Timer> = Timer::new(handler, next_n_us_timer_jiffies(total_sleep_time_us));
+    // 不足一个时间片的休眠使用高精度定时器，避免到期时间取整到时间片之后提前唤醒
+    let hres = total_sleep_time_ns < NSEC_PER_JIFFY as u64;
 
     let irq_guard: crate::exception::IrqFlagsGuard =
         unsafe { CurrentIrqArch::save_and_disable_irq() };
     ProcessManager::mark_sleep(true).ok();
 
     let start_time = getnstimeofday();
-    timer.activate();
+    if hres {
+        timer.activate_hres(total_sleep_time_ns);
+    } else {
+        timer.activate();
+    }
 
     drop(irq_guard);
     schedule(SchedMode::SM_NONE);
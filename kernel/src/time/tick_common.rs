@@ -18,8 +18,9 @@ pub fn tick_handle_periodic(trap_frame: &TrapFrame) {
 fn tick_periodic(cpu_id: ProcessorId, trap_frame: &TrapFrame) {
     if cpu_id.data() == 0 {
         update_timer_jiffies(1);
-        run_local_timer();
     }
+    // 每个cpu都有自己的定时器
+    run_local_timer();
 
     ProcessManager::update_process_times(trap_frame.is_from_user());
 }
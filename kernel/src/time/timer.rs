@@ -1,12 +1,16 @@
 use core::{
+    cmp::min,
     fmt::Debug,
+    hint::spin_loop,
     intrinsics::unlikely,
-    sync::atomic::{compiler_fence, AtomicBool, AtomicU64, Ordering},
+    mem,
+    sync::atomic::{compiler_fence, AtomicU64, Ordering},
     time::Duration,
 };
 
 use alloc::{
     boxed::Box,
+    collections::BTreeMap,
     sync::{Arc, Weak},
     vec::Vec,
 };
@@ -14,24 +18,42 @@ use log::{error, info, warn};
 use system_error::SystemError;
 
 use crate::{
-    arch::CurrentIrqArch,
+    arch::{CurrentIrqArch, CurrentTimeArch},
     exception::{
         softirq::{softirq_vectors, SoftirqNumber, SoftirqVec},
         InterruptArch,
     },
     libs::spinlock::{SpinLock, SpinLockGuard},
+    mm::percpu::PerCpu,
     process::{ProcessControlBlock, ProcessManager},
     sched::{schedule, SchedMode},
+    smp::core::smp_get_processor_id,
 };
 
-use super::{jiffies::NSEC_PER_JIFFY, timekeeping::update_wall_time};
+use super::{jiffies::NSEC_PER_JIFFY, timekeeping::update_wall_time, TimeArch};
 
 const MAX_TIMEOUT: i64 = i64::MAX;
-const TIMER_RUN_CYCLE_THRESHOLD: usize = 20;
 static TIMER_JIFFIES: AtomicU64 = AtomicU64::new(0);
 
+/// 第0级时间轮的槽数的位数，第0级的每个槽对应一个时间片
+const TVR_BITS: u32 = 8;
+/// 第1级及以上的时间轮的槽数的位数，每个槽对应下一级时间轮转一圈的时间
+const TVN_BITS: u32 = 6;
+const TVR_SIZE: usize = 1 << TVR_BITS;
+const TVN_SIZE: usize = 1 << TVN_BITS;
+const TVR_MASK: u64 = TVR_SIZE as u64 - 1;
+const TVN_MASK: u64 = TVN_SIZE as u64 - 1;
+/// 第1级及以上的时间轮的数量
+const TVN_LEVELS: u32 = 4;
+/// 时间轮能表示的最远的到期时间（相对于时间轮当前的时刻）。更远的定时器先放在最后一级，降级时重新计算位置
+const MAX_WHEEL_DELTA: u64 = (1 << (TVR_BITS + TVN_BITS * TVN_LEVELS)) - 1;
+const WHEEL_SLOTS: usize = TVR_SIZE + TVN_SIZE * TVN_LEVELS as usize;
+
 lazy_static! {
-    pub static ref TIMER_LIST: SpinLock<Vec<(u64, Arc<Timer>)>> = SpinLock::new(Vec::new());
+    /// 每个cpu的定时器。定时器只在激活它的cpu上触发，但可能在其他cpu上被取消，因此需要加锁
+    static ref TIMER_BASES: Vec<TimerBase> = (0..PerCpu::MAX_CPU_NUM as usize)
+        .map(TimerBase::new)
+        .collect();
 }
 
 /// 定时器要执行的函数的特征
@@ -103,6 +125,27 @@ impl TimerFunction for WakeUpHelper {
     }
 }
 
+/// 只持有进程弱引用的唤醒函数，用于保存在进程控制块中、反复使用的睡眠定时器
+#[derive(Debug)]
+pub struct SleepTimerHelper {
+    pcb: Weak<ProcessControlBlock>,
+}
+
+impl SleepTimerHelper {
+    pub fn new(pcb: Weak<ProcessControlBlock>) -> Box<SleepTimerHelper> {
+        return Box::new(SleepTimerHelper { pcb });
+    }
+}
+
+impl TimerFunction for SleepTimerHelper {
+    fn run(&mut self) -> Result<(), SystemError> {
+        if let Some(pcb) = self.pcb.upgrade() {
+            ProcessManager::wakeup(&pcb).ok();
+        }
+        return Ok(());
+    }
+}
+
 #[derive(Debug)]
 pub struct Timer {
     inner: SpinLock<InnerTimer>,
@@ -123,6 +166,7 @@ impl Timer {
                 timer_func: Some(timer_func),
                 self_ref: Weak::default(),
                 triggered: false,
+                pos: None,
             }),
         });
 
@@ -135,41 +179,73 @@ impl Timer {
         return self.inner.lock_irqsave();
     }
 
-    /// @brief 将定时器插入到定时器链表中
+    /// @brief 将定时器加入当前cpu的时间轮中，在`expire_jiffies`之后触发
     pub fn activate(&self) {
-        let mut timer_list = TIMER_LIST.lock_irqsave();
-        let inner_guard = self.inner();
-
-        // 链表为空，则直接插入
-        if timer_list.is_empty() {
-            // FIXME push_timer
-            timer_list.push((
-                inner_guard.expire_jiffies,
-                inner_guard.self_ref.upgrade().unwrap(),
-            ));
+        let base = local_timer_base();
+        let mut wheel = base.wheel.lock_irqsave();
+        let mut inner_guard = self.inner();
+        if inner_guard.pos.is_some() {
+            warn!("Timer already activated");
+            return;
+        }
+        let self_arc = inner_guard.self_ref.upgrade().unwrap();
 
-            drop(inner_guard);
-            drop(timer_list);
-            compiler_fence(Ordering::SeqCst);
+        // 时间轮为空时，直接跳到当前时刻，不需要再逐个处理空的槽
+        if wheel.count == 0 {
+            wheel.clk = clock();
+        }
+        let due = wheel.enqueue(self_arc, &mut inner_guard);
+        base.next_expiry.fetch_min(due, Ordering::SeqCst);
+    }
 
+    /// @brief 以时钟周期为精度激活定时器，用于不足一个时间片的定时
+    ///
+    /// 定时器在`delay_ns`纳秒之后的第一个时钟中断中触发。按时间片计时的定时器会把到期时间向下取整到时间片，
+    /// 不足一个时间片的定时可能会提前触发，而这里不会。
+    ///
+    /// @param delay_ns 从现在开始的纳秒数
+    pub fn activate_hres(&self, delay_ns: u64) {
+        let base = local_timer_base();
+        let mut wheel = base.wheel.lock_irqsave();
+        let mut inner_guard = self.inner();
+        if inner_guard.pos.is_some() {
+            warn!("Timer already activated");
             return;
         }
-        let expire_jiffies = inner_guard.expire_jiffies;
         let self_arc = inner_guard.self_ref.upgrade().unwrap();
-        drop(inner_guard);
-        let mut split_pos: usize = 0;
-        for (pos, elt) in timer_list.iter().enumerate() {
-            if Arc::ptr_eq(&self_arc, &elt.1) {
-                warn!("Timer already in list");
-            }
-            if elt.0 > expire_jiffies {
-                split_pos = pos;
-                break;
+
+        let expire_cycles = CurrentTimeArch::cal_expire_cycles(delay_ns as usize) as u64;
+        let key = (expire_cycles, wheel.hres_seq);
+        wheel.hres_seq += 1;
+        inner_guard.pos = Some(TimerPos::Hres {
+            cpu: wheel.cpu,
+            key,
+        });
+        wheel.hres.insert(key, self_arc);
+        base.next_hres.fetch_min(expire_cycles, Ordering::SeqCst);
+    }
+
+    /// ## 重新激活定时器，在`expire_jiffies`时刻触发
+    ///
+    /// 定时器还在等待触发时先取消。定时器函数在触发之后会被保留下来，因此同一个定时器可以反复使用，
+    /// 不需要每次都重新分配。
+    ///
+    /// 不能在这个定时器自己的定时器函数中调用。
+    pub fn rearm(&self, expire_jiffies: u64) {
+        self.cancel();
+        loop {
+            let mut inner_guard = self.inner();
+            // 上一次触发时的定时器函数可能还在其他cpu上执行，等它放回来
+            if inner_guard.timer_func.is_none() {
+                drop(inner_guard);
+                spin_loop();
+                continue;
             }
+            inner_guard.expire_jiffies = expire_jiffies;
+            inner_guard.triggered = false;
+            break;
         }
-        timer_list.insert(split_pos, (expire_jiffies, self_arc));
-
-        drop(timer_list);
+        self.activate();
     }
 
     #[inline]
@@ -178,7 +254,17 @@ impl Timer {
         timer.triggered = true;
         let func = timer.timer_func.take();
         drop(timer);
-        let r = func.map(|mut f| f.run()).unwrap_or(Ok(()));
+        let r = func
+            .map(|mut f| {
+                let r = f.run();
+                // 保留定时器函数，以便用rearm重新激活
+                let mut timer = self.inner();
+                if timer.timer_func.is_none() {
+                    timer.timer_func = Some(f);
+                }
+                r
+            })
+            .unwrap_or(Ok(()));
         if unlikely(r.is_err()) {
             error!(
                 "Failed to run timer function: {self:?} {:?}",
@@ -193,13 +279,37 @@ impl Timer {
     }
 
     /// ## 取消定时器任务
+    ///
+    /// 定时器记录了自己在时间轮中的位置，取消时不需要查找
+    ///
+    /// ### 返回值
+    ///
+    /// 定时器在取消之前是否还在等待触发
     pub fn cancel(&self) -> bool {
-        let this_arc = self.inner().self_ref.upgrade().unwrap();
-        TIMER_LIST
-            .lock_irqsave()
-            .extract_if(|x| Arc::ptr_eq(&this_arc, &x.1))
-            .for_each(drop);
-        true
+        loop {
+            let cpu = match self.inner().pos {
+                Some(pos) => pos.cpu(),
+                None => return false,
+            };
+
+            let mut wheel = TIMER_BASES[cpu].wheel.lock_irqsave();
+            let mut inner_guard = self.inner();
+            let pos = match inner_guard.pos {
+                Some(pos) if pos.cpu() == cpu => pos,
+                // 获取锁之前，定时器已经触发并且被重新激活到了其他cpu上
+                Some(_) => continue,
+                None => return false,
+            };
+            inner_guard.pos = None;
+            let removed = match pos {
+                TimerPos::Wheel { slot, idx, .. } => wheel.dequeue(slot, idx),
+                TimerPos::Hres { key, .. } => wheel.hres.remove(&key).unwrap(),
+            };
+            drop(inner_guard);
+            drop(wheel);
+            drop(removed);
+            return true;
+        }
     }
 }
 
@@ -214,61 +324,239 @@ pub struct InnerTimer {
     self_ref: Weak<Timer>,
     /// 判断该计时器是否触发
     triggered: bool,
+    /// 定时器所在的位置，None表示没有等待触发。需要同时持有所在cpu的时间轮的锁才能修改
+    pos: Option<TimerPos>,
 }
 
-#[derive(Debug)]
-pub struct DoTimerSoftirq {
-    running: AtomicBool,
+/// 定时器在时间轮中的位置
+#[derive(Debug, Clone, Copy)]
+enum TimerPos {
+    /// 在`cpu`的时间轮的第`slot`个槽的第`idx`个位置
+    Wheel { cpu: usize, slot: usize, idx: usize },
+    /// 在`cpu`的高精度定时器队列中
+    Hres { cpu: usize, key: (u64, u64) },
 }
 
-impl DoTimerSoftirq {
-    pub fn new() -> Self {
-        return DoTimerSoftirq {
-            running: AtomicBool::new(false),
+impl TimerPos {
+    fn cpu(&self) -> usize {
+        match self {
+            TimerPos::Wheel { cpu, .. } | TimerPos::Hres { cpu, .. } => *cpu,
+        }
+    }
+}
+
+/// 每个cpu的定时器
+struct TimerBase {
+    wheel: SpinLock<TimerWheel>,
+    /// 时间轮中最早需要处理的时间片的下界，没有定时器时为u64::MAX。时钟中断据此判断是否需要触发软中断
+    next_expiry: AtomicU64,
+    /// 最早到期的高精度定时器的时钟周期数，没有定时器时为u64::MAX
+    next_hres: AtomicU64,
+}
+
+impl TimerBase {
+    fn new(cpu: usize) -> Self {
+        return Self {
+            wheel: SpinLock::new(TimerWheel {
+                cpu,
+                clk: 0,
+                count: 0,
+                slots: Vec::new(),
+                hres: BTreeMap::new(),
+                hres_seq: 0,
+            }),
+            next_expiry: AtomicU64::new(u64::MAX),
+            next_hres: AtomicU64::new(u64::MAX),
         };
     }
+}
+
+#[inline]
+fn local_timer_base() -> &'static TimerBase {
+    return &TIMER_BASES[smp_get_processor_id().data() as usize];
+}
+
+/// # 分级时间轮
+///
+/// 第0级有`TVR_SIZE`个槽，每个槽对应一个时间片；第n级有`TVN_SIZE`个槽，每个槽对应第n-1级转一圈的时间。
+/// 定时器根据离到期还有多久放入某一级的槽中，插入和删除都是O(1)的。
+/// 第0级转完一圈时，把第1级中接下来一个槽的定时器重新放置到第0级（第1级转完一圈时同理），称为降级。
+struct TimerWheel {
+    cpu: usize,
+    /// 下一个要处理的时间片
+    clk: u64,
+    /// 时间轮中定时器的数量（不包括高精度定时器）
+    count: usize,
+    /// 先是第0级的槽，然后依次是第1~TVN_LEVELS级的槽。第一次插入定时器时才分配
+    slots: Vec<Vec<Arc<Timer>>>,
+    /// 高精度定时器，键为(到期时的时钟周期数, 插入序号)
+    hres: BTreeMap<(u64, u64), Arc<Timer>>,
+    hres_seq: u64,
+}
+
+impl TimerWheel {
+    /// 第level级（level >= 1）中，`expires`对应的槽
+    #[inline]
+    fn tvn_slot(level: u32, expires: u64) -> usize {
+        let idx = (expires >> (TVR_BITS + TVN_BITS * (level - 1))) & TVN_MASK;
+        return TVR_SIZE + TVN_SIZE * (level as usize - 1) + idx as usize;
+    }
+
+    /// ## 把定时器放入时间轮，调用者需要持有定时器的锁
+    ///
+    /// ### 返回值
+    ///
+    /// 处理到这个定时器所在的槽的时刻的下界
+    fn enqueue(&mut self, timer: Arc<Timer>, inner: &mut InnerTimer) -> u64 {
+        if self.slots.is_empty() {
+            self.slots = (0..WHEEL_SLOTS).map(|_| Vec::new()).collect();
+        }
+
+        // 已经过期的定时器放到下一个要处理的槽中
+        let delta = min(
+            inner.expire_jiffies.saturating_sub(self.clk),
+            MAX_WHEEL_DELTA,
+        );
+        let expires = self.clk + delta;
+        let (slot, due) = if delta < TVR_SIZE as u64 {
+            ((expires & TVR_MASK) as usize, expires)
+        } else {
+            let mut level = 1;
+            while delta >= 1 << (TVR_BITS + TVN_BITS * level) {
+                level += 1;
+            }
+            // 高级的定时器在第0级转完一圈时才会被处理
+            (
+                Self::tvn_slot(level, expires),
+                (self.clk + TVR_MASK) & !TVR_MASK,
+            )
+        };
 
-    fn set_run(&self) -> bool {
-        let x = self
-            .running
-            .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed);
-        return x.is_ok();
+        let list = &mut self.slots[slot];
+        inner.pos = Some(TimerPos::Wheel {
+            cpu: self.cpu,
+            slot,
+            idx: list.len(),
+        });
+        list.push(timer);
+        self.count += 1;
+        return due;
     }
 
-    fn clear_run(&self) {
-        self.running.store(false, Ordering::Release);
+    /// 从槽中删除定时器，调用者需要持有这个定时器的锁
+    fn dequeue(&mut self, slot: usize, idx: usize) -> Arc<Timer> {
+        let list = &mut self.slots[slot];
+        let timer = list.swap_remove(idx);
+        // 槽的最后一个定时器被移动到了idx处
+        if let Some(moved) = list.get(idx) {
+            if let Some(TimerPos::Wheel { idx: moved_idx, .. }) = moved.inner().pos.as_mut() {
+                *moved_idx = idx;
+            }
+        }
+        self.count -= 1;
+        return timer;
     }
-}
-impl SoftirqVec for DoTimerSoftirq {
-    fn run(&self) {
-        if !self.set_run() {
-            return;
+
+    /// 把第level级中接下来的一个槽中的定时器降级。这一级也转完了一圈时，继续降级更高一级
+    fn cascade(&mut self, level: u32) {
+        let slot = Self::tvn_slot(level, self.clk);
+        let list = mem::take(&mut self.slots[slot]);
+        self.count -= list.len();
+        for timer in list {
+            let t = timer.clone();
+            let mut inner = t.inner();
+            self.enqueue(timer, &mut inner);
         }
-        // 最多只处理TIMER_RUN_CYCLE_THRESHOLD个计时器
-        for _ in 0..TIMER_RUN_CYCLE_THRESHOLD {
-            // debug!("DoTimerSoftirq run");
-            let timer_list = TIMER_LIST.try_lock_irqsave();
-            if timer_list.is_err() {
-                continue;
+
+        if slot == Self::tvn_slot(level, 0) && level < TVN_LEVELS {
+            self.cascade(level + 1);
+        }
+    }
+
+    /// 处理时刻`now`之前的所有槽，取出到期的定时器
+    fn collect_expired(&mut self, now: u64, expired: &mut Vec<Arc<Timer>>) {
+        while self.clk < now && self.count > 0 {
+            let idx = (self.clk & TVR_MASK) as usize;
+            if idx == 0 {
+                self.cascade(1);
             }
-            let mut timer_list = timer_list.unwrap();
 
-            if timer_list.is_empty() {
-                break;
+            let list = mem::take(&mut self.slots[idx]);
+            self.count -= list.len();
+            for timer in list.iter() {
+                timer.inner().pos = None;
             }
+            expired.extend(list);
+            self.clk += 1;
+        }
 
-            let (front_jiffies, timer_list_front) = timer_list.first().unwrap().clone();
-            // debug!("to lock timer_list_front");
+        if self.count == 0 {
+            self.clk = self.clk.max(now);
+        }
+    }
 
-            if front_jiffies >= TIMER_JIFFIES.load(Ordering::SeqCst) {
+    /// 取出时钟周期数`now_cycles`之前到期的高精度定时器
+    fn collect_expired_hres(&mut self, now_cycles: u64, expired: &mut Vec<Arc<Timer>>) {
+        while let Some(entry) = self.hres.first_entry() {
+            if entry.key().0 > now_cycles {
                 break;
             }
-            timer_list.remove(0);
-            drop(timer_list);
-            timer_list_front.run();
+            let timer = entry.remove();
+            timer.inner().pos = None;
+            expired.push(timer);
+        }
+    }
+
+    /// 时间轮中最早需要处理的时间片的下界
+    fn next_expiry(&self) -> u64 {
+        if self.count == 0 {
+            return u64::MAX;
+        }
+        // 第0级中，在下一次降级之前到期的定时器
+        let boundary = (self.clk + TVR_MASK) & !TVR_MASK;
+        for j in self.clk..boundary {
+            if !self.slots[(j & TVR_MASK) as usize].is_empty() {
+                return j;
+            }
         }
+        return boundary;
+    }
 
-        self.clear_run();
+    fn next_hres(&self) -> u64 {
+        return self
+            .hres
+            .first_key_value()
+            .map_or(u64::MAX, |(key, _)| key.0);
+    }
+}
+
+#[derive(Debug)]
+pub struct DoTimerSoftirq;
+
+impl DoTimerSoftirq {
+    pub fn new() -> Self {
+        return DoTimerSoftirq;
+    }
+}
+
+impl SoftirqVec for DoTimerSoftirq {
+    /// 处理当前cpu上到期的定时器
+    fn run(&self) {
+        let base = local_timer_base();
+        let mut expired = Vec::new();
+
+        let mut wheel = base.wheel.lock_irqsave();
+        wheel.collect_expired(clock(), &mut expired);
+        wheel.collect_expired_hres(CurrentTimeArch::get_cycles() as u64, &mut expired);
+        base.next_expiry
+            .store(wheel.next_expiry(), Ordering::SeqCst);
+        base.next_hres.store(wheel.next_hres(), Ordering::SeqCst);
+        drop(wheel);
+
+        // 定时器函数可能会重新激活定时器，不能在持有锁的时候执行
+        for timer in expired {
+            timer.run();
+        }
     }
 }
 
@@ -335,34 +623,22 @@ pub fn schedule_timeout(mut timeout: i64) -> Result<i64, SystemError> {
     }
 }
 
+/// 当前cpu的时间轮中最早需要处理的时间片的下界，没有定时器时返回0
 pub fn timer_get_first_expire() -> Result<u64, SystemError> {
-    // FIXME
-    // debug!("rs_timer_get_first_expire,timer_jif = {:?}", TIMER_JIFFIES);
-    for _ in 0..10 {
-        match TIMER_LIST.try_lock_irqsave() {
-            Ok(timer_list) => {
-                // debug!("rs_timer_get_first_expire TIMER_LIST lock successfully");
-                if timer_list.is_empty() {
-                    // debug!("timer_list is empty");
-                    return Ok(0);
-                } else {
-                    // debug!("timer_list not empty");
-                    return Ok(timer_list.first().unwrap().0);
-                }
-            }
-            // 加锁失败返回啥？？
-            Err(_) => continue,
-        }
+    let next = local_timer_base().next_expiry.load(Ordering::SeqCst);
+    if next == u64::MAX {
+        return Ok(0);
     }
-    return Err(SystemError::EAGAIN_OR_EWOULDBLOCK);
+    return Ok(next);
 }
 
-/// 检查是否需要触发定时器软中断，如果需要则触发
+/// 检查当前cpu是否有定时器到期，如果有则触发定时器软中断
 pub fn try_raise_timer_softirq() {
-    if let Ok(first_expire) = timer_get_first_expire() {
-        if first_expire <= clock() {
-            softirq_vectors().raise_softirq(SoftirqNumber::TIMER);
-        }
+    let base = local_timer_base();
+    if base.next_expiry.load(Ordering::SeqCst) < clock()
+        || base.next_hres.load(Ordering::SeqCst) <= CurrentTimeArch::get_cycles() as u64
+    {
+        softirq_vectors().raise_softirq(SoftirqNumber::TIMER);
     }
 }
 
@@ -0,0 +1,221 @@
+/*
+ * epoll唤醒延迟和惊群测试
+ *
+ * 用法: test_epoll_latency [iterations] [herd_size]
+ *
+ * 1. 延迟: 父子进程通过两个eventfd来回传递，写入的值是发送时刻(CLOCK_MONOTONIC，纳秒)，
+ *    接收方在epoll_wait返回后读出并计算从写入到被唤醒的延迟
+ * 2. 惊群: herd_size个子进程各自用一个epoll以EPOLLIN|EPOLLEXCLUSIVE监听同一个eventfd，
+ *    每写入一次，统计有多少个子进程被唤醒。理想情况下每个事件只唤醒一个
+ */
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_HERD_SIZE 8
+#define HERD_ROUNDS 100
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int
+epoll_watch(int fd, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+    int ep;
+
+    ep = epoll_create1(0);
+    if (ep == -1)
+        err(EXIT_FAILURE, "epoll_create1");
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1)
+        err(EXIT_FAILURE, "epoll_ctl");
+    return ep;
+}
+
+/* 等待fd可读，读出eventfd的值 */
+static uint64_t
+wait_and_read(int ep, int fd)
+{
+    struct epoll_event ev;
+    uint64_t u;
+
+    for (;;) {
+        int n = epoll_wait(ep, &ev, 1, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            err(EXIT_FAILURE, "epoll_wait");
+        }
+        if (n == 1)
+            break;
+    }
+    if (read(fd, &u, sizeof(u)) != sizeof(u))
+        err(EXIT_FAILURE, "read");
+    return u;
+}
+
+static void
+send_now(int fd)
+{
+    uint64_t u = now_ns();
+
+    if (write(fd, &u, sizeof(u)) != sizeof(u))
+        err(EXIT_FAILURE, "write");
+}
+
+static void
+bench_latency(int iterations)
+{
+    int ping, pong, ep;
+    uint64_t min = UINT64_MAX, max = 0, sum = 0;
+    pid_t pid;
+
+    ping = eventfd(0, 0);
+    pong = eventfd(0, 0);
+    if (ping == -1 || pong == -1)
+        err(EXIT_FAILURE, "eventfd");
+
+    pid = fork();
+    if (pid == -1)
+        err(EXIT_FAILURE, "fork");
+    if (pid == 0) {
+        ep = epoll_watch(ping, EPOLLIN);
+        for (int i = 0; i < iterations; i++) {
+            wait_and_read(ep, ping);
+            send_now(pong);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    ep = epoll_watch(pong, EPOLLIN);
+    for (int i = 0; i < iterations; i++) {
+        uint64_t sent, lat;
+
+        send_now(ping);
+        sent = wait_and_read(ep, pong);
+        lat = now_ns() - sent;
+        if (lat < min)
+            min = lat;
+        if (lat > max)
+            max = lat;
+        sum += lat;
+    }
+    waitpid(pid, NULL, 0);
+
+    printf("wakeup latency over %d iterations: min %" PRIu64 " ns, avg %" PRIu64
+           " ns, max %" PRIu64 " ns\n",
+           iterations, min, sum / iterations, max);
+    close(ping);
+    close(pong);
+}
+
+static void
+bench_herd(int herd_size)
+{
+    int efd, report[2], total = 0, worst = 0;
+    pid_t *pids;
+
+    efd = eventfd(0, EFD_NONBLOCK);
+    if (efd == -1)
+        err(EXIT_FAILURE, "eventfd");
+    if (pipe(report) == -1)
+        err(EXIT_FAILURE, "pipe");
+
+    pids = calloc(herd_size, sizeof(pid_t));
+    if (pids == NULL)
+        err(EXIT_FAILURE, "calloc");
+
+    for (int i = 0; i < herd_size; i++) {
+        pids[i] = fork();
+        if (pids[i] == -1)
+            err(EXIT_FAILURE, "fork");
+        if (pids[i] == 0) {
+            struct epoll_event ev;
+            uint64_t u;
+            int ep = epoll_watch(efd, EPOLLIN | EPOLLEXCLUSIVE);
+
+            close(report[0]);
+            for (;;) {
+                if (epoll_wait(ep, &ev, 1, -1) != 1)
+                    continue;
+                /* 被唤醒就报告一次，不管事件有没有被其他进程抢先取走 */
+                if (write(report[1], "w", 1) != 1)
+                    err(EXIT_FAILURE, "write");
+                read(efd, &u, sizeof(u));
+            }
+        }
+    }
+    close(report[1]);
+    fcntl(report[0], F_SETFL, O_NONBLOCK);
+
+    /* 等所有子进程进入epoll_wait */
+    usleep(200000);
+
+    for (int round = 0; round < HERD_ROUNDS; round++) {
+        uint64_t u = 1;
+        char buf[64];
+        int woken = 0;
+        ssize_t n;
+
+        if (write(efd, &u, sizeof(u)) != sizeof(u))
+            err(EXIT_FAILURE, "write");
+        usleep(20000);
+        while ((n = read(report[0], buf, sizeof(buf))) > 0)
+            woken += n;
+        total += woken;
+        if (woken > worst)
+            worst = woken;
+    }
+
+    for (int i = 0; i < herd_size; i++)
+        kill(pids[i], SIGKILL);
+    for (int i = 0; i < herd_size; i++)
+        waitpid(pids[i], NULL, 0);
+
+    printf("herd of %d waiters, %d events: %d wakeups in total, at most %d per event\n",
+           herd_size, HERD_ROUNDS, total, worst);
+    free(pids);
+    close(report[0]);
+    close(efd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int herd_size = DEFAULT_HERD_SIZE;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (argc > 2)
+        herd_size = atoi(argv[2]);
+    if (iterations <= 0 || herd_size <= 0) {
+        fprintf(stderr, "Usage: %s [iterations] [herd_size]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_latency(iterations);
+    bench_herd(herd_size);
+    exit(EXIT_SUCCESS);
+}
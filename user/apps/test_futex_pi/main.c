@@ -0,0 +1,225 @@
+/*
+ * 优先级继承futex和futex_waitv测试
+ *
+ * 1. PI锁: FUTEX_LOCK_PI/FUTEX_TRYLOCK_PI/FUTEX_UNLOCK_PI的基本语义，
+ *    futex字中的持有者tid和FUTEX_WAITERS位，重复加锁(EDEADLK)、非持有者解锁(EPERM)，
+ *    以及有等待者时解锁把锁直接交给等待者
+ * 2. futex_waitv: 返回被唤醒的futex在数组中的下标，值不匹配时返回EAGAIN，
+ *    到达超时时间(绝对时间)时返回ETIMEDOUT
+ */
+#include <err.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+#ifndef FUTEX2_SIZE_U32
+#define FUTEX2_SIZE_U32 0x02
+#endif
+#ifndef FUTEX2_PRIVATE
+#define FUTEX2_PRIVATE FUTEX_PRIVATE_FLAG
+#endif
+
+struct waitv {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+static int failures;
+
+#define CHECK(cond, ...)                                                       \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            printf("FAIL %s:%d: ", __func__, __LINE__);                        \
+            printf(__VA_ARGS__);                                               \
+            printf("\n");                                                      \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static long
+futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op | FUTEX_PRIVATE_FLAG, val, timeout,
+                   NULL, 0);
+}
+
+static long
+futex_waitv(struct waitv *waiters, unsigned int nr,
+            const struct timespec *timeout, clockid_t clockid)
+{
+    return syscall(SYS_futex_waitv, waiters, nr, 0, timeout, clockid);
+}
+
+static uint32_t
+gettid_u32(void)
+{
+    return (uint32_t)syscall(SYS_gettid);
+}
+
+static void
+sleep_ms(long ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000,
+                           .tv_nsec = (ms % 1000) * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t pi_lock;
+
+static void *
+contend_trylock_unlock(void *arg)
+{
+    long ret;
+
+    (void)arg;
+    ret = futex(&pi_lock, FUTEX_TRYLOCK_PI, 0, NULL);
+    CHECK(ret == -1 && errno == EAGAIN,
+          "trylock of a held lock: ret=%ld errno=%d", ret, errno);
+
+    ret = futex(&pi_lock, FUTEX_UNLOCK_PI, 0, NULL);
+    CHECK(ret == -1 && errno == EPERM,
+          "unlock by a non-owner: ret=%ld errno=%d", ret, errno);
+    return NULL;
+}
+
+static void *
+contend_lock(void *arg)
+{
+    uint32_t *tid = arg;
+    long ret;
+
+    *tid = gettid_u32();
+    ret = futex(&pi_lock, FUTEX_LOCK_PI, 0, NULL);
+    CHECK(ret == 0, "blocking lock: ret=%ld errno=%d", ret, errno);
+    CHECK((pi_lock & FUTEX_TID_MASK) == *tid,
+          "lock handed over to 0x%x, waiter is %u", pi_lock, *tid);
+
+    ret = futex(&pi_lock, FUTEX_UNLOCK_PI, 0, NULL);
+    CHECK(ret == 0, "waiter unlock: ret=%ld errno=%d", ret, errno);
+    return NULL;
+}
+
+static void
+test_pi_lock(void)
+{
+    uint32_t tid = gettid_u32();
+    uint32_t waiter_tid = 0;
+    pthread_t thread;
+    long ret;
+
+    pi_lock = 0;
+    ret = futex(&pi_lock, FUTEX_LOCK_PI, 0, NULL);
+    CHECK(ret == 0, "lock: ret=%ld errno=%d", ret, errno);
+    CHECK(pi_lock == tid, "futex word 0x%x, expected owner %u", pi_lock, tid);
+
+    ret = futex(&pi_lock, FUTEX_LOCK_PI, 0, NULL);
+    CHECK(ret == -1 && errno == EDEADLK,
+          "relock by the owner: ret=%ld errno=%d", ret, errno);
+
+    pthread_create(&thread, NULL, contend_trylock_unlock, NULL);
+    pthread_join(thread, NULL);
+
+    ret = futex(&pi_lock, FUTEX_UNLOCK_PI, 0, NULL);
+    CHECK(ret == 0, "unlock: ret=%ld errno=%d", ret, errno);
+    CHECK(pi_lock == 0, "futex word 0x%x after unlock", pi_lock);
+
+    ret = futex(&pi_lock, FUTEX_TRYLOCK_PI, 0, NULL);
+    CHECK(ret == 0, "trylock of a free lock: ret=%ld errno=%d", ret, errno);
+    CHECK(pi_lock == tid, "futex word 0x%x, expected owner %u", pi_lock, tid);
+
+    /* 等待者阻塞之后，futex字上会带有FUTEX_WAITERS，解锁时锁被直接交给等待者 */
+    pthread_create(&thread, NULL, contend_lock, &waiter_tid);
+    for (int i = 0; i < 100 && !(pi_lock & FUTEX_WAITERS); i++)
+        sleep_ms(10);
+    CHECK(pi_lock == (tid | FUTEX_WAITERS),
+          "futex word 0x%x with a blocked waiter", pi_lock);
+
+    ret = futex(&pi_lock, FUTEX_UNLOCK_PI, 0, NULL);
+    CHECK(ret == 0, "contended unlock: ret=%ld errno=%d", ret, errno);
+    pthread_join(thread, NULL);
+    CHECK(pi_lock == 0, "futex word 0x%x after the waiter unlocked", pi_lock);
+}
+
+static uint32_t waitv_words[3];
+
+static void *
+wake_second(void *arg)
+{
+    (void)arg;
+    sleep_ms(50);
+    __atomic_store_n(&waitv_words[1], 1, __ATOMIC_SEQ_CST);
+    futex(&waitv_words[1], FUTEX_WAKE, 1, NULL);
+    return NULL;
+}
+
+static void
+test_futex_waitv(void)
+{
+    struct waitv waiters[3];
+    struct timespec timeout;
+    pthread_t thread;
+    long ret;
+
+    for (int i = 0; i < 3; i++) {
+        waitv_words[i] = 0;
+        waiters[i] = (struct waitv){
+            .val = 0,
+            .uaddr = (uintptr_t)&waitv_words[i],
+            .flags = FUTEX2_SIZE_U32 | FUTEX2_PRIVATE,
+        };
+    }
+
+    /* 被唤醒的futex的下标 */
+    pthread_create(&thread, NULL, wake_second, NULL);
+    ret = futex_waitv(waiters, 3, NULL, CLOCK_MONOTONIC);
+    CHECK(ret == 1, "woken index: ret=%ld errno=%d", ret, errno);
+    pthread_join(thread, NULL);
+
+    /* waitv_words[1]已经不等于期望的值 */
+    ret = futex_waitv(waiters, 3, NULL, CLOCK_MONOTONIC);
+    CHECK(ret == -1 && errno == EAGAIN,
+          "value mismatch: ret=%ld errno=%d", ret, errno);
+
+    /* 超时时间是绝对时间 */
+    waiters[1].val = 1;
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_nsec += 50000000L;
+    if (timeout.tv_nsec >= 1000000000L) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000L;
+    }
+    ret = futex_waitv(waiters, 3, &timeout, CLOCK_MONOTONIC);
+    CHECK(ret == -1 && errno == ETIMEDOUT,
+          "timeout: ret=%ld errno=%d", ret, errno);
+
+    /* 不支持的flags */
+    ret = syscall(SYS_futex_waitv, waiters, 3, 1, NULL, CLOCK_MONOTONIC);
+    CHECK(ret == -1 && errno == EINVAL,
+          "invalid flags: ret=%ld errno=%d", ret, errno);
+}
+
+int
+main(void)
+{
+    test_pi_lock();
+    test_futex_waitv();
+
+    if (failures) {
+        printf("test_futex_pi: %d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("test_futex_pi: all tests passed\n");
+    return EXIT_SUCCESS;
+}